@@ -0,0 +1,142 @@
+// Activation functions of the hidden and the output layers
+//
+// Every activation is a policy with Apply( x ) and Derivative( y ), the derivative taken from the activation y = Apply( x ) the backward
+// pass already has. The network and the trainer pick the policy once per layer and run their per neuron loops on it, the vectorized
+// versions of Apply live with the other kernels (NNKernelsImpl.h).
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    enum class Activation : uint8_t
+    {
+        Sigmoid,                    // 1 / ( 1 + exp( -x ) )
+        FastSigmoid,                // Rational approximation, absolute error below 5e-5
+        Tanh,
+        FastTanh,                   // Rational approximation, absolute error below 1e-4
+        ReLU,
+        LeakyReLU,                  // Slope k_leakyReluSlope below zero
+        Softmax,                    // Output layer only: exp( x ) over the sum of the layer, trained with the cross-entropy error
+        Count
+    };
+
+    static char const* const k_activationNames[] = { "sigmoid", "fastsigmoid", "tanh", "fasttanh", "relu", "leakyrelu", "softmax" };
+
+    inline char const* GetActivationName( Activation activation ) { return k_activationNames[(size_t) activation]; }
+
+    // Returns false if name is none of the names above
+    inline bool ParseActivation( char const* name, Activation& activation )
+    {
+        for ( size_t activationIdx = 0; activationIdx < (size_t) Activation::Count; activationIdx++ )
+        {
+            if ( strcmp( name, k_activationNames[activationIdx] ) == 0 )
+            {
+                activation = (Activation) activationIdx;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    namespace Activations
+    {
+        static double const k_leakyReluSlope = 0.01;
+
+        // tanh( x ) = x * P( x^2 ) / Q( x^2 ), the [7/6] Pade approximant of Lambert's continued fraction. It reaches 1 at |x| = 4.9718,
+        // inputs are clamped to |x| <= k_fastTanhLimit, where tanh( x ) is 1 within 1e-4.
+        static double const k_fastTanhLimit = 4.97;
+        static double const k_fastTanhP[4] = { 135135.0, 17325.0, 378.0, 1.0 };
+        static double const k_fastTanhQ[4] = { 135135.0, 62370.0, 3150.0, 28.0 };
+
+        template<typename Scalar>
+        inline Scalar ApproximateTanh( Scalar x )
+        {
+            x = std::min( std::max( x, Scalar( -k_fastTanhLimit ) ), Scalar( k_fastTanhLimit ) );
+            Scalar const x2 = x * x;
+            Scalar const p = ( ( Scalar( k_fastTanhP[3] ) * x2 + Scalar( k_fastTanhP[2] ) ) * x2 + Scalar( k_fastTanhP[1] ) ) * x2 + Scalar( k_fastTanhP[0] );
+            Scalar const q = ( ( Scalar( k_fastTanhQ[3] ) * x2 + Scalar( k_fastTanhQ[2] ) ) * x2 + Scalar( k_fastTanhQ[1] ) ) * x2 + Scalar( k_fastTanhQ[0] );
+            return x * p / q;
+        }
+
+        struct Sigmoid
+        {
+            template<typename Scalar> static inline Scalar Apply( Scalar x ) { return Scalar( 1 ) / ( Scalar( 1 ) + std::exp( -x ) ); }
+            template<typename Scalar> static inline Scalar Derivative( Scalar y ) { return y * ( Scalar( 1 ) - y ); }
+        };
+
+        // sigmoid( x ) = ( 1 + tanh( x / 2 ) ) / 2, so the error is half the one of ApproximateTanh. The derivative is the one of the sigmoid.
+        struct FastSigmoid
+        {
+            template<typename Scalar> static inline Scalar Apply( Scalar x ) { return Scalar( 0.5 ) + Scalar( 0.5 ) * ApproximateTanh( Scalar( 0.5 ) * x ); }
+            template<typename Scalar> static inline Scalar Derivative( Scalar y ) { return y * ( Scalar( 1 ) - y ); }
+        };
+
+        struct Tanh
+        {
+            template<typename Scalar> static inline Scalar Apply( Scalar x ) { return std::tanh( x ); }
+            template<typename Scalar> static inline Scalar Derivative( Scalar y ) { return Scalar( 1 ) - y * y; }
+        };
+
+        struct FastTanh
+        {
+            template<typename Scalar> static inline Scalar Apply( Scalar x ) { return ApproximateTanh( x ); }
+            template<typename Scalar> static inline Scalar Derivative( Scalar y ) { return Scalar( 1 ) - y * y; }
+        };
+
+        struct ReLU
+        {
+            template<typename Scalar> static inline Scalar Apply( Scalar x ) { return std::max( x, Scalar( 0 ) ); }
+            template<typename Scalar> static inline Scalar Derivative( Scalar y ) { return ( y > Scalar( 0 ) ) ? Scalar( 1 ) : Scalar( 0 ); }
+        };
+
+        struct LeakyReLU
+        {
+            template<typename Scalar> static inline Scalar Apply( Scalar x ) { return ( x > Scalar( 0 ) ) ? x : Scalar( k_leakyReluSlope ) * x; }
+            template<typename Scalar> static inline Scalar Derivative( Scalar y ) { return ( y > Scalar( 0 ) ) ? Scalar( 1 ) : Scalar( k_leakyReluSlope ); }
+        };
+
+        //-------------------------------------------------------------------------
+
+        template<typename Policy, typename Scalar>
+        inline void MultiplyByDerivative( int32_t count, Scalar const* activations, Scalar* gradients )
+        {
+            for ( int32_t idx = 0; idx < count; idx++ )
+            {
+                gradients[idx] *= Policy::template Derivative<Scalar>( activations[idx] );
+            }
+        }
+
+        // gradients *= derivative of activation at the given activations, for a layer of count neurons. Softmax has no element wise
+        // derivative, its error gradients are never multiplied by one.
+        template<typename Scalar>
+        inline void MultiplyByDerivative( Activation activation, int32_t count, Scalar const* activations, Scalar* gradients )
+        {
+            switch ( activation )
+            {
+                case Activation::Sigmoid: MultiplyByDerivative<Sigmoid>( count, activations, gradients ); break;
+                case Activation::FastSigmoid: MultiplyByDerivative<FastSigmoid>( count, activations, gradients ); break;
+                case Activation::Tanh: MultiplyByDerivative<Tanh>( count, activations, gradients ); break;
+                case Activation::FastTanh: MultiplyByDerivative<FastTanh>( count, activations, gradients ); break;
+                case Activation::ReLU: MultiplyByDerivative<ReLU>( count, activations, gradients ); break;
+                case Activation::LeakyReLU: MultiplyByDerivative<LeakyReLU>( count, activations, gradients ); break;
+                default: break;
+            }
+        }
+
+        // Error gradients of the output layer: ( desired - output ) times the derivative, which the cross-entropy error of softmax cancels
+        template<typename Scalar>
+        inline void GetOutputErrorGradients( Activation activation, int32_t count, int32_t const* desiredOutputs, Scalar const* outputs, Scalar* gradients )
+        {
+            for ( int32_t idx = 0; idx < count; idx++ )
+            {
+                gradients[idx] = static_cast<Scalar>( desiredOutputs[idx] ) - outputs[idx];
+            }
+            MultiplyByDerivative( activation, count, outputs, gradients );
+        }
+    }
+}
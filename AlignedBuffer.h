@@ -0,0 +1,124 @@
+// Fixed size heap array aligned to a cache line
+#pragma once
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined( _MSC_VER )
+#include <malloc.h>
+#endif
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    static size_t const k_cacheLineSize = 64;
+
+    // Rounds a count of values up so that the next block starts on a cache line
+    template<typename T>
+    inline size_t AlignCount( size_t count )
+    {
+        size_t const valuesPerLine = k_cacheLineSize / sizeof( T );
+        return ( count + valuesPerLine - 1 ) / valuesPerLine * valuesPerLine;
+    }
+
+    // Zero initialized, copyable storage for trivially copyable values
+    template<typename T>
+    class AlignedBuffer
+    {
+    public:
+
+        AlignedBuffer() = default;
+        explicit AlignedBuffer( size_t size ) { Resize( size ); }
+        AlignedBuffer( AlignedBuffer const& other ) { *this = other; }
+        AlignedBuffer( AlignedBuffer&& other ) { *this = std::move( other ); }
+        ~AlignedBuffer() { Free(); }
+
+        AlignedBuffer& operator=( AlignedBuffer const& other )
+        {
+            if ( this != &other )
+            {
+                Resize( other.m_size );
+                if ( m_size > 0 )
+                {
+                    memcpy( m_data, other.m_data, m_size * sizeof( T ) );
+                }
+            }
+            return *this;
+        }
+
+        AlignedBuffer& operator=( AlignedBuffer&& other )
+        {
+            if ( this != &other )
+            {
+                Free();
+                m_data = other.m_data;
+                m_size = other.m_size;
+                other.m_data = nullptr;
+                other.m_size = 0;
+            }
+            return *this;
+        }
+
+        // Discards the content, the new values are all zero
+        void Resize( size_t size )
+        {
+            if ( size != m_size )
+            {
+                Free();
+                if ( size > 0 )
+                {
+                    size_t const numBytes = AlignCount<T>( size ) * sizeof( T );
+#if defined( _MSC_VER )
+                    m_data = static_cast<T*>( _aligned_malloc( numBytes, k_cacheLineSize ) );
+#else
+                    void* memory = nullptr;
+                    m_data = ( posix_memalign( &memory, k_cacheLineSize, numBytes ) == 0 ) ? static_cast<T*>( memory ) : nullptr;
+#endif
+                    if ( m_data == nullptr )
+                    {
+                        throw std::bad_alloc();
+                    }
+                    m_size = size;
+                }
+            }
+
+            Clear();
+        }
+
+        void Clear()
+        {
+            if ( m_size > 0 )
+            {
+                memset( m_data, 0, m_size * sizeof( T ) );
+            }
+        }
+
+        inline T* data() { return m_data; }
+        inline T const* data() const { return m_data; }
+        inline size_t size() const { return m_size; }
+        inline bool empty() const { return m_size == 0; }
+        inline T& operator[]( size_t idx ) { return m_data[idx]; }
+        inline T const& operator[]( size_t idx ) const { return m_data[idx]; }
+
+    private:
+
+        void Free()
+        {
+#if defined( _MSC_VER )
+            _aligned_free( m_data );
+#else
+            free( m_data );
+#endif
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+    private:
+
+        T*                      m_data = nullptr;
+        size_t                  m_size = 0;
+    };
+}
@@ -0,0 +1,611 @@
+// Benchmark executable: times evaluation, back propagation, whole generations (of dense and of sparse rows) and the CSV reader on
+// synthetic data of several sizes and writes the results as JSON or CSV, so they can be compared between releases
+//
+// NeuralNetworkBenchmarks [--quick] [--layers 4-3-3,32-64-8] [--rows 1000,10000] [--filter name] [--seconds s] [--seed n]
+//                         [--format json|csv] [--output file|-]
+#include "NNKernels.h"
+#include "NNTrainer.h"
+#include "SyntheticData.h"
+#include "TrainingFileReader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Benchmarks
+    {
+        // Reaches the per sample steps of the serial training loop, which the trainer keeps private
+        struct TrainerAccess
+        {
+            template<typename Scalar>
+            static void Evaluate( NNTrainerT<Scalar>& trainer, Scalar const* inputs )
+            {
+                trainer.m_networkToTrain->Evaluate( inputs, trainer.m_workspace );
+            }
+
+            // Also updates the weights
+            template<typename Scalar>
+            static void Backpropagate( NNTrainerT<Scalar>& trainer, int32_t const* expectedOutputs )
+            {
+                trainer.Backpropagate( expectedOutputs );
+            }
+        };
+    }
+}
+
+//-------------------------------------------------------------------------
+
+namespace
+{
+    using namespace BPN;
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    static uint32_t const k_repetitions = 3;
+    static size_t const k_maxEvaluationRows = 1024;                 // Rows cycled through by the per sample benchmarks
+    static double const k_sparseInputDensity = 0.05;                // Nonzero inputs of the sparse benchmarks
+
+    // Receives results of timed loops so the compiler cannot drop them
+    static volatile double g_benchmarkSink = 0;
+
+    struct Options
+    {
+        std::vector<std::vector<uint32_t>> m_layerWidths = { { 4, 3, 3 }, { 4, 16, 3 }, { 32, 64, 8 }, { 128, 256, 10 } };
+        std::vector<size_t>     m_numRows = { 1000, 10000 };
+        std::string             m_filter;                           // Runs only the benchmarks whose name contains it
+        double                  m_minSeconds = 0.2;                 // Per repetition of a timed loop
+        uint64_t                m_seed = 1;
+        std::string             m_format = "json";
+        std::string             m_outputPath;                       // Machine readable results, "-" for stdout (replaces the table)
+    };
+
+    // Times of one benchmark, per sample (per row for the CSV reader)
+    struct Result
+    {
+        std::string             m_benchmark;
+        std::string             m_layers;
+        size_t                  m_numRows;
+        uint32_t                m_batchSize;
+        double                  m_minNanoseconds;                   // Fastest repetition
+        double                  m_meanNanoseconds;
+        double                  m_megabytesPerSecond;               // Only for the CSV reader, 0 otherwise
+    };
+
+    static double GetElapsedSeconds( Clock::time_point start )
+    {
+        return std::chrono::duration<double>( Clock::now() - start ).count();
+    }
+
+    static std::string GetLayersName( std::vector<uint32_t> const& layerWidths )
+    {
+        std::string name;
+        for ( uint32_t width : layerWidths )
+        {
+            name += ( name.empty() ? "" : "-" ) + std::to_string( width );
+        }
+        return name;
+    }
+
+    static bool ParseList( std::string const& text, char separator, std::vector<uint32_t>& values )
+    {
+        values.clear();
+        std::stringstream stream( text );
+        std::string item;
+        while ( std::getline( stream, item, separator ) )
+        {
+            if ( item.empty() || item.find_first_not_of( "0123456789" ) != std::string::npos || std::stoul( item ) == 0 )
+            {
+                return false;
+            }
+            values.push_back( (uint32_t) std::stoul( item ) );
+        }
+        return !values.empty();
+    }
+
+    // Calls runOnce until minSeconds have passed, k_repetitions times, and returns the nanoseconds per sample of the fastest and the
+    // average repetition. runOnce processes numSamples samples per call.
+    template<typename Function>
+    static void Measure( Options const& options, size_t numSamples, Function const& runOnce, Result& result )
+    {
+        runOnce();
+
+        double totalNanoseconds = 0;
+        result.m_minNanoseconds = 0;
+        for ( uint32_t repetitionIdx = 0; repetitionIdx < k_repetitions; repetitionIdx++ )
+        {
+            uint64_t numCalls = 0;
+            Clock::time_point const start = Clock::now();
+            double seconds = 0;
+            do
+            {
+                runOnce();
+                numCalls++;
+                seconds = GetElapsedSeconds( start );
+            } while ( seconds < options.m_minSeconds );
+
+            double const nanoseconds = seconds * 1e9 / ( (double) numCalls * numSamples );
+            result.m_minNanoseconds = ( repetitionIdx == 0 ) ? nanoseconds : std::min( result.m_minNanoseconds, nanoseconds );
+            totalNanoseconds += nanoseconds;
+        }
+        result.m_meanNanoseconds = totalNanoseconds / k_repetitions;
+    }
+
+    static bool IsSelected( Options const& options, char const* benchmark )
+    {
+        return options.m_filter.empty() || std::string( benchmark ).find( options.m_filter ) != std::string::npos;
+    }
+
+    static SyntheticData::Settings GetDataSettings( Options const& options, std::vector<uint32_t> const& layerWidths, size_t numRows )
+    {
+        SyntheticData::Settings settings;
+        settings.m_numInputs = layerWidths.front();
+        settings.m_numOutputs = layerWidths.back();
+        settings.m_numRows = numRows;
+        settings.m_seed = options.m_seed;
+        return settings;
+    }
+
+    static NNTrainer::Settings GetQuietTrainerSettings()
+    {
+        NNTrainer::Settings settings;
+        settings.m_logProgress = false;
+        settings.m_overlapEvaluation = false;
+        settings.m_desiredAccuracy = 101;
+        return settings;
+    }
+
+    // Benchmarks
+    //-------------------------------------------------------------------------
+
+    // Network::Evaluate (one sample into a workspace), Network::EvaluateBatch and NNTrainer::Backpropagate (including the weight update)
+    static void RunSampleBenchmarks( Options const& options, std::vector<uint32_t> const& layerWidths, std::vector<Result>& results )
+    {
+        TrainingData const data = SyntheticData::Generate( GetDataSettings( options, layerWidths, k_maxEvaluationRows ) );
+        TrainingSet const& rows = data.m_trainingSet;
+        int32_t const numOutputs = layerWidths.back();
+
+        Network::Settings networkSettings{ layerWidths.front(), layerWidths[1], layerWidths.back() };
+        networkSettings.m_layerWidths = layerWidths;
+        Network network( networkSettings );
+
+        Result result = { "", GetLayersName( layerWidths ), rows.size(), 1, 0, 0, 0 };
+
+        if ( IsSelected( options, "evaluate" ) )
+        {
+            NetworkWorkspaceT<double> workspace( network );
+            result.m_benchmark = "evaluate";
+            Measure( options, rows.size(), [&] ()
+            {
+                for ( auto const& entry : rows )
+                {
+                    network.Evaluate( entry.m_inputs.data(), workspace );
+                    g_benchmarkSink = g_benchmarkSink + workspace.GetOutputs()[0];
+                }
+            }, result );
+            results.push_back( result );
+        }
+
+        // The same evaluation with every other hidden activation, the output layer stays sigmoid
+        for ( size_t activationIdx = (size_t) Activation::FastSigmoid; activationIdx < (size_t) Activation::Softmax; activationIdx++ )
+        {
+            std::string const benchmark = std::string( "evaluate_" ) + GetActivationName( (Activation) activationIdx );
+            if ( !IsSelected( options, benchmark.c_str() ) )
+            {
+                continue;
+            }
+
+            Network::Settings activationSettings = networkSettings;
+            activationSettings.m_hiddenActivation = (Activation) activationIdx;
+            Network activationNetwork( activationSettings );
+            activationNetwork.CopyWeights( network );
+
+            NetworkWorkspaceT<double> workspace( activationNetwork );
+            result.m_benchmark = benchmark;
+            Measure( options, rows.size(), [&] ()
+            {
+                for ( auto const& entry : rows )
+                {
+                    activationNetwork.Evaluate( entry.m_inputs.data(), workspace );
+                    g_benchmarkSink = g_benchmarkSink + workspace.GetOutputs()[0];
+                }
+            }, result );
+            results.push_back( result );
+        }
+
+        if ( IsSelected( options, "evaluate_sparse" ) )
+        {
+            SyntheticData::Settings sparseSettings = GetDataSettings( options, layerWidths, k_maxEvaluationRows );
+            sparseSettings.m_inputDensity = k_sparseInputDensity;
+            TrainingData const sparseData = SyntheticData::Generate( sparseSettings );
+
+            NetworkWorkspaceT<double> workspace( network );
+            result.m_benchmark = "evaluate_sparse";
+            Measure( options, sparseData.m_trainingSet.size(), [&] ()
+            {
+                for ( auto const& entry : sparseData.m_trainingSet )
+                {
+                    network.Evaluate( entry.GetSparseInputs(), workspace );
+                    g_benchmarkSink = g_benchmarkSink + workspace.GetOutputs()[0];
+                }
+            }, result );
+            results.push_back( result );
+        }
+
+        if ( IsSelected( options, "evaluate_batch" ) )
+        {
+            std::vector<double> inputs;
+            for ( auto const& entry : rows )
+            {
+                inputs.insert( inputs.end(), entry.m_inputs.begin(), entry.m_inputs.end() );
+            }
+            std::vector<int32_t> classIndices( rows.size() );
+            std::vector<double> outputs( rows.size() * numOutputs );
+
+            result.m_benchmark = "evaluate_batch";
+            result.m_batchSize = (uint32_t) rows.size();
+            Measure( options, rows.size(), [&] ()
+            {
+                network.EvaluateBatch( inputs.data(), (int32_t) rows.size(), classIndices.data(), outputs.data() );
+                g_benchmarkSink = g_benchmarkSink + outputs[0];
+            }, result );
+            results.push_back( result );
+            result.m_batchSize = 1;
+        }
+
+        if ( IsSelected( options, "backpropagate" ) )
+        {
+            // A zero learning rate and momentum keep the weights (and the cost of every step) constant however often the same
+            // activations are back propagated, so only Backpropagate is timed
+            NNTrainer::Settings trainerSettings = GetQuietTrainerSettings();
+            trainerSettings.m_learningRate = 0;
+            trainerSettings.m_momentum = 0;
+            Network trainedNetwork( network );
+            NNTrainer trainer( trainerSettings, &trainedNetwork );
+            Benchmarks::TrainerAccess::Evaluate( trainer, rows.front().m_inputs.data() );
+
+            result.m_benchmark = "backpropagate";
+            Measure( options, rows.size(), [&] ()
+            {
+                for ( size_t rowIdx = 0; rowIdx < rows.size(); rowIdx++ )
+                {
+                    Benchmarks::TrainerAccess::Backpropagate( trainer, rows[rowIdx].m_expectedOutputs.data() );
+                }
+            }, result );
+            results.push_back( result );
+        }
+    }
+
+    // One generation of NNTrainer::Train over the training set (RunGeneration), per sample and per mini-batch. With an input density
+    // below 1 the rows are sparse.
+    static void RunGenerationBenchmarks( Options const& options, std::vector<uint32_t> const& layerWidths, size_t numRows, double inputDensity, std::vector<Result>& results )
+    {
+        char const* const benchmark = ( inputDensity < 1.0 ) ? "generation_sparse" : "generation";
+        if ( !IsSelected( options, benchmark ) )
+        {
+            return;
+        }
+
+        SyntheticData::Settings dataSettings = GetDataSettings( options, layerWidths, numRows );
+        dataSettings.m_inputDensity = inputDensity;
+        TrainingData const data = SyntheticData::Generate( dataSettings );
+        Network::Settings networkSettings{ layerWidths.front(), layerWidths[1], layerWidths.back() };
+        networkSettings.m_layerWidths = layerWidths;
+        Network const initialNetwork( networkSettings );
+
+        for ( uint32_t batchSize : { 1u, 32u } )
+        {
+            // The trainer times the training pass of every generation itself, without the test pass. The second generation is used,
+            // the first one warms up the caches.
+            NNTrainer::Settings trainerSettings = GetQuietTrainerSettings();
+            trainerSettings.m_batchSize = batchSize;
+            trainerSettings.m_maxGenerations = 2;
+
+            Result result = { benchmark, GetLayersName( layerWidths ), data.m_trainingSet.size(), batchSize, 0, 0, 0 };
+            double totalNanoseconds = 0;
+            for ( uint32_t repetitionIdx = 0; repetitionIdx < k_repetitions; repetitionIdx++ )
+            {
+                Network network( initialNetwork );
+                NNTrainer trainer( trainerSettings, &network );
+                trainer.Train( data );
+
+                double const nanoseconds = 1e9 / trainer.GetSamplesPerSecond();
+                result.m_minNanoseconds = ( repetitionIdx == 0 ) ? nanoseconds : std::min( result.m_minNanoseconds, nanoseconds );
+                totalNanoseconds += nanoseconds;
+            }
+            result.m_meanNanoseconds = totalNanoseconds / k_repetitions;
+            results.push_back( result );
+        }
+    }
+
+    // TrainingFileReader::ReadData parsing the CSV text and mapping its binary cache, the files have three classes (the Iris labels)
+    static void RunReadDataBenchmarks( Options const& options, uint32_t numInputs, size_t numRows, std::vector<Result>& results )
+    {
+        bool const runParse = IsSelected( options, "read_data" );
+        bool const runCache = IsSelected( options, "read_data_cache" );
+        if ( !runParse && !runCache )
+        {
+            return;
+        }
+
+        std::vector<uint32_t> const layerWidths = { numInputs, 3 };
+        TrainingData const data = SyntheticData::Generate( GetDataSettings( options, layerWidths, numRows ) );
+        TrainingSet rows = data.m_trainingSet;
+        rows.insert( rows.end(), data.m_testSet.begin(), data.m_testSet.end() );
+
+        std::string const filename = "benchmark_" + std::to_string( numInputs ) + "_" + std::to_string( numRows ) + ".csv";
+        if ( !SyntheticData::WriteCsv( filename, rows ) )
+        {
+            return;
+        }
+
+        uint64_t numBytes = 0;
+        Result result = { "", GetLayersName( layerWidths ), numRows, 1, 0, 0, 0 };
+
+        if ( runParse )
+        {
+            result.m_benchmark = "read_data";
+            Measure( options, numRows, [&] ()
+            {
+                TrainingFileReader reader( filename, numInputs, 3 );
+                reader.ReadData();
+                numBytes = reader.GetNumBytesRead();
+                g_benchmarkSink = g_benchmarkSink + (double) reader.GetTrainingData().m_trainingSet.size();
+            }, result );
+            result.m_megabytesPerSecond = numBytes / ( result.m_minNanoseconds * 1e-9 * numRows ) / ( 1 << 20 );
+            results.push_back( result );
+        }
+
+        TrainingFileReader cacheWriter( filename, numInputs, 3, true );
+        if ( runCache && cacheWriter.ReadData() )
+        {
+            numBytes = cacheWriter.GetNumBytesRead();
+            result.m_benchmark = "read_data_cache";
+            Measure( options, numRows, [&] ()
+            {
+                TrainingFileReader reader( filename, numInputs, 3, true );
+                reader.ReadData();
+                g_benchmarkSink = g_benchmarkSink + (double) reader.GetTrainingData().m_trainingSet.size();
+            }, result );
+            result.m_megabytesPerSecond = numBytes / ( result.m_minNanoseconds * 1e-9 * numRows ) / ( 1 << 20 );
+            results.push_back( result );
+        }
+
+        std::remove( filename.c_str() );
+        std::remove( cacheWriter.GetCacheFilename().c_str() );
+    }
+
+    // Output
+    //-------------------------------------------------------------------------
+
+    static std::string GetCompilerName()
+    {
+#if defined( __clang__ )
+        return std::string( "clang " ) + __clang_version__;
+#elif defined( __GNUC__ )
+        return std::string( "gcc " ) + __VERSION__;
+#elif defined( _MSC_VER )
+        return "msvc " + std::to_string( _MSC_VER );
+#else
+        return "unknown";
+#endif
+    }
+
+    static std::string GetTimestamp()
+    {
+        std::time_t const now = std::time( nullptr );
+        char text[32];
+        std::strftime( text, sizeof( text ), "%Y-%m-%dT%H:%M:%SZ", std::gmtime( &now ) );
+        return text;
+    }
+
+    static void PrintTable( std::vector<Result> const& results )
+    {
+        std::cout << "Benchmark              Layers          Rows  Batch    ns/sample (min)   ns/sample (mean)    samples/s       MB/s" << std::endl;
+        std::cout << std::fixed << std::setprecision( 1 );
+        for ( auto const& result : results )
+        {
+            std::cout << std::left << std::setw( 22 ) << result.m_benchmark << std::setw( 12 ) << result.m_layers << std::right << std::setw( 8 ) << result.m_numRows
+                << std::setw( 7 ) << result.m_batchSize << std::setw( 19 ) << result.m_minNanoseconds << std::setw( 19 ) << result.m_meanNanoseconds
+                << std::setw( 13 ) << std::setprecision( 0 ) << 1e9 / result.m_minNanoseconds << std::setw( 11 ) << std::setprecision( 1 ) << result.m_megabytesPerSecond << std::endl;
+        }
+    }
+
+    // Every record carries the environment, so the CSV rows of several runs can be concatenated
+    static void WriteResults( std::ostream& stream, std::string const& format, std::vector<Result> const& results )
+    {
+        std::string const compiler = GetCompilerName();
+        std::string const timestamp = GetTimestamp();
+        char const* const kernels = Kernels::GetInstructionSetName( Kernels::GetInstructionSet() );
+        unsigned const hardwareThreads = std::thread::hardware_concurrency();
+
+        stream << std::setprecision( 6 );
+        if ( format == "csv" )
+        {
+            stream << "benchmark,layers,rows,batch_size,ns_per_sample_min,ns_per_sample_mean,samples_per_second,megabytes_per_second,kernels,hardware_threads,compiler,timestamp" << std::endl;
+            for ( auto const& result : results )
+            {
+                stream << result.m_benchmark << ',' << result.m_layers << ',' << result.m_numRows << ',' << result.m_batchSize << ',' << result.m_minNanoseconds << ','
+                    << result.m_meanNanoseconds << ',' << 1e9 / result.m_minNanoseconds << ',' << result.m_megabytesPerSecond << ',' << kernels << ','
+                    << hardwareThreads << ",\"" << compiler << "\"," << timestamp << std::endl;
+            }
+            return;
+        }
+
+        stream << "{" << std::endl;
+        stream << "  \"schema_version\": 1," << std::endl;
+        stream << "  \"timestamp\": \"" << timestamp << "\"," << std::endl;
+        stream << "  \"compiler\": \"" << compiler << "\"," << std::endl;
+        stream << "  \"kernels\": \"" << kernels << "\"," << std::endl;
+        stream << "  \"hardware_threads\": " << hardwareThreads << "," << std::endl;
+        stream << "  \"results\": [" << std::endl;
+        for ( size_t resultIdx = 0; resultIdx < results.size(); resultIdx++ )
+        {
+            Result const& result = results[resultIdx];
+            stream << "    { \"benchmark\": \"" << result.m_benchmark << "\", \"layers\": \"" << result.m_layers << "\", \"rows\": " << result.m_numRows
+                << ", \"batch_size\": " << result.m_batchSize << ", \"ns_per_sample_min\": " << result.m_minNanoseconds << ", \"ns_per_sample_mean\": " << result.m_meanNanoseconds
+                << ", \"samples_per_second\": " << 1e9 / result.m_minNanoseconds << ", \"megabytes_per_second\": " << result.m_megabytesPerSecond << " }"
+                << ( resultIdx + 1 < results.size() ? "," : "" ) << std::endl;
+        }
+        stream << "  ]" << std::endl;
+        stream << "}" << std::endl;
+    }
+
+    static bool ParseOptions( int argc, char** argv, Options& options )
+    {
+        for ( int argIdx = 1; argIdx < argc; argIdx++ )
+        {
+            std::string const argument = argv[argIdx];
+            bool const hasValue = argIdx + 1 < argc;
+
+            if ( argument == "--quick" )
+            {
+                options.m_layerWidths = { { 4, 3, 3 }, { 32, 64, 8 } };
+                options.m_numRows = { 1000 };
+                options.m_minSeconds = 0.05;
+            }
+            else if ( argument == "--layers" && hasValue )
+            {
+                options.m_layerWidths.clear();
+                std::stringstream stream( argv[++argIdx] );
+                std::string layers;
+                while ( std::getline( stream, layers, ',' ) )
+                {
+                    std::vector<uint32_t> widths;
+                    if ( !ParseList( layers, '-', widths ) || widths.size() < 3 )
+                    {
+                        return false;
+                    }
+                    options.m_layerWidths.push_back( widths );
+                }
+            }
+            else if ( argument == "--rows" && hasValue )
+            {
+                std::vector<uint32_t> numRows;
+                if ( !ParseList( argv[++argIdx], ',', numRows ) )
+                {
+                    return false;
+                }
+                options.m_numRows.assign( numRows.begin(), numRows.end() );
+            }
+            else if ( argument == "--filter" && hasValue )
+            {
+                options.m_filter = argv[++argIdx];
+            }
+            else if ( argument == "--seconds" && hasValue )
+            {
+                options.m_minSeconds = std::max( atof( argv[++argIdx] ), 0.001 );
+            }
+            else if ( argument == "--seed" && hasValue )
+            {
+                options.m_seed = strtoull( argv[++argIdx], nullptr, 10 );
+            }
+            else if ( argument == "--format" && hasValue )
+            {
+                options.m_format = argv[++argIdx];
+                if ( options.m_format != "json" && options.m_format != "csv" )
+                {
+                    return false;
+                }
+            }
+            else if ( argument == "--output" && hasValue )
+            {
+                options.m_outputPath = argv[++argIdx];
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return !options.m_layerWidths.empty();
+    }
+}
+
+//-------------------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+    Options options;
+    if ( !ParseOptions( argc, argv, options ) )
+    {
+        std::cerr << "Usage: " << argv[0] << " [--quick] [--layers 4-3-3,32-64-8] [--rows 1000,10000] [--filter name] [--seconds s] [--seed n] [--format json|csv] [--output file|-]" << std::endl;
+        return 1;
+    }
+
+    // The reader reports every file it reads to the console, which is muted while the benchmarks run
+    bool const printTable = ( options.m_outputPath != "-" );
+    std::streambuf* const consoleBuffer = std::cout.rdbuf();
+    std::ostream console( consoleBuffer );
+    std::ostream& log = printTable ? console : std::cerr;
+    log << "Kernels: " << Kernels::GetInstructionSetName( Kernels::GetInstructionSet() ) << ", " << k_repetitions << " repetitions of at least " << options.m_minSeconds << " s" << std::endl;
+
+    std::vector<Result> results;
+    Clock::time_point const start = Clock::now();
+    std::cout.rdbuf( nullptr );
+
+    for ( auto const& layerWidths : options.m_layerWidths )
+    {
+        log << "Layers " << GetLayersName( layerWidths ) << std::endl;
+        RunSampleBenchmarks( options, layerWidths, results );
+        for ( size_t numRows : options.m_numRows )
+        {
+            RunGenerationBenchmarks( options, layerWidths, numRows, 1.0, results );
+            RunGenerationBenchmarks( options, layerWidths, numRows, k_sparseInputDensity, results );
+        }
+    }
+
+    // The reader only depends on the number of inputs
+    std::vector<uint32_t> inputCounts;
+    for ( auto const& layerWidths : options.m_layerWidths )
+    {
+        if ( std::find( inputCounts.begin(), inputCounts.end(), layerWidths.front() ) == inputCounts.end() )
+        {
+            inputCounts.push_back( layerWidths.front() );
+        }
+    }
+
+    for ( uint32_t numInputs : inputCounts )
+    {
+        for ( size_t numRows : options.m_numRows )
+        {
+            log << "CSV with " << numInputs << " inputs, " << numRows << " rows" << std::endl;
+            RunReadDataBenchmarks( options, numInputs, numRows, results );
+        }
+    }
+
+    std::cout.rdbuf( consoleBuffer );
+    log << results.size() << " benchmarks in " << GetElapsedSeconds( start ) << " s" << std::endl << std::endl;
+
+    if ( printTable )
+    {
+        PrintTable( results );
+    }
+
+    if ( options.m_outputPath == "-" )
+    {
+        WriteResults( std::cout, options.m_format, results );
+    }
+    else if ( !options.m_outputPath.empty() )
+    {
+        std::ofstream file( options.m_outputPath, std::ios::out | std::ios::trunc );
+        WriteResults( file, options.m_format, results );
+        if ( !file )
+        {
+            std::cerr << "Error writing results file: " << options.m_outputPath << std::endl;
+            return 1;
+        }
+        std::cout << std::endl << "Results written to " << options.m_outputPath << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,816 @@
+#include "Benchmarks.h"
+#include "NNKernels.h"
+#include "QuantizedNetwork.h"
+#include "StaticNetwork.h"
+#include "TrainingFileReader.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Benchmarks
+    {
+        typedef std::chrono::high_resolution_clock Clock;
+
+        static double GetElapsedSeconds( Clock::time_point start )
+        {
+            return std::chrono::duration<double>( Clock::now() - start ).count();
+        }
+
+        // Receives results of timed loops so the compiler cannot drop them
+        static volatile double g_benchmarkSink = 0;
+
+        // Restores the console formatting changed by a report
+        struct ConsoleFormatGuard
+        {
+            ConsoleFormatGuard() : m_flags( std::cout.flags() ), m_precision( std::cout.precision() ) {}
+            ~ConsoleFormatGuard() { std::cout.flags( m_flags ); std::cout.precision( m_precision ); }
+
+            std::ios::fmtflags      m_flags;
+            std::streamsize         m_precision;
+        };
+
+        // Random training set with numOutputs one-hot classes decided by the sign of sums of the first inputs
+        static TrainingSet CreateRandomTrainingSet( int32_t numEntries, int32_t numInputs, int32_t numOutputs, uint32_t seed )
+        {
+            std::mt19937 generator( seed );
+            std::normal_distribution<double> distribution( 0.0, 1.0 );
+
+            TrainingSet trainingSet( numEntries );
+            for ( auto& entry : trainingSet )
+            {
+                entry.m_inputs.resize( numInputs );
+                for ( auto& input : entry.m_inputs )
+                {
+                    input = distribution( generator );
+                }
+
+                int32_t const classIdx = (int32_t) ( std::fabs( entry.m_inputs[0] ) * numOutputs ) % numOutputs;
+                entry.m_expectedOutputs.assign( numOutputs, 0 );
+                entry.m_expectedOutputs[classIdx] = 1;
+            }
+
+            return trainingSet;
+        }
+
+        template<typename Scalar>
+        static std::vector<Scalar> CreateRandomValues( size_t count, double range, std::mt19937& generator )
+        {
+            std::uniform_real_distribution<double> distribution( -range, range );
+            std::vector<Scalar> values( count );
+            for ( auto& value : values )
+            {
+                value = static_cast<Scalar>( distribution( generator ) );
+            }
+            return values;
+        }
+
+        // Largest |a - b| / scale over all values
+        template<typename Scalar>
+        static double GetMaxScaledError( std::vector<Scalar> const& a, std::vector<Scalar> const& b, std::vector<Scalar> const& scale )
+        {
+            double maxError = 0;
+            for ( size_t idx = 0; idx < a.size(); idx++ )
+            {
+                maxError = std::max( maxError, std::fabs( (double) a[idx] - (double) b[idx] ) / std::max( (double) scale[idx], 1e-300 ) );
+            }
+            return maxError;
+        }
+
+        // Runs every kernel of the given scalar type with the active instruction set and returns the largest error against the
+        // reference results computed by the scalar kernels, relative for the products and absolute for the activations
+        template<typename Scalar>
+        static void ValidateKernels( Kernels::InstructionSet instructionSet, double& maxProductError, double& maxActivationError )
+        {
+            typedef std::vector<Scalar> Values;
+
+            int32_t const rows = 37, cols = 131, inner = 53;
+            std::mt19937 generator( 17 );
+            Values const A = CreateRandomValues<Scalar>( rows * inner, 1.0, generator );
+            Values const B = CreateRandomValues<Scalar>( inner * cols, 1.0, generator );
+            Values const BT = CreateRandomValues<Scalar>( cols * inner, 1.0, generator );
+            Values const AT = CreateRandomValues<Scalar>( inner * rows, 1.0, generator );
+            Values const C0 = CreateRandomValues<Scalar>( rows * cols, 1.0, generator );
+            Values const activationInput = CreateRandomValues<Scalar>( rows * cols, 40.0, generator );
+
+            auto absolute = [] ( Values values ) { for ( auto& value : values ) { value = std::fabs( value ); } return values; };
+
+            // A with about a fifth of its values kept as a CSR matrix for the sparse products
+            std::vector<int32_t> rowOffsets( 1, 0 ), columnIndices;
+            Values sparseValues, sparseA( A.size(), Scalar( 0 ) );
+            for ( int32_t rowIdx = 0; rowIdx < rows; rowIdx++ )
+            {
+                for ( int32_t innerIdx = 0; innerIdx < inner; innerIdx++ )
+                {
+                    if ( generator() % 5 == 0 )
+                    {
+                        columnIndices.push_back( innerIdx );
+                        sparseValues.push_back( A[rowIdx * inner + innerIdx] );
+                        sparseA[rowIdx * inner + innerIdx] = A[rowIdx * inner + innerIdx];
+                    }
+                }
+                rowOffsets.push_back( (int32_t) columnIndices.size() );
+            }
+
+            // Reference results and error scales (the same products on absolute values) from the scalar kernels
+            Kernels::SetInstructionSet( Kernels::InstructionSet::Scalar );
+
+            Values referenceNN = C0, referenceNT = C0, referenceTN = C0, scaleNN = absolute( C0 ), scaleNT = absolute( C0 ), scaleTN = absolute( C0 );
+            Kernels::GemmNN( rows, cols, inner, A.data(), inner, B.data(), cols, referenceNN.data(), cols );
+            Kernels::GemmNT( rows, cols, inner, A.data(), inner, BT.data(), inner, referenceNT.data(), cols );
+            Kernels::GemmTN( rows, cols, inner, AT.data(), rows, B.data(), cols, referenceTN.data(), cols );
+            Kernels::GemmNN( rows, cols, inner, absolute( A ).data(), inner, absolute( B ).data(), cols, scaleNN.data(), cols );
+            Kernels::GemmNT( rows, cols, inner, absolute( A ).data(), inner, absolute( BT ).data(), inner, scaleNT.data(), cols );
+            Kernels::GemmTN( rows, cols, inner, absolute( AT ).data(), rows, absolute( B ).data(), cols, scaleTN.data(), cols );
+
+            // The sparse products against the dense ones on the same nonzeros
+            Values referenceSparseNN = C0, referenceSparseTN = B, scaleSparseNN = absolute( C0 ), scaleSparseTN = absolute( B );
+            Kernels::GemmNN( rows, cols, inner, sparseA.data(), inner, B.data(), cols, referenceSparseNN.data(), cols );
+            Kernels::GemmTN( inner, cols, rows, sparseA.data(), inner, C0.data(), cols, referenceSparseTN.data(), cols );
+            Kernels::GemmNN( rows, cols, inner, absolute( sparseA ).data(), inner, absolute( B ).data(), cols, scaleSparseNN.data(), cols );
+            Kernels::GemmTN( inner, cols, rows, absolute( sparseA ).data(), inner, absolute( C0 ).data(), cols, scaleSparseTN.data(), cols );
+
+            Values referenceDeltas = C0, referenceWeights = A;
+            referenceWeights.resize( C0.size() );
+            Kernels::MomentumUpdate( (int32_t) C0.size(), Scalar( 0.1 ), referenceNN.data(), Scalar( 0.9 ), referenceDeltas.data(), referenceWeights.data() );
+            Values referenceFusedDeltas = C0, referenceFusedWeights = referenceWeights;
+            double const referenceFusedDot = Kernels::DotMomentumUpdate( (int32_t) C0.size(), Scalar( 0.1 ), referenceNN.data(), Scalar( 0.9 ), referenceFusedDeltas.data(), referenceFusedWeights.data() );
+            double const fusedDotScale = Kernels::Dot( (int32_t) C0.size(), absolute( referenceWeights ).data(), absolute( referenceNN ).data() );
+            std::vector<Values> referenceActivations( (size_t) Activation::Count, activationInput );
+            for ( size_t activationIdx = 0; activationIdx < referenceActivations.size(); activationIdx++ )
+            {
+                Kernels::Activate( (Activation) activationIdx, rows, cols, referenceActivations[activationIdx].data(), cols );
+            }
+            double const referenceDot = Kernels::Dot( (int32_t) A.size(), A.data(), AT.data() );
+            double const dotScale = Kernels::Dot( (int32_t) A.size(), absolute( A ).data(), absolute( AT ).data() );
+
+            // Same work on the instruction set under test
+            Kernels::SetInstructionSet( instructionSet );
+
+            Values resultNN = C0, resultNT = C0, resultTN = C0;
+            Kernels::GemmNN( rows, cols, inner, A.data(), inner, B.data(), cols, resultNN.data(), cols );
+            Kernels::GemmNT( rows, cols, inner, A.data(), inner, BT.data(), inner, resultNT.data(), cols );
+            Kernels::GemmTN( rows, cols, inner, AT.data(), rows, B.data(), cols, resultTN.data(), cols );
+
+            Values resultSparseNN = C0, resultSparseTN = B;
+            Kernels::SparseGemmNN( rows, cols, rowOffsets.data(), columnIndices.data(), sparseValues.data(), B.data(), cols, resultSparseNN.data(), cols );
+            Kernels::SparseGemmTN( rows, cols, rowOffsets.data(), columnIndices.data(), sparseValues.data(), C0.data(), cols, resultSparseTN.data(), cols );
+
+            Values resultDeltas = C0, resultWeights = A;
+            resultWeights.resize( C0.size() );
+            Kernels::MomentumUpdate( (int32_t) C0.size(), Scalar( 0.1 ), referenceNN.data(), Scalar( 0.9 ), resultDeltas.data(), resultWeights.data() );
+            Values resultFusedDeltas = C0, resultFusedWeights = referenceWeights;
+            double const resultFusedDot = Kernels::DotMomentumUpdate( (int32_t) C0.size(), Scalar( 0.1 ), referenceNN.data(), Scalar( 0.9 ), resultFusedDeltas.data(), resultFusedWeights.data() );
+            std::vector<Values> resultActivations( (size_t) Activation::Count, activationInput );
+            for ( size_t activationIdx = 0; activationIdx < resultActivations.size(); activationIdx++ )
+            {
+                Kernels::Activate( (Activation) activationIdx, rows, cols, resultActivations[activationIdx].data(), cols );
+            }
+            double const resultDot = Kernels::Dot( (int32_t) A.size(), A.data(), AT.data() );
+
+            Values const ones( C0.size(), Scalar( 1 ) );
+            maxProductError = std::max( { GetMaxScaledError( resultNN, referenceNN, scaleNN ), GetMaxScaledError( resultNT, referenceNT, scaleNT ),
+                GetMaxScaledError( resultTN, referenceTN, scaleTN ), GetMaxScaledError( resultSparseNN, referenceSparseNN, scaleSparseNN ),
+                GetMaxScaledError( resultSparseTN, referenceSparseTN, scaleSparseTN ), GetMaxScaledError( resultDeltas, referenceDeltas, ones ),
+                GetMaxScaledError( resultWeights, referenceWeights, ones ), std::fabs( resultDot - referenceDot ) / dotScale,
+                GetMaxScaledError( resultFusedDeltas, referenceFusedDeltas, ones ), GetMaxScaledError( resultFusedWeights, referenceFusedWeights, ones ),
+                std::fabs( resultFusedDot - referenceFusedDot ) / fusedDotScale } );
+            maxActivationError = 0;
+            for ( size_t activationIdx = 0; activationIdx < resultActivations.size(); activationIdx++ )
+            {
+                maxActivationError = std::max( maxActivationError, GetMaxScaledError( resultActivations[activationIdx], referenceActivations[activationIdx], ones ) );
+            }
+        }
+
+        // TrainingFileReader::ReadData as it was before it scanned its buffer in place: substr/erase/find and std::stof per value, a heap
+        // copy of every line (freed here instead of leaked), then shuffled and copied into the two sets. Kept to measure the rewrite against.
+        static size_t ReadCsvLegacy( std::string const& filename, int32_t numInputs, TrainingData& data )
+        {
+            TrainingSet entries;
+
+            std::fstream inputFile;
+            inputFile.open( filename, std::ios::in );
+
+            std::string line;
+            while ( std::getline( inputFile, line ) )
+            {
+                if ( line.length() > 2 )
+                {
+                    entries.push_back( TrainingEntry() );
+                    TrainingEntry& entry = entries.back();
+
+                    char* cstr = new char[line.size() + 1];
+                    memcpy( cstr, line.c_str(), line.size() + 1 );
+
+                    for ( int i = 0; i < numInputs; i++ )
+                    {
+                        std::string stringNumber = line.substr( 0, line.find( "," ) );
+                        if ( stringNumber.find_first_not_of( "0123456789." ) != std::string::npos )
+                        {
+                            delete[] cstr;
+                            return 0;
+                        }
+                        entry.m_inputs.push_back( std::stof( stringNumber ) );
+                        line.erase( 0, line.find( "," ) + 1 );
+                    }
+
+                    if ( line == "Iris-setosa" )
+                    {
+                        entry.m_expectedOutputs = { 1, 0, 0 };
+                    }
+                    else if ( line == "Iris-versicolor" )
+                    {
+                        entry.m_expectedOutputs = { 0, 1, 0 };
+                    }
+                    else if ( line == "Iris-virginica" )
+                    {
+                        entry.m_expectedOutputs = { 0, 0, 1 };
+                    }
+
+                    delete[] cstr;
+                }
+            }
+
+            std::shuffle( entries.begin(), entries.end(), std::mt19937( 1 ) );
+            size_t const numTrainingEntries = (size_t) ( 0.75 * entries.size() );
+            for ( size_t entryIdx = 0; entryIdx < entries.size(); entryIdx++ )
+            {
+                ( entryIdx < numTrainingEntries ? data.m_trainingSet : data.m_testSet ).push_back( entries[entryIdx] );
+            }
+
+            return entries.size();
+        }
+
+        // Prints one row of the static network report: latency of both evaluations and the largest output difference
+        template<uint32_t Inputs, uint32_t Hidden, uint32_t Outputs>
+        static void MeasureStaticNetworkLatency( char const* name, Network const& network, TrainingSet const& samples )
+        {
+            typedef StaticNetwork<Inputs, Hidden, Outputs> StaticNetworkType;
+
+            StaticNetworkType staticNetwork;
+            if ( !staticNetwork.Load( network ) || samples.empty() || samples[0].m_inputs.size() != Inputs )
+            {
+                std::cout << std::setw( 12 ) << name << "   network or samples do not match the static topology" << std::endl;
+                return;
+            }
+
+            std::vector<typename StaticNetworkType::InputArray> staticInputs( samples.size() );
+            for ( size_t sampleIdx = 0; sampleIdx < samples.size(); sampleIdx++ )
+            {
+                std::copy( samples[sampleIdx].m_inputs.begin(), samples[sampleIdx].m_inputs.end(), staticInputs[sampleIdx].begin() );
+            }
+
+            // Both must produce the same activations up to rounding
+            double maxDifference = 0;
+            typename StaticNetworkType::OutputArray staticOutputs;
+            std::vector<double> dynamicOutputs( Outputs );
+            int32_t classIdx;
+            for ( size_t sampleIdx = 0; sampleIdx < samples.size(); sampleIdx++ )
+            {
+                network.EvaluateBatch( samples[sampleIdx].m_inputs.data(), 1, &classIdx, dynamicOutputs.data() );
+                staticNetwork.Evaluate( staticInputs[sampleIdx], staticOutputs );
+                for ( uint32_t outputIdx = 0; outputIdx < Outputs; outputIdx++ )
+                {
+                    maxDifference = std::max( maxDifference, std::fabs( staticOutputs[outputIdx] - dynamicOutputs[outputIdx] ) );
+                }
+            }
+
+            // Same number of single sample evaluations for both, the results feed a checksum so none can be skipped
+            size_t const numPasses = std::max( (size_t) 1, (size_t) 200000 / samples.size() );
+            Network dynamicNetwork = network;
+            double checksum = 0;
+
+            Clock::time_point start = Clock::now();
+            for ( size_t passIdx = 0; passIdx < numPasses; passIdx++ )
+            {
+                for ( auto const& sample : samples )
+                {
+                    checksum += dynamicNetwork.Evaluate( sample.m_inputs ).size();
+                }
+            }
+            double const dynamicSeconds = GetElapsedSeconds( start );
+
+            start = Clock::now();
+            for ( size_t passIdx = 0; passIdx < numPasses; passIdx++ )
+            {
+                for ( auto const& input : staticInputs )
+                {
+                    checksum += staticNetwork.EvaluateClass( input );
+                }
+            }
+            double const staticSeconds = GetElapsedSeconds( start );
+            g_benchmarkSink = checksum;
+
+            double const numEvaluations = (double) numPasses * samples.size();
+            std::cout << std::setw( 12 ) << name << std::setprecision( 4 ) << std::setw( 16 ) << dynamicSeconds / numEvaluations * 1e9 << std::setw( 16 ) << staticSeconds / numEvaluations * 1e9
+                << std::setw( 10 ) << std::setprecision( 3 ) << dynamicSeconds / staticSeconds << std::setw( 18 ) << maxDifference << std::endl;
+        }
+
+        // The trainer settings of a report run: quiet, never writing over the checkpoint file of the console session, and without early
+        // stopping, so all compared runs train the same generations and end on their last weights
+        static NNTrainer::Settings GetReportSettings( NNTrainer::Settings const& settings )
+        {
+            NNTrainer::Settings reportSettings = settings;
+            reportSettings.m_logProgress = false;
+            reportSettings.m_checkpointPath.clear();
+            reportSettings.m_earlyStoppingPatience = 0;
+            return reportSettings;
+        }
+
+        static double GetMaxWeightDifference( Network const& a, Network const& b )
+        {
+            double maxDifference = 0;
+            for ( size_t weightIdx = 0; weightIdx < a.GetNumWeights(); weightIdx++ )
+            {
+                maxDifference = std::max( maxDifference, std::fabs( a.GetWeights()[weightIdx] - b.GetWeights()[weightIdx] ) );
+            }
+
+            return maxDifference;
+        }
+
+        //-------------------------------------------------------------------------
+
+        void RunThreadScalingReport( Network const& initialNetwork, NNTrainer::Settings const& settings, TrainingData const& trainingData, uint32_t maxThreads )
+        {
+            if ( settings.m_batchSize <= 1 )
+            {
+                std::cout << "Data parallel training needs a batch size > 1, set one with 'batchsize'" << std::endl;
+                return;
+            }
+
+            ConsoleFormatGuard const formatGuard;
+            NNTrainer::Settings runSettings = GetReportSettings( settings );
+
+            std::cout << std::endl << "Thread scaling, batch size " << settings.m_batchSize << ", " << trainingData.m_trainingSet.size() << " training samples, "
+                << settings.m_maxGenerations << " max generations" << std::endl;
+            std::cout << "Threads   Seconds   Samples/s   Speedup   Max weight diff" << std::endl;
+
+            Network referenceNetwork = initialNetwork;
+            double referenceSeconds = 0;
+
+            for ( uint32_t numThreads = 1; numThreads <= maxThreads; numThreads++ )
+            {
+                Network network = initialNetwork;
+                runSettings.m_numThreads = numThreads;
+                NNTrainer trainer( runSettings, &network );
+
+                Clock::time_point const start = Clock::now();
+                trainer.Train( trainingData );
+                double const seconds = GetElapsedSeconds( start );
+
+                if ( numThreads == 1 )
+                {
+                    referenceNetwork = network;
+                    referenceSeconds = seconds;
+                }
+
+                double const samplesPerSecond = (double) trainer.GetCurrentGeneration() * trainingData.m_trainingSet.size() / seconds;
+                std::cout << std::setw( 7 ) << numThreads << std::setw( 10 ) << std::setprecision( 4 ) << seconds << std::setw( 12 ) << std::setprecision( 6 ) << samplesPerSecond
+                    << std::setw( 10 ) << std::setprecision( 3 ) << referenceSeconds / seconds << std::setw( 18 ) << GetMaxWeightDifference( network, referenceNetwork ) << std::endl;
+            }
+        }
+
+        void RunAsynchronousConvergenceReport( Network const& initialNetwork, NNTrainer::Settings const& settings, TrainingData const& trainingData, uint32_t numThreads )
+        {
+            ConsoleFormatGuard const formatGuard;
+
+            // Train one generation per call so both runs can be compared after every generation, the trainers keep their momentum
+            NNTrainer::Settings serialSettings = GetReportSettings( settings );
+            serialSettings.m_batchSize = 1;
+            serialSettings.m_numThreads = 1;
+            serialSettings.m_parallelMode = NNTrainer::ParallelMode::Synchronous;
+            serialSettings.m_maxGenerations = 1;
+            serialSettings.m_desiredAccuracy = 101;
+
+            NNTrainer::Settings asyncSettings = serialSettings;
+            asyncSettings.m_numThreads = numThreads;
+            asyncSettings.m_parallelMode = NNTrainer::ParallelMode::Asynchronous;
+
+            Network serialNetwork = initialNetwork;
+            Network asyncNetwork = initialNetwork;
+            NNTrainer serialTrainer( serialSettings, &serialNetwork );
+            NNTrainer asyncTrainer( asyncSettings, &asyncNetwork );
+
+            std::cout << std::endl << "Serial vs asynchronous training on " << numThreads << " threads, " << trainingData.m_trainingSet.size() << " training samples" << std::endl;
+            std::cout << "Generation   Serial MSE  Serial Acc   Async MSE   Async Acc" << std::endl;
+
+            double serialSeconds = 0;
+            double asyncSeconds = 0;
+            uint32_t nextReportedGeneration = 1;
+
+            for ( uint32_t generation = 1; generation <= settings.m_maxGenerations; generation++ )
+            {
+                Clock::time_point start = Clock::now();
+                serialTrainer.Train( trainingData );
+                serialSeconds += GetElapsedSeconds( start );
+
+                start = Clock::now();
+                asyncTrainer.Train( trainingData );
+                asyncSeconds += GetElapsedSeconds( start );
+
+                // Report on a roughly logarithmic scale
+                if ( generation == nextReportedGeneration || generation == settings.m_maxGenerations )
+                {
+                    std::cout << std::setw( 10 ) << generation << std::setprecision( 5 )
+                        << std::setw( 13 ) << serialTrainer.GetTestSetMSE() << std::setw( 12 ) << serialTrainer.GetTestSetAccuracy()
+                        << std::setw( 12 ) << asyncTrainer.GetTestSetMSE() << std::setw( 12 ) << asyncTrainer.GetTestSetAccuracy() << std::endl;
+                    nextReportedGeneration = std::max( nextReportedGeneration + 1, nextReportedGeneration * 3 / 2 );
+                }
+            }
+
+            double const samplesTrained = (double) settings.m_maxGenerations * trainingData.m_trainingSet.size();
+            std::cout << "Serial: " << serialSeconds << "s, " << samplesTrained / serialSeconds << " samples/s" << std::endl;
+            std::cout << "Async:  " << asyncSeconds << "s, " << samplesTrained / asyncSeconds << " samples/s" << std::endl;
+        }
+
+        void RunPrecisionReport( Network::Settings const& networkSettings, NNTrainer::Settings const& settings, TrainingData const& trainingData )
+        {
+            ConsoleFormatGuard const formatGuard;
+
+            // Same initial weights and samples for both, one generation per call like the asynchronous report
+            NNTrainer::Settings generationSettings = GetReportSettings( settings );
+            generationSettings.m_maxGenerations = 1;
+            generationSettings.m_desiredAccuracy = 101;
+
+            Network doubleNetwork( networkSettings );
+            NetworkFloat floatNetwork( networkSettings );
+            floatNetwork.CopyWeights( doubleNetwork );
+            TrainingDataT<float> const floatTrainingData = ConvertTrainingData<float>( trainingData );
+
+            NNTrainer doubleTrainer( generationSettings, &doubleNetwork );
+            NNTrainerFloat floatTrainer( generationSettings, &floatNetwork );
+
+            std::cout << std::endl << "Double vs float training, " << trainingData.m_trainingSet.size() << " training samples, weights "
+                << doubleNetwork.GetNumWeights() * sizeof( double ) << " vs " << floatNetwork.GetNumWeights() * sizeof( float ) << " bytes" << std::endl;
+            std::cout << "Generation   Double MSE  Double Acc   Float MSE   Float Acc" << std::endl;
+
+            double doubleSeconds = 0;
+            double floatSeconds = 0;
+            uint32_t nextReportedGeneration = 1;
+
+            for ( uint32_t generation = 1; generation <= settings.m_maxGenerations; generation++ )
+            {
+                Clock::time_point start = Clock::now();
+                doubleTrainer.Train( trainingData );
+                doubleSeconds += GetElapsedSeconds( start );
+
+                start = Clock::now();
+                floatTrainer.Train( floatTrainingData );
+                floatSeconds += GetElapsedSeconds( start );
+
+                if ( generation == nextReportedGeneration || generation == settings.m_maxGenerations )
+                {
+                    std::cout << std::setw( 10 ) << generation << std::setprecision( 5 )
+                        << std::setw( 13 ) << doubleTrainer.GetTestSetMSE() << std::setw( 12 ) << doubleTrainer.GetTestSetAccuracy()
+                        << std::setw( 12 ) << floatTrainer.GetTestSetMSE() << std::setw( 12 ) << floatTrainer.GetTestSetAccuracy() << std::endl;
+                    nextReportedGeneration = std::max( nextReportedGeneration + 1, nextReportedGeneration * 3 / 2 );
+                }
+            }
+
+            double const samplesTrained = (double) settings.m_maxGenerations * trainingData.m_trainingSet.size();
+            std::cout << "Double: " << doubleSeconds << "s, " << samplesTrained / doubleSeconds << " samples/s" << std::endl;
+            std::cout << "Float:  " << floatSeconds << "s, " << samplesTrained / floatSeconds << " samples/s" << std::endl;
+            std::cout << "Test MSE difference " << std::fabs( floatTrainer.GetTestSetMSE() - doubleTrainer.GetTestSetMSE() )
+                << ", accuracy difference " << floatTrainer.GetTestSetAccuracy() - doubleTrainer.GetTestSetAccuracy() << "%" << std::endl;
+        }
+
+        void RunActivationReport( Network::Settings const& networkSettings, NNTrainer::Settings const& settings, TrainingData const& trainingData )
+        {
+            ConsoleFormatGuard const formatGuard;
+            Kernels::InstructionSet const previousInstructionSet = Kernels::GetInstructionSet();
+
+            NNTrainer::Settings const trainerSettings = GetReportSettings( settings );
+
+            // Every variant starts from the same weights and evaluates the training set often enough to time it
+            Network const initialNetwork( networkSettings );
+            int32_t const numInputs = initialNetwork.GetNumInputs();
+            int32_t const numRows = (int32_t) trainingData.m_trainingSet.size();
+            std::vector<double> batchInputs( (size_t) numRows * numInputs );
+            for ( int32_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
+            {
+                trainingData.m_trainingSet[rowIdx].GetDenseInputs( numInputs, batchInputs.data() + (size_t) rowIdx * numInputs );
+            }
+            std::vector<int32_t> classIndices( numRows );
+            int32_t const numEvaluatePasses = std::max( 1, 200000 / std::max( numRows, 1 ) );
+
+            struct Variant
+            {
+                char const*             m_name;
+                Activation              m_hiddenActivation;
+                Activation              m_outputActivation;
+                Kernels::InstructionSet m_instructionSet;
+            };
+
+            Kernels::InstructionSet const activeSet = previousInstructionSet;
+            Variant const variants[] =
+            {
+                { "sigmoid, scalar kernels", Activation::Sigmoid, Activation::Sigmoid, Kernels::InstructionSet::Scalar },
+                { "sigmoid", Activation::Sigmoid, Activation::Sigmoid, activeSet },
+                { "fastsigmoid", Activation::FastSigmoid, Activation::FastSigmoid, activeSet },
+                { "tanh", Activation::Tanh, Activation::Sigmoid, activeSet },
+                { "fasttanh", Activation::FastTanh, Activation::Sigmoid, activeSet },
+                { "relu", Activation::ReLU, Activation::Sigmoid, activeSet },
+                { "leakyrelu", Activation::LeakyReLU, Activation::Sigmoid, activeSet },
+                { "sigmoid, softmax out", Activation::Sigmoid, Activation::Softmax, activeSet },
+                { "relu, softmax out", Activation::ReLU, Activation::Softmax, activeSet },
+            };
+
+            std::cout << std::endl << "Activations, " << numRows << " training samples, at most " << settings.m_maxGenerations << " generations, "
+                << Kernels::GetInstructionSetName( activeSet ) << " kernels" << std::endl;
+            std::cout << "Hidden, output            Evaluate rows/s   Speedup   Generations   Train s   Test MSE   Test Acc" << std::endl;
+
+            double baselineSeconds = 0;
+            for ( Variant const& variant : variants )
+            {
+                Kernels::SetInstructionSet( variant.m_instructionSet );
+
+                Network::Settings variantSettings = networkSettings;
+                variantSettings.m_hiddenActivation = variant.m_hiddenActivation;
+                variantSettings.m_outputActivation = variant.m_outputActivation;
+                Network network( variantSettings );
+                network.CopyWeights( initialNetwork );
+
+                Clock::time_point start = Clock::now();
+                for ( int32_t passIdx = 0; passIdx < numEvaluatePasses; passIdx++ )
+                {
+                    network.EvaluateBatch( batchInputs.data(), numRows, classIndices.data(), nullptr );
+                }
+                double const evaluateSeconds = GetElapsedSeconds( start );
+                g_benchmarkSink = g_benchmarkSink + classIndices[0];
+                if ( baselineSeconds == 0 )
+                {
+                    baselineSeconds = evaluateSeconds;
+                }
+
+                NNTrainer trainer( trainerSettings, &network );
+                start = Clock::now();
+                trainer.Train( trainingData );
+                double const trainSeconds = GetElapsedSeconds( start );
+
+                std::cout << std::left << std::setw( 24 ) << variant.m_name << std::right << std::setprecision( 4 )
+                    << std::setw( 17 ) << (double) numRows * numEvaluatePasses / evaluateSeconds << std::setw( 10 ) << baselineSeconds / evaluateSeconds
+                    << std::setw( 14 ) << trainer.GetCurrentGeneration() << std::setw( 10 ) << trainSeconds
+                    << std::setw( 11 ) << trainer.GetTestSetMSE() << std::setw( 11 ) << trainer.GetTestSetAccuracy() << std::endl;
+            }
+
+            Kernels::SetInstructionSet( previousInstructionSet );
+        }
+
+        void RunKernelReport()
+        {
+            ConsoleFormatGuard const formatGuard;
+            Kernels::InstructionSet const previousInstructionSet = Kernels::GetInstructionSet();
+            Kernels::InstructionSet const supportedInstructionSet = Kernels::GetSupportedInstructionSet();
+
+            std::cout << std::endl << "Kernels: " << Kernels::GetInstructionSetName( supportedInstructionSet ) << " supported, "
+                << Kernels::GetInstructionSetName( previousInstructionSet ) << " active" << std::endl;
+
+            // Accuracy against the scalar kernels
+            //-------------------------------------------------------------------------
+
+            std::cout << "Instruction set   Scalar   Product error   Activation error   Result" << std::endl;
+            for ( int32_t instructionSet = (int32_t) Kernels::InstructionSet::SSE2; instructionSet <= (int32_t) supportedInstructionSet; instructionSet++ )
+            {
+                double productError, activationError;
+                ValidateKernels<double>( (Kernels::InstructionSet) instructionSet, productError, activationError );
+                bool passed = productError <= 1e-12 && activationError <= 1e-15;
+                std::cout << std::setw( 15 ) << Kernels::GetInstructionSetName( (Kernels::InstructionSet) instructionSet ) << "   double" << std::setprecision( 3 )
+                    << std::setw( 16 ) << productError << std::setw( 19 ) << activationError << "   " << ( passed ? "ok" : "OUT OF TOLERANCE" ) << std::endl;
+
+                ValidateKernels<float>( (Kernels::InstructionSet) instructionSet, productError, activationError );
+                passed = productError <= 1e-5 && activationError <= 1e-6;
+                std::cout << std::setw( 15 ) << Kernels::GetInstructionSetName( (Kernels::InstructionSet) instructionSet ) << "    float" << std::setprecision( 3 )
+                    << std::setw( 16 ) << productError << std::setw( 19 ) << activationError << "   " << ( passed ? "ok" : "OUT OF TOLERANCE" ) << std::endl;
+            }
+
+            // Throughput per hidden width: per sample training and batched evaluation
+            //-------------------------------------------------------------------------
+
+            int32_t const numInputs = 32;
+            int32_t const numOutputs = 4;
+            int32_t const numEntries = 2000;
+            TrainingData trainingData;
+            trainingData.m_trainingSet = CreateRandomTrainingSet( numEntries, numInputs, numOutputs, 5 );
+            trainingData.m_testSet = CreateRandomTrainingSet( 1, numInputs, numOutputs, 6 );
+
+            std::vector<double> batchInputs;
+            for ( auto const& entry : trainingData.m_trainingSet )
+            {
+                batchInputs.insert( batchInputs.end(), entry.m_inputs.begin(), entry.m_inputs.end() );
+            }
+            std::vector<int32_t> classIndices( numEntries );
+
+            NNTrainer::Settings settings;
+            settings.m_maxGenerations = 1;
+            settings.m_desiredAccuracy = 101;
+            settings.m_logProgress = false;
+
+            std::cout << std::endl << "Hidden   Instruction set   Train samples/s   Evaluate rows/s   Speedup" << std::endl;
+            for ( uint32_t numHidden : { 8u, 32u, 128u, 512u } )
+            {
+                double scalarSeconds = 0;
+                for ( int32_t instructionSet = 0; instructionSet <= (int32_t) supportedInstructionSet; instructionSet++ )
+                {
+                    Kernels::SetInstructionSet( (Kernels::InstructionSet) instructionSet );
+
+                    Network network( Network::Settings{ (uint32_t) numInputs, numHidden, (uint32_t) numOutputs } );
+                    NNTrainer trainer( settings, &network );
+
+                    Clock::time_point start = Clock::now();
+                    trainer.Train( trainingData );
+                    double const trainSeconds = GetElapsedSeconds( start );
+
+                    start = Clock::now();
+                    network.EvaluateBatch( batchInputs.data(), numEntries, classIndices.data(), nullptr );
+                    double const evaluateSeconds = GetElapsedSeconds( start );
+
+                    if ( instructionSet == 0 )
+                    {
+                        scalarSeconds = trainSeconds;
+                    }
+
+                    std::cout << std::setw( 6 ) << numHidden << std::setw( 18 ) << Kernels::GetInstructionSetName( (Kernels::InstructionSet) instructionSet ) << std::setprecision( 4 )
+                        << std::setw( 18 ) << numEntries / trainSeconds << std::setw( 18 ) << numEntries / evaluateSeconds << std::setw( 10 ) << scalarSeconds / trainSeconds << std::endl;
+                }
+            }
+
+            Kernels::SetInstructionSet( previousInstructionSet );
+        }
+
+        void RunStaticNetworkReport( Network const& network, TrainingSet const& samples )
+        {
+            ConsoleFormatGuard const formatGuard;
+
+            std::cout << std::endl << "Topology   Network ns/sample   Static ns/sample   Speedup   Max output diff" << std::endl;
+            MeasureStaticNetworkLatency<4, 3, 3>( "current", network, samples );
+
+            // Fixed shapes on random inputs, the weights come from a fresh network
+            TrainingSet const smallSamples = CreateRandomTrainingSet( 1000, 4, 3, 7 );
+            MeasureStaticNetworkLatency<4, 3, 3>( "4-3-3", Network( Network::Settings{ 4, 3, 3 } ), smallSamples );
+
+            TrainingSet const mediumSamples = CreateRandomTrainingSet( 1000, 16, 4, 8 );
+            MeasureStaticNetworkLatency<16, 16, 4>( "16-16-4", Network( Network::Settings{ 16, 16, 4 } ), mediumSamples );
+
+            TrainingSet const largeSamples = CreateRandomTrainingSet( 1000, 32, 8, 9 );
+            MeasureStaticNetworkLatency<32, 64, 8>( "32-64-8", Network( Network::Settings{ 32, 64, 8 } ), largeSamples );
+        }
+
+        void RunQuantizationReport( Network const& network, TrainingData const& trainingData )
+        {
+            ConsoleFormatGuard const formatGuard;
+
+            TrainingSet const& testSet = trainingData.m_testSet;
+            if ( testSet.empty() || testSet[0].m_inputs.size() != (size_t) network.GetNumInputs() )
+            {
+                std::cout << std::endl << "The test set does not match the network" << std::endl;
+                return;
+            }
+
+            QuantizedNetwork quantizedNetwork( network, trainingData.m_trainingSet );
+
+            // Accuracy of both on the test split, how often they pick the same class and how far the output activations are apart
+            //-------------------------------------------------------------------------
+
+            int32_t const numOutputs = network.GetNumOutputs();
+            std::vector<double> outputs( numOutputs );
+            std::vector<float> quantizedOutputs( numOutputs );
+            size_t numCorrect = 0, numQuantizedCorrect = 0, numAgreeing = 0;
+            double maxDifference = 0;
+
+            for ( auto const& entry : testSet )
+            {
+                int32_t const expectedClassIdx = (int32_t) ( std::max_element( entry.m_expectedOutputs.begin(), entry.m_expectedOutputs.end() ) - entry.m_expectedOutputs.begin() );
+
+                int32_t classIdx;
+                network.EvaluateBatch( entry.m_inputs.data(), 1, &classIdx, outputs.data() );
+                int32_t const quantizedClassIdx = quantizedNetwork.Evaluate( entry.m_inputs.data(), quantizedOutputs.data() );
+
+                numCorrect += ( classIdx == expectedClassIdx ) ? 1 : 0;
+                numQuantizedCorrect += ( quantizedClassIdx == expectedClassIdx ) ? 1 : 0;
+                numAgreeing += ( classIdx == quantizedClassIdx ) ? 1 : 0;
+                for ( int32_t outputIdx = 0; outputIdx < numOutputs; outputIdx++ )
+                {
+                    maxDifference = std::max( maxDifference, std::fabs( outputs[outputIdx] - quantizedOutputs[outputIdx] ) );
+                }
+            }
+
+            // Single sample latency of both
+            //-------------------------------------------------------------------------
+
+            size_t const numPasses = std::max( (size_t) 1, (size_t) 200000 / testSet.size() );
+            Network evaluatedNetwork = network;
+            double checksum = 0;
+
+            Clock::time_point start = Clock::now();
+            for ( size_t passIdx = 0; passIdx < numPasses; passIdx++ )
+            {
+                for ( auto const& entry : testSet )
+                {
+                    checksum += evaluatedNetwork.Evaluate( entry.m_inputs ).size();
+                }
+            }
+            double const networkSeconds = GetElapsedSeconds( start );
+
+            start = Clock::now();
+            for ( size_t passIdx = 0; passIdx < numPasses; passIdx++ )
+            {
+                for ( auto const& entry : testSet )
+                {
+                    checksum += quantizedNetwork.Evaluate( entry.m_inputs.data() );
+                }
+            }
+            double const quantizedSeconds = GetElapsedSeconds( start );
+            g_benchmarkSink = checksum;
+
+            double const numEvaluations = (double) numPasses * testSet.size();
+            double const accuracy = 100.0 * numCorrect / testSet.size();
+            double const quantizedAccuracy = 100.0 * numQuantizedCorrect / testSet.size();
+
+            std::cout << std::endl << "Int8 quantization, calibrated on " << trainingData.m_trainingSet.size() << " training samples, " << testSet.size() << " test samples" << std::endl;
+            std::cout << "              Accuracy   ns/sample   Model bytes" << std::endl;
+            std::cout << std::setprecision( 5 ) << "Network   " << std::setw( 12 ) << accuracy << std::setw( 12 ) << networkSeconds * 1e9 / numEvaluations
+                << std::setw( 14 ) << network.GetNumWeights() * sizeof( double ) << std::endl;
+            std::cout << "Int8      " << std::setw( 12 ) << quantizedAccuracy << std::setw( 12 ) << quantizedSeconds * 1e9 / numEvaluations
+                << std::setw( 14 ) << quantizedNetwork.GetModelBytes() << std::endl;
+            std::cout << "Accuracy delta " << quantizedAccuracy - accuracy << "%, same class for " << 100.0 * numAgreeing / testSet.size()
+                << "% of the samples, max output diff " << maxDifference << std::endl;
+        }
+
+        void RunCsvReaderReport( std::string const& filename, int32_t numInputs, int32_t numOutputs )
+        {
+            ConsoleFormatGuard const formatGuard;
+
+            // Repeat the data set until the file is large enough to measure throughput rather than latency
+            //-------------------------------------------------------------------------
+
+            std::ifstream sourceFile( filename, std::ios::in | std::ios::binary );
+            std::string const source( ( std::istreambuf_iterator<char>( sourceFile ) ), std::istreambuf_iterator<char>() );
+            if ( source.empty() )
+            {
+                std::cout << std::endl << "Error Opening Input File: " << filename << std::endl;
+                return;
+            }
+
+            size_t const targetBytes = (size_t) 64 << 20;
+            std::string const benchmarkFilename = filename + ".benchmark.csv";
+            {
+                std::ofstream benchmarkFile( benchmarkFilename, std::ios::out | std::ios::binary | std::ios::trunc );
+                bool const needsLineBreak = source.back() != '\n';
+                for ( size_t numWritten = 0; numWritten < targetBytes; numWritten += source.size() )
+                {
+                    benchmarkFile << source;
+                    if ( needsLineBreak )
+                    {
+                        benchmarkFile << '\n';
+                    }
+                }
+            }
+
+            // Both readers on the same file, the page cache is warm for both after the file was just written
+            //-------------------------------------------------------------------------
+
+            Clock::time_point start = Clock::now();
+            TrainingData legacyData;
+            size_t const numLegacyEntries = ReadCsvLegacy( benchmarkFilename, numInputs, legacyData );
+            double const legacySeconds = GetElapsedSeconds( start );
+
+            start = Clock::now();
+            TrainingFileReader reader( benchmarkFilename, numInputs, numOutputs );
+            bool const succeeded = reader.ReadData();
+            double const readerSeconds = GetElapsedSeconds( start );
+
+            size_t const numEntries = reader.GetTrainingData().m_trainingSet.size() + reader.GetTrainingData().m_testSet.size();
+            double const megabytes = (double) reader.GetNumBytesRead() / ( 1 << 20 );
+
+            // The first cached read parses and writes the cache, the second one maps it
+            TrainingFileReader cacheWriter( benchmarkFilename, numInputs, numOutputs, true );
+            cacheWriter.ReadData();
+
+            start = Clock::now();
+            TrainingFileReader cacheReader( benchmarkFilename, numInputs, numOutputs, true );
+            cacheReader.ReadData();
+            double const cacheSeconds = GetElapsedSeconds( start );
+            size_t const numCachedEntries = cacheReader.GetTrainingData().m_trainingSet.size() + cacheReader.GetTrainingData().m_testSet.size();
+
+            std::remove( benchmarkFilename.c_str() );
+            std::remove( cacheReader.GetCacheFilename().c_str() );
+
+            std::cout << std::endl << "CSV reader on " << megabytes << " MB (" << filename << " repeated)" << std::endl;
+            std::cout << "Reader        Entries     Seconds        MB/s" << std::endl;
+            std::cout << std::setprecision( 4 ) << "Previous " << std::setw( 12 ) << numLegacyEntries << std::setw( 12 ) << legacySeconds << std::setw( 12 ) << megabytes / legacySeconds << std::endl;
+            std::cout << "In place " << std::setw( 12 ) << numEntries << std::setw( 12 ) << readerSeconds << std::setw( 12 ) << megabytes / readerSeconds
+                << ( succeeded ? "" : "   (malformed lines)" ) << std::endl;
+            std::cout << "Cache    " << std::setw( 12 ) << numCachedEntries << std::setw( 12 ) << cacheSeconds << std::setw( 12 ) << megabytes / cacheSeconds
+                << ( cacheReader.WasLoadedFromCache() ? "" : "   (cache not used)" ) << std::endl;
+            std::cout << "Speedup " << legacySeconds / readerSeconds << ", with the cache " << legacySeconds / cacheSeconds << std::endl;
+        }
+    }
+}
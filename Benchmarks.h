@@ -0,0 +1,44 @@
+// Performance and convergence reports printed to the console
+#pragma once
+
+#include "NNTrainer.h"
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Benchmarks
+    {
+        // Trains copies of initialNetwork with 1 to maxThreads worker threads and prints wall time, speedup and how far the trained
+        // weights are from the single threaded result
+        void RunThreadScalingReport( Network const& initialNetwork, NNTrainer::Settings const& settings, TrainingData const& trainingData, uint32_t maxThreads );
+
+        // Trains copies of initialNetwork with the serial per sample loop and with asynchronous (hogwild) training on numThreads threads,
+        // and prints test MSE, accuracy and throughput of both side by side as the generations progress
+        void RunAsynchronousConvergenceReport( Network const& initialNetwork, NNTrainer::Settings const& settings, TrainingData const& trainingData, uint32_t numThreads );
+
+        // Trains a double and a float network from the same initial weights and prints test MSE, accuracy and throughput of both
+        // side by side as the generations progress, followed by the final differences
+        void RunPrecisionReport( Network::Settings const& networkSettings, NNTrainer::Settings const& settings, TrainingData const& trainingData );
+
+        // Trains copies of one network with every hidden activation (sigmoid outputs) and with softmax outputs, and prints batched
+        // evaluation throughput, generations, test MSE and accuracy of each against the std::exp sigmoid on the scalar kernels
+        void RunActivationReport( Network::Settings const& networkSettings, NNTrainer::Settings const& settings, TrainingData const& trainingData );
+
+        // Checks every supported kernel instruction set against the scalar kernels for double and float (within the tolerance documented in NNKernels.h)
+        // and prints per sample training throughput and batched evaluation throughput for a range of hidden layer widths
+        void RunKernelReport();
+
+        // Compares the per sample latency of Network::Evaluate with a StaticNetwork of the same topology on the given samples, for
+        // the network itself when it has the Iris 4-3-3 shape and for freshly initialised networks of a few fixed shapes
+        void RunStaticNetworkReport( Network const& network, TrainingSet const& samples );
+
+        // Quantizes the network to int8 (calibrated on the training set) and prints the accuracy of both on the test set, the accuracy
+        // delta, single sample latency and model size
+        void RunQuantizationReport( Network const& network, TrainingData const& trainingData );
+
+        // Writes a copy of the given CSV file repeated to 64 MB, reads it with TrainingFileReader, with the previous line parser and from
+        // the binary dataset cache and prints the throughput of all three in MB/s of CSV text
+        void RunCsvReaderReport( std::string const& filename, int32_t numInputs, int32_t numOutputs );
+    }
+}
@@ -0,0 +1,28 @@
+// Columnar binary copy of a parsed training file, written next to it and memory mapped by later runs. The columns skip the text
+// parsing only: TrainingFileReader still copies every row into a TrainingEntry with its own input and output vectors, so a cached
+// load is bound by those allocations and the shuffle, not by the mapping.
+#pragma once
+#include "AlignedBuffer.h"
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    static char const k_datasetCacheMagic[4] = { 'B', 'P', 'N', 'D' };
+    static uint32_t const k_datasetCacheVersion = 1;
+
+    // Followed by m_numInputs float feature columns and one int32 label column (class index of every row), all of m_columnStride
+    // values and starting on a cache line, rows in the order of the source file. All values are little endian.
+    struct DatasetCacheHeader
+    {
+        char                    m_magic[4];
+        uint32_t                m_version;
+        uint64_t                m_sourceSize;               // Size and modification time of the source file when the cache was written,
+        int64_t                 m_sourceModifiedTime;       // the cache is stale as soon as either differs
+        uint32_t                m_numInputs;
+        uint32_t                m_numOutputs;
+        uint64_t                m_numRows;
+        uint64_t                m_columnStride;             // Values per column, m_numRows rounded up to a cache line
+        uint64_t                m_columnsOffset;            // File offset of the first feature column, a multiple of k_cacheLineSize
+    };
+}
@@ -0,0 +1,141 @@
+#include "HyperparameterSweep.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace HyperparameterSweep
+    {
+        std::vector<Candidate> CreateCandidates( Settings const& settings )
+        {
+            std::vector<Candidate> candidates;
+            if ( settings.m_learningRates.empty() || settings.m_momentums.empty() || settings.m_hiddenSizes.empty() || settings.m_maxGenerations.empty() )
+            {
+                return candidates;
+            }
+
+            if ( settings.m_numRandomCandidates == 0 )
+            {
+                for ( double learningRate : settings.m_learningRates )
+                {
+                    for ( double momentum : settings.m_momentums )
+                    {
+                        for ( uint32_t hiddenSize : settings.m_hiddenSizes )
+                        {
+                            for ( uint32_t maxGenerations : settings.m_maxGenerations )
+                            {
+                                candidates.push_back( { learningRate, momentum, hiddenSize, maxGenerations } );
+                            }
+                        }
+                    }
+                }
+                return candidates;
+            }
+
+            auto const learningRateRange = std::minmax_element( settings.m_learningRates.begin(), settings.m_learningRates.end() );
+            auto const momentumRange = std::minmax_element( settings.m_momentums.begin(), settings.m_momentums.end() );
+
+            std::mt19937_64 generator( settings.m_seed );
+            std::uniform_real_distribution<double> logLearningRate( std::log( *learningRateRange.first ), std::log( *learningRateRange.second ) );
+            std::uniform_real_distribution<double> momentum( *momentumRange.first, *momentumRange.second );
+            std::uniform_int_distribution<size_t> hiddenSizeIdx( 0, settings.m_hiddenSizes.size() - 1 );
+            std::uniform_int_distribution<size_t> maxGenerationsIdx( 0, settings.m_maxGenerations.size() - 1 );
+
+            for ( uint32_t candidateIdx = 0; candidateIdx < settings.m_numRandomCandidates; candidateIdx++ )
+            {
+                candidates.push_back( { std::exp( logLearningRate( generator ) ), momentum( generator ), settings.m_hiddenSizes[hiddenSizeIdx( generator )], settings.m_maxGenerations[maxGenerationsIdx( generator )] } );
+            }
+            return candidates;
+        }
+
+        std::vector<Result> Run( Settings const& settings, int32_t numInputs, int32_t numOutputs, NNTrainer::Settings const& trainerSettings, TrainingData const& trainingData )
+        {
+            std::vector<Candidate> const candidates = CreateCandidates( settings );
+            std::vector<Result> results( candidates.size() );
+
+            // Parallel over candidates rather than within one: every trainer is serial and quiet, and the training data is only read.
+            // Candidates never checkpoint (they would all write the same file) and train their full generations without early stopping.
+            NNTrainer::Settings candidateSettings = trainerSettings;
+            candidateSettings.m_numThreads = 1;
+            candidateSettings.m_parallelMode = NNTrainer::ParallelMode::Synchronous;
+            candidateSettings.m_overlapEvaluation = false;
+            candidateSettings.m_logProgress = false;
+            candidateSettings.m_checkpointPath.clear();
+            candidateSettings.m_earlyStoppingPatience = 0;
+
+            uint32_t const numThreads = ( settings.m_numThreads > 0 ) ? settings.m_numThreads : std::max( std::thread::hardware_concurrency(), 1u );
+            ThreadPool threadPool( numThreads );
+
+            threadPool.ParallelFor( candidates.size(), [&] ( size_t candidateIdx, uint32_t )
+            {
+                Candidate const& candidate = candidates[candidateIdx];
+                auto const start = std::chrono::high_resolution_clock::now();
+
+                Network::Settings networkSettings{ (uint32_t) numInputs, candidate.m_hiddenSize, (uint32_t) numOutputs };
+                networkSettings.m_layerWidths = { (uint32_t) numInputs, candidate.m_hiddenSize, (uint32_t) numOutputs };
+                Network network( networkSettings );
+
+                NNTrainer::Settings runSettings = candidateSettings;
+                runSettings.m_learningRate = candidate.m_learningRate;
+                runSettings.m_momentum = candidate.m_momentum;
+                runSettings.m_maxGenerations = candidate.m_maxGenerations;
+                NNTrainer trainer( runSettings, &network );
+                trainer.Train( trainingData );
+
+                Result& result = results[candidateIdx];
+                result.m_candidate = candidate;
+                result.m_generations = trainer.GetCurrentGeneration();
+                result.m_trainingSetAccuracy = trainer.GetTrainingSetAccuracy();
+                result.m_trainingSetMSE = trainer.GetTrainingSetMSE();
+                result.m_testSetAccuracy = trainer.GetTestSetAccuracy();
+                result.m_testSetMSE = trainer.GetTestSetMSE();
+                result.m_seconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+            } );
+
+            std::stable_sort( results.begin(), results.end(), [] ( Result const& a, Result const& b )
+            {
+                if ( a.m_testSetAccuracy != b.m_testSetAccuracy )
+                {
+                    return a.m_testSetAccuracy > b.m_testSetAccuracy;
+                }
+                return a.m_testSetMSE < b.m_testSetMSE;
+            } );
+
+            return results;
+        }
+
+        void PrintResults( std::vector<Result> const& results, double totalSeconds, size_t maxRows )
+        {
+            std::ios::fmtflags const flags = std::cout.flags();
+            std::streamsize const precision = std::cout.precision();
+
+            double candidateSeconds = 0;
+            for ( auto const& result : results )
+            {
+                candidateSeconds += result.m_seconds;
+            }
+
+            std::cout << std::endl << results.size() << " candidates in " << std::setprecision( 4 ) << totalSeconds << " s (" << candidateSeconds << " s of training)" << std::endl;
+            std::cout << "Rank  LearnRate  Momentum  Hidden  MaxGen  Generations  Train %  Train MSE   Test %  Test MSE   Seconds" << std::endl;
+
+            for ( size_t resultIdx = 0; resultIdx < std::min( results.size(), maxRows ); resultIdx++ )
+            {
+                Result const& result = results[resultIdx];
+                std::cout << std::setw( 4 ) << resultIdx + 1 << std::setw( 11 ) << std::setprecision( 4 ) << result.m_candidate.m_learningRate << std::setw( 10 ) << result.m_candidate.m_momentum
+                    << std::setw( 8 ) << result.m_candidate.m_hiddenSize << std::setw( 8 ) << result.m_candidate.m_maxGenerations << std::setw( 13 ) << result.m_generations
+                    << std::setw( 9 ) << result.m_trainingSetAccuracy << std::setw( 11 ) << result.m_trainingSetMSE << std::setw( 9 ) << result.m_testSetAccuracy
+                    << std::setw( 10 ) << result.m_testSetMSE << std::setw( 10 ) << result.m_seconds << std::endl;
+            }
+
+            std::cout.flags( flags );
+            std::cout.precision( precision );
+        }
+    }
+}
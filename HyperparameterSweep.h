@@ -0,0 +1,56 @@
+// Trains many hyperparameter candidates side by side and ranks them
+#pragma once
+
+#include "NNTrainer.h"
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace HyperparameterSweep
+    {
+        struct Settings
+        {
+            // Values to search, every combination of them in a grid search
+            std::vector<double>     m_learningRates = { 0.001, 0.01, 0.1 };
+            std::vector<double>     m_momentums = { 0.0, 0.5, 0.9 };
+            std::vector<uint32_t>   m_hiddenSizes = { 3, 8, 16 };
+            std::vector<uint32_t>   m_maxGenerations = { 500, 1000 };
+
+            // 0 for a grid search, otherwise the number of random candidates: the learning rate is drawn log-uniformly and the momentum
+            // uniformly between the smallest and the largest value above, hidden size and max generations are picked from their lists
+            uint32_t                m_numRandomCandidates = 0;
+            uint64_t                m_seed = 0;
+
+            uint32_t                m_numThreads = 0;           // Candidates trained at the same time, 0 uses every core
+        };
+
+        struct Candidate
+        {
+            double                  m_learningRate;
+            double                  m_momentum;
+            uint32_t                m_hiddenSize;
+            uint32_t                m_maxGenerations;
+        };
+
+        struct Result
+        {
+            Candidate               m_candidate;
+            uint32_t                m_generations;              // Generations trained before a stopping condition was met
+            double                  m_trainingSetAccuracy;
+            double                  m_trainingSetMSE;
+            double                  m_testSetAccuracy;
+            double                  m_testSetMSE;
+            double                  m_seconds;                  // Wall time of this candidate
+        };
+
+        std::vector<Candidate> CreateCandidates( Settings const& settings );
+
+        // Trains a network with one hidden layer per candidate, each on a single thread and all of them reading the same training data.
+        // The other trainer settings (batch size, desired accuracy) come from trainerSettings. Returns the results ranked by test
+        // accuracy, then test MSE.
+        std::vector<Result> Run( Settings const& settings, int32_t numInputs, int32_t numOutputs, NNTrainer::Settings const& trainerSettings, TrainingData const& trainingData );
+
+        void PrintResults( std::vector<Result> const& results, double totalSeconds, size_t maxRows = 20 );
+    }
+}
@@ -0,0 +1,34 @@
+// Binary request and response format of the inference server
+#pragma once
+#include <stdint.h>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // Request flags
+    static uint16_t const k_inferenceRequestShutdown = 1;      // Stops the server once the pending requests are answered, has no inputs
+
+    enum class InferenceStatus : uint8_t
+    {
+        Ok,
+        BadRequest,                                             // Wrong number of inputs, no outputs follow
+    };
+
+    // Followed by m_numInputs float values. All values are little endian, requests on one connection are answered in order.
+    struct InferenceRequestHeader
+    {
+        uint32_t                m_requestId;                    // Chosen by the client, returned in the response
+        uint16_t                m_numInputs;
+        uint16_t                m_flags;
+    };
+
+    // Followed by m_numOutputs float values (the output activations)
+    struct InferenceResponseHeader
+    {
+        uint32_t                m_requestId;
+        int16_t                 m_classIndex;                   // Index of the single highest output, -1 if there is none
+        InferenceStatus         m_status;
+        uint8_t                 m_numOutputs;
+    };
+}
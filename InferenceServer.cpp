@@ -0,0 +1,542 @@
+#include "InferenceServer.h"
+#include "InferenceProtocol.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#if defined( _WIN32 )
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Byte stream carrying requests in and responses out. Read is only called by the reader thread of the connection, Write only by the
+    // batcher thread.
+    class InferenceServer::Connection
+    {
+    public:
+
+        virtual ~Connection() = default;
+
+        // Reads exactly size bytes, returns false if the connection closed first
+        virtual bool Read( void* data, size_t size ) = 0;
+        virtual bool Write( void const* data, size_t size ) = 0;
+
+        // Makes a blocked Read return false
+        virtual void Close() {}
+    };
+
+    class InferenceServer::FileConnection : public InferenceServer::Connection
+    {
+    public:
+
+        FileConnection( FILE* input, FILE* output ) : m_input( input ), m_output( output ) {}
+
+        virtual bool Read( void* data, size_t size ) override
+        {
+            return fread( data, 1, size, m_input ) == size;
+        }
+
+        virtual bool Write( void const* data, size_t size ) override
+        {
+            return fwrite( data, 1, size, m_output ) == size && fflush( m_output ) == 0;
+        }
+
+    private:
+
+        FILE*                   m_input;
+        FILE*                   m_output;
+    };
+
+#if !defined( _WIN32 )
+
+    class InferenceServer::SocketConnection : public InferenceServer::Connection
+    {
+    public:
+
+        explicit SocketConnection( int socket ) : m_socket( socket ) {}
+        ~SocketConnection() { close( m_socket ); }
+
+        virtual bool Read( void* data, size_t size ) override
+        {
+            uint8_t* cursor = static_cast<uint8_t*>( data );
+            while ( size > 0 )
+            {
+                ssize_t const numRead = recv( m_socket, cursor, size, 0 );
+                if ( numRead <= 0 )
+                {
+                    if ( numRead < 0 && errno == EINTR )
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                cursor += numRead;
+                size -= (size_t) numRead;
+            }
+            return true;
+        }
+
+        virtual bool Write( void const* data, size_t size ) override
+        {
+            // A client that disconnected must not kill the server with SIGPIPE
+#if defined( MSG_NOSIGNAL )
+            int const flags = MSG_NOSIGNAL;
+#else
+            int const flags = 0;
+#endif
+            uint8_t const* cursor = static_cast<uint8_t const*>( data );
+            while ( size > 0 )
+            {
+                ssize_t const numWritten = send( m_socket, cursor, size, flags );
+                if ( numWritten <= 0 )
+                {
+                    if ( numWritten < 0 && errno == EINTR )
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                cursor += numWritten;
+                size -= (size_t) numWritten;
+            }
+            return true;
+        }
+
+        virtual void Close() override
+        {
+            shutdown( m_socket, SHUT_RDWR );
+        }
+
+    private:
+
+        int                     m_socket;
+    };
+
+#endif
+
+    //-------------------------------------------------------------------------
+
+    InferenceServer::InferenceServer( Network const& network, Settings const& settings )
+        : m_network( network )
+        , m_settings( settings )
+    {
+        m_settings.m_maxBatchSize = std::max( m_settings.m_maxBatchSize, 1u );
+    }
+
+    InferenceServer::~InferenceServer()
+    {
+        Stop();
+    }
+
+    bool InferenceServer::ServeSocket( std::string const& path )
+    {
+#if defined( _WIN32 )
+        std::cout << "Unix domain sockets are not supported on this platform, use the stdin/stdout pipe" << std::endl;
+        return false;
+#else
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if ( path.empty() || path.size() >= sizeof( address.sun_path ) )
+        {
+            std::cout << "Invalid socket path: " << path << std::endl;
+            return false;
+        }
+        memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+
+        int const listenSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+        unlink( path.c_str() );
+        if ( listenSocket < 0 || bind( listenSocket, reinterpret_cast<sockaddr*>( &address ), sizeof( address ) ) != 0 || listen( listenSocket, 64 ) != 0 )
+        {
+            std::cout << "Cannot listen on " << path << ": " << strerror( errno ) << std::endl;
+            if ( listenSocket >= 0 )
+            {
+                close( listenSocket );
+            }
+            return false;
+        }
+
+        std::cout << "Serving on " << path << ", max batch " << m_settings.m_maxBatchSize << ", deadline " << m_settings.m_maxDelayMicroseconds << " us" << std::endl;
+        m_reportToStderr = false;
+        m_listenSocket = listenSocket;
+        Start();
+
+        while ( true )
+        {
+            int const connectionSocket = accept( listenSocket, nullptr, nullptr );
+            if ( connectionSocket < 0 )
+            {
+                if ( errno == EINTR )
+                {
+                    continue;
+                }
+                break;
+            }
+
+            std::lock_guard<std::mutex> lock( m_mutex );
+            std::shared_ptr<Connection> connection( new SocketConnection( connectionSocket ) );
+            if ( m_stopping )
+            {
+                break;
+            }
+            JoinFinishedReaders();
+            m_connections.push_back( connection );
+            m_readerThreads.emplace_back( &InferenceServer::ReadSocketRequests, this, connection );
+        }
+
+        Stop();
+        close( listenSocket );
+        unlink( path.c_str() );
+        m_listenSocket = -1;
+
+        PrintStatistics( GetStatistics(), "Total" );
+        return true;
+#endif
+    }
+
+    bool InferenceServer::ServePipe()
+    {
+#if defined( _WIN32 )
+        _setmode( _fileno( stdin ), _O_BINARY );
+        _setmode( _fileno( stdout ), _O_BINARY );
+#endif
+
+        // stdout carries the responses, everything else goes to stderr
+        m_reportToStderr = true;
+        Start();
+        ReadRequests( std::shared_ptr<Connection>( new FileConnection( stdin, stdout ) ) );
+        Stop();
+
+        PrintStatistics( GetStatistics(), "Total" );
+        return true;
+    }
+
+    InferenceServer::Statistics InferenceServer::GetStatistics() const
+    {
+        std::lock_guard<std::mutex> lock( m_statisticsMutex );
+        Window total = m_total;
+        return GetWindowStatistics( total, Clock::now() );
+    }
+
+    //-------------------------------------------------------------------------
+
+    void InferenceServer::Start()
+    {
+        Clock::time_point const now = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock( m_statisticsMutex );
+            m_window = Window();
+            m_window.m_start = now;
+            m_total = Window();
+            m_total.m_start = now;
+        }
+
+        m_stopping = false;
+        m_batchThread = std::thread( &InferenceServer::BatchLoop, this );
+    }
+
+    void InferenceServer::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stopping = true;
+        }
+        m_requestAvailable.notify_one();
+
+        // The batcher answers everything queued before it exits
+        if ( m_batchThread.joinable() )
+        {
+            m_batchThread.join();
+        }
+
+        // Readers remove their own connections as they exit, so close a snapshot
+        std::vector<std::shared_ptr<Connection>> connections;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            connections = m_connections;
+        }
+        for ( auto const& connection : connections )
+        {
+            connection->Close();
+        }
+        for ( auto& thread : m_readerThreads )
+        {
+            thread.join();
+        }
+        m_connections.clear();
+        m_readerThreads.clear();
+        m_finishedReaders.clear();
+    }
+
+    void InferenceServer::ReadSocketRequests( std::shared_ptr<Connection> connection )
+    {
+        ReadRequests( connection );
+
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_connections.erase( std::find( m_connections.begin(), m_connections.end(), connection ) );
+        m_finishedReaders.push_back( std::this_thread::get_id() );
+    }
+
+    // Expects m_mutex to be held, a finished reader only has to return so the join is short
+    void InferenceServer::JoinFinishedReaders()
+    {
+        for ( std::thread::id const id : m_finishedReaders )
+        {
+            auto const thread = std::find_if( m_readerThreads.begin(), m_readerThreads.end(), [id] ( std::thread const& reader ) { return reader.get_id() == id; } );
+            thread->join();
+            m_readerThreads.erase( thread );
+        }
+        m_finishedReaders.clear();
+    }
+
+    void InferenceServer::ReadRequests( std::shared_ptr<Connection> connection )
+    {
+        int32_t const numInputs = m_network.GetNumInputs();
+        InferenceRequestHeader header;
+        std::vector<float> values;
+
+        while ( connection->Read( &header, sizeof( header ) ) )
+        {
+            if ( header.m_flags & k_inferenceRequestShutdown )
+            {
+                {
+                    std::lock_guard<std::mutex> lock( m_mutex );
+                    m_stopping = true;
+                }
+                m_requestAvailable.notify_one();
+
+#if !defined( _WIN32 )
+                // Wakes up the accept loop of ServeSocket
+                if ( m_listenSocket >= 0 )
+                {
+                    shutdown( m_listenSocket, SHUT_RDWR );
+                }
+#endif
+                return;
+            }
+
+            values.resize( header.m_numInputs );
+            if ( !connection->Read( values.data(), values.size() * sizeof( float ) ) )
+            {
+                return;
+            }
+
+            PendingRequest request;
+            request.m_connection = connection;
+            request.m_requestId = header.m_requestId;
+            request.m_isValid = ( header.m_numInputs == numInputs );
+            if ( request.m_isValid )
+            {
+                request.m_inputs.assign( values.begin(), values.end() );
+            }
+            request.m_arrivalTime = Clock::now();
+
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                if ( m_stopping )
+                {
+                    return;
+                }
+                m_queue.push_back( std::move( request ) );
+            }
+            m_requestAvailable.notify_one();
+        }
+    }
+
+    void InferenceServer::BatchLoop()
+    {
+        std::vector<PendingRequest> batch;
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        while ( true )
+        {
+            m_requestAvailable.wait( lock, [this] () { return !m_queue.empty() || m_stopping; } );
+            if ( m_queue.empty() )
+            {
+                return;
+            }
+
+            // Wait for the batch to fill up, but never past the deadline of the oldest request
+            Clock::time_point const deadline = m_queue.front().m_arrivalTime + std::chrono::microseconds( m_settings.m_maxDelayMicroseconds );
+            m_requestAvailable.wait_until( lock, deadline, [this] () { return m_queue.size() >= m_settings.m_maxBatchSize || m_stopping; } );
+
+            size_t const batchSize = std::min( m_queue.size(), (size_t) m_settings.m_maxBatchSize );
+            batch.clear();
+            std::move( m_queue.begin(), m_queue.begin() + batchSize, std::back_inserter( batch ) );
+            m_queue.erase( m_queue.begin(), m_queue.begin() + batchSize );
+
+            lock.unlock();
+            AnswerBatch( batch );
+            lock.lock();
+        }
+    }
+
+    void InferenceServer::AnswerBatch( std::vector<PendingRequest>& batch )
+    {
+        int32_t const numInputs = m_network.GetNumInputs();
+        int32_t const numOutputs = m_network.GetNumOutputs();
+
+        // Evaluate the valid requests as one matrix
+        //-------------------------------------------------------------------------
+
+        m_batchInputs.clear();
+        for ( auto const& request : batch )
+        {
+            if ( request.m_isValid )
+            {
+                m_batchInputs.insert( m_batchInputs.end(), request.m_inputs.begin(), request.m_inputs.end() );
+            }
+        }
+
+        int32_t const numRows = (int32_t) ( m_batchInputs.size() / numInputs );
+        m_batchClasses.resize( numRows );
+        m_batchOutputs.resize( (size_t) numRows * numOutputs );
+        if ( numRows > 0 )
+        {
+            m_network.EvaluateBatch( m_batchInputs.data(), numRows, m_batchClasses.data(), m_batchOutputs.data() );
+        }
+
+        // One buffer of responses per connection, in request order
+        //-------------------------------------------------------------------------
+
+        for ( auto& responseBuffer : m_responseBuffers )
+        {
+            responseBuffer.second.clear();
+        }
+
+        int32_t rowIdx = 0;
+        for ( auto const& request : batch )
+        {
+            auto responseBuffer = std::find_if( m_responseBuffers.begin(), m_responseBuffers.end(), [&request] ( auto const& buffer ) { return buffer.first == request.m_connection.get(); } );
+            if ( responseBuffer == m_responseBuffers.end() )
+            {
+                m_responseBuffers.emplace_back( request.m_connection.get(), std::vector<uint8_t>() );
+                responseBuffer = m_responseBuffers.end() - 1;
+            }
+
+            InferenceResponseHeader header;
+            header.m_requestId = request.m_requestId;
+            header.m_classIndex = request.m_isValid ? (int16_t) m_batchClasses[rowIdx] : -1;
+            header.m_status = request.m_isValid ? InferenceStatus::Ok : InferenceStatus::BadRequest;
+            header.m_numOutputs = request.m_isValid ? (uint8_t) numOutputs : 0;
+
+            std::vector<uint8_t>& buffer = responseBuffer->second;
+            size_t const offset = buffer.size();
+            buffer.resize( offset + sizeof( header ) + header.m_numOutputs * sizeof( float ) );
+            memcpy( buffer.data() + offset, &header, sizeof( header ) );
+
+            if ( request.m_isValid )
+            {
+                float* const outputs = reinterpret_cast<float*>( buffer.data() + offset + sizeof( header ) );
+                for ( int32_t outputIdx = 0; outputIdx < numOutputs; outputIdx++ )
+                {
+                    float const value = (float) m_batchOutputs[(size_t) rowIdx * numOutputs + outputIdx];
+                    memcpy( outputs + outputIdx, &value, sizeof( float ) );
+                }
+                rowIdx++;
+            }
+        }
+
+        for ( auto& responseBuffer : m_responseBuffers )
+        {
+            if ( !responseBuffer.second.empty() )
+            {
+                responseBuffer.first->Write( responseBuffer.second.data(), responseBuffer.second.size() );
+            }
+        }
+
+        // The connections of this batch are only referenced by the requests, which go away with the next batch
+        m_responseBuffers.erase( std::remove_if( m_responseBuffers.begin(), m_responseBuffers.end(), [] ( auto const& buffer ) { return buffer.second.empty(); } ), m_responseBuffers.end() );
+
+        // Statistics
+        //-------------------------------------------------------------------------
+
+        Clock::time_point const now = Clock::now();
+        Statistics windowStatistics;
+        bool reportWindow = false;
+        {
+            std::lock_guard<std::mutex> lock( m_statisticsMutex );
+            for ( auto const& request : batch )
+            {
+                float const latency = std::chrono::duration<float, std::micro>( now - request.m_arrivalTime ).count();
+                AddLatency( m_window, latency );
+                AddLatency( m_total, latency );
+            }
+            m_window.m_numBatches++;
+            m_total.m_numBatches++;
+
+            if ( std::chrono::duration<double>( now - m_window.m_start ).count() >= m_settings.m_reportIntervalSeconds )
+            {
+                windowStatistics = GetWindowStatistics( m_window, now );
+                m_window = Window();
+                m_window.m_start = now;
+                reportWindow = true;
+            }
+        }
+
+        if ( reportWindow )
+        {
+            PrintStatistics( windowStatistics, "Last interval" );
+        }
+    }
+
+    void InferenceServer::AddLatency( Window& window, float latency )
+    {
+        window.m_numRequests++;
+        if ( window.m_latencies.size() < k_maxLatencySamples )
+        {
+            window.m_latencies.push_back( latency );
+            return;
+        }
+
+        // Reservoir sampling: the n-th latency replaces a random sample with probability k_maxLatencySamples / n
+        uint64_t const sampleIdx = std::uniform_int_distribution<uint64_t>( 0, window.m_numRequests - 1 )( m_sampleGenerator );
+        if ( sampleIdx < k_maxLatencySamples )
+        {
+            window.m_latencies[sampleIdx] = latency;
+        }
+    }
+
+    InferenceServer::Statistics InferenceServer::GetWindowStatistics( Window& window, Clock::time_point end )
+    {
+        Statistics statistics;
+        statistics.m_numRequests = window.m_numRequests;
+        statistics.m_numBatches = window.m_numBatches;
+        statistics.m_seconds = std::chrono::duration<double>( end - window.m_start ).count();
+        statistics.m_requestsPerSecond = ( statistics.m_seconds > 0 ) ? window.m_numRequests / statistics.m_seconds : 0;
+        statistics.m_averageBatchSize = ( window.m_numBatches > 0 ) ? (double) window.m_numRequests / window.m_numBatches : 0;
+
+        std::vector<float>& latencies = window.m_latencies;
+        if ( !latencies.empty() )
+        {
+            size_t const p50Idx = latencies.size() / 2;
+            size_t const p99Idx = std::min( latencies.size() * 99 / 100, latencies.size() - 1 );
+            std::nth_element( latencies.begin(), latencies.begin() + p50Idx, latencies.end() );
+            statistics.m_p50Microseconds = latencies[p50Idx];
+            std::nth_element( latencies.begin(), latencies.begin() + p99Idx, latencies.end() );
+            statistics.m_p99Microseconds = latencies[p99Idx];
+        }
+
+        return statistics;
+    }
+
+    void InferenceServer::PrintStatistics( Statistics const& statistics, char const* label ) const
+    {
+        std::ostream& stream = m_reportToStderr ? std::cerr : std::cout;
+        stream << label << ": " << statistics.m_numRequests << " requests in " << statistics.m_seconds << " s, " << statistics.m_requestsPerSecond << " requests/s, "
+            << "avg batch " << statistics.m_averageBatchSize << ", latency p50 " << statistics.m_p50Microseconds << " us, p99 " << statistics.m_p99Microseconds << " us" << std::endl;
+    }
+}
@@ -0,0 +1,137 @@
+// Long running inference server answering binary requests (see InferenceProtocol.h) in micro-batches
+#pragma once
+
+#include "NeuralNetwork.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // Every connection has a reader thread queueing its requests. A single batcher thread waits until m_maxBatchSize requests are
+    // queued or the oldest one has waited m_maxDelayMicroseconds, evaluates them together with Network::EvaluateBatch and writes the
+    // responses, one write per connection and batch. Latency is measured from the moment a request is read until its response is written.
+    class InferenceServer
+    {
+    public:
+
+        struct Settings
+        {
+            uint32_t    m_maxBatchSize = 64;
+            uint32_t    m_maxDelayMicroseconds = 500;       // Latency deadline: longest time a request waits for the batch to fill up
+            double      m_reportIntervalSeconds = 5;        // Statistics are printed this often while requests arrive, and when the server stops
+        };
+
+        struct Statistics
+        {
+            uint64_t    m_numRequests = 0;
+            uint64_t    m_numBatches = 0;
+            double      m_seconds = 0;                      // Covered by the statistics
+            double      m_requestsPerSecond = 0;
+            double      m_averageBatchSize = 0;
+            double      m_p50Microseconds = 0;
+            double      m_p99Microseconds = 0;
+        };
+
+    public:
+
+        // The network is only read (EvaluateBatch) and must outlive the server
+        InferenceServer( Network const& network, Settings const& settings );
+        ~InferenceServer();
+
+        InferenceServer( InferenceServer const& ) = delete;
+        InferenceServer& operator=( InferenceServer const& ) = delete;
+
+        // Listens on a Unix domain socket until a client sends a shutdown request. Returns false if the socket cannot be created, and
+        // on Windows, where only ServePipe is available.
+        bool ServeSocket( std::string const& path );
+
+        // Reads requests from stdin and writes the responses to stdout until stdin is closed, the statistics go to stderr
+        bool ServePipe();
+
+        // Since the last Serve call started
+        Statistics GetStatistics() const;
+
+    private:
+
+        class Connection;
+        class FileConnection;
+        class SocketConnection;
+
+        struct PendingRequest
+        {
+            std::shared_ptr<Connection>     m_connection;
+            uint32_t                        m_requestId;
+            bool                            m_isValid;
+            std::vector<double>             m_inputs;
+            std::chrono::steady_clock::time_point m_arrivalTime;
+        };
+
+        // Counts and latencies of a reporting window, the latencies are a uniform sample of at most k_maxLatencySamples (reservoir sampling)
+        struct Window
+        {
+            std::chrono::steady_clock::time_point m_start;
+            uint64_t                        m_numRequests = 0;
+            uint64_t                        m_numBatches = 0;
+            std::vector<float>              m_latencies;    // Microseconds
+        };
+
+        void Start();
+        void Stop();
+
+        // Reads requests until the connection closes or a shutdown request arrives
+        void ReadRequests( std::shared_ptr<Connection> connection );
+
+        // Socket mode reader thread: drops its connection and marks itself finished when the client goes away
+        void ReadSocketRequests( std::shared_ptr<Connection> connection );
+        void JoinFinishedReaders();
+
+        void BatchLoop();
+        void AnswerBatch( std::vector<PendingRequest>& batch );
+
+        void AddLatency( Window& window, float latency );
+        static Statistics GetWindowStatistics( Window& window, std::chrono::steady_clock::time_point end );
+        void PrintStatistics( Statistics const& statistics, char const* label ) const;
+
+    private:
+
+        Network const&                      m_network;
+        Settings                            m_settings;
+        bool                                m_reportToStderr = false;
+
+        std::mutex                          m_mutex;
+        std::condition_variable             m_requestAvailable;
+        std::deque<PendingRequest>          m_queue;
+        bool                                m_stopping = false;
+        std::thread                         m_batchThread;
+
+        // Socket mode: the open connections and the reader threads, guarded by m_mutex. A reader removes its
+        // own connection when it exits, the socket closes once the queued requests holding it are answered.
+        // Finished readers are joined on the next accept, Stop closes and joins the rest.
+        std::vector<std::shared_ptr<Connection>> m_connections;
+        std::vector<std::thread>            m_readerThreads;
+        std::vector<std::thread::id>        m_finishedReaders;
+        int                                 m_listenSocket = -1;
+
+        // Evaluation scratch of the batcher thread
+        std::vector<double>                 m_batchInputs;
+        std::vector<double>                 m_batchOutputs;
+        std::vector<int32_t>                m_batchClasses;
+        std::vector<std::pair<Connection*, std::vector<uint8_t>>> m_responseBuffers;    // Responses of the batch per connection
+
+        static size_t const                 k_maxLatencySamples = 1 << 16;
+
+        mutable std::mutex                  m_statisticsMutex;
+        std::mt19937                        m_sampleGenerator;
+        Window                              m_window;           // Current reporting window
+        Window                              m_total;            // Everything since Start
+    };
+}
@@ -0,0 +1,121 @@
+#include "MappedFile.h"
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+#if defined( _WIN32 )
+
+    bool MappedFile::Open( std::string const& filename )
+    {
+        Close();
+
+        HANDLE const fileHandle = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+        if ( fileHandle == INVALID_HANDLE_VALUE )
+        {
+            return false;
+        }
+        m_fileHandle = fileHandle;
+
+        LARGE_INTEGER fileSize;
+        if ( !GetFileSizeEx( fileHandle, &fileSize ) || fileSize.QuadPart == 0 )
+        {
+            Close();
+            return false;
+        }
+
+        // PAGE_WRITECOPY / FILE_MAP_COPY: shared pages until written, then private copies
+        m_mappingHandle = CreateFileMappingA( fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr );
+        if ( m_mappingHandle == nullptr )
+        {
+            Close();
+            return false;
+        }
+
+        m_data = static_cast<uint8_t*>( MapViewOfFile( m_mappingHandle, FILE_MAP_COPY, 0, 0, 0 ) );
+        if ( m_data == nullptr )
+        {
+            Close();
+            return false;
+        }
+
+        m_size = (size_t) fileSize.QuadPart;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if ( m_data != nullptr )
+        {
+            UnmapViewOfFile( m_data );
+        }
+        if ( m_mappingHandle != nullptr )
+        {
+            CloseHandle( m_mappingHandle );
+        }
+        if ( m_fileHandle != nullptr )
+        {
+            CloseHandle( m_fileHandle );
+        }
+
+        m_data = nullptr;
+        m_size = 0;
+        m_mappingHandle = nullptr;
+        m_fileHandle = nullptr;
+    }
+
+#else
+
+    bool MappedFile::Open( std::string const& filename )
+    {
+        Close();
+
+        int const fileDescriptor = open( filename.c_str(), O_RDONLY );
+        if ( fileDescriptor < 0 )
+        {
+            return false;
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        struct stat fileStatus;
+        void* data = MAP_FAILED;
+        if ( fstat( fileDescriptor, &fileStatus ) == 0 && fileStatus.st_size > 0 )
+        {
+            data = mmap( nullptr, (size_t) fileStatus.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileDescriptor, 0 );
+        }
+        close( fileDescriptor );
+
+        if ( data == MAP_FAILED )
+        {
+            return false;
+        }
+
+        m_data = static_cast<uint8_t*>( data );
+        m_size = (size_t) fileStatus.st_size;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if ( m_data != nullptr )
+        {
+            munmap( m_data, m_size );
+        }
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+#endif
+}
@@ -0,0 +1,41 @@
+// Read only view of a whole file mapped into memory
+#pragma once
+#include <stdint.h>
+#include <string>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // The pages are shared with the page cache and with every other process mapping the same file. They are mapped copy-on-write:
+    // writing to them is allowed, only the written pages are copied and the file itself never changes.
+    class MappedFile
+    {
+    public:
+
+        MappedFile() = default;
+        ~MappedFile() { Close(); }
+
+        MappedFile( MappedFile const& ) = delete;
+        MappedFile& operator=( MappedFile const& ) = delete;
+
+        // Maps the file, returns false if it cannot be opened or is empty
+        bool Open( std::string const& filename );
+        void Close();
+
+        inline bool IsOpen() const { return m_data != nullptr; }
+        inline uint8_t* data() { return m_data; }
+        inline uint8_t const* data() const { return m_data; }
+        inline size_t size() const { return m_size; }
+
+    private:
+
+        uint8_t*                m_data = nullptr;           // Page aligned
+        size_t                  m_size = 0;
+
+#if defined( _WIN32 )
+        void*                   m_fileHandle = nullptr;
+        void*                   m_mappingHandle = nullptr;
+#endif
+    };
+}
@@ -0,0 +1,183 @@
+#include "MetricsSink.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // Longest time a pushed record waits before the writer picks it up
+    static std::chrono::milliseconds const k_drainPeriod( 20 );
+
+    // Buffered stdio writes, the file is only flushed when the writer thread drains the ring
+    class MetricsFileWriter : public MetricsWriter
+    {
+    public:
+
+        MetricsFileWriter( FILE* file, MetricsFormat format )
+            : m_file( file )
+            , m_format( format )
+        {
+            if ( m_format == MetricsFormat::Csv )
+            {
+                fputs( "Generation,Training Set Accuracy, Training Set MSE, Test Set Accuracy, Test Set MSE, Samples/s\n", m_file );
+            }
+            else
+            {
+                MetricsFileHeader header = {};
+                memcpy( header.m_magic, k_metricsFileMagic, sizeof( header.m_magic ) );
+                header.m_version = k_metricsFileVersion;
+                header.m_recordSize = sizeof( GenerationMetrics );
+                fwrite( &header, sizeof( header ), 1, m_file );
+            }
+        }
+
+        ~MetricsFileWriter()
+        {
+            fclose( m_file );
+        }
+
+        virtual void Write( GenerationMetrics const& metrics ) override
+        {
+            if ( m_format == MetricsFormat::Csv )
+            {
+                fprintf( m_file, "%u,%.17g,%.17g,%.17g,%.17g,%.17g\n", metrics.m_generation, metrics.m_trainingSetAccuracy, metrics.m_trainingSetMSE,
+                         metrics.m_testSetAccuracy, metrics.m_testSetMSE, metrics.m_samplesPerSecond );
+            }
+            else
+            {
+                fwrite( &metrics, sizeof( metrics ), 1, m_file );
+            }
+        }
+
+        virtual void Flush() override
+        {
+            fflush( m_file );
+        }
+
+    private:
+
+        FILE*                   m_file;
+        MetricsFormat           m_format;
+    };
+
+    class MetricsConsoleWriter : public MetricsWriter
+    {
+    public:
+
+        virtual void Write( GenerationMetrics const& metrics ) override
+        {
+            std::cout << "Generation: " << metrics.m_generation;
+            std::cout << " Training Accuracy:" << metrics.m_trainingSetAccuracy << "%, MSE: " << metrics.m_trainingSetMSE;
+            std::cout << " Test Accuracy:" << metrics.m_testSetAccuracy << "%, MSE: " << metrics.m_testSetMSE;
+            std::cout << " Samples/s: " << metrics.m_samplesPerSecond << '\n';
+        }
+
+        virtual void Flush() override
+        {
+            std::cout.flush();
+        }
+    };
+
+    std::unique_ptr<MetricsWriter> MetricsWriter::CreateFileWriter( std::string const& path, MetricsFormat format )
+    {
+        FILE* const file = fopen( path.c_str(), ( format == MetricsFormat::Csv ) ? "w" : "wb" );
+        if ( file == nullptr )
+        {
+            return nullptr;
+        }
+        return std::unique_ptr<MetricsWriter>( new MetricsFileWriter( file, format ) );
+    }
+
+    std::unique_ptr<MetricsWriter> MetricsWriter::CreateConsoleWriter()
+    {
+        return std::unique_ptr<MetricsWriter>( new MetricsConsoleWriter() );
+    }
+
+    //-------------------------------------------------------------------------
+
+    MetricsSink::MetricsSink( std::vector<std::unique_ptr<MetricsWriter>> writers, size_t capacity )
+        : m_writers( std::move( writers ) )
+        , m_numPushed( 0 )
+        , m_numWritten( 0 )
+        , m_numDropped( 0 )
+    {
+        size_t ringSize = 1;
+        while ( ringSize < capacity )
+        {
+            ringSize *= 2;
+        }
+        m_ring.resize( ringSize );
+        m_ringMask = ringSize - 1;
+
+        m_writerThread = std::thread( &MetricsSink::WriterLoop, this );
+    }
+
+    MetricsSink::~MetricsSink()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_shutdown = true;
+        }
+        m_wakeUp.notify_one();
+        m_writerThread.join();
+    }
+
+    bool MetricsSink::Push( GenerationMetrics const& metrics )
+    {
+        // The writer only ever advances m_numWritten, so a stale value can only make the ring look fuller than it is
+        uint64_t const numPushed = m_numPushed.load( std::memory_order_relaxed );
+        if ( numPushed - m_numWritten.load( std::memory_order_acquire ) > m_ringMask )
+        {
+            m_numDropped.fetch_add( 1, std::memory_order_relaxed );
+            return false;
+        }
+
+        m_ring[numPushed & m_ringMask] = metrics;
+        m_numPushed.store( numPushed + 1, std::memory_order_release );
+        return true;
+    }
+
+    void MetricsSink::WriterLoop()
+    {
+        while ( true )
+        {
+            bool shutdown;
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_wakeUp.wait_for( lock, k_drainPeriod, [this] () { return m_shutdown; } );
+                shutdown = m_shutdown;
+            }
+
+            Drain();
+
+            if ( shutdown )
+            {
+                return;
+            }
+        }
+    }
+
+    void MetricsSink::Drain()
+    {
+        uint64_t const numWritten = m_numWritten.load( std::memory_order_relaxed );
+        uint64_t const numPushed = m_numPushed.load( std::memory_order_acquire );
+        if ( numWritten == numPushed )
+        {
+            return;
+        }
+
+        for ( auto const& writer : m_writers )
+        {
+            for ( uint64_t recordIdx = numWritten; recordIdx < numPushed; recordIdx++ )
+            {
+                writer->Write( m_ring[recordIdx & m_ringMask] );
+            }
+            writer->Flush();
+        }
+
+        m_numWritten.store( numPushed, std::memory_order_release );
+    }
+}
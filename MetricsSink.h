@@ -0,0 +1,111 @@
+// Training metrics handed off to a background writer, so no file or console output happens on the training thread
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    struct GenerationMetrics
+    {
+        uint32_t                m_generation;
+        uint32_t                m_padding;
+        double                  m_trainingSetAccuracy;
+        double                  m_trainingSetMSE;
+        double                  m_testSetAccuracy;
+        double                  m_testSetMSE;
+        double                  m_samplesPerSecond;
+    };
+
+    enum class MetricsFormat
+    {
+        Csv,                                    // One text line per generation with a header line
+        Binary,                                 // MetricsFileHeader followed by GenerationMetrics records as they are in memory
+    };
+
+    static char const k_metricsFileMagic[4] = { 'B', 'P', 'N', 'L' };
+    static uint32_t const k_metricsFileVersion = 1;
+
+    struct MetricsFileHeader
+    {
+        char                    m_magic[4];
+        uint32_t                m_version;
+        uint32_t                m_recordSize;   // sizeof( GenerationMetrics )
+        uint32_t                m_padding;
+    };
+
+    //-------------------------------------------------------------------------
+
+    // Destination of the metrics, only ever called on the writer thread of a MetricsSink
+    class MetricsWriter
+    {
+    public:
+
+        virtual ~MetricsWriter() = default;
+
+        virtual void Write( GenerationMetrics const& metrics ) = 0;
+
+        // Called once the records available at a time are written
+        virtual void Flush() {}
+
+        // Writer to a new file (truncating an existing one), null if it cannot be created
+        static std::unique_ptr<MetricsWriter> CreateFileWriter( std::string const& path, MetricsFormat format );
+
+        // Prints one line per generation to the console
+        static std::unique_ptr<MetricsWriter> CreateConsoleWriter();
+    };
+
+    //-------------------------------------------------------------------------
+
+    // Push copies a record into a lock-free single producer / single consumer ring buffer and returns immediately. A background thread
+    // drains the ring every few milliseconds into the writers. If the writers fall behind so far that the ring is full, new records are
+    // dropped and counted rather than blocking the trainer. Everything pushed is written by the time the sink is destroyed.
+    class MetricsSink
+    {
+    public:
+
+        // capacity is rounded up to a power of two
+        explicit MetricsSink( std::vector<std::unique_ptr<MetricsWriter>> writers, size_t capacity = 1024 );
+        ~MetricsSink();
+
+        MetricsSink( MetricsSink const& ) = delete;
+        MetricsSink& operator=( MetricsSink const& ) = delete;
+
+        // Only one thread may push. Returns false if the record was dropped because the ring is full.
+        bool Push( GenerationMetrics const& metrics );
+
+        inline uint64_t GetNumDropped() const { return m_numDropped.load( std::memory_order_relaxed ); }
+
+    private:
+
+        void WriterLoop();
+
+        // Writes all records pushed so far
+        void Drain();
+
+    private:
+
+        std::vector<std::unique_ptr<MetricsWriter>> m_writers;
+
+        std::vector<GenerationMetrics> m_ring;
+        size_t                          m_ringMask;
+
+        // Monotonic counters, the record of count c is at m_ring[c & m_ringMask]. Each is written by one thread only.
+        alignas( 64 ) std::atomic<uint64_t> m_numPushed;
+        alignas( 64 ) std::atomic<uint64_t> m_numWritten;
+        alignas( 64 ) std::atomic<uint64_t> m_numDropped;
+
+        // Only used to sleep between drains and to wake the writer for shutdown, Push never takes it
+        std::mutex                      m_mutex;
+        std::condition_variable         m_wakeUp;
+        bool                            m_shutdown = false;
+        std::thread                     m_writerThread;
+    };
+}
@@ -0,0 +1,66 @@
+// Binary model file: header, layer widths and the weight block of a network exactly as it is laid out in memory
+#pragma once
+#include "Activations.h"
+#include "AlignedBuffer.h"
+#include <cstddef>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    static char const k_modelFileMagic[4] = { 'B', 'P', 'N', 'M' };
+    static uint32_t const k_modelFileVersion = 2;
+
+    // Followed by m_numLayers uint32 layer widths and zero padding up to m_weightsOffset. The weight block holds one block of
+    // ( width + 1 ) x nextWidth weights per layer, bias row last, each block starting on a cache line. All values are little endian.
+    struct ModelFileHeader
+    {
+        char                    m_magic[4];
+        uint32_t                m_version;
+        uint32_t                m_scalarSize;               // Bytes per weight, 8 for double and 4 for float
+        uint32_t                m_numLayers;
+        uint64_t                m_weightsOffset;            // File offset of the weight block, a multiple of k_cacheLineSize
+        uint64_t                m_numWeights;               // Values in the weight block, including the zero padding between the layers
+        uint64_t                m_checksum;                 // FNV-1a over the layer widths and the weight block
+        uint8_t                 m_hiddenActivation;         // Activation enum values, version 2 on
+        uint8_t                 m_outputActivation;
+        uint8_t                 m_padding[6];
+    };
+
+    // Version 1 files end the header before the activations and only know the sigmoid
+    static size_t const k_modelFileHeaderSizeV1 = offsetof( ModelFileHeader, m_hiddenActivation );
+
+    static char const k_checkpointFileMagic[4] = { 'B', 'P', 'N', 'C' };
+    static uint32_t const k_checkpointFileVersion = 1;
+
+    // Training state written by NNTrainer. Followed by m_numLayers uint32 layer widths, then m_numWeights weights, as many momentum
+    // deltas and, if m_hasBestWeights, as many best weights, each in the layout of the weight block of a model file.
+    struct CheckpointFileHeader
+    {
+        char                    m_magic[4];
+        uint32_t                m_version;
+        uint32_t                m_scalarSize;
+        uint32_t                m_numLayers;
+        uint64_t                m_numWeights;
+        uint32_t                m_generation;               // Generations trained so far
+        uint32_t                m_numGenerationsWithoutImprovement;
+        uint32_t                m_hasBestWeights;
+        uint32_t                m_bestGeneration;           // Generation of the lowest test MSE and its results, for early stopping
+        double                  m_bestTrainingSetAccuracy;
+        double                  m_bestTrainingSetMSE;
+        double                  m_bestTestSetAccuracy;
+        double                  m_bestTestSetMSE;
+        uint64_t                m_checksum;                 // FNV-1a over the layer widths and the three weight blocks
+    };
+
+    // 64 bit FNV-1a, continued from a previous result when hash is given
+    inline uint64_t ComputeModelChecksum( void const* data, size_t numBytes, uint64_t hash = 14695981039346656037ull )
+    {
+        uint8_t const* const bytes = static_cast<uint8_t const*>( data );
+        for ( size_t byteIdx = 0; byteIdx < numBytes; byteIdx++ )
+        {
+            hash = ( hash ^ bytes[byteIdx] ) * 1099511628211ull;
+        }
+        return hash;
+    }
+}
@@ -0,0 +1,358 @@
+#include "NNKernels.h"
+#include "NNKernelsImpl.h"
+#include <atomic>
+#include <cmath>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define BPN_KERNELS_X86 1
+#if defined( _MSC_VER )
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        // Reference implementation, one lane wide
+        struct ScalarOps
+        {
+            typedef double Scalar;
+            typedef double Vector;
+            static int32_t const k_width = 1;
+
+            static inline Vector Zero() { return 0.0; }
+            static inline Vector Set1( double value ) { return value; }
+            static inline Vector Load( double const* address ) { return *address; }
+            static inline void Store( double* address, Vector value ) { *address = value; }
+            static inline Vector Add( Vector a, Vector b ) { return a + b; }
+            static inline Vector Sub( Vector a, Vector b ) { return a - b; }
+            static inline Vector Mul( Vector a, Vector b ) { return a * b; }
+            static inline Vector Div( Vector a, Vector b ) { return a / b; }
+            static inline Vector Min( Vector a, Vector b ) { return std::min( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return std::max( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return a * b + c; }
+            static inline double ReduceAdd( Vector a ) { return a; }
+            static inline Vector Exp( Vector a ) { return std::exp( a ); }
+        };
+
+        struct ScalarFloatOps
+        {
+            typedef float Scalar;
+            typedef float Vector;
+            static int32_t const k_width = 1;
+
+            static inline Vector Zero() { return 0.0f; }
+            static inline Vector Set1( float value ) { return value; }
+            static inline Vector Load( float const* address ) { return *address; }
+            static inline void Store( float* address, Vector value ) { *address = value; }
+            static inline Vector Add( Vector a, Vector b ) { return a + b; }
+            static inline Vector Sub( Vector a, Vector b ) { return a - b; }
+            static inline Vector Mul( Vector a, Vector b ) { return a * b; }
+            static inline Vector Div( Vector a, Vector b ) { return a / b; }
+            static inline Vector Min( Vector a, Vector b ) { return std::min( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return std::max( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return a * b + c; }
+            static inline float ReduceAdd( Vector a ) { return a; }
+            static inline Vector Exp( Vector a ) { return std::exp( a ); }
+        };
+
+        KernelTable<double> const* GetScalarKernelTable()
+        {
+            static KernelTable<double> const table = Impl::MakeKernelTable<ScalarOps>();
+            return &table;
+        }
+
+        KernelTable<float> const* GetScalarFloatKernelTable()
+        {
+            static KernelTable<float> const table = Impl::MakeKernelTable<ScalarFloatOps>();
+            return &table;
+        }
+
+        //-------------------------------------------------------------------------
+
+#if BPN_KERNELS_X86
+        static void GetCpuid( uint32_t leaf, uint32_t subLeaf, uint32_t registers[4] )
+        {
+#if defined( _MSC_VER )
+            int values[4];
+            __cpuidex( values, (int) leaf, (int) subLeaf );
+            for ( int32_t registerIdx = 0; registerIdx < 4; registerIdx++ )
+            {
+                registers[registerIdx] = (uint32_t) values[registerIdx];
+            }
+#else
+            __cpuid_count( leaf, subLeaf, registers[0], registers[1], registers[2], registers[3] );
+#endif
+        }
+
+        // Register state the OS saves on context switches (XCR0)
+        static uint64_t GetEnabledRegisterState()
+        {
+#if defined( _MSC_VER )
+            return _xgetbv( 0 );
+#else
+            uint32_t eax, edx;
+            __asm__ volatile( "xgetbv" : "=a"( eax ), "=d"( edx ) : "c"( 0 ) );
+            return ( (uint64_t) edx << 32 ) | eax;
+#endif
+        }
+#endif
+
+        static InstructionSet DetectInstructionSet()
+        {
+#if BPN_KERNELS_X86
+            uint32_t registers[4];
+            GetCpuid( 0, 0, registers );
+            uint32_t const maxLeaf = registers[0];
+
+            GetCpuid( 1, 0, registers );
+            bool const hasSse2 = ( registers[3] & ( 1u << 26 ) ) != 0;
+            bool const hasFma = ( registers[2] & ( 1u << 12 ) ) != 0;
+            bool const hasOsxsave = ( registers[2] & ( 1u << 27 ) ) != 0;
+            bool const hasAvx = ( registers[2] & ( 1u << 28 ) ) != 0;
+
+            if ( !hasSse2 || GetSse2KernelTable() == nullptr )
+            {
+                return InstructionSet::Scalar;
+            }
+
+            if ( !hasOsxsave || !hasAvx || maxLeaf < 7 )
+            {
+                return InstructionSet::SSE2;
+            }
+
+            uint64_t const enabledState = GetEnabledRegisterState();
+            bool const osSavesYmm = ( enabledState & 0x6 ) == 0x6;
+            bool const osSavesZmm = ( enabledState & 0xE6 ) == 0xE6;
+
+            GetCpuid( 7, 0, registers );
+            bool const hasAvx2 = ( registers[1] & ( 1u << 5 ) ) != 0;
+            bool const hasAvx512f = ( registers[1] & ( 1u << 16 ) ) != 0;
+
+            if ( hasAvx512f && osSavesZmm && GetAvx512KernelTable() != nullptr )
+            {
+                return InstructionSet::AVX512;
+            }
+
+            if ( hasAvx2 && hasFma && osSavesYmm && GetAvx2KernelTable() != nullptr )
+            {
+                return InstructionSet::AVX2;
+            }
+
+            return InstructionSet::SSE2;
+#else
+            return InstructionSet::Scalar;
+#endif
+        }
+
+        template<typename Scalar>
+        static KernelTable<Scalar> const* GetKernelTable( InstructionSet instructionSet );
+
+        template<>
+        KernelTable<double> const* GetKernelTable<double>( InstructionSet instructionSet )
+        {
+            switch ( instructionSet )
+            {
+                case InstructionSet::AVX512: return GetAvx512KernelTable();
+                case InstructionSet::AVX2: return GetAvx2KernelTable();
+                case InstructionSet::SSE2: return GetSse2KernelTable();
+                default: return GetScalarKernelTable();
+            }
+        }
+
+        template<>
+        KernelTable<float> const* GetKernelTable<float>( InstructionSet instructionSet )
+        {
+            switch ( instructionSet )
+            {
+                case InstructionSet::AVX512: return GetAvx512FloatKernelTable();
+                case InstructionSet::AVX2: return GetAvx2FloatKernelTable();
+                case InstructionSet::SSE2: return GetSse2FloatKernelTable();
+                default: return GetScalarFloatKernelTable();
+            }
+        }
+
+        // Selected instruction set, -1 until the first kernel call or SetInstructionSet
+        static std::atomic<int32_t> g_activeInstructionSet( -1 );
+
+        static inline InstructionSet GetActiveInstructionSet()
+        {
+            int32_t instructionSet = g_activeInstructionSet.load( std::memory_order_relaxed );
+            if ( instructionSet < 0 )
+            {
+                instructionSet = (int32_t) GetSupportedInstructionSet();
+                g_activeInstructionSet.store( instructionSet, std::memory_order_relaxed );
+            }
+
+            return (InstructionSet) instructionSet;
+        }
+
+        template<typename Scalar>
+        static inline KernelTable<Scalar> const& GetActiveKernels()
+        {
+            return *GetKernelTable<Scalar>( GetActiveInstructionSet() );
+        }
+
+        //-------------------------------------------------------------------------
+
+        InstructionSet GetSupportedInstructionSet()
+        {
+            static InstructionSet const supportedInstructionSet = DetectInstructionSet();
+            return supportedInstructionSet;
+        }
+
+        InstructionSet GetInstructionSet()
+        {
+            return GetActiveInstructionSet();
+        }
+
+        void SetInstructionSet( InstructionSet instructionSet )
+        {
+            InstructionSet const supportedInstructionSet = GetSupportedInstructionSet();
+            if ( (int32_t) instructionSet > (int32_t) supportedInstructionSet )
+            {
+                instructionSet = supportedInstructionSet;
+            }
+
+            g_activeInstructionSet.store( (int32_t) instructionSet, std::memory_order_relaxed );
+        }
+
+        char const* GetInstructionSetName( InstructionSet instructionSet )
+        {
+            switch ( instructionSet )
+            {
+                case InstructionSet::AVX512: return "AVX-512";
+                case InstructionSet::AVX2: return "AVX2";
+                case InstructionSet::SSE2: return "SSE2";
+                default: return "Scalar";
+            }
+        }
+
+        //-------------------------------------------------------------------------
+
+        void BroadcastRow( int32_t rows, int32_t cols, double alpha, double const* row, double* C, int32_t ldc )
+        {
+            GetActiveKernels<double>().m_broadcastRow( rows, cols, alpha, row, C, ldc );
+        }
+
+        void BroadcastRow( int32_t rows, int32_t cols, float alpha, float const* row, float* C, int32_t ldc )
+        {
+            GetActiveKernels<float>().m_broadcastRow( rows, cols, alpha, row, C, ldc );
+        }
+
+        void GemmNN( int32_t rows, int32_t cols, int32_t inner, double const* A, int32_t lda, double const* B, int32_t ldb, double* C, int32_t ldc )
+        {
+            GetActiveKernels<double>().m_gemmNN( rows, cols, inner, A, lda, B, ldb, C, ldc );
+        }
+
+        void GemmNN( int32_t rows, int32_t cols, int32_t inner, float const* A, int32_t lda, float const* B, int32_t ldb, float* C, int32_t ldc )
+        {
+            GetActiveKernels<float>().m_gemmNN( rows, cols, inner, A, lda, B, ldb, C, ldc );
+        }
+
+        void GemmNT( int32_t rows, int32_t cols, int32_t inner, double const* A, int32_t lda, double const* B, int32_t ldb, double* C, int32_t ldc )
+        {
+            GetActiveKernels<double>().m_gemmNT( rows, cols, inner, A, lda, B, ldb, C, ldc );
+        }
+
+        void GemmNT( int32_t rows, int32_t cols, int32_t inner, float const* A, int32_t lda, float const* B, int32_t ldb, float* C, int32_t ldc )
+        {
+            GetActiveKernels<float>().m_gemmNT( rows, cols, inner, A, lda, B, ldb, C, ldc );
+        }
+
+        void GemmTN( int32_t rows, int32_t cols, int32_t inner, double const* A, int32_t lda, double const* B, int32_t ldb, double* C, int32_t ldc )
+        {
+            GetActiveKernels<double>().m_gemmTN( rows, cols, inner, A, lda, B, ldb, C, ldc );
+        }
+
+        void GemmTN( int32_t rows, int32_t cols, int32_t inner, float const* A, int32_t lda, float const* B, int32_t ldb, float* C, int32_t ldc )
+        {
+            GetActiveKernels<float>().m_gemmTN( rows, cols, inner, A, lda, B, ldb, C, ldc );
+        }
+
+        void SparseGemmNN( int32_t rows, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, double const* values, double const* B, int32_t ldb, double* C, int32_t ldc )
+        {
+            GetActiveKernels<double>().m_sparseGemmNN( rows, cols, rowOffsets, columnIndices, values, B, ldb, C, ldc );
+        }
+
+        void SparseGemmNN( int32_t rows, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, float const* values, float const* B, int32_t ldb, float* C, int32_t ldc )
+        {
+            GetActiveKernels<float>().m_sparseGemmNN( rows, cols, rowOffsets, columnIndices, values, B, ldb, C, ldc );
+        }
+
+        void SparseGemmTN( int32_t inner, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, double const* values, double const* B, int32_t ldb, double* C, int32_t ldc )
+        {
+            GetActiveKernels<double>().m_sparseGemmTN( inner, cols, rowOffsets, columnIndices, values, B, ldb, C, ldc );
+        }
+
+        void SparseGemmTN( int32_t inner, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, float const* values, float const* B, int32_t ldb, float* C, int32_t ldc )
+        {
+            GetActiveKernels<float>().m_sparseGemmTN( inner, cols, rowOffsets, columnIndices, values, B, ldb, C, ldc );
+        }
+
+        double Dot( int32_t count, double const* x, double const* y )
+        {
+            return GetActiveKernels<double>().m_dot( count, x, y );
+        }
+
+        float Dot( int32_t count, float const* x, float const* y )
+        {
+            return GetActiveKernels<float>().m_dot( count, x, y );
+        }
+
+        void Axpy( int32_t count, double alpha, double const* x, double* y )
+        {
+            GetActiveKernels<double>().m_axpy( count, alpha, x, y );
+        }
+
+        void Axpy( int32_t count, float alpha, float const* x, float* y )
+        {
+            GetActiveKernels<float>().m_axpy( count, alpha, x, y );
+        }
+
+        void Axpby( int32_t count, double alpha, double const* x, double beta, double* y )
+        {
+            GetActiveKernels<double>().m_axpby( count, alpha, x, beta, y );
+        }
+
+        void Axpby( int32_t count, float alpha, float const* x, float beta, float* y )
+        {
+            GetActiveKernels<float>().m_axpby( count, alpha, x, beta, y );
+        }
+
+        void MomentumUpdate( int32_t count, double learningRate, double const* gradients, double momentum, double* deltas, double* weights )
+        {
+            GetActiveKernels<double>().m_momentumUpdate( count, learningRate, gradients, momentum, deltas, weights );
+        }
+
+        void MomentumUpdate( int32_t count, float learningRate, float const* gradients, float momentum, float* deltas, float* weights )
+        {
+            GetActiveKernels<float>().m_momentumUpdate( count, learningRate, gradients, momentum, deltas, weights );
+        }
+
+        double DotMomentumUpdate( int32_t count, double learningRate, double const* gradients, double momentum, double* deltas, double* weights )
+        {
+            return GetActiveKernels<double>().m_dotMomentumUpdate( count, learningRate, gradients, momentum, deltas, weights );
+        }
+
+        float DotMomentumUpdate( int32_t count, float learningRate, float const* gradients, float momentum, float* deltas, float* weights )
+        {
+            return GetActiveKernels<float>().m_dotMomentumUpdate( count, learningRate, gradients, momentum, deltas, weights );
+        }
+
+        void Activate( Activation activation, int32_t rows, int32_t cols, double* C, int32_t ldc )
+        {
+            GetActiveKernels<double>().m_activate[(size_t) activation]( rows, cols, C, ldc );
+        }
+
+        void Activate( Activation activation, int32_t rows, int32_t cols, float* C, int32_t ldc )
+        {
+            GetActiveKernels<float>().m_activate[(size_t) activation]( rows, cols, C, ldc );
+        }
+    }
+}
@@ -0,0 +1,90 @@
+// Dense and sparse kernels shared by the network and the trainer
+//
+// Every kernel exists in a scalar, SSE2, AVX2 (+FMA) and AVX-512 version for double and for float, the best one supported by the CPU is
+// picked at runtime. The vector versions sum in a different order and use fused multiply-adds, so they match the scalar kernels within
+// a tolerance: dot products and matrix products agree to 1e-12 (double) / 1e-5 (float) relative to the sum of the absolute products,
+// activations to 1e-15 (double) / 1e-6 (float) absolute.
+#pragma once
+#include "Activations.h"
+#include <stdint.h>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        enum class InstructionSet
+        {
+            Scalar,
+            SSE2,
+            AVX2,
+            AVX512,
+        };
+
+        // Highest instruction set supported by both the CPU and the OS
+        InstructionSet GetSupportedInstructionSet();
+
+        // Instruction set currently used by the kernels, the supported one unless overridden
+        InstructionSet GetInstructionSet();
+
+        // Restricts the kernels to an instruction set (clamped to the supported one), used to validate and benchmark the versions
+        void SetInstructionSet( InstructionSet instructionSet );
+
+        char const* GetInstructionSetName( InstructionSet instructionSet );
+
+        //-------------------------------------------------------------------------
+
+        // All matrices are row-major, ld* is the distance in elements between two consecutive rows
+
+        // C[rows x cols] = alpha * row, for every row of C
+        void BroadcastRow( int32_t rows, int32_t cols, double alpha, double const* row, double* C, int32_t ldc );
+        void BroadcastRow( int32_t rows, int32_t cols, float alpha, float const* row, float* C, int32_t ldc );
+
+        // C[rows x cols] += A[rows x inner] * B[inner x cols]
+        void GemmNN( int32_t rows, int32_t cols, int32_t inner, double const* A, int32_t lda, double const* B, int32_t ldb, double* C, int32_t ldc );
+        void GemmNN( int32_t rows, int32_t cols, int32_t inner, float const* A, int32_t lda, float const* B, int32_t ldb, float* C, int32_t ldc );
+
+        // C[rows x cols] += A[rows x inner] * transpose( B[cols x inner] )
+        void GemmNT( int32_t rows, int32_t cols, int32_t inner, double const* A, int32_t lda, double const* B, int32_t ldb, double* C, int32_t ldc );
+        void GemmNT( int32_t rows, int32_t cols, int32_t inner, float const* A, int32_t lda, float const* B, int32_t ldb, float* C, int32_t ldc );
+
+        // C[rows x cols] += transpose( A[inner x rows] ) * B[inner x cols]
+        void GemmTN( int32_t rows, int32_t cols, int32_t inner, double const* A, int32_t lda, double const* B, int32_t ldb, double* C, int32_t ldc );
+        void GemmTN( int32_t rows, int32_t cols, int32_t inner, float const* A, int32_t lda, float const* B, int32_t ldb, float* C, int32_t ldc );
+
+        // Sparse A is in CSR form: the nonzeros of its row r are values[k] in column columnIndices[k] for k in [rowOffsets[r], rowOffsets[r + 1])
+
+        // C[rows x cols] += A[rows x inner] * B[inner x cols], only the rows of B selected by the nonzeros of A are read
+        void SparseGemmNN( int32_t rows, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, double const* values, double const* B, int32_t ldb, double* C, int32_t ldc );
+        void SparseGemmNN( int32_t rows, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, float const* values, float const* B, int32_t ldb, float* C, int32_t ldc );
+
+        // C[n x cols] += transpose( A[inner x n] ) * B[inner x cols], only the rows of C selected by the nonzeros of A are written
+        void SparseGemmTN( int32_t inner, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, double const* values, double const* B, int32_t ldb, double* C, int32_t ldc );
+        void SparseGemmTN( int32_t inner, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, float const* values, float const* B, int32_t ldb, float* C, int32_t ldc );
+
+        // Sum of x[i] * y[i] over count values
+        double Dot( int32_t count, double const* x, double const* y );
+        float Dot( int32_t count, float const* x, float const* y );
+
+        // y += alpha * x over count values
+        void Axpy( int32_t count, double alpha, double const* x, double* y );
+        void Axpy( int32_t count, float alpha, float const* x, float* y );
+
+        // y = alpha * x + beta * y over count values
+        void Axpby( int32_t count, double alpha, double const* x, double beta, double* y );
+        void Axpby( int32_t count, float alpha, float const* x, float beta, float* y );
+
+        // Gradient descent with momentum over count values: deltas = learningRate * gradients + momentum * deltas, weights += deltas
+        void MomentumUpdate( int32_t count, double learningRate, double const* gradients, double momentum, double* deltas, double* weights );
+        void MomentumUpdate( int32_t count, float learningRate, float const* gradients, float momentum, float* deltas, float* weights );
+
+        // MomentumUpdate in the same pass as the dot product of the weights before the update with the gradients, which it returns
+        double DotMomentumUpdate( int32_t count, double learningRate, double const* gradients, double momentum, double* deltas, double* weights );
+        float DotMomentumUpdate( int32_t count, float learningRate, float const* gradients, float momentum, float* deltas, float* weights );
+
+        // Activation function applied in place to rows x cols values, softmax normalizes every row on its own
+        void Activate( Activation activation, int32_t rows, int32_t cols, double* C, int32_t ldc );
+        void Activate( Activation activation, int32_t rows, int32_t cols, float* C, int32_t ldc );
+    }
+}
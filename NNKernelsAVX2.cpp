@@ -0,0 +1,132 @@
+// AVX2 + FMA kernels, 4 doubles or 8 floats per vector
+#include "NNKernels.h"
+#include <cmath>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+
+// Everything below is compiled for AVX2 and FMA regardless of the compiler flags, it only runs once CPUID has confirmed support
+#if defined( __clang__ )
+#pragma clang attribute push( __attribute__(( target( "avx2,fma" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+#pragma GCC push_options
+#pragma GCC target( "avx2,fma" )
+#endif
+
+#include "NNKernelsImpl.h"
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        struct Avx2Ops
+        {
+            typedef double Scalar;
+            typedef __m256d Vector;
+            static int32_t const k_width = 4;
+
+            static inline Vector Zero() { return _mm256_setzero_pd(); }
+            static inline Vector Set1( double value ) { return _mm256_set1_pd( value ); }
+            static inline Vector Load( double const* address ) { return _mm256_loadu_pd( address ); }
+            static inline void Store( double* address, Vector value ) { _mm256_storeu_pd( address, value ); }
+            static inline Vector Add( Vector a, Vector b ) { return _mm256_add_pd( a, b ); }
+            static inline Vector Sub( Vector a, Vector b ) { return _mm256_sub_pd( a, b ); }
+            static inline Vector Mul( Vector a, Vector b ) { return _mm256_mul_pd( a, b ); }
+            static inline Vector Div( Vector a, Vector b ) { return _mm256_div_pd( a, b ); }
+            static inline Vector Min( Vector a, Vector b ) { return _mm256_min_pd( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return _mm256_max_pd( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return _mm256_fmadd_pd( a, b, c ); }
+
+            static inline double ReduceAdd( Vector a )
+            {
+                __m128d const pairs = _mm_add_pd( _mm256_castpd256_pd128( a ), _mm256_extractf128_pd( a, 1 ) );
+                return _mm_cvtsd_f64( _mm_add_sd( pairs, _mm_unpackhi_pd( pairs, pairs ) ) );
+            }
+
+            static inline Vector Round( Vector a ) { return _mm256_round_pd( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+
+            // a * 2^n for integral n in [-1022, 1023], built directly in the exponent bits
+            static inline Vector Scale2n( Vector a, Vector n )
+            {
+                __m128i const biased = _mm_add_epi32( _mm256_cvtpd_epi32( n ), _mm_set1_epi32( 1023 ) );
+                __m256i const exponent = _mm256_slli_epi64( _mm256_cvtepi32_epi64( biased ), 52 );
+                return _mm256_mul_pd( a, _mm256_castsi256_pd( exponent ) );
+            }
+
+            static inline Vector Exp( Vector a ) { return Impl::VectorExp<Avx2Ops>( a ); }
+        };
+
+
+        struct Avx2FloatOps
+        {
+            typedef float Scalar;
+            typedef __m256 Vector;
+            static int32_t const k_width = 8;
+
+            static inline Vector Zero() { return _mm256_setzero_ps(); }
+            static inline Vector Set1( float value ) { return _mm256_set1_ps( value ); }
+            static inline Vector Load( float const* address ) { return _mm256_loadu_ps( address ); }
+            static inline void Store( float* address, Vector value ) { _mm256_storeu_ps( address, value ); }
+            static inline Vector Add( Vector a, Vector b ) { return _mm256_add_ps( a, b ); }
+            static inline Vector Sub( Vector a, Vector b ) { return _mm256_sub_ps( a, b ); }
+            static inline Vector Mul( Vector a, Vector b ) { return _mm256_mul_ps( a, b ); }
+            static inline Vector Div( Vector a, Vector b ) { return _mm256_div_ps( a, b ); }
+            static inline Vector Min( Vector a, Vector b ) { return _mm256_min_ps( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return _mm256_max_ps( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return _mm256_fmadd_ps( a, b, c ); }
+
+            static inline float ReduceAdd( Vector a )
+            {
+                __m128 const quads = _mm_add_ps( _mm256_castps256_ps128( a ), _mm256_extractf128_ps( a, 1 ) );
+                __m128 const pairs = _mm_add_ps( quads, _mm_movehl_ps( quads, quads ) );
+                return _mm_cvtss_f32( _mm_add_ss( pairs, _mm_shuffle_ps( pairs, pairs, 1 ) ) );
+            }
+
+            static inline Vector Round( Vector a ) { return _mm256_round_ps( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+
+            // a * 2^n for integral n in [-126, 127], built directly in the exponent bits
+            static inline Vector Scale2n( Vector a, Vector n )
+            {
+                __m256i const exponent = _mm256_slli_epi32( _mm256_add_epi32( _mm256_cvtps_epi32( n ), _mm256_set1_epi32( 127 ) ), 23 );
+                return _mm256_mul_ps( a, _mm256_castsi256_ps( exponent ) );
+            }
+
+            static inline Vector Exp( Vector a ) { return Impl::VectorExpFloat<Avx2FloatOps>( a ); }
+        };
+
+        KernelTable<double> const* GetAvx2KernelTable()
+        {
+            static KernelTable<double> const table = Impl::MakeKernelTable<Avx2Ops>();
+            return &table;
+        }
+
+        KernelTable<float> const* GetAvx2FloatKernelTable()
+        {
+            static KernelTable<float> const table = Impl::MakeKernelTable<Avx2FloatOps>();
+            return &table;
+        }
+    }
+}
+
+#if defined( __clang__ )
+#pragma clang attribute pop
+#elif defined( __GNUC__ )
+#pragma GCC pop_options
+#endif
+
+#else
+
+#include "NNKernelsImpl.h"
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        KernelTable<double> const* GetAvx2KernelTable() { return nullptr; }
+        KernelTable<float> const* GetAvx2FloatKernelTable() { return nullptr; }
+    }
+}
+
+#endif
@@ -0,0 +1,109 @@
+// AVX-512 (foundation) kernels, 8 doubles or 16 floats per vector
+#include "NNKernels.h"
+#include <cmath>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+
+// Everything below is compiled for AVX-512F regardless of the compiler flags, it only runs once CPUID has confirmed support
+#if defined( __clang__ )
+#pragma clang attribute push( __attribute__(( target( "avx512f" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+#pragma GCC push_options
+#pragma GCC target( "avx512f" )
+// GCC's AVX-512 headers build their undefined placeholder vectors from themselves, which trips its own uninitialized warnings
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include "NNKernelsImpl.h"
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        struct Avx512Ops
+        {
+            typedef double Scalar;
+            typedef __m512d Vector;
+            static int32_t const k_width = 8;
+
+            static inline Vector Zero() { return _mm512_setzero_pd(); }
+            static inline Vector Set1( double value ) { return _mm512_set1_pd( value ); }
+            static inline Vector Load( double const* address ) { return _mm512_loadu_pd( address ); }
+            static inline void Store( double* address, Vector value ) { _mm512_storeu_pd( address, value ); }
+            static inline Vector Add( Vector a, Vector b ) { return _mm512_add_pd( a, b ); }
+            static inline Vector Sub( Vector a, Vector b ) { return _mm512_sub_pd( a, b ); }
+            static inline Vector Mul( Vector a, Vector b ) { return _mm512_mul_pd( a, b ); }
+            static inline Vector Div( Vector a, Vector b ) { return _mm512_div_pd( a, b ); }
+            static inline Vector Min( Vector a, Vector b ) { return _mm512_min_pd( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return _mm512_max_pd( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return _mm512_fmadd_pd( a, b, c ); }
+            static inline double ReduceAdd( Vector a ) { return _mm512_reduce_add_pd( a ); }
+            static inline Vector Round( Vector a ) { return _mm512_roundscale_pd( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+            static inline Vector Scale2n( Vector a, Vector n ) { return _mm512_scalef_pd( a, n ); }
+            static inline Vector Exp( Vector a ) { return Impl::VectorExp<Avx512Ops>( a ); }
+        };
+
+
+        struct Avx512FloatOps
+        {
+            typedef float Scalar;
+            typedef __m512 Vector;
+            static int32_t const k_width = 16;
+
+            static inline Vector Zero() { return _mm512_setzero_ps(); }
+            static inline Vector Set1( float value ) { return _mm512_set1_ps( value ); }
+            static inline Vector Load( float const* address ) { return _mm512_loadu_ps( address ); }
+            static inline void Store( float* address, Vector value ) { _mm512_storeu_ps( address, value ); }
+            static inline Vector Add( Vector a, Vector b ) { return _mm512_add_ps( a, b ); }
+            static inline Vector Sub( Vector a, Vector b ) { return _mm512_sub_ps( a, b ); }
+            static inline Vector Mul( Vector a, Vector b ) { return _mm512_mul_ps( a, b ); }
+            static inline Vector Div( Vector a, Vector b ) { return _mm512_div_ps( a, b ); }
+            static inline Vector Min( Vector a, Vector b ) { return _mm512_min_ps( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return _mm512_max_ps( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return _mm512_fmadd_ps( a, b, c ); }
+            static inline float ReduceAdd( Vector a ) { return _mm512_reduce_add_ps( a ); }
+            static inline Vector Round( Vector a ) { return _mm512_roundscale_ps( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+            static inline Vector Scale2n( Vector a, Vector n ) { return _mm512_scalef_ps( a, n ); }
+            static inline Vector Exp( Vector a ) { return Impl::VectorExpFloat<Avx512FloatOps>( a ); }
+        };
+
+        KernelTable<double> const* GetAvx512KernelTable()
+        {
+            static KernelTable<double> const table = Impl::MakeKernelTable<Avx512Ops>();
+            return &table;
+        }
+
+        KernelTable<float> const* GetAvx512FloatKernelTable()
+        {
+            static KernelTable<float> const table = Impl::MakeKernelTable<Avx512FloatOps>();
+            return &table;
+        }
+    }
+}
+
+#if defined( __clang__ )
+#pragma clang attribute pop
+#elif defined( __GNUC__ )
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+#else
+
+#include "NNKernelsImpl.h"
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        KernelTable<double> const* GetAvx512KernelTable() { return nullptr; }
+        KernelTable<float> const* GetAvx512FloatKernelTable() { return nullptr; }
+    }
+}
+
+#endif
@@ -0,0 +1,660 @@
+// Kernel implementations written once against a vector abstraction and instantiated per instruction set
+//
+// An Ops type describes one instruction set for one scalar type: Scalar and Vector types, k_width lanes and static Zero, Set1, Load,
+// Store, Add, Sub, Mul, Div, Min, Max, MulAdd( a, b, c ) = a * b + c, ReduceAdd and Exp. The instruction set translation units include this file after switching the
+// compiler target, so it must only include headers they have already included before doing so.
+#pragma once
+#include "NNKernels.h"
+#include <cmath>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        // Function table of one instruction set for one scalar type
+        template<typename Scalar>
+        struct KernelTable
+        {
+            void ( *m_broadcastRow )( int32_t, int32_t, Scalar, Scalar const*, Scalar*, int32_t );
+            void ( *m_gemmNN )( int32_t, int32_t, int32_t, Scalar const*, int32_t, Scalar const*, int32_t, Scalar*, int32_t );
+            void ( *m_gemmNT )( int32_t, int32_t, int32_t, Scalar const*, int32_t, Scalar const*, int32_t, Scalar*, int32_t );
+            void ( *m_gemmTN )( int32_t, int32_t, int32_t, Scalar const*, int32_t, Scalar const*, int32_t, Scalar*, int32_t );
+            void ( *m_sparseGemmNN )( int32_t, int32_t, int32_t const*, int32_t const*, Scalar const*, Scalar const*, int32_t, Scalar*, int32_t );
+            void ( *m_sparseGemmTN )( int32_t, int32_t, int32_t const*, int32_t const*, Scalar const*, Scalar const*, int32_t, Scalar*, int32_t );
+            Scalar ( *m_dot )( int32_t, Scalar const*, Scalar const* );
+            void ( *m_axpy )( int32_t, Scalar, Scalar const*, Scalar* );
+            void ( *m_axpby )( int32_t, Scalar, Scalar const*, Scalar, Scalar* );
+            void ( *m_momentumUpdate )( int32_t, Scalar, Scalar const*, Scalar, Scalar*, Scalar* );
+            Scalar ( *m_dotMomentumUpdate )( int32_t, Scalar, Scalar const*, Scalar, Scalar*, Scalar* );
+            void ( *m_activate[(size_t) Activation::Count] )( int32_t, int32_t, Scalar*, int32_t );
+        };
+
+        // Defined by the instruction set translation units, null when the instruction set cannot be compiled for this target
+        KernelTable<double> const* GetScalarKernelTable();
+        KernelTable<double> const* GetSse2KernelTable();
+        KernelTable<double> const* GetAvx2KernelTable();
+        KernelTable<double> const* GetAvx512KernelTable();
+
+        KernelTable<float> const* GetScalarFloatKernelTable();
+        KernelTable<float> const* GetSse2FloatKernelTable();
+        KernelTable<float> const* GetAvx2FloatKernelTable();
+        KernelTable<float> const* GetAvx512FloatKernelTable();
+
+        namespace Impl
+        {
+            // Cache blocking of the matrix products, a KC x NC panel of B (256 KB) stays in L2 while rows of A and C stream through L1
+            static int32_t const k_blockInner = 128;
+            static int32_t const k_blockCols = 256;
+
+            // Register blocking of the matrix products: k_microRows rows x 2 vectors of C are kept in registers
+            static int32_t const k_microRows = 4;
+
+            //-------------------------------------------------------------------------
+
+            // exp( x ) for a vector: range reduction to x = n * ln2 + r, Pade approximation of exp( r ) (Cephes), scaled by 2^n
+            // Relative error below 2e-16 for x in [-708, 708], inputs outside that range are clamped
+            template<typename Ops>
+            inline typename Ops::Vector VectorExp( typename Ops::Vector x )
+            {
+                typedef typename Ops::Vector Vector;
+
+                x = Ops::Min( Ops::Max( x, Ops::Set1( -708.0 ) ), Ops::Set1( 708.0 ) );
+
+                Vector const n = Ops::Round( Ops::Mul( x, Ops::Set1( 1.4426950408889634073599 ) ) );
+                Vector r = Ops::Sub( x, Ops::Mul( n, Ops::Set1( 6.93145751953125E-1 ) ) );
+                r = Ops::Sub( r, Ops::Mul( n, Ops::Set1( 1.42860682030941723212E-6 ) ) );
+
+                Vector const r2 = Ops::Mul( r, r );
+                Vector p = Ops::MulAdd( Ops::Set1( 1.26177193074810590878E-4 ), r2, Ops::Set1( 3.02994407707441961300E-2 ) );
+                p = Ops::Mul( r, Ops::MulAdd( p, r2, Ops::Set1( 9.99999999999999999910E-1 ) ) );
+                Vector q = Ops::MulAdd( Ops::Set1( 3.00198505138664455042E-6 ), r2, Ops::Set1( 2.52448340349684104192E-3 ) );
+                q = Ops::MulAdd( q, r2, Ops::Set1( 2.27265548208155028766E-1 ) );
+                q = Ops::MulAdd( q, r2, Ops::Set1( 2.00000000000000000009E0 ) );
+
+                Vector const expR = Ops::MulAdd( Ops::Div( p, Ops::Sub( q, p ) ), Ops::Set1( 2.0 ), Ops::Set1( 1.0 ) );
+                return Ops::Scale2n( expR, n );
+            }
+
+            // Single precision version: Cephes expf polynomial, relative error below 2e-7 for x in [-87.3, 88.3], inputs outside are clamped
+            template<typename Ops>
+            inline typename Ops::Vector VectorExpFloat( typename Ops::Vector x )
+            {
+                typedef typename Ops::Vector Vector;
+
+                x = Ops::Min( Ops::Max( x, Ops::Set1( -87.3f ) ), Ops::Set1( 88.3f ) );
+
+                Vector const n = Ops::Round( Ops::Mul( x, Ops::Set1( 1.44269504088896341f ) ) );
+                Vector r = Ops::Sub( x, Ops::Mul( n, Ops::Set1( 0.693359375f ) ) );
+                r = Ops::Add( r, Ops::Mul( n, Ops::Set1( 2.12194440e-4f ) ) );
+
+                Vector p = Ops::MulAdd( Ops::Set1( 1.9875691500E-4f ), r, Ops::Set1( 1.3981999507E-3f ) );
+                p = Ops::MulAdd( p, r, Ops::Set1( 8.3334519073E-3f ) );
+                p = Ops::MulAdd( p, r, Ops::Set1( 4.1665795894E-2f ) );
+                p = Ops::MulAdd( p, r, Ops::Set1( 1.6666665459E-1f ) );
+                p = Ops::MulAdd( p, r, Ops::Set1( 5.0000001201E-1f ) );
+
+                Vector const expR = Ops::Add( Ops::MulAdd( p, Ops::Mul( r, r ), r ), Ops::Set1( 1.0f ) );
+                return Ops::Scale2n( expR, n );
+            }
+
+            //-------------------------------------------------------------------------
+
+            template<typename Ops>
+            void BroadcastRow( int32_t rows, int32_t cols, typename Ops::Scalar alpha, typename Ops::Scalar const* row, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                typename Ops::Vector const alphaVector = Ops::Set1( alpha );
+
+                for ( int32_t rowIdx = 0; rowIdx < rows; rowIdx++ )
+                {
+                    Scalar* const cRow = C + (int64_t) rowIdx * ldc;
+
+                    int32_t colIdx = 0;
+                    for ( ; colIdx + Ops::k_width <= cols; colIdx += Ops::k_width )
+                    {
+                        Ops::Store( cRow + colIdx, Ops::Mul( alphaVector, Ops::Load( row + colIdx ) ) );
+                    }
+
+                    for ( ; colIdx < cols; colIdx++ )
+                    {
+                        cRow[colIdx] = alpha * row[colIdx];
+                    }
+                }
+            }
+
+            // C[MR x NV vectors] += A'[MR x inner] * B[inner x NV vectors] with A'( r, k ) = A[r * aRowStride + k * aInnerStride]
+            template<typename Ops, int32_t MR, int32_t NV>
+            inline void GemmMicroKernel( int32_t innerStart, int32_t innerEnd, typename Ops::Scalar const* A, int64_t aRowStride, int64_t aInnerStride, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                typename Ops::Vector accumulators[MR][NV];
+                for ( int32_t rowIdx = 0; rowIdx < MR; rowIdx++ )
+                {
+                    for ( int32_t vectorIdx = 0; vectorIdx < NV; vectorIdx++ )
+                    {
+                        accumulators[rowIdx][vectorIdx] = Ops::Zero();
+                    }
+                }
+
+                for ( int32_t innerIdx = innerStart; innerIdx < innerEnd; innerIdx++ )
+                {
+                    Scalar const* const bRow = B + (int64_t) innerIdx * ldb;
+
+                    typename Ops::Vector b[NV];
+                    for ( int32_t vectorIdx = 0; vectorIdx < NV; vectorIdx++ )
+                    {
+                        b[vectorIdx] = Ops::Load( bRow + vectorIdx * Ops::k_width );
+                    }
+
+                    for ( int32_t rowIdx = 0; rowIdx < MR; rowIdx++ )
+                    {
+                        typename Ops::Vector const a = Ops::Set1( A[rowIdx * aRowStride + innerIdx * aInnerStride] );
+                        for ( int32_t vectorIdx = 0; vectorIdx < NV; vectorIdx++ )
+                        {
+                            accumulators[rowIdx][vectorIdx] = Ops::MulAdd( a, b[vectorIdx], accumulators[rowIdx][vectorIdx] );
+                        }
+                    }
+                }
+
+                for ( int32_t rowIdx = 0; rowIdx < MR; rowIdx++ )
+                {
+                    Scalar* const cRow = C + (int64_t) rowIdx * ldc;
+                    for ( int32_t vectorIdx = 0; vectorIdx < NV; vectorIdx++ )
+                    {
+                        Scalar* const cVector = cRow + vectorIdx * Ops::k_width;
+                        Ops::Store( cVector, Ops::Add( Ops::Load( cVector ), accumulators[rowIdx][vectorIdx] ) );
+                    }
+                }
+            }
+
+            // MR rows of C for one cache block of columns and inner indices, register blocked where the columns allow it
+            template<typename Ops, int32_t MR>
+            inline void GemmRows( int32_t colStart, int32_t colEnd, int32_t innerStart, int32_t innerEnd, typename Ops::Scalar const* A, int64_t aRowStride, int64_t aInnerStride, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                int32_t colIdx = colStart;
+                for ( ; colIdx + 2 * Ops::k_width <= colEnd; colIdx += 2 * Ops::k_width )
+                {
+                    GemmMicroKernel<Ops, MR, 2>( innerStart, innerEnd, A, aRowStride, aInnerStride, B + colIdx, ldb, C + colIdx, ldc );
+                }
+
+                for ( ; colIdx + Ops::k_width <= colEnd; colIdx += Ops::k_width )
+                {
+                    GemmMicroKernel<Ops, MR, 1>( innerStart, innerEnd, A, aRowStride, aInnerStride, B + colIdx, ldb, C + colIdx, ldc );
+                }
+
+                for ( ; colIdx < colEnd; colIdx++ )
+                {
+                    for ( int32_t rowIdx = 0; rowIdx < MR; rowIdx++ )
+                    {
+                        Scalar sum = 0;
+                        for ( int32_t innerIdx = innerStart; innerIdx < innerEnd; innerIdx++ )
+                        {
+                            sum += A[rowIdx * aRowStride + innerIdx * aInnerStride] * B[(int64_t) innerIdx * ldb + colIdx];
+                        }
+
+                        C[(int64_t) rowIdx * ldc + colIdx] += sum;
+                    }
+                }
+            }
+
+            // C[rows x cols] += A'[rows x inner] * B[inner x cols], A' is A or its transpose depending on the strides
+            template<typename Ops>
+            void GemmStrided( int32_t rows, int32_t cols, int32_t inner, typename Ops::Scalar const* A, int64_t aRowStride, int64_t aInnerStride, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                for ( int32_t colStart = 0; colStart < cols; colStart += k_blockCols )
+                {
+                    int32_t const colEnd = ( colStart + k_blockCols < cols ) ? colStart + k_blockCols : cols;
+
+                    for ( int32_t innerStart = 0; innerStart < inner; innerStart += k_blockInner )
+                    {
+                        int32_t const innerEnd = ( innerStart + k_blockInner < inner ) ? innerStart + k_blockInner : inner;
+
+                        int32_t rowIdx = 0;
+                        for ( ; rowIdx + k_microRows <= rows; rowIdx += k_microRows )
+                        {
+                            GemmRows<Ops, k_microRows>( colStart, colEnd, innerStart, innerEnd, A + rowIdx * aRowStride, aRowStride, aInnerStride, B, ldb, C + (int64_t) rowIdx * ldc, ldc );
+                        }
+
+                        for ( ; rowIdx < rows; rowIdx++ )
+                        {
+                            GemmRows<Ops, 1>( colStart, colEnd, innerStart, innerEnd, A + rowIdx * aRowStride, aRowStride, aInnerStride, B, ldb, C + (int64_t) rowIdx * ldc, ldc );
+                        }
+                    }
+                }
+            }
+
+            template<typename Ops>
+            void GemmNN( int32_t rows, int32_t cols, int32_t inner, typename Ops::Scalar const* A, int32_t lda, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                GemmStrided<Ops>( rows, cols, inner, A, lda, 1, B, ldb, C, ldc );
+            }
+
+            template<typename Ops>
+            void GemmTN( int32_t rows, int32_t cols, int32_t inner, typename Ops::Scalar const* A, int32_t lda, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                GemmStrided<Ops>( rows, cols, inner, A, 1, lda, B, ldb, C, ldc );
+            }
+
+            template<typename Ops>
+            void SparseGemmNN( int32_t rows, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, typename Ops::Scalar const* values, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+                typedef typename Ops::Vector Vector;
+
+                for ( int32_t rowIdx = 0; rowIdx < rows; rowIdx++ )
+                {
+                    int32_t const nonzeroStart = rowOffsets[rowIdx];
+                    int32_t const nonzeroEnd = rowOffsets[rowIdx + 1];
+                    Scalar* const cRow = C + (int64_t) rowIdx * ldc;
+
+                    // Four vectors of the C row stay in registers while the selected rows of B are added to them
+                    int32_t colIdx = 0;
+                    for ( ; colIdx + 4 * Ops::k_width <= cols; colIdx += 4 * Ops::k_width )
+                    {
+                        Vector sum0 = Ops::Load( cRow + colIdx );
+                        Vector sum1 = Ops::Load( cRow + colIdx + Ops::k_width );
+                        Vector sum2 = Ops::Load( cRow + colIdx + 2 * Ops::k_width );
+                        Vector sum3 = Ops::Load( cRow + colIdx + 3 * Ops::k_width );
+                        for ( int32_t nonzeroIdx = nonzeroStart; nonzeroIdx < nonzeroEnd; nonzeroIdx++ )
+                        {
+                            Vector const value = Ops::Set1( values[nonzeroIdx] );
+                            Scalar const* const bRow = B + (int64_t) columnIndices[nonzeroIdx] * ldb + colIdx;
+                            sum0 = Ops::MulAdd( value, Ops::Load( bRow ), sum0 );
+                            sum1 = Ops::MulAdd( value, Ops::Load( bRow + Ops::k_width ), sum1 );
+                            sum2 = Ops::MulAdd( value, Ops::Load( bRow + 2 * Ops::k_width ), sum2 );
+                            sum3 = Ops::MulAdd( value, Ops::Load( bRow + 3 * Ops::k_width ), sum3 );
+                        }
+                        Ops::Store( cRow + colIdx, sum0 );
+                        Ops::Store( cRow + colIdx + Ops::k_width, sum1 );
+                        Ops::Store( cRow + colIdx + 2 * Ops::k_width, sum2 );
+                        Ops::Store( cRow + colIdx + 3 * Ops::k_width, sum3 );
+                    }
+
+                    for ( ; colIdx + Ops::k_width <= cols; colIdx += Ops::k_width )
+                    {
+                        Vector sum = Ops::Load( cRow + colIdx );
+                        for ( int32_t nonzeroIdx = nonzeroStart; nonzeroIdx < nonzeroEnd; nonzeroIdx++ )
+                        {
+                            sum = Ops::MulAdd( Ops::Set1( values[nonzeroIdx] ), Ops::Load( B + (int64_t) columnIndices[nonzeroIdx] * ldb + colIdx ), sum );
+                        }
+                        Ops::Store( cRow + colIdx, sum );
+                    }
+
+                    for ( ; colIdx < cols; colIdx++ )
+                    {
+                        Scalar sum = cRow[colIdx];
+                        for ( int32_t nonzeroIdx = nonzeroStart; nonzeroIdx < nonzeroEnd; nonzeroIdx++ )
+                        {
+                            sum += values[nonzeroIdx] * B[(int64_t) columnIndices[nonzeroIdx] * ldb + colIdx];
+                        }
+                        cRow[colIdx] = sum;
+                    }
+                }
+            }
+
+            template<typename Ops>
+            void SparseGemmTN( int32_t inner, int32_t cols, int32_t const* rowOffsets, int32_t const* columnIndices, typename Ops::Scalar const* values, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                // Every nonzero A( r, j ) adds row r of B to row j of C
+                for ( int32_t innerIdx = 0; innerIdx < inner; innerIdx++ )
+                {
+                    Scalar const* const bRow = B + (int64_t) innerIdx * ldb;
+                    for ( int32_t nonzeroIdx = rowOffsets[innerIdx]; nonzeroIdx < rowOffsets[innerIdx + 1]; nonzeroIdx++ )
+                    {
+                        typename Ops::Vector const value = Ops::Set1( values[nonzeroIdx] );
+                        Scalar* const cRow = C + (int64_t) columnIndices[nonzeroIdx] * ldc;
+
+                        int32_t colIdx = 0;
+                        for ( ; colIdx + Ops::k_width <= cols; colIdx += Ops::k_width )
+                        {
+                            Ops::Store( cRow + colIdx, Ops::MulAdd( value, Ops::Load( bRow + colIdx ), Ops::Load( cRow + colIdx ) ) );
+                        }
+
+                        for ( ; colIdx < cols; colIdx++ )
+                        {
+                            cRow[colIdx] += values[nonzeroIdx] * bRow[colIdx];
+                        }
+                    }
+                }
+            }
+
+            template<typename Ops>
+            typename Ops::Scalar Dot( int32_t count, typename Ops::Scalar const* x, typename Ops::Scalar const* y )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                // Four independent accumulators hide the latency of the multiply-adds
+                typename Ops::Vector sum0 = Ops::Zero();
+                typename Ops::Vector sum1 = Ops::Zero();
+                typename Ops::Vector sum2 = Ops::Zero();
+                typename Ops::Vector sum3 = Ops::Zero();
+
+                int32_t idx = 0;
+                for ( ; idx + 4 * Ops::k_width <= count; idx += 4 * Ops::k_width )
+                {
+                    sum0 = Ops::MulAdd( Ops::Load( x + idx ), Ops::Load( y + idx ), sum0 );
+                    sum1 = Ops::MulAdd( Ops::Load( x + idx + Ops::k_width ), Ops::Load( y + idx + Ops::k_width ), sum1 );
+                    sum2 = Ops::MulAdd( Ops::Load( x + idx + 2 * Ops::k_width ), Ops::Load( y + idx + 2 * Ops::k_width ), sum2 );
+                    sum3 = Ops::MulAdd( Ops::Load( x + idx + 3 * Ops::k_width ), Ops::Load( y + idx + 3 * Ops::k_width ), sum3 );
+                }
+
+                for ( ; idx + Ops::k_width <= count; idx += Ops::k_width )
+                {
+                    sum0 = Ops::MulAdd( Ops::Load( x + idx ), Ops::Load( y + idx ), sum0 );
+                }
+
+                Scalar sum = Ops::ReduceAdd( Ops::Add( Ops::Add( sum0, sum1 ), Ops::Add( sum2, sum3 ) ) );
+                for ( ; idx < count; idx++ )
+                {
+                    sum += x[idx] * y[idx];
+                }
+
+                return sum;
+            }
+
+            template<typename Ops>
+            void GemmNT( int32_t rows, int32_t cols, int32_t inner, typename Ops::Scalar const* A, int32_t lda, typename Ops::Scalar const* B, int32_t ldb, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                for ( int32_t colStart = 0; colStart < cols; colStart += k_blockCols )
+                {
+                    int32_t const colEnd = ( colStart + k_blockCols < cols ) ? colStart + k_blockCols : cols;
+
+                    // Both operands are walked along their rows, every output is a unit-stride dot product
+                    for ( int32_t rowIdx = 0; rowIdx < rows; rowIdx++ )
+                    {
+                        Scalar const* const aRow = A + (int64_t) rowIdx * lda;
+                        Scalar* const cRow = C + (int64_t) rowIdx * ldc;
+
+                        for ( int32_t colIdx = colStart; colIdx < colEnd; colIdx++ )
+                        {
+                            cRow[colIdx] += Dot<Ops>( inner, aRow, B + (int64_t) colIdx * ldb );
+                        }
+                    }
+                }
+            }
+
+            template<typename Ops>
+            void Axpy( int32_t count, typename Ops::Scalar alpha, typename Ops::Scalar const* x, typename Ops::Scalar* y )
+            {
+                typename Ops::Vector const alphaVector = Ops::Set1( alpha );
+
+                int32_t idx = 0;
+                for ( ; idx + Ops::k_width <= count; idx += Ops::k_width )
+                {
+                    Ops::Store( y + idx, Ops::MulAdd( alphaVector, Ops::Load( x + idx ), Ops::Load( y + idx ) ) );
+                }
+
+                for ( ; idx < count; idx++ )
+                {
+                    y[idx] += alpha * x[idx];
+                }
+            }
+
+            template<typename Ops>
+            void Axpby( int32_t count, typename Ops::Scalar alpha, typename Ops::Scalar const* x, typename Ops::Scalar beta, typename Ops::Scalar* y )
+            {
+                typename Ops::Vector const alphaVector = Ops::Set1( alpha );
+                typename Ops::Vector const betaVector = Ops::Set1( beta );
+
+                int32_t idx = 0;
+                for ( ; idx + Ops::k_width <= count; idx += Ops::k_width )
+                {
+                    Ops::Store( y + idx, Ops::MulAdd( alphaVector, Ops::Load( x + idx ), Ops::Mul( betaVector, Ops::Load( y + idx ) ) ) );
+                }
+
+                for ( ; idx < count; idx++ )
+                {
+                    y[idx] = alpha * x[idx] + beta * y[idx];
+                }
+            }
+
+            template<typename Ops>
+            void MomentumUpdate( int32_t count, typename Ops::Scalar learningRate, typename Ops::Scalar const* gradients, typename Ops::Scalar momentum, typename Ops::Scalar* deltas, typename Ops::Scalar* weights )
+            {
+                typename Ops::Vector const learningRateVector = Ops::Set1( learningRate );
+                typename Ops::Vector const momentumVector = Ops::Set1( momentum );
+
+                int32_t idx = 0;
+                for ( ; idx + Ops::k_width <= count; idx += Ops::k_width )
+                {
+                    typename Ops::Vector const delta = Ops::MulAdd( learningRateVector, Ops::Load( gradients + idx ), Ops::Mul( momentumVector, Ops::Load( deltas + idx ) ) );
+                    Ops::Store( deltas + idx, delta );
+                    Ops::Store( weights + idx, Ops::Add( Ops::Load( weights + idx ), delta ) );
+                }
+
+                for ( ; idx < count; idx++ )
+                {
+                    deltas[idx] = learningRate * gradients[idx] + momentum * deltas[idx];
+                    weights[idx] += deltas[idx];
+                }
+            }
+
+            // One vector of DotMomentumUpdate: sum += weights * gradients with the weights before adding the new delta
+            template<typename Ops>
+            inline typename Ops::Vector DotMomentumUpdateStep( typename Ops::Vector learningRate, typename Ops::Scalar const* gradients, typename Ops::Vector momentum,
+                typename Ops::Scalar* deltas, typename Ops::Scalar* weights, typename Ops::Vector sum )
+            {
+                typename Ops::Vector const gradient = Ops::Load( gradients );
+                typename Ops::Vector const weight = Ops::Load( weights );
+                typename Ops::Vector const delta = Ops::MulAdd( learningRate, gradient, Ops::Mul( momentum, Ops::Load( deltas ) ) );
+                Ops::Store( deltas, delta );
+                Ops::Store( weights, Ops::Add( weight, delta ) );
+                return Ops::MulAdd( weight, gradient, sum );
+            }
+
+            // Same accumulators and summation order as Dot, so the result matches a Dot before MomentumUpdate
+            template<typename Ops>
+            typename Ops::Scalar DotMomentumUpdate( int32_t count, typename Ops::Scalar learningRate, typename Ops::Scalar const* gradients, typename Ops::Scalar momentum, typename Ops::Scalar* deltas, typename Ops::Scalar* weights )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                typename Ops::Vector const learningRateVector = Ops::Set1( learningRate );
+                typename Ops::Vector const momentumVector = Ops::Set1( momentum );
+                typename Ops::Vector sum0 = Ops::Zero();
+                typename Ops::Vector sum1 = Ops::Zero();
+                typename Ops::Vector sum2 = Ops::Zero();
+                typename Ops::Vector sum3 = Ops::Zero();
+
+                int32_t idx = 0;
+                for ( ; idx + 4 * Ops::k_width <= count; idx += 4 * Ops::k_width )
+                {
+                    sum0 = DotMomentumUpdateStep<Ops>( learningRateVector, gradients + idx, momentumVector, deltas + idx, weights + idx, sum0 );
+                    sum1 = DotMomentumUpdateStep<Ops>( learningRateVector, gradients + idx + Ops::k_width, momentumVector, deltas + idx + Ops::k_width, weights + idx + Ops::k_width, sum1 );
+                    sum2 = DotMomentumUpdateStep<Ops>( learningRateVector, gradients + idx + 2 * Ops::k_width, momentumVector, deltas + idx + 2 * Ops::k_width, weights + idx + 2 * Ops::k_width, sum2 );
+                    sum3 = DotMomentumUpdateStep<Ops>( learningRateVector, gradients + idx + 3 * Ops::k_width, momentumVector, deltas + idx + 3 * Ops::k_width, weights + idx + 3 * Ops::k_width, sum3 );
+                }
+
+                for ( ; idx + Ops::k_width <= count; idx += Ops::k_width )
+                {
+                    sum0 = DotMomentumUpdateStep<Ops>( learningRateVector, gradients + idx, momentumVector, deltas + idx, weights + idx, sum0 );
+                }
+
+                Scalar sum = Ops::ReduceAdd( Ops::Add( Ops::Add( sum0, sum1 ), Ops::Add( sum2, sum3 ) ) );
+                for ( ; idx < count; idx++ )
+                {
+                    sum += weights[idx] * gradients[idx];
+                    deltas[idx] = learningRate * gradients[idx] + momentum * deltas[idx];
+                    weights[idx] += deltas[idx];
+                }
+
+                return sum;
+            }
+
+            // Activation policies on a whole vector, the scalar Apply of the policy handles the remaining columns
+            template<typename Ops, typename Policy>
+            struct VectorActivation;
+
+            template<typename Ops>
+            struct VectorActivation<Ops, Activations::Sigmoid>
+            {
+                static inline typename Ops::Vector Apply( typename Ops::Vector x )
+                {
+                    typename Ops::Vector const one = Ops::Set1( typename Ops::Scalar( 1 ) );
+                    return Ops::Div( one, Ops::Add( one, Ops::Exp( Ops::Sub( Ops::Zero(), x ) ) ) );
+                }
+            };
+
+            template<typename Ops>
+            struct VectorActivation<Ops, Activations::FastTanh>
+            {
+                static inline typename Ops::Vector Apply( typename Ops::Vector x )
+                {
+                    typedef typename Ops::Scalar Scalar;
+
+                    x = Ops::Min( Ops::Max( x, Ops::Set1( Scalar( -Activations::k_fastTanhLimit ) ) ), Ops::Set1( Scalar( Activations::k_fastTanhLimit ) ) );
+                    typename Ops::Vector const x2 = Ops::Mul( x, x );
+                    typename Ops::Vector p = Ops::MulAdd( Ops::Set1( Scalar( Activations::k_fastTanhP[3] ) ), x2, Ops::Set1( Scalar( Activations::k_fastTanhP[2] ) ) );
+                    p = Ops::MulAdd( p, x2, Ops::Set1( Scalar( Activations::k_fastTanhP[1] ) ) );
+                    p = Ops::MulAdd( p, x2, Ops::Set1( Scalar( Activations::k_fastTanhP[0] ) ) );
+                    typename Ops::Vector q = Ops::MulAdd( Ops::Set1( Scalar( Activations::k_fastTanhQ[3] ) ), x2, Ops::Set1( Scalar( Activations::k_fastTanhQ[2] ) ) );
+                    q = Ops::MulAdd( q, x2, Ops::Set1( Scalar( Activations::k_fastTanhQ[1] ) ) );
+                    q = Ops::MulAdd( q, x2, Ops::Set1( Scalar( Activations::k_fastTanhQ[0] ) ) );
+                    return Ops::Div( Ops::Mul( x, p ), q );
+                }
+            };
+
+            template<typename Ops>
+            struct VectorActivation<Ops, Activations::FastSigmoid>
+            {
+                static inline typename Ops::Vector Apply( typename Ops::Vector x )
+                {
+                    typename Ops::Vector const half = Ops::Set1( typename Ops::Scalar( 0.5 ) );
+                    return Ops::MulAdd( half, VectorActivation<Ops, Activations::FastTanh>::Apply( Ops::Mul( half, x ) ), half );
+                }
+            };
+
+            // tanh( x ) = 2 / ( 1 + exp( -2x ) ) - 1
+            template<typename Ops>
+            struct VectorActivation<Ops, Activations::Tanh>
+            {
+                static inline typename Ops::Vector Apply( typename Ops::Vector x )
+                {
+                    typename Ops::Vector const one = Ops::Set1( typename Ops::Scalar( 1 ) );
+                    typename Ops::Vector const minusTwo = Ops::Set1( typename Ops::Scalar( -2 ) );
+                    typename Ops::Vector const expNegative = Ops::Exp( Ops::Mul( minusTwo, x ) );
+                    return Ops::Sub( Ops::Div( Ops::Add( one, one ), Ops::Add( one, expNegative ) ), one );
+                }
+            };
+
+            template<typename Ops>
+            struct VectorActivation<Ops, Activations::ReLU>
+            {
+                static inline typename Ops::Vector Apply( typename Ops::Vector x ) { return Ops::Max( x, Ops::Zero() ); }
+            };
+
+            // The slope is below 1, so the larger of x and slope * x is the leaky ReLU
+            template<typename Ops>
+            struct VectorActivation<Ops, Activations::LeakyReLU>
+            {
+                static inline typename Ops::Vector Apply( typename Ops::Vector x )
+                {
+                    return Ops::Max( x, Ops::Mul( Ops::Set1( typename Ops::Scalar( Activations::k_leakyReluSlope ) ), x ) );
+                }
+            };
+
+            template<typename Ops, typename Policy>
+            void Activate( int32_t rows, int32_t cols, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                for ( int32_t rowIdx = 0; rowIdx < rows; rowIdx++ )
+                {
+                    Scalar* const cRow = C + (int64_t) rowIdx * ldc;
+
+                    int32_t colIdx = 0;
+                    for ( ; colIdx + Ops::k_width <= cols; colIdx += Ops::k_width )
+                    {
+                        Ops::Store( cRow + colIdx, VectorActivation<Ops, Policy>::Apply( Ops::Load( cRow + colIdx ) ) );
+                    }
+
+                    for ( ; colIdx < cols; colIdx++ )
+                    {
+                        cRow[colIdx] = Policy::template Apply<Scalar>( cRow[colIdx] );
+                    }
+                }
+            }
+
+            // exp( x - max ) over its sum per row, subtracting the row maximum keeps exp from overflowing
+            template<typename Ops>
+            void Softmax( int32_t rows, int32_t cols, typename Ops::Scalar* C, int32_t ldc )
+            {
+                typedef typename Ops::Scalar Scalar;
+
+                for ( int32_t rowIdx = 0; rowIdx < rows; rowIdx++ )
+                {
+                    Scalar* const cRow = C + (int64_t) rowIdx * ldc;
+                    Scalar rowMax = cRow[0];
+                    for ( int32_t colIdx = 1; colIdx < cols; colIdx++ )
+                    {
+                        rowMax = ( cRow[colIdx] > rowMax ) ? cRow[colIdx] : rowMax;
+                    }
+                    typename Ops::Vector const shift = Ops::Set1( rowMax );
+
+                    typename Ops::Vector vectorSum = Ops::Zero();
+                    int32_t colIdx = 0;
+                    for ( ; colIdx + Ops::k_width <= cols; colIdx += Ops::k_width )
+                    {
+                        typename Ops::Vector const value = Ops::Exp( Ops::Sub( Ops::Load( cRow + colIdx ), shift ) );
+                        Ops::Store( cRow + colIdx, value );
+                        vectorSum = Ops::Add( vectorSum, value );
+                    }
+
+                    Scalar sum = Ops::ReduceAdd( vectorSum );
+                    for ( ; colIdx < cols; colIdx++ )
+                    {
+                        cRow[colIdx] = std::exp( cRow[colIdx] - rowMax );
+                        sum += cRow[colIdx];
+                    }
+
+                    typename Ops::Vector const scale = Ops::Set1( Scalar( 1 ) / sum );
+                    for ( colIdx = 0; colIdx + Ops::k_width <= cols; colIdx += Ops::k_width )
+                    {
+                        Ops::Store( cRow + colIdx, Ops::Mul( Ops::Load( cRow + colIdx ), scale ) );
+                    }
+
+                    for ( ; colIdx < cols; colIdx++ )
+                    {
+                        cRow[colIdx] *= Scalar( 1 ) / sum;
+                    }
+                }
+            }
+
+            //-------------------------------------------------------------------------
+
+            template<typename Ops>
+            KernelTable<typename Ops::Scalar> MakeKernelTable()
+            {
+                KernelTable<typename Ops::Scalar> table;
+                table.m_broadcastRow = &BroadcastRow<Ops>;
+                table.m_gemmNN = &GemmNN<Ops>;
+                table.m_gemmNT = &GemmNT<Ops>;
+                table.m_gemmTN = &GemmTN<Ops>;
+                table.m_sparseGemmNN = &SparseGemmNN<Ops>;
+                table.m_sparseGemmTN = &SparseGemmTN<Ops>;
+                table.m_dot = &Dot<Ops>;
+                table.m_axpy = &Axpy<Ops>;
+                table.m_axpby = &Axpby<Ops>;
+                table.m_momentumUpdate = &MomentumUpdate<Ops>;
+                table.m_dotMomentumUpdate = &DotMomentumUpdate<Ops>;
+                table.m_activate[(size_t) Activation::Sigmoid] = &Activate<Ops, Activations::Sigmoid>;
+                table.m_activate[(size_t) Activation::FastSigmoid] = &Activate<Ops, Activations::FastSigmoid>;
+                table.m_activate[(size_t) Activation::Tanh] = &Activate<Ops, Activations::Tanh>;
+                table.m_activate[(size_t) Activation::FastTanh] = &Activate<Ops, Activations::FastTanh>;
+                table.m_activate[(size_t) Activation::ReLU] = &Activate<Ops, Activations::ReLU>;
+                table.m_activate[(size_t) Activation::LeakyReLU] = &Activate<Ops, Activations::LeakyReLU>;
+                table.m_activate[(size_t) Activation::Softmax] = &Softmax<Ops>;
+                return table;
+            }
+        }
+    }
+}
@@ -0,0 +1,131 @@
+// SSE2 kernels, 2 doubles or 4 floats per vector
+#include "NNKernels.h"
+#include <cmath>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+
+// Everything below is compiled for SSE2 regardless of the compiler flags, it only runs once CPUID has confirmed support
+#if defined( __clang__ )
+#pragma clang attribute push( __attribute__(( target( "sse2" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+#pragma GCC push_options
+#pragma GCC target( "sse2" )
+#endif
+
+#include "NNKernelsImpl.h"
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        struct Sse2Ops
+        {
+            typedef double Scalar;
+            typedef __m128d Vector;
+            static int32_t const k_width = 2;
+
+            static inline Vector Zero() { return _mm_setzero_pd(); }
+            static inline Vector Set1( double value ) { return _mm_set1_pd( value ); }
+            static inline Vector Load( double const* address ) { return _mm_loadu_pd( address ); }
+            static inline void Store( double* address, Vector value ) { _mm_storeu_pd( address, value ); }
+            static inline Vector Add( Vector a, Vector b ) { return _mm_add_pd( a, b ); }
+            static inline Vector Sub( Vector a, Vector b ) { return _mm_sub_pd( a, b ); }
+            static inline Vector Mul( Vector a, Vector b ) { return _mm_mul_pd( a, b ); }
+            static inline Vector Div( Vector a, Vector b ) { return _mm_div_pd( a, b ); }
+            static inline Vector Min( Vector a, Vector b ) { return _mm_min_pd( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return _mm_max_pd( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return _mm_add_pd( _mm_mul_pd( a, b ), c ); }
+
+            static inline double ReduceAdd( Vector a )
+            {
+                return _mm_cvtsd_f64( _mm_add_sd( a, _mm_unpackhi_pd( a, a ) ) );
+            }
+
+            // Round to nearest through a 32 bit conversion, the exponent range of VectorExp fits easily
+            static inline Vector Round( Vector a ) { return _mm_cvtepi32_pd( _mm_cvtpd_epi32( a ) ); }
+
+            // a * 2^n for integral n in [-1022, 1023], built directly in the exponent bits
+            static inline Vector Scale2n( Vector a, Vector n )
+            {
+                __m128i const biased = _mm_add_epi32( _mm_cvtpd_epi32( n ), _mm_set1_epi32( 1023 ) );
+                __m128i const exponent = _mm_slli_epi64( _mm_unpacklo_epi32( biased, _mm_setzero_si128() ), 52 );
+                return _mm_mul_pd( a, _mm_castsi128_pd( exponent ) );
+            }
+
+            static inline Vector Exp( Vector a ) { return Impl::VectorExp<Sse2Ops>( a ); }
+        };
+
+
+        struct Sse2FloatOps
+        {
+            typedef float Scalar;
+            typedef __m128 Vector;
+            static int32_t const k_width = 4;
+
+            static inline Vector Zero() { return _mm_setzero_ps(); }
+            static inline Vector Set1( float value ) { return _mm_set1_ps( value ); }
+            static inline Vector Load( float const* address ) { return _mm_loadu_ps( address ); }
+            static inline void Store( float* address, Vector value ) { _mm_storeu_ps( address, value ); }
+            static inline Vector Add( Vector a, Vector b ) { return _mm_add_ps( a, b ); }
+            static inline Vector Sub( Vector a, Vector b ) { return _mm_sub_ps( a, b ); }
+            static inline Vector Mul( Vector a, Vector b ) { return _mm_mul_ps( a, b ); }
+            static inline Vector Div( Vector a, Vector b ) { return _mm_div_ps( a, b ); }
+            static inline Vector Min( Vector a, Vector b ) { return _mm_min_ps( a, b ); }
+            static inline Vector Max( Vector a, Vector b ) { return _mm_max_ps( a, b ); }
+            static inline Vector MulAdd( Vector a, Vector b, Vector c ) { return _mm_add_ps( _mm_mul_ps( a, b ), c ); }
+
+            static inline float ReduceAdd( Vector a )
+            {
+                __m128 const pairs = _mm_add_ps( a, _mm_movehl_ps( a, a ) );
+                return _mm_cvtss_f32( _mm_add_ss( pairs, _mm_shuffle_ps( pairs, pairs, 1 ) ) );
+            }
+
+            static inline Vector Round( Vector a ) { return _mm_cvtepi32_ps( _mm_cvtps_epi32( a ) ); }
+
+            // a * 2^n for integral n in [-126, 127], built directly in the exponent bits
+            static inline Vector Scale2n( Vector a, Vector n )
+            {
+                __m128i const exponent = _mm_slli_epi32( _mm_add_epi32( _mm_cvtps_epi32( n ), _mm_set1_epi32( 127 ) ), 23 );
+                return _mm_mul_ps( a, _mm_castsi128_ps( exponent ) );
+            }
+
+            static inline Vector Exp( Vector a ) { return Impl::VectorExpFloat<Sse2FloatOps>( a ); }
+        };
+
+        KernelTable<double> const* GetSse2KernelTable()
+        {
+            static KernelTable<double> const table = Impl::MakeKernelTable<Sse2Ops>();
+            return &table;
+        }
+
+        KernelTable<float> const* GetSse2FloatKernelTable()
+        {
+            static KernelTable<float> const table = Impl::MakeKernelTable<Sse2FloatOps>();
+            return &table;
+        }
+    }
+}
+
+#if defined( __clang__ )
+#pragma clang attribute pop
+#elif defined( __GNUC__ )
+#pragma GCC pop_options
+#endif
+
+#else
+
+#include "NNKernelsImpl.h"
+
+namespace BPN
+{
+    namespace Kernels
+    {
+        KernelTable<double> const* GetSse2KernelTable() { return nullptr; }
+        KernelTable<float> const* GetSse2FloatKernelTable() { return nullptr; }
+    }
+}
+
+#endif
@@ -1,120 +1,718 @@
 #include "NNTrainer.h"
+#include "NNKernels.h"
+#include "Profiler.h"
+#include "StreamingDataSource.h"
+#include "ModelFile.h"
+#include "TrainingPipeline.h"
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 
 //-------------------------------------------------------------------------
 
 namespace BPN
 {
-    NNTrainer::NNTrainer( Settings const& settings, Network* networkToTrain )
+    // Mini-batches are split into shards of this many samples, each shard's gradient is computed on its own and the shards are
+    // summed pairwise in index order, so the result only depends on the batch size and never on the number of threads
+    static size_t const k_gradientShardSize = 32;
+
+    // In asynchronous mode the shared weights are read and written with relaxed atomic accesses. Updates from other threads can be
+    // seen late or lost (load + store, not read-modify-write), which hogwild training tolerates, but every value read is a whole
+    // weight that some thread wrote.
+    template<typename Scalar>
+    static inline Scalar LoadRelaxed( Scalar const* address )
+    {
+#if defined( _MSC_VER )
+        return *reinterpret_cast<Scalar const volatile*>( address );
+#else
+        Scalar value;
+        __atomic_load( address, &value, __ATOMIC_RELAXED );
+        return value;
+#endif
+    }
+
+    template<typename Scalar>
+    static inline void StoreRelaxed( Scalar* address, Scalar value )
+    {
+#if defined( _MSC_VER )
+        *reinterpret_cast<Scalar volatile*>( address ) = value;
+#else
+        __atomic_store( address, &value, __ATOMIC_RELAXED );
+#endif
+    }
+
+    // Row access to a training set and to a staged batch, so that the training loops are written once for both
+    template<typename Scalar>
+    struct SetRows
+    {
+        TrainingSetT<Scalar> const& m_set;
+
+        inline size_t size() const { return m_set.size(); }
+        inline Scalar const* GetInputs( size_t rowIdx ) const { return m_set[rowIdx].m_inputs.data(); }
+        inline int32_t const* GetExpectedOutputs( size_t rowIdx ) const { return m_set[rowIdx].m_expectedOutputs.data(); }
+        inline bool IsSparse( size_t rowIdx ) const { return m_set[rowIdx].IsSparse(); }
+        inline SparseInputsT<Scalar> GetSparseInputs( size_t rowIdx ) const { return m_set[rowIdx].GetSparseInputs(); }
+    };
+
+    template<typename Scalar>
+    struct BatchRows
+    {
+        TrainingBatchT<Scalar> const& m_batch;
+
+        inline size_t size() const { return m_batch.m_numRows; }
+        inline Scalar const* GetInputs( size_t rowIdx ) const { return m_batch.m_inputs + rowIdx * m_batch.m_numInputs; }
+        inline int32_t const* GetExpectedOutputs( size_t rowIdx ) const { return m_batch.m_expectedOutputs + rowIdx * m_batch.m_numOutputs; }
+
+        // Staged batches are always dense
+        inline bool IsSparse( size_t ) const { return false; }
+        inline SparseInputsT<Scalar> GetSparseInputs( size_t ) const { return SparseInputsT<Scalar>(); }
+    };
+
+    template<typename Scalar>
+    NNTrainerT<Scalar>::NNTrainerT( Settings const& settings, NetworkType* networkToTrain )
         : m_networkToTrain( networkToTrain )
-        , m_learningRate( settings.m_learningRate )
-        , m_momentum( settings.m_momentum )
+        , m_workspace( *networkToTrain )
+        , m_learningRate( static_cast<Scalar>( settings.m_learningRate ) )
+        , m_momentum( static_cast<Scalar>( settings.m_momentum ) )
         , m_desiredAccuracy( settings.m_desiredAccuracy )
+        , m_batchSize( std::max( settings.m_batchSize, 1u ) )
+        , m_parallelMode( settings.m_parallelMode )
         , m_maxGenerations( settings.m_maxGenerations )
+        , m_overlapEvaluation( settings.m_overlapEvaluation )
+        , m_logProgress( settings.m_logProgress )
+        , m_reportInterval( std::max( settings.m_reportInterval, 1u ) )
+        , m_logPath( settings.m_logPath )
+        , m_logFormat( settings.m_logFormat )
+        , m_numSparseSteps( 0 )
+        , m_earlyStoppingPatience( settings.m_earlyStoppingPatience )
+        , m_minMSEImprovement( settings.m_minMSEImprovement )
+        , m_numGenerationsWithoutImprovement( 0 )
+        , m_bestResults()
+        , m_checkpointPath( settings.m_checkpointPath )
+        , m_checkpointInterval( std::max( settings.m_checkpointInterval, 1u ) )
+        , m_isResuming( false )
         , m_currentGeneration( 0 )
         , m_trainingSetAccuracy( 0 )
         , m_testSetAccuracy( 0 )
         , m_trainingSetMSE( 0 )
         , m_testSetMSE( 0 )
+        , m_samplesPerSecond( 0 )
+        , m_numUsedWeights( 0 )
+        , m_activationBytes( 0 )
     {
         assert( networkToTrain != nullptr );
 
-        m_deltaInputHidden.resize( networkToTrain->m_weightsInputHidden.size() );
-        m_deltaHiddenOutput.resize( networkToTrain->m_weightsHiddenOutput.size() );
-        m_errorGradientsHidden.resize( networkToTrain->m_hiddenNeurons.size() );
-        m_errorGradientsOutput.resize( networkToTrain->m_outputNeurons.size() );
-
-        memset( m_deltaInputHidden.data(), 0, sizeof( double ) * m_deltaInputHidden.size() );
-        memset( m_deltaHiddenOutput.data(), 0, sizeof( double ) * m_deltaHiddenOutput.size() );
-        memset( m_errorGradientsHidden.data(), 0, sizeof( double ) * m_errorGradientsHidden.size() );
-        memset( m_errorGradientsOutput.data(), 0, sizeof( double ) * m_errorGradientsOutput.size() );
-		
-    	if (!logFile.is_open())
-		{
-			logFile.open("IrisNNtrainingResult.csv", std::ios::out);
+        for ( int32_t layerIdx = 0; layerIdx < networkToTrain->GetNumLayers(); layerIdx++ )
+        {
+            if ( layerIdx + 1 < networkToTrain->GetNumLayers() )
+            {
+                m_numUsedWeights += (uint64_t) ( networkToTrain->GetLayerWidth( layerIdx ) + 1 ) * networkToTrain->GetLayerWidth( layerIdx + 1 );
+            }
+            m_activationBytes += ( 2 * networkToTrain->GetLayerWidth( layerIdx ) + 1 ) * sizeof( Scalar );
+        }
 
-			if (logFile.is_open())
-			{
-				//write log file header
-				logFile << "Generation,Training Set Accuracy, Training Set MSE, Test Set Accuracy, Test Set MSE" << std::endl;
-			}
-		}
+        // Deltas share the layout of the weights, so they can be applied to all layers in one pass
+        size_t arenaSize = networkToTrain->GetNumWeights();
+
+        m_errorGradientOffsets.resize( networkToTrain->GetNumLayers() );
+        for ( int32_t layerIdx = 1; layerIdx < networkToTrain->GetNumLayers(); layerIdx++ )
+        {
+            m_errorGradientOffsets[layerIdx] = arenaSize;
+            arenaSize += AlignCount<Scalar>( networkToTrain->GetLayerWidth( layerIdx ) );
+        }
+
+        m_arena.Resize( arenaSize );
+
+        m_inputRowSteps.assign( networkToTrain->m_numInputs, 0 );
+        m_momentumPowers.assign( 1, Scalar( 1 ) );
+        m_momentumSums.assign( 1, Scalar( 0 ) );
+
+        m_bestResults.m_testSetMSE = HUGE_VAL;
+        if ( m_earlyStoppingPatience > 0 )
+        {
+            m_bestWeights.Resize( networkToTrain->GetNumWeights() );
+        }
+
+        uint32_t const numThreads = std::max( settings.m_numThreads, 1u );
+
+        if ( m_parallelMode == ParallelMode::Asynchronous )
+        {
+            m_threadPool.reset( new ThreadPool( numThreads ) );
+
+            m_asyncWorkers.resize( numThreads );
+            for ( auto& worker : m_asyncWorkers )
+            {
+                AllocateBatchBuffers( worker.m_buffers, 1 );
+                worker.m_deltas.Resize( networkToTrain->GetNumWeights() );
+            }
+        }
+        else if ( m_batchSize > 1 )
+        {
+            size_t const shardSize = std::min( (size_t) m_batchSize, k_gradientShardSize );
+            size_t const numShards = ( m_batchSize + k_gradientShardSize - 1 ) / k_gradientShardSize;
+
+            m_threadPool.reset( new ThreadPool( numThreads ) );
+
+            m_workerBuffers.resize( numThreads );
+            for ( auto& buffers : m_workerBuffers )
+            {
+                AllocateBatchBuffers( buffers, shardSize );
+            }
+
+            m_shardGradients.resize( numShards );
+            for ( auto& gradients : m_shardGradients )
+            {
+                gradients.m_weights.Resize( networkToTrain->GetNumWeights() );
+            }
+        }
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::Train( TrainingDataType const& trainingData )
+    {
+        TrainGenerations( [this, &trainingData] ( SetStatistics& statistics )
+        {
+            RunGeneration( SetRows<Scalar>{ trainingData.m_trainingSet }, statistics );
+        },
+        [this, &trainingData] ( NetworkType const& network, SetStatistics& statistics )
+        {
+            AccumulateSetStatistics( network, SetRows<Scalar>{ trainingData.m_testSet }, statistics );
+        } );
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::Train( StreamingDataSourceT<Scalar>& dataSource )
+    {
+        // A single chunk is in memory at a time besides the shuffle buffer of the data source. The test split is read through a source of
+        // its own, which can run on the evaluation thread while the training split is read.
+        TrainingSetType chunk;
+        TrainingSetType testChunk;
+        StreamingDataSourceT<Scalar> testSource( dataSource.GetFilename(), m_networkToTrain->m_numInputs, m_networkToTrain->m_numOutputs, dataSource.GetSettings() );
+
+        TrainGenerations( [this, &dataSource, &chunk] ( SetStatistics& statistics )
+        {
+            dataSource.Rewind( StreamingDataSourceT<Scalar>::Split::Training );
+            while ( dataSource.ReadChunk( chunk ) )
+            {
+                RunGeneration( SetRows<Scalar>{ chunk }, statistics );
+            }
+        },
+        [this, &testSource, &testChunk] ( NetworkType const& network, SetStatistics& statistics )
+        {
+            testSource.Rewind( StreamingDataSourceT<Scalar>::Split::Test );
+            while ( testSource.ReadChunk( testChunk ) )
+            {
+                AccumulateSetStatistics( network, SetRows<Scalar>{ testChunk }, statistics );
+            }
+        } );
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::Train( TrainingPipelineT<Scalar>& pipeline )
+    {
+        TrainGenerations( [this, &pipeline] ( SetStatistics& statistics )
+        {
+            // The producer fills the other buffers in the meantime
+            while ( TrainingBatchT<Scalar> const* batch = pipeline.AcquireBatch() )
+            {
+                RunGeneration( BatchRows<Scalar>{ *batch }, statistics );
+                pipeline.ReleaseBatch();
+            }
+        },
+        [this, &pipeline] ( NetworkType const& network, SetStatistics& statistics )
+        {
+            AccumulateSetStatistics( network, BatchRows<Scalar>{ pipeline.GetTestBatch() }, statistics );
+        } );
     }
 
-    void NNTrainer::Train( TrainingData const& trainingData )
+    template<typename Scalar>
+    template<typename TrainFunction, typename TestFunction>
+    void NNTrainerT<Scalar>::TrainGenerations( TrainFunction const& runTraining, TestFunction const& runTest )
     {
-        // Reset training state
-        m_currentGeneration = 0;
+        // Reset training state, a resumed checkpoint keeps its generation and early stopping state
+        if ( !m_isResuming )
+        {
+            m_currentGeneration = 0;
+            m_numGenerationsWithoutImprovement = 0;
+            m_bestResults = GenerationMetrics();
+            m_bestResults.m_testSetMSE = HUGE_VAL;
+        }
+        m_isResuming = false;
         m_trainingSetAccuracy = 0;
         m_testSetAccuracy = 0;
         m_trainingSetMSE = 0;
         m_testSetMSE = 0;
 
+        // Quiet trainers (sweeps, benchmarks) add to the profile of whoever reports it
+        if ( m_logProgress )
+        {
+            Profiling::Reset();
+        }
+
         // Print header
         //-------------------------------------------------------------------------
 
-		std::cout << std::endl << " Neural Network Starting: " << std::endl;
+        // The metrics file is only created once training starts, constructing a trainer does not touch it
+        std::unique_ptr<MetricsSink> metricsSink;
+		if (m_logProgress)
+		{
+			std::cout << std::endl << " Neural Network Starting: " << std::endl;
+
+            std::vector<std::unique_ptr<MetricsWriter>> writers;
+            writers.push_back( MetricsWriter::CreateConsoleWriter() );
+            if ( !m_logPath.empty() )
+            {
+                if ( std::unique_ptr<MetricsWriter> fileWriter = MetricsWriter::CreateFileWriter( m_logPath, m_logFormat ) )
+                {
+                    writers.push_back( std::move( fileWriter ) );
+                }
+                else
+                {
+                    std::cout << "Cannot write the training metrics to " << m_logPath << std::endl;
+                }
+            }
+            metricsSink.reset( new MetricsSink( std::move( writers ) ) );
+		}
+
+        auto const reportGeneration = [this, &metricsSink] ( GenerationMetrics metrics, bool isLastGeneration )
+        {
+            // Only copied into the ring buffer of the sink, formatting and writing happen on its thread
+            if ( metricsSink && ( metrics.m_generation % m_reportInterval == 0 || isLastGeneration ) )
+            {
+                metrics.m_testSetAccuracy = m_testSetAccuracy;
+                metrics.m_testSetMSE = m_testSetMSE;
+                metricsSink->Push( metrics );
+            }
+        };
+
+        // Overlapped evaluation: the snapshot holds the weights after the generation being evaluated, it belongs to the worker until Wait
+        std::unique_ptr<NetworkType> snapshot;
+        std::unique_ptr<BackgroundWorker> evaluationWorker;
+        SetStatistics snapshotStatistics;
+        GenerationMetrics snapshotMetrics = {};
+        bool evaluationPending = false;
+
+        if ( m_overlapEvaluation )
+        {
+            snapshot.reset( new NetworkType( *m_networkToTrain ) );
+            evaluationWorker.reset( new BackgroundWorker() );
+        }
+
+        // Checkpoints are written from a copy of the training state. While the previous one is still being written a due checkpoint
+        // waits for the next generation, so training never waits for the disk.
+        std::unique_ptr<CheckpointState> checkpointState;
+        std::unique_ptr<BackgroundWorker> checkpointWorker;
+        bool checkpointDue = false;
+
+        if ( !m_checkpointPath.empty() )
+        {
+            checkpointState.reset( new CheckpointState() );
+            checkpointWorker.reset( new BackgroundWorker() );
+        }
+
+        auto const writeCheckpoint = [this, &checkpointState, &checkpointWorker] ()
+        {
+            CaptureCheckpoint( *checkpointState );
+            checkpointWorker->Run( [this, &checkpointState] ()
+            {
+                WriteCheckpoint( *checkpointState );
+            } );
+        };
 
         // Train network using training dataset for training and test dataset for testing
 
-        while ( ( m_trainingSetAccuracy < m_desiredAccuracy || m_testSetAccuracy < m_desiredAccuracy ) && m_currentGeneration < m_maxGenerations )
+        while ( !IsTrainingComplete() )
         {
             // Use training set to train network
-            RunGeneration( trainingData.m_trainingSet );
+            SetStatistics trainingStatistics;
+            auto const generationStart = std::chrono::high_resolution_clock::now();
+            {
+                BPN_PROFILE_SCOPE( TrainingPass );
+                runTraining( trainingStatistics );
+            }
+            double const generationSeconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - generationStart ).count();
+            BPN_PROFILE_END_GENERATION( m_currentGeneration, generationSeconds );
+            m_samplesPerSecond = ( generationSeconds > 0 ) ? trainingStatistics.m_numEntries / generationSeconds : 0;
+            GetAccuracyAndMSE( trainingStatistics, m_trainingSetAccuracy, m_trainingSetMSE );
 
-            // Get test set accuracy and MSE
-            GetSetAccuracyAndMSE( trainingData.m_testSet, m_testSetAccuracy, m_testSetMSE );
+            GenerationMetrics const metrics = { m_currentGeneration, 0, m_trainingSetAccuracy, m_trainingSetMSE, 0, 0, m_samplesPerSecond };
+            m_currentGeneration++;
+
+            if ( !evaluationWorker )
+            {
+                // Get test set accuracy and MSE
+                SetStatistics testStatistics;
+                {
+                    BPN_PROFILE_SCOPE( TestPass );
+                    runTest( *m_networkToTrain, testStatistics );
+                }
+                GetAccuracyAndMSE( testStatistics, m_testSetAccuracy, m_testSetMSE );
+                RecordTestResults( metrics, m_networkToTrain->m_weights );
+                reportGeneration( metrics, IsTrainingComplete() );
+            }
+            else
+            {
+                // The previous evaluation has usually finished while this generation trained, its results decide whether to go on
+                if ( evaluationPending )
+                {
+                    evaluationWorker->Wait();
+                    GetAccuracyAndMSE( snapshotStatistics, m_testSetAccuracy, m_testSetMSE );
+                    RecordTestResults( snapshotMetrics, snapshot->m_weights );
+                    reportGeneration( snapshotMetrics, false );
+                }
 
-			if (logFile.is_open())
-			{
-				logFile << m_currentGeneration << "," << m_trainingSetAccuracy << "," << m_trainingSetMSE << "," << m_testSetAccuracy << "," << m_testSetMSE << std::endl;
-			}
-            std::cout << "Generation: " << m_currentGeneration;
-            std::cout << " Training Accuracy:" << m_trainingSetAccuracy << "%, MSE: " << m_trainingSetMSE;
-            std::cout << " Test Accuracy:" << m_testSetAccuracy << "%, MSE: " << m_testSetMSE << std::endl;
+                memcpy( snapshot->m_weights, m_networkToTrain->m_weights, m_networkToTrain->GetNumWeights() * sizeof( Scalar ) );
+                snapshotStatistics = SetStatistics();
+                snapshotMetrics = metrics;
+                evaluationWorker->Run( [&runTest, &snapshot, &snapshotStatistics] ()
+                {
+                    BPN_PROFILE_SCOPE( TestPass );
+                    runTest( *snapshot, snapshotStatistics );
+                } );
+                evaluationPending = true;
+            }
 
-            m_currentGeneration++;
+            checkpointDue = checkpointDue || ( checkpointWorker && m_currentGeneration % m_checkpointInterval == 0 );
+            if ( checkpointDue && checkpointWorker->IsIdle() && !IsTrainingComplete() )
+            {
+                writeCheckpoint();
+                checkpointDue = false;
+            }
 		}
-		logFile.close();
+
+        // The final weights are always evaluated before Train returns
+        if ( evaluationPending )
+        {
+            evaluationWorker->Wait();
+            GetAccuracyAndMSE( snapshotStatistics, m_testSetAccuracy, m_testSetMSE );
+            RecordTestResults( snapshotMetrics, snapshot->m_weights );
+            reportGeneration( snapshotMetrics, true );
+        }
+
+        // The last checkpoint holds the final training state. The previous write still reads the capture buffer, so it has to finish
+        // before the buffer is captured again; training has ended, so the wait costs nothing.
+        if ( checkpointWorker )
+        {
+            checkpointWorker->Wait();
+            writeCheckpoint();
+            checkpointWorker->Wait();
+        }
+
+        // Destroying the sink writes the remaining reports, the profile follows them
+        metricsSink.reset();
+
+        // Early stopping hands back the best weights rather than the last ones
+        if ( m_earlyStoppingPatience > 0 && m_bestResults.m_testSetMSE != HUGE_VAL && m_bestResults.m_generation + 1 != m_currentGeneration )
+        {
+            memcpy( m_networkToTrain->m_weights, m_bestWeights.data(), m_networkToTrain->GetNumWeights() * sizeof( Scalar ) );
+            m_trainingSetAccuracy = m_bestResults.m_trainingSetAccuracy;
+            m_trainingSetMSE = m_bestResults.m_trainingSetMSE;
+            m_testSetAccuracy = m_bestResults.m_testSetAccuracy;
+            m_testSetMSE = m_bestResults.m_testSetMSE;
+
+            if ( m_logProgress )
+            {
+                std::cout << "Early stopping: restored the weights of generation " << m_bestResults.m_generation << ", test MSE " << m_bestResults.m_testSetMSE << std::endl;
+            }
+        }
+
+        if ( m_logProgress && Profiling::IsEnabled() )
+        {
+            Profiling::PrintSummary();
+        }
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::RecordTestResults( GenerationMetrics const& metrics, Scalar const* weights )
+    {
+        if ( m_earlyStoppingPatience == 0 )
+        {
+            return;
+        }
+
+        if ( m_testSetMSE < m_bestResults.m_testSetMSE - m_minMSEImprovement )
+        {
+            m_bestResults = metrics;
+            m_bestResults.m_testSetAccuracy = m_testSetAccuracy;
+            m_bestResults.m_testSetMSE = m_testSetMSE;
+            memcpy( m_bestWeights.data(), weights, m_networkToTrain->GetNumWeights() * sizeof( Scalar ) );
+            m_numGenerationsWithoutImprovement = 0;
+        }
+        else
+        {
+            m_numGenerationsWithoutImprovement++;
+        }
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::CaptureCheckpoint( CheckpointState& state ) const
+    {
+        // The momentum deltas lead the arena, the asynchronous workers keep private deltas which are not saved
+        size_t const numWeights = m_networkToTrain->GetNumWeights();
+        state.m_weights.Resize( numWeights );
+        state.m_deltas.Resize( numWeights );
+        memcpy( state.m_weights.data(), m_networkToTrain->m_weights, numWeights * sizeof( Scalar ) );
+        memcpy( state.m_deltas.data(), m_arena.data(), numWeights * sizeof( Scalar ) );
+
+        bool const hasBestWeights = m_earlyStoppingPatience > 0 && m_bestResults.m_testSetMSE != HUGE_VAL;
+        state.m_bestWeights.Resize( hasBestWeights ? numWeights : 0 );
+        if ( hasBestWeights )
+        {
+            memcpy( state.m_bestWeights.data(), m_bestWeights.data(), numWeights * sizeof( Scalar ) );
+        }
+
+        state.m_generation = m_currentGeneration;
+        state.m_numGenerationsWithoutImprovement = m_numGenerationsWithoutImprovement;
+        state.m_bestResults = m_bestResults;
+    }
+
+    template<typename Scalar>
+    bool NNTrainerT<Scalar>::WriteCheckpoint( CheckpointState const& state ) const
+    {
+        NetworkType const& network = *m_networkToTrain;
+        std::vector<uint32_t> const layerWidths( network.m_layerWidths.begin(), network.m_layerWidths.end() );
+        size_t const widthBytes = layerWidths.size() * sizeof( uint32_t );
+        size_t const weightBytes = state.m_weights.size() * sizeof( Scalar );
+        size_t const bestWeightBytes = state.m_bestWeights.size() * sizeof( Scalar );
+
+        CheckpointFileHeader header = {};
+        memcpy( header.m_magic, k_checkpointFileMagic, sizeof( header.m_magic ) );
+        header.m_version = k_checkpointFileVersion;
+        header.m_scalarSize = sizeof( Scalar );
+        header.m_numLayers = (uint32_t) layerWidths.size();
+        header.m_numWeights = state.m_weights.size();
+        header.m_generation = state.m_generation;
+        header.m_numGenerationsWithoutImprovement = state.m_numGenerationsWithoutImprovement;
+        header.m_hasBestWeights = state.m_bestWeights.size() > 0 ? 1 : 0;
+        header.m_bestGeneration = state.m_bestResults.m_generation;
+        header.m_bestTrainingSetAccuracy = state.m_bestResults.m_trainingSetAccuracy;
+        header.m_bestTrainingSetMSE = state.m_bestResults.m_trainingSetMSE;
+        header.m_bestTestSetAccuracy = state.m_bestResults.m_testSetAccuracy;
+        header.m_bestTestSetMSE = state.m_bestResults.m_testSetMSE;
+
+        uint64_t checksum = ComputeModelChecksum( layerWidths.data(), widthBytes );
+        checksum = ComputeModelChecksum( state.m_weights.data(), weightBytes, checksum );
+        checksum = ComputeModelChecksum( state.m_deltas.data(), weightBytes, checksum );
+        header.m_checksum = ComputeModelChecksum( state.m_bestWeights.data(), bestWeightBytes, checksum );
+
+        // Written next to the checkpoint and renamed over it, so a crash while writing leaves the previous checkpoint intact
+        std::string const temporaryPath = m_checkpointPath + ".tmp";
+        std::ofstream file( temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc );
+        if ( !file.is_open() )
+        {
+            std::cout << "Error opening checkpoint file: " << temporaryPath << std::endl;
+            return false;
+        }
+
+        file.write( reinterpret_cast<char const*>( &header ), sizeof( header ) );
+        file.write( reinterpret_cast<char const*>( layerWidths.data() ), widthBytes );
+        file.write( reinterpret_cast<char const*>( state.m_weights.data() ), weightBytes );
+        file.write( reinterpret_cast<char const*>( state.m_deltas.data() ), weightBytes );
+        file.write( reinterpret_cast<char const*>( state.m_bestWeights.data() ), bestWeightBytes );
+        file.close();
+
+        std::error_code errorCode;
+        if ( file )
+        {
+            std::filesystem::rename( temporaryPath, m_checkpointPath, errorCode );
+        }
+
+        if ( !file || errorCode )
+        {
+            std::cout << "Error writing checkpoint file: " << m_checkpointPath << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    template<typename Scalar>
+    bool NNTrainerT<Scalar>::ResumeFromCheckpoint()
+    {
+        std::ifstream file( m_checkpointPath, std::ios::in | std::ios::binary );
+        if ( !file.is_open() )
+        {
+            std::cout << "Error opening checkpoint file: " << m_checkpointPath << std::endl;
+            return false;
+        }
+
+        // Validate everything before touching the trainer
+        //-------------------------------------------------------------------------
+
+        NetworkType& network = *m_networkToTrain;
+        size_t const numWeights = network.GetNumWeights();
+
+        CheckpointFileHeader header;
+        if ( !file.read( reinterpret_cast<char*>( &header ), sizeof( header ) ) || memcmp( header.m_magic, k_checkpointFileMagic, sizeof( header.m_magic ) ) != 0 ||
+            header.m_version != k_checkpointFileVersion )
+        {
+            std::cout << "Not a checkpoint file of version " << k_checkpointFileVersion << ": " << m_checkpointPath << std::endl;
+            return false;
+        }
+
+        std::vector<uint32_t> layerWidths( header.m_numLayers );
+        std::vector<uint32_t> const networkWidths( network.m_layerWidths.begin(), network.m_layerWidths.end() );
+        if ( header.m_scalarSize != sizeof( Scalar ) || header.m_numWeights != numWeights || header.m_numLayers != networkWidths.size() ||
+            !file.read( reinterpret_cast<char*>( layerWidths.data() ), layerWidths.size() * sizeof( uint32_t ) ) || layerWidths != networkWidths )
+        {
+            std::cout << "Checkpoint was written for another topology or precision: " << m_checkpointPath << std::endl;
+            return false;
+        }
+
+        CheckpointState state;
+        state.m_weights.Resize( numWeights );
+        state.m_deltas.Resize( numWeights );
+        state.m_bestWeights.Resize( header.m_hasBestWeights ? numWeights : 0 );
+        size_t const weightBytes = numWeights * sizeof( Scalar );
+        file.read( reinterpret_cast<char*>( state.m_weights.data() ), weightBytes );
+        file.read( reinterpret_cast<char*>( state.m_deltas.data() ), weightBytes );
+        file.read( reinterpret_cast<char*>( state.m_bestWeights.data() ), state.m_bestWeights.size() * sizeof( Scalar ) );
+
+        uint64_t checksum = ComputeModelChecksum( layerWidths.data(), layerWidths.size() * sizeof( uint32_t ) );
+        checksum = ComputeModelChecksum( state.m_weights.data(), weightBytes, checksum );
+        checksum = ComputeModelChecksum( state.m_deltas.data(), weightBytes, checksum );
+        checksum = ComputeModelChecksum( state.m_bestWeights.data(), state.m_bestWeights.size() * sizeof( Scalar ), checksum );
+        if ( !file || checksum != header.m_checksum )
+        {
+            std::cout << "Checkpoint file is truncated or corrupt: " << m_checkpointPath << std::endl;
+            return false;
+        }
+
+        // Restore
+        //-------------------------------------------------------------------------
+
+        memcpy( network.m_weights, state.m_weights.data(), weightBytes );
+        memcpy( m_arena.data(), state.m_deltas.data(), weightBytes );
+
+        m_bestResults = GenerationMetrics();
+        m_bestResults.m_testSetMSE = HUGE_VAL;
+        if ( header.m_hasBestWeights && m_earlyStoppingPatience > 0 )
+        {
+            memcpy( m_bestWeights.data(), state.m_bestWeights.data(), weightBytes );
+            m_bestResults.m_generation = header.m_bestGeneration;
+            m_bestResults.m_trainingSetAccuracy = header.m_bestTrainingSetAccuracy;
+            m_bestResults.m_trainingSetMSE = header.m_bestTrainingSetMSE;
+            m_bestResults.m_testSetAccuracy = header.m_bestTestSetAccuracy;
+            m_bestResults.m_testSetMSE = header.m_bestTestSetMSE;
+        }
+
+        m_currentGeneration = header.m_generation;
+        m_numGenerationsWithoutImprovement = header.m_numGenerationsWithoutImprovement;
+        m_isResuming = true;
+        return true;
     }
 
-    double NNTrainer::GetHiddenErrorGradient( int32_t hiddenIdx ) const
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::AllocateBatchBuffers( BatchBuffers& buffers, size_t numRows ) const
     {
-        // Get sum of hidden->output weights * output error gradients
-        double weightedSum = 0;
-        for ( auto outputIdx = 0; outputIdx < m_networkToTrain->m_numOutputs; outputIdx++ )
+        NetworkType const& network = *m_networkToTrain;
+
+        // Activations of all layers, then error gradients of all layers but the inputs, each matrix on a cache line
+        std::vector<size_t> activationOffsets( network.GetNumLayers() );
+        std::vector<size_t> errorGradientOffsets( network.GetNumLayers() );
+        size_t arenaSize = 0;
+
+        for ( int32_t layerIdx = 0; layerIdx < network.GetNumLayers(); layerIdx++ )
         {
-            int32_t const weightIdx = m_networkToTrain->GetHiddenOutputWeightIndex( hiddenIdx, outputIdx );
-            weightedSum += m_networkToTrain->m_weightsHiddenOutput[weightIdx] * m_errorGradientsOutput[outputIdx];
+            activationOffsets[layerIdx] = arenaSize;
+            arenaSize += AlignCount<Scalar>( numRows * GetActivationStride( layerIdx ) );
+        }
+
+        for ( int32_t layerIdx = 1; layerIdx < network.GetNumLayers(); layerIdx++ )
+        {
+            errorGradientOffsets[layerIdx] = arenaSize;
+            arenaSize += AlignCount<Scalar>( numRows * network.GetLayerWidth( layerIdx ) );
+        }
+
+        buffers.m_arena.Resize( arenaSize );
+        buffers.m_activations.resize( network.GetNumLayers() );
+        buffers.m_errorGradients.assign( network.GetNumLayers(), nullptr );
+
+        for ( int32_t layerIdx = 0; layerIdx < network.GetNumLayers(); layerIdx++ )
+        {
+            buffers.m_activations[layerIdx] = buffers.m_arena.data() + activationOffsets[layerIdx];
+            if ( layerIdx > 0 )
+            {
+                buffers.m_errorGradients[layerIdx] = buffers.m_arena.data() + errorGradientOffsets[layerIdx];
+            }
         }
-        
-        // Return error gradient
-        return m_networkToTrain->m_hiddenNeurons[hiddenIdx] * ( 1.0 - m_networkToTrain->m_hiddenNeurons[hiddenIdx] ) * weightedSum;
     }
 
-    void NNTrainer::RunGeneration( TrainingSet const& trainingSet )
+    template<typename Scalar>
+    template<typename Rows>
+    void NNTrainerT<Scalar>::RunGeneration( Rows const& rows, SetStatistics& statistics )
     {
+        if ( m_parallelMode == ParallelMode::Asynchronous )
+        {
+            RunAsynchronousGeneration( rows, statistics );
+            return;
+        }
+
+        if ( m_batchSize > 1 )
+        {
+            RunBatchedGeneration( rows, statistics );
+            return;
+        }
+
         double incorrectEntries = 0;
         double MSE = 0;
+        uint64_t numSkippedWeights = 0;
+        Scalar const* const outputNeurons = m_workspace.GetOutputs();
 
-        for ( auto const& trainingEntry : trainingSet )
+        // A catch-up spans at most the sparse samples of this pass
+        while ( m_momentumPowers.size() <= m_numSparseSteps + rows.size() )
         {
+            m_momentumPowers.push_back( m_momentumPowers.back() * m_momentum );
+            m_momentumSums.push_back( m_momentumSums.back() + m_momentumPowers.back() );
+        }
+
+        for ( size_t rowIdx = 0; rowIdx < rows.size(); rowIdx++ )
+        {
+            int32_t const* const expectedOutputs = rows.GetExpectedOutputs( rowIdx );
+
             // Feed inputs through network and back propagate errors
-            m_networkToTrain->Evaluate( trainingEntry.m_inputs );
-            Backpropagate( trainingEntry.m_expectedOutputs );
+            if ( rows.IsSparse( rowIdx ) )
+            {
+                SparseInputsType const inputs = rows.GetSparseInputs( rowIdx );
+                for ( int32_t nonzeroIdx = 0; nonzeroIdx < inputs.m_numNonzeros; nonzeroIdx++ )
+                {
+                    CatchUpInputRow( inputs.m_indices[nonzeroIdx] );
+                }
+
+                {
+                    BPN_PROFILE_SCOPE( Forward );
+                    m_networkToTrain->Evaluate( inputs, m_workspace );
+                }
+                Backpropagate( expectedOutputs, &inputs );
+                m_numSparseSteps++;
+                numSkippedWeights += GetNumSkippedWeights( inputs.m_numNonzeros );
+            }
+            else
+            {
+                FlushInputRows();
+                {
+                    BPN_PROFILE_SCOPE( Forward );
+                    m_networkToTrain->Evaluate( rows.GetInputs( rowIdx ), m_workspace );
+                }
+                Backpropagate( expectedOutputs );
+            }
 
             // Check all outputs from neural network against desired values
             bool resultCorrect = true;
             for ( int outputIdx = 0; outputIdx < m_networkToTrain->m_numOutputs; outputIdx++ )
             {
-                if ( m_networkToTrain->m_clampedOutputs[outputIdx] != trainingEntry.m_expectedOutputs[outputIdx] )
+                if ( m_workspace.m_clampedOutputs[outputIdx] != expectedOutputs[outputIdx] )
                 {
                     resultCorrect = false;
                 }
 
                 // Calculate MSE
-                MSE += pow( ( m_networkToTrain->m_outputNeurons[outputIdx] - trainingEntry.m_expectedOutputs[outputIdx] ), 2);
+                MSE += pow( ( outputNeurons[outputIdx] - expectedOutputs[outputIdx] ), 2);
             }
 
             if ( !resultCorrect )
@@ -123,105 +721,577 @@ namespace BPN
             }
         }
 
-        // Update training accuracy and MSE
-        m_trainingSetAccuracy = 100.0 - ( incorrectEntries / trainingSet.size() * 100.0 );
-        m_trainingSetMSE = MSE / ( m_networkToTrain->m_numOutputs * trainingSet.size() );
+        // The weights are read by the test pass and copied into snapshots
+        FlushInputRows();
+
+        // Forward pass, hidden error gradients, deltas and update; the weights are read by the forward pass and read and written once
+        // more together with the deltas by the fused backward pass
+        BPN_PROFILE_COUNT( TrainedSamples, rows.size() );
+        BPN_PROFILE_COUNT( Flops, 8 * ( rows.size() * m_numUsedWeights - numSkippedWeights ) );
+        BPN_PROFILE_COUNT( BytesTouched, 5 * ( rows.size() * m_numUsedWeights - numSkippedWeights ) * sizeof( Scalar ) );
+
+        statistics.m_incorrectEntries += incorrectEntries;
+        statistics.m_squaredError += MSE;
+        statistics.m_numEntries += rows.size();
     }
 
-    void NNTrainer::Backpropagate( std::vector<int32_t> const& expectedOutputs )
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::Backpropagate( int32_t const* expectedOutputs, SparseInputsType const* sparseInputs )
     {
-        // Modify deltas between hidden and output layers
+        BPN_PROFILE_SCOPE( Backpropagate );
+
+        NetworkType& network = *m_networkToTrain;
+        int32_t const outputLayerIdx = network.GetNumLayers() - 1;
+        Scalar* const deltas = m_arena.data();
+
+        // Get error gradient for every output node
         //--------------------------------------------------------------------------------------------------------
-        for ( auto OutputIdx = 0; OutputIdx < m_networkToTrain->m_numOutputs; OutputIdx++ )
+
+        Activations::GetOutputErrorGradients( network.GetOutputActivation(), network.m_numOutputs, expectedOutputs, m_workspace.GetNeurons( outputLayerIdx ), GetErrorGradients( outputLayerIdx ) );
+
+        // Walk the layers backwards, one sweep per layer: every row of outgoing weights gives the weighted error sum of its neuron
+        // before it takes this sample's deltas, the hidden gradients of a layer only need the rows of the layer above it
+        //--------------------------------------------------------------------------------------------------------
+
+        for ( int32_t layerIdx = network.GetNumWeightLayers() - 1; layerIdx >= 0; layerIdx-- )
         {
-            // Get error gradient for every output node
-            m_errorGradientsOutput[OutputIdx] = GetOutputErrorGradient
-        	( static_cast<double>(expectedOutputs[OutputIdx]), m_networkToTrain->m_outputNeurons[OutputIdx] );
+            int32_t const numNeurons = network.GetLayerWidth( layerIdx );
+            int32_t const numNextNeurons = network.GetLayerWidth( layerIdx + 1 );
+            Scalar const* const neurons = m_workspace.GetNeurons( layerIdx );
+            Scalar const* const nextErrorGradients = GetErrorGradients( layerIdx + 1 );
+            Scalar* const layerWeights = network.GetLayerWeights( layerIdx );
+            Scalar* const layerDeltas = deltas + network.m_weightOffsets[layerIdx];
+            Scalar* const biasWeights = layerWeights + (size_t) numNeurons * numNextNeurons;
+            Scalar* const biasDeltas = layerDeltas + (size_t) numNeurons * numNextNeurons;
 
-            // For all nodes in hidden layer and bias neuron
-            for ( auto hiddenIdx = 0; hiddenIdx <= m_networkToTrain->m_numHidden; hiddenIdx++ )
+            // The bias neuron (-1) has no incoming weights and needs no error gradient, only its row is updated
+            Kernels::MomentumUpdate( numNextNeurons, -m_learningRate, nextErrorGradients, m_momentum, biasDeltas, biasWeights );
+
+            // Hidden nodes: error gradient, deltas and update of a node from one pass over its contiguous row
+            if ( layerIdx > 0 )
             {
-                int32_t const weightIdx = m_networkToTrain->GetHiddenOutputWeightIndex( hiddenIdx, OutputIdx );
+                Scalar* const errorGradients = GetErrorGradients( layerIdx );
+                for ( auto neuronIdx = 0; neuronIdx < numNeurons; neuronIdx++ )
+                {
+                    size_t const rowOffset = (size_t) neuronIdx * numNextNeurons;
+                    errorGradients[neuronIdx] = Kernels::DotMomentumUpdate( numNextNeurons, m_learningRate * neurons[neuronIdx], nextErrorGradients, m_momentum, layerDeltas + rowOffset, layerWeights + rowOffset );
+                }
+                Activations::MultiplyByDerivative( network.GetHiddenActivation(), numNeurons, neurons, errorGradients );
+                continue;
+            }
 
-                // Calculate change in weight
+            // Sparse inputs: only the rows of the nonzero inputs, which are then up to date including this sample; the input
+            // activations were never written
+            if ( sparseInputs != nullptr )
+            {
+                for ( int32_t nonzeroIdx = 0; nonzeroIdx < sparseInputs->m_numNonzeros; nonzeroIdx++ )
+                {
+                    int32_t const inputIdx = sparseInputs->m_indices[nonzeroIdx];
+                    size_t const rowOffset = (size_t) inputIdx * numNextNeurons;
+                    Kernels::MomentumUpdate( numNextNeurons, m_learningRate * sparseInputs->m_values[nonzeroIdx], nextErrorGradients, m_momentum, layerDeltas + rowOffset, layerWeights + rowOffset );
+                    m_inputRowSteps[inputIdx] = m_numSparseSteps + 1;
+                }
+                continue;
+            }
 
-                    m_deltaHiddenOutput[weightIdx]
-                	= m_learningRate * m_networkToTrain->m_hiddenNeurons[hiddenIdx] * m_errorGradientsOutput[OutputIdx]
-                	+ m_momentum 
-                	* m_deltaHiddenOutput[weightIdx];
-                
+            for ( auto neuronIdx = 0; neuronIdx < numNeurons; neuronIdx++ )
+            {
+                size_t const rowOffset = (size_t) neuronIdx * numNextNeurons;
+                Kernels::MomentumUpdate( numNextNeurons, m_learningRate * neurons[neuronIdx], nextErrorGradients, m_momentum, layerDeltas + rowOffset, layerWeights + rowOffset );
             }
         }
+    }
 
-        // Modify deltas between input and hidden layers
-        //--------------------------------------------------------------------------------------------------------
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::CatchUpInputRow( int32_t inputIdx )
+    {
+        uint32_t const numMissedSteps = m_numSparseSteps - m_inputRowSteps[inputIdx];
+        if ( numMissedSteps == 0 )
+        {
+            return;
+        }
+
+        // k steps without a gradient: weights += ( momentum + ... + momentum^k ) * deltas, deltas *= momentum^k
+        NetworkType& network = *m_networkToTrain;
+        int32_t const numNextNeurons = network.GetLayerWidth( 1 );
+        size_t const weightIdx = network.GetWeightIndex( 0, inputIdx, 0 );
+        Scalar* const deltas = m_arena.data() + weightIdx;
+        Kernels::Axpy( numNextNeurons, m_momentumSums[numMissedSteps], deltas, network.m_weights + weightIdx );
+        Kernels::Axpby( numNextNeurons, Scalar( 0 ), deltas, m_momentumPowers[numMissedSteps], deltas );
+        m_inputRowSteps[inputIdx] = m_numSparseSteps;
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::FlushInputRows()
+    {
+        if ( m_numSparseSteps == 0 )
+        {
+            return;
+        }
+
+        for ( int32_t inputIdx = 0; inputIdx < m_networkToTrain->m_numInputs; inputIdx++ )
+        {
+            CatchUpInputRow( inputIdx );
+        }
+
+        m_numSparseSteps = 0;
+        std::fill( m_inputRowSteps.begin(), m_inputRowSteps.end(), 0 );
+    }
+
+    template<typename Scalar>
+    template<typename Rows>
+    void NNTrainerT<Scalar>::RunBatchedGeneration( Rows const& rows, SetStatistics& statistics )
+    {
+        double incorrectEntries = 0;
+        double MSE = 0;
+
+        for ( size_t firstEntry = 0; firstEntry < rows.size(); firstEntry += m_batchSize )
+        {
+            size_t const batchEntries = std::min( (size_t) m_batchSize, rows.size() - firstEntry );
+            size_t const numShards = ( batchEntries + k_gradientShardSize - 1 ) / k_gradientShardSize;
+
+            // Every shard is computed from the same weights by whichever worker picks it up
+            m_threadPool->ParallelFor( numShards, [&] ( size_t shardIdx, uint32_t workerIdx )
+            {
+                size_t const shardFirstEntry = firstEntry + shardIdx * k_gradientShardSize;
+                size_t const shardEntries = std::min( k_gradientShardSize, batchEntries - shardIdx * k_gradientShardSize );
+                AccumulateBatchGradients( rows, shardFirstEntry, shardEntries, m_workerBuffers[workerIdx], m_shardGradients[shardIdx] );
+            } );
+
+            ReduceShardGradients( numShards );
+            ApplyBatchGradients( m_shardGradients[0] );
+
+            incorrectEntries += m_shardGradients[0].m_incorrectEntries;
+            MSE += m_shardGradients[0].m_squaredError;
+        }
+
+        statistics.m_incorrectEntries += incorrectEntries;
+        statistics.m_squaredError += MSE;
+        statistics.m_numEntries += rows.size();
+    }
+
+    template<typename Scalar>
+    template<typename Rows>
+    void NNTrainerT<Scalar>::AccumulateBatchGradients( Rows const& rows, size_t firstEntry, size_t numEntries, BatchBuffers& buffers, GradientBuffers& gradients ) const
+    {
+        BPN_PROFILE_SCOPE( BatchGradients );
+
+        NetworkType const& network = *m_networkToTrain;
+        int32_t const numRows = (int32_t) numEntries;
+        int32_t const numInputs = network.m_numInputs;
+        int32_t const numOutputs = network.m_numOutputs;
+        int32_t const outputLayerIdx = network.GetNumLayers() - 1;
+
+        // Gather inputs into a contiguous matrix with a trailing bias column, or into a CSR matrix if any row is sparse
+        //-------------------------------------------------------------------------
+
+        bool isSparse = false;
+        for ( int32_t rowIdx = 0; rowIdx < numRows && !isSparse; rowIdx++ )
+        {
+            isSparse = rows.IsSparse( firstEntry + rowIdx );
+        }
+
+        uint64_t numSkippedWeights = 0;
+        int32_t const inputStride = GetActivationStride( 0 );
+        if ( isSparse )
+        {
+            buffers.m_rowOffsets.assign( 1, 0 );
+            buffers.m_columnIndices.clear();
+            buffers.m_values.clear();
+            for ( int32_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
+            {
+                if ( rows.IsSparse( firstEntry + rowIdx ) )
+                {
+                    SparseInputsType const inputs = rows.GetSparseInputs( firstEntry + rowIdx );
+                    buffers.m_columnIndices.insert( buffers.m_columnIndices.end(), inputs.m_indices, inputs.m_indices + inputs.m_numNonzeros );
+                    buffers.m_values.insert( buffers.m_values.end(), inputs.m_values, inputs.m_values + inputs.m_numNonzeros );
+                }
+                else
+                {
+                    Scalar const* const inputs = rows.GetInputs( firstEntry + rowIdx );
+                    for ( int32_t inputIdx = 0; inputIdx < numInputs; inputIdx++ )
+                    {
+                        if ( inputs[inputIdx] != Scalar( 0 ) )
+                        {
+                            buffers.m_columnIndices.push_back( inputIdx );
+                            buffers.m_values.push_back( inputs[inputIdx] );
+                        }
+                    }
+                }
+
+                numSkippedWeights += GetNumSkippedWeights( (int32_t) buffers.m_columnIndices.size() - buffers.m_rowOffsets.back() );
+                buffers.m_rowOffsets.push_back( (int32_t) buffers.m_columnIndices.size() );
+            }
+        }
+        else
+        {
+            for ( int32_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
+            {
+                Scalar* const inputRow = buffers.m_activations[0] + (size_t) rowIdx * inputStride;
+                memcpy( inputRow, rows.GetInputs( firstEntry + rowIdx ), numInputs * sizeof( Scalar ) );
+                inputRow[numInputs] = Scalar( -1 );
+            }
+        }
+
+        // Forward pass: next activations = activation( activations x weights ), layer by layer
+        //-------------------------------------------------------------------------
+
+        for ( int32_t layerIdx = 0; layerIdx < network.GetNumWeightLayers(); layerIdx++ )
+        {
+            int32_t const numNextNeurons = network.GetLayerWidth( layerIdx + 1 );
+            int32_t const stride = GetActivationStride( layerIdx );
+            int32_t const nextStride = GetActivationStride( layerIdx + 1 );
+            Scalar* const nextActivations = buffers.m_activations[layerIdx + 1];
+
+            if ( layerIdx == 0 && isSparse )
+            {
+                // The bias row (bias neuron is -1) plus the weight rows of the nonzero inputs
+                Scalar const* const layerWeights = network.GetLayerWeights( 0 );
+                Kernels::BroadcastRow( numRows, numNextNeurons, Scalar( -1 ), layerWeights + (size_t) numInputs * numNextNeurons, nextActivations, nextStride );
+                Kernels::SparseGemmNN( numRows, numNextNeurons, buffers.m_rowOffsets.data(), buffers.m_columnIndices.data(), buffers.m_values.data(), layerWeights, numNextNeurons, nextActivations, nextStride );
+            }
+            else
+            {
+                memset( nextActivations, 0, (size_t) numRows * nextStride * sizeof( Scalar ) );
+                Kernels::GemmNN( numRows, numNextNeurons, stride, buffers.m_activations[layerIdx], stride, network.GetLayerWeights( layerIdx ), numNextNeurons, nextActivations, nextStride );
+            }
+            Kernels::Activate( network.GetLayerActivation( layerIdx + 1 ), numRows, numNextNeurons, nextActivations, nextStride );
+
+            if ( nextStride > numNextNeurons )
+            {
+                for ( int32_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
+                {
+                    nextActivations[(size_t) rowIdx * nextStride + numNextNeurons] = Scalar( -1 );
+                }
+            }
+        }
+
+        // Output error gradients, accuracy and MSE
+        //-------------------------------------------------------------------------
+
+        gradients.m_incorrectEntries = 0;
+        gradients.m_squaredError = 0;
 
-        for ( auto hiddenIdx = 0; hiddenIdx <= m_networkToTrain->m_numHidden; hiddenIdx++ )
+        for ( int32_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
         {
-            // Get error gradient for every hidden node
-            m_errorGradientsHidden[hiddenIdx] = GetHiddenErrorGradient( hiddenIdx );
+            int32_t const* const expectedOutputs = rows.GetExpectedOutputs( firstEntry + rowIdx );
+            Scalar const* const outputRow = buffers.m_activations[outputLayerIdx] + (size_t) rowIdx * numOutputs;
+            Scalar* const gradientRow = buffers.m_errorGradients[outputLayerIdx] + (size_t) rowIdx * numOutputs;
 
-            // For all nodes in input layer and bias neuron
-            for ( auto inputIdx = 0; inputIdx <= m_networkToTrain->m_numInputs; inputIdx++ )
+            Activations::GetOutputErrorGradients( network.GetOutputActivation(), numOutputs, expectedOutputs, outputRow, gradientRow );
+
+            bool resultCorrect = true;
+            for ( int32_t outputIdx = 0; outputIdx < numOutputs; outputIdx++ )
             {
-                int32_t const weightIdx = m_networkToTrain->GetInputHiddenWeightIndex( inputIdx, hiddenIdx );
+                Scalar const outputValue = outputRow[outputIdx];
 
-                // Calculate change in weight 
+                int32_t const clampedOutput = ( outputValue >= 0.5 ) ? 1 : 0;
+                if ( clampedOutput != expectedOutputs[outputIdx] )
+                {
+                    resultCorrect = false;
+                }
+
+                gradients.m_squaredError += pow( ( outputValue - expectedOutputs[outputIdx] ), 2 );
+            }
 
-                    m_deltaInputHidden[weightIdx] = m_learningRate * m_networkToTrain->m_inputNeurons[inputIdx] * m_errorGradientsHidden[hiddenIdx] + m_momentum * m_deltaInputHidden[weightIdx];
-                
+            if ( !resultCorrect )
+            {
+                gradients.m_incorrectEntries++;
             }
         }
-            UpdateWeights();
+
+        // Hidden error gradients: ( next error gradients x transpose( weights ) ) * activation derivative, the bias neurons have no incoming weights
+        //-------------------------------------------------------------------------
+
+        for ( int32_t layerIdx = outputLayerIdx - 1; layerIdx > 0; layerIdx-- )
+        {
+            int32_t const numNeurons = network.GetLayerWidth( layerIdx );
+            int32_t const numNextNeurons = network.GetLayerWidth( layerIdx + 1 );
+            int32_t const stride = GetActivationStride( layerIdx );
+            Scalar* const errorGradients = buffers.m_errorGradients[layerIdx];
+
+            memset( errorGradients, 0, (size_t) numRows * numNeurons * sizeof( Scalar ) );
+            Kernels::GemmNT( numRows, numNeurons, numNextNeurons, buffers.m_errorGradients[layerIdx + 1], numNextNeurons, network.GetLayerWeights( layerIdx ), numNextNeurons, errorGradients, numNeurons );
+
+            for ( int32_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
+            {
+                Scalar const* const activationRow = buffers.m_activations[layerIdx] + (size_t) rowIdx * stride;
+                Activations::MultiplyByDerivative( network.GetHiddenActivation(), numNeurons, activationRow, errorGradients + (size_t) rowIdx * numNeurons );
+            }
+        }
+
+        // Weight gradients summed over the batch: transpose( activations ) x next error gradients
+        //-------------------------------------------------------------------------
+
+        gradients.m_weights.Clear();
+        for ( int32_t layerIdx = 0; layerIdx < network.GetNumWeightLayers(); layerIdx++ )
+        {
+            int32_t const numNextNeurons = network.GetLayerWidth( layerIdx + 1 );
+            int32_t const stride = GetActivationStride( layerIdx );
+            Scalar* const layerGradients = gradients.m_weights.data() + network.m_weightOffsets[layerIdx];
+
+            if ( layerIdx == 0 && isSparse )
+            {
+                // Rows of the nonzero inputs, and the bias row: minus the sum of the error gradients
+                Scalar const* const nextErrorGradients = buffers.m_errorGradients[1];
+                Kernels::SparseGemmTN( numRows, numNextNeurons, buffers.m_rowOffsets.data(), buffers.m_columnIndices.data(), buffers.m_values.data(), nextErrorGradients, numNextNeurons, layerGradients, numNextNeurons );
+                for ( int32_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
+                {
+                    Kernels::Axpy( numNextNeurons, Scalar( -1 ), nextErrorGradients + (size_t) rowIdx * numNextNeurons, layerGradients + (size_t) numInputs * numNextNeurons );
+                }
+                continue;
+            }
+
+            Kernels::GemmTN( stride, numNextNeurons, numRows, buffers.m_activations[layerIdx], stride, buffers.m_errorGradients[layerIdx + 1], numNextNeurons, layerGradients, numNextNeurons );
+        }
+
+        // Forward pass, hidden error gradients and weight gradients per row; the weights are read twice, the gradients cleared and accumulated
+        BPN_PROFILE_COUNT( TrainedSamples, numRows );
+        BPN_PROFILE_COUNT( Flops, 6 * ( (uint64_t) numRows * m_numUsedWeights - numSkippedWeights ) );
+        BPN_PROFILE_COUNT( BytesTouched, 5 * m_numUsedWeights * sizeof( Scalar ) + (uint64_t) numRows * m_activationBytes );
     }
 
-    void NNTrainer::UpdateWeights()
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::ReduceShardGradients( size_t numShards )
     {
-        // Input -> hidden weights
-        //--------------------------------------------------------------------------------------------------------
+        BPN_PROFILE_SCOPE( ReduceGradients );
+
+        // Pairwise tree sum in shard order: shard i absorbs shard i + stride, the result ends up in shard 0
+        for ( size_t stride = 1; stride < numShards; stride *= 2 )
+        {
+            size_t const numPairs = ( numShards + 2 * stride - 1 ) / ( 2 * stride );
+            m_threadPool->ParallelFor( numPairs, [this, stride, numShards] ( size_t pairIdx, uint32_t )
+            {
+                size_t const targetIdx = pairIdx * 2 * stride;
+                size_t const sourceIdx = targetIdx + stride;
+                if ( sourceIdx >= numShards )
+                {
+                    return;
+                }
+
+                GradientBuffers& target = m_shardGradients[targetIdx];
+                GradientBuffers const& source = m_shardGradients[sourceIdx];
+                Kernels::Axpy( (int32_t) target.m_weights.size(), Scalar( 1 ), source.m_weights.data(), target.m_weights.data() );
+                target.m_incorrectEntries += source.m_incorrectEntries;
+                target.m_squaredError += source.m_squaredError;
+
+                BPN_PROFILE_COUNT( Flops, 2 * m_numUsedWeights );
+                BPN_PROFILE_COUNT( BytesTouched, 3 * m_numUsedWeights * sizeof( Scalar ) );
+            } );
+        }
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::ApplyBatchGradients( GradientBuffers const& gradients )
+    {
+        BPN_PROFILE_SCOPE( ApplyGradients );
+        BPN_PROFILE_COUNT( Flops, 4 * m_numUsedWeights );
+        BPN_PROFILE_COUNT( BytesTouched, 5 * m_numUsedWeights * sizeof( Scalar ) );
 
-        for ( auto InputIdx = 0; InputIdx <= m_networkToTrain->m_numInputs; InputIdx++ )
+        // A single momentum step per batch over all layers, the learning rate applies to the summed gradient so it keeps its per sample meaning
+        Kernels::MomentumUpdate( (int32_t) m_networkToTrain->GetNumWeights(), m_learningRate, gradients.m_weights.data(), m_momentum, m_arena.data(), m_networkToTrain->m_weights );
+    }
+
+    template<typename Scalar>
+    template<typename Rows>
+    void NNTrainerT<Scalar>::RunAsynchronousGeneration( Rows const& rows, SetStatistics& statistics )
+    {
+        // Every thread walks its own contiguous slice of the training set
+        size_t const numSlices = m_asyncWorkers.size();
+        m_threadPool->ParallelFor( numSlices, [this, &rows, numSlices] ( size_t sliceIdx, uint32_t )
         {
-            for ( auto hiddenIdx = 0; hiddenIdx <= m_networkToTrain->m_numHidden; hiddenIdx++ )
+            AsyncWorkerState& worker = m_asyncWorkers[sliceIdx];
+            worker.m_incorrectEntries = 0;
+            worker.m_squaredError = 0;
+
+            size_t const firstEntry = rows.size() * sliceIdx / numSlices;
+            size_t const lastEntry = rows.size() * ( sliceIdx + 1 ) / numSlices;
+            for ( size_t entryIdx = firstEntry; entryIdx < lastEntry; entryIdx++ )
             {
-                int32_t const weightIdx = m_networkToTrain->GetInputHiddenWeightIndex( InputIdx, hiddenIdx );
-                m_networkToTrain->m_weightsInputHidden[weightIdx] += m_deltaInputHidden[weightIdx];
+                Scalar const* inputs = rows.GetInputs( entryIdx );
+                if ( rows.IsSparse( entryIdx ) )
+                {
+                    SparseInputsType const sparseInputs = rows.GetSparseInputs( entryIdx );
+                    worker.m_denseInputs.assign( m_networkToTrain->m_numInputs, Scalar( 0 ) );
+                    for ( int32_t nonzeroIdx = 0; nonzeroIdx < sparseInputs.m_numNonzeros; nonzeroIdx++ )
+                    {
+                        worker.m_denseInputs[sparseInputs.m_indices[nonzeroIdx]] = sparseInputs.m_values[nonzeroIdx];
+                    }
+                    inputs = worker.m_denseInputs.data();
+                }
+
+                TrainEntryAsynchronous( inputs, rows.GetExpectedOutputs( entryIdx ), worker );
             }
+
+            BPN_PROFILE_COUNT( TrainedSamples, lastEntry - firstEntry );
+            BPN_PROFILE_COUNT( Flops, ( lastEntry - firstEntry ) * 8 * m_numUsedWeights );
+            BPN_PROFILE_COUNT( BytesTouched, ( lastEntry - firstEntry ) * 5 * m_numUsedWeights * sizeof( Scalar ) );
+        } );
+
+        double incorrectEntries = 0;
+        double MSE = 0;
+        for ( auto const& worker : m_asyncWorkers )
+        {
+            incorrectEntries += worker.m_incorrectEntries;
+            MSE += worker.m_squaredError;
         }
 
-        // Hidden -> output weights
-        //--------------------------------------------------------------------------------------------------------
+        statistics.m_incorrectEntries += incorrectEntries;
+        statistics.m_squaredError += MSE;
+        statistics.m_numEntries += rows.size();
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::TrainEntryAsynchronous( Scalar const* inputs, int32_t const* expectedOutputs, AsyncWorkerState& worker )
+    {
+        BPN_PROFILE_SCOPE( AsyncSample );
 
-        for ( auto hiddenIdx = 0; hiddenIdx <= m_networkToTrain->m_numHidden; hiddenIdx++ )
+        NetworkType& network = *m_networkToTrain;
+        int32_t const numInputs = network.m_numInputs;
+        int32_t const numOutputs = network.m_numOutputs;
+        int32_t const outputLayerIdx = network.GetNumLayers() - 1;
+        Scalar* const weights = network.m_weights;
+        std::vector<Scalar*> const& activations = worker.m_buffers.m_activations;
+        std::vector<Scalar*> const& errorGradients = worker.m_buffers.m_errorGradients;
+
+        memcpy( activations[0], inputs, numInputs * sizeof( Scalar ) );
+        activations[0][numInputs] = Scalar( -1 );
+
+        // Forward pass on the shared weights
+        //-------------------------------------------------------------------------
+
+        for ( int32_t layerIdx = 0; layerIdx < network.GetNumWeightLayers(); layerIdx++ )
+        {
+            int32_t const numNeurons = network.GetLayerWidth( layerIdx );
+            int32_t const numNextNeurons = network.GetLayerWidth( layerIdx + 1 );
+            Scalar* const nextActivations = activations[layerIdx + 1];
+
+            std::fill( nextActivations, nextActivations + numNextNeurons, Scalar( 0 ) );
+            for ( int32_t neuronIdx = 0; neuronIdx <= numNeurons; neuronIdx++ )
+            {
+                Scalar const neuronValue = activations[layerIdx][neuronIdx];
+                for ( int32_t nextNeuronIdx = 0; nextNeuronIdx < numNextNeurons; nextNeuronIdx++ )
+                {
+                    nextActivations[nextNeuronIdx] += neuronValue * LoadRelaxed( &weights[network.GetWeightIndex( layerIdx, neuronIdx, nextNeuronIdx )] );
+                }
+            }
+
+            Kernels::Activate( network.GetLayerActivation( layerIdx + 1 ), 1, numNextNeurons, nextActivations, numNextNeurons );
+
+            if ( layerIdx + 1 < outputLayerIdx )
+            {
+                nextActivations[numNextNeurons] = Scalar( -1 );
+            }
+        }
+
+        // Output error gradients, accuracy and MSE
+        //-------------------------------------------------------------------------
+
+        Activations::GetOutputErrorGradients( network.GetOutputActivation(), numOutputs, expectedOutputs, activations[outputLayerIdx], errorGradients[outputLayerIdx] );
+
+        bool resultCorrect = true;
+        for ( int32_t outputIdx = 0; outputIdx < numOutputs; outputIdx++ )
         {
-            for ( auto outputIdx = 0; outputIdx < m_networkToTrain->m_numOutputs; outputIdx++ )
+            Scalar const outputValue = activations[outputLayerIdx][outputIdx];
+
+            int32_t const clampedOutput = ( outputValue >= 0.5 ) ? 1 : 0;
+            if ( clampedOutput != expectedOutputs[outputIdx] )
             {
-                int32_t const weightIdx = m_networkToTrain->GetHiddenOutputWeightIndex( hiddenIdx, outputIdx );
-                m_networkToTrain->m_weightsHiddenOutput[weightIdx] += m_deltaHiddenOutput[weightIdx];
+                resultCorrect = false;
+            }
+
+            worker.m_squaredError += pow( ( outputValue - expectedOutputs[outputIdx] ), 2 );
+        }
+
+        if ( !resultCorrect )
+        {
+            worker.m_incorrectEntries++;
+        }
+
+        // Hidden error gradients and private momentum deltas in one sweep per layer: every shared weight is loaded once, feeds the
+        // error gradient of its neuron (from the weights before this sample's update) and gets its delta added in place
+        //-------------------------------------------------------------------------
+
+        for ( int32_t layerIdx = outputLayerIdx - 1; layerIdx >= 0; layerIdx-- )
+        {
+            int32_t const numNeurons = network.GetLayerWidth( layerIdx );
+            int32_t const numNextNeurons = network.GetLayerWidth( layerIdx + 1 );
+            Scalar const* const nextErrorGradients = errorGradients[layerIdx + 1];
+            Scalar* const layerWeights = network.GetLayerWeights( layerIdx );
+            Scalar* const layerDeltas = worker.m_deltas.data() + network.m_weightOffsets[layerIdx];
+
+            // The bias neuron and the inputs need no error gradients
+            for ( int32_t neuronIdx = 0; neuronIdx <= numNeurons; neuronIdx++ )
+            {
+                Scalar const scaledNeuronValue = m_learningRate * activations[layerIdx][neuronIdx];
+                Scalar* const weightRow = layerWeights + (size_t) neuronIdx * numNextNeurons;
+                Scalar* const deltaRow = layerDeltas + (size_t) neuronIdx * numNextNeurons;
+
+                if ( layerIdx == 0 || neuronIdx == numNeurons )
+                {
+                    for ( int32_t nextNeuronIdx = 0; nextNeuronIdx < numNextNeurons; nextNeuronIdx++ )
+                    {
+                        deltaRow[nextNeuronIdx] = scaledNeuronValue * nextErrorGradients[nextNeuronIdx] + m_momentum * deltaRow[nextNeuronIdx];
+                        StoreRelaxed( &weightRow[nextNeuronIdx], LoadRelaxed( &weightRow[nextNeuronIdx] ) + deltaRow[nextNeuronIdx] );
+                    }
+                    continue;
+                }
+
+                Scalar weightedSum = 0;
+                for ( int32_t nextNeuronIdx = 0; nextNeuronIdx < numNextNeurons; nextNeuronIdx++ )
+                {
+                    Scalar const weight = LoadRelaxed( &weightRow[nextNeuronIdx] );
+                    weightedSum += weight * nextErrorGradients[nextNeuronIdx];
+                    deltaRow[nextNeuronIdx] = scaledNeuronValue * nextErrorGradients[nextNeuronIdx] + m_momentum * deltaRow[nextNeuronIdx];
+                    StoreRelaxed( &weightRow[nextNeuronIdx], weight + deltaRow[nextNeuronIdx] );
+                }
+                errorGradients[layerIdx][neuronIdx] = weightedSum;
+            }
+
+            if ( layerIdx > 0 )
+            {
+                Activations::MultiplyByDerivative( network.GetHiddenActivation(), numNeurons, activations[layerIdx], errorGradients[layerIdx] );
             }
         }
     }
 
-    void NNTrainer::GetSetAccuracyAndMSE( TrainingSet const& trainingSet, double& accuracy, double& MSE ) const
+    template<typename Scalar>
+    template<typename Rows>
+    void NNTrainerT<Scalar>::AccumulateSetStatistics( NetworkType const& network, Rows const& rows, SetStatistics& statistics ) const
     {
-        accuracy = 0;
-        MSE = 0;
+        BPN_PROFILE_SCOPE( SetStatistics );
+
+        // Own workspace, this may run on the evaluation thread while the next generation trains
+        WorkspaceType workspace( network );
 
+        double MSE = 0;
         double numIncorrectResults = 0;
-        for ( auto const& trainingEntry : trainingSet )
+        uint64_t numSkippedWeights = 0;
+        Scalar const* const outputNeurons = workspace.GetOutputs();
+        for ( size_t rowIdx = 0; rowIdx < rows.size(); rowIdx++ )
         {
-            m_networkToTrain->Evaluate( trainingEntry.m_inputs );
+            int32_t const* const expectedOutputs = rows.GetExpectedOutputs( rowIdx );
+            if ( rows.IsSparse( rowIdx ) )
+            {
+                SparseInputsType const inputs = rows.GetSparseInputs( rowIdx );
+                network.Evaluate( inputs, workspace );
+                numSkippedWeights += GetNumSkippedWeights( inputs.m_numNonzeros );
+            }
+            else
+            {
+                network.Evaluate( rows.GetInputs( rowIdx ), workspace );
+            }
 
             // Check if the network outputs match the expected outputs
             bool correctResult = true;
-            for ( int32_t outputIdx = 0; outputIdx < m_networkToTrain->m_numOutputs; outputIdx++ )
+            for ( int32_t outputIdx = 0; outputIdx < network.m_numOutputs; outputIdx++ )
             {
-                if ( static_cast<double>(m_networkToTrain->m_clampedOutputs[outputIdx]) != trainingEntry.m_expectedOutputs[outputIdx] )
+                if ( static_cast<double>(workspace.m_clampedOutputs[outputIdx]) != expectedOutputs[outputIdx] )
                 {
                     correctResult = false;
                 }
 
-                MSE += pow( ( m_networkToTrain->m_outputNeurons[outputIdx] - trainingEntry.m_expectedOutputs[outputIdx] ), 2 );
+                MSE += pow( ( outputNeurons[outputIdx] - expectedOutputs[outputIdx] ), 2 );
             }
 
             if ( !correctResult )
@@ -230,8 +1300,30 @@ namespace BPN
             }
         }
 
-        accuracy = 100.0f - ( numIncorrectResults / trainingSet.size() * 100.0 );
-        MSE = MSE / ( m_networkToTrain->m_numOutputs * trainingSet.size() );
+        BPN_PROFILE_COUNT( EvaluatedSamples, rows.size() );
+        BPN_PROFILE_COUNT( Flops, 2 * ( rows.size() * m_numUsedWeights - numSkippedWeights ) );
+        BPN_PROFILE_COUNT( BytesTouched, ( rows.size() * m_numUsedWeights - numSkippedWeights ) * sizeof( Scalar ) );
+
+        statistics.m_incorrectEntries += numIncorrectResults;
+        statistics.m_squaredError += MSE;
+        statistics.m_numEntries += rows.size();
+    }
+
+    template<typename Scalar>
+    void NNTrainerT<Scalar>::GetAccuracyAndMSE( SetStatistics const& statistics, double& accuracy, double& mse ) const
+    {
+        // An empty set (e.g. a test split with no lines) counts as 0% rather than NaN, so it never satisfies the desired accuracy
+        if ( statistics.m_numEntries == 0 )
+        {
+            accuracy = 0;
+            mse = 0;
+            return;
+        }
+
+        accuracy = 100.0 - ( statistics.m_incorrectEntries / statistics.m_numEntries * 100.0 );
+        mse = statistics.m_squaredError / ( m_networkToTrain->m_numOutputs * statistics.m_numEntries );
     }
 
-}
\ No newline at end of file
+    template class NNTrainerT<double>;
+    template class NNTrainerT<float>;
+}
@@ -1,80 +1,362 @@
 // Feed forward NN Trainer using gradient descent with Momentum
 #pragma once
 
+#include "MetricsSink.h"
 #include "NeuralNetwork.h"
-#include <fstream>
+#include "ThreadPool.h"
+#include <memory>
 
 namespace BPN
 {
-    struct TrainingEntry
+    template<typename Scalar>
+    struct TrainingEntryT
     {
-        std::vector<double>         m_inputs;
+        std::vector<Scalar>         m_inputs;
         std::vector<int32_t>        m_expectedOutputs;
+
+        // Sparse entries leave m_inputs empty and hold their nonzero inputs only, in ascending index order
+        std::vector<int32_t>        m_inputIndices;
+        std::vector<Scalar>         m_inputValues;
+
+        inline bool IsSparse() const { return m_inputs.empty(); }
+        inline SparseInputsT<Scalar> GetSparseInputs() const { return { (int32_t) m_inputIndices.size(), m_inputIndices.data(), m_inputValues.data() }; }
+
+        // Writes all numInputs inputs of a dense or a sparse entry
+        void GetDenseInputs( int32_t numInputs, Scalar* inputs ) const
+        {
+            if ( !IsSparse() )
+            {
+                std::copy( m_inputs.begin(), m_inputs.end(), inputs );
+                return;
+            }
+
+            std::fill( inputs, inputs + numInputs, Scalar( 0 ) );
+            for ( size_t nonzeroIdx = 0; nonzeroIdx < m_inputIndices.size(); nonzeroIdx++ )
+            {
+                inputs[m_inputIndices[nonzeroIdx]] = m_inputValues[nonzeroIdx];
+            }
+        }
+    };
+
+    template<typename Scalar>
+    using TrainingSetT = std::vector<TrainingEntryT<Scalar>>;
+
+    template<typename Scalar>
+    struct TrainingDataT
+    {
+        TrainingSetT<Scalar> m_trainingSet;
+        TrainingSetT<Scalar> m_testSet;
     };
 
-    typedef std::vector<TrainingEntry> TrainingSet;
+    typedef TrainingEntryT<double> TrainingEntry;
+    typedef TrainingSetT<double> TrainingSet;
+    typedef TrainingDataT<double> TrainingData;
 
-    struct TrainingData
+    // Copy of a data set with the inputs converted to another scalar type
+    template<typename Scalar, typename OtherScalar>
+    TrainingSetT<Scalar> ConvertTrainingSet( TrainingSetT<OtherScalar> const& trainingSet )
     {
-        TrainingSet m_trainingSet;
-        TrainingSet m_testSet;
+        TrainingSetT<Scalar> converted( trainingSet.size() );
+        for ( size_t entryIdx = 0; entryIdx < trainingSet.size(); entryIdx++ )
+        {
+            converted[entryIdx].m_inputs.assign( trainingSet[entryIdx].m_inputs.begin(), trainingSet[entryIdx].m_inputs.end() );
+            converted[entryIdx].m_expectedOutputs = trainingSet[entryIdx].m_expectedOutputs;
+            converted[entryIdx].m_inputIndices = trainingSet[entryIdx].m_inputIndices;
+            converted[entryIdx].m_inputValues.assign( trainingSet[entryIdx].m_inputValues.begin(), trainingSet[entryIdx].m_inputValues.end() );
+        }
+        return converted;
+    }
+
+    template<typename Scalar, typename OtherScalar>
+    TrainingDataT<Scalar> ConvertTrainingData( TrainingDataT<OtherScalar> const& trainingData )
+    {
+        TrainingDataT<Scalar> converted;
+        converted.m_trainingSet = ConvertTrainingSet<Scalar>( trainingData.m_trainingSet );
+        converted.m_testSet = ConvertTrainingSet<Scalar>( trainingData.m_testSet );
+        return converted;
+    }
+
+    // Rows of a data set in contiguous memory, as staged by TrainingPipeline: numRows x numInputs inputs and numRows x numOutputs
+    // one-hot expected outputs, both row-major
+    template<typename Scalar>
+    struct TrainingBatchT
+    {
+        Scalar const*               m_inputs = nullptr;
+        int32_t const*              m_expectedOutputs = nullptr;
+        size_t                      m_numRows = 0;
+        int32_t                     m_numInputs = 0;
+        int32_t                     m_numOutputs = 0;
     };
 
+    template<typename Scalar>
+    class StreamingDataSourceT;
+
+    template<typename Scalar>
+    class TrainingPipelineT;
+
+    namespace Benchmarks
+    {
+        struct TrainerAccess;
+    }
+
     //-------------------------------------------------------------------------
 
-    class NNTrainer
+    // Parts of the trainer that do not depend on the scalar type
+    class NNTrainerBase
     {
     public:
 
+        enum class ParallelMode
+        {
+            Synchronous,                            // Threads share each mini-batch, the trained weights do not depend on the thread count
+            Asynchronous,                           // Hogwild: each thread trains on its own slice and updates the shared weights in place without locks
+        };
+
         struct Settings
         {
             // Learning params
             double      m_learningRate = 0.01;
             double      m_momentum = 0.9;
+            uint32_t    m_batchSize = 1;            // Samples whose gradients are summed before each weight update, 1 updates after every sample
+            uint32_t    m_numThreads = 1;           // Worker threads used by the parallel mode
+            ParallelMode m_parallelMode = ParallelMode::Synchronous;
+            bool        m_overlapEvaluation = true; // Evaluate the test set on a copy of the weights while the next generation trains, the stopping
+                                                    // conditions then see the test results one generation late (the final results are exact)
+
+            // Reporting
+            bool        m_logProgress = true;       // Report the generations to the console and to m_logPath, written by a background thread
+            uint32_t    m_reportInterval = 1;       // Generations between reports, the last generation is always reported
+            std::string m_logPath = "IrisNNtrainingResult.csv";     // Metrics file, none if empty
+            MetricsFormat m_logFormat = MetricsFormat::Csv;
 
             // Stopping conditions
             uint32_t    m_maxGenerations = 1500;
             double      m_desiredAccuracy = 85;
+
+            // Early stopping: training also stops once the test MSE has not dropped more than m_minMSEImprovement below its best for
+            // m_earlyStoppingPatience generations, and the weights of the best generation are restored. 0 disables it.
+            uint32_t    m_earlyStoppingPatience = 0;
+            double      m_minMSEImprovement = 0;
+
+            // Checkpoints: every m_checkpointInterval generations and after the last one, the weights, momentum deltas and counters are
+            // written to m_checkpointPath by a background thread, none if empty
+            std::string m_checkpointPath;
+            uint32_t    m_checkpointInterval = 10;
         };
+    };
+
+    // Scalar is the type of the weights, activations and gradients, double or float
+    template<typename Scalar>
+    class NNTrainerT : public NNTrainerBase
+    {
+        // Times the private per sample steps
+        friend struct Benchmarks::TrainerAccess;
 
     public:
 
-        NNTrainer( Settings const& settings, Network* networkToTrain );
+        typedef NetworkT<Scalar> NetworkType;
+        typedef NetworkWorkspaceT<Scalar> WorkspaceType;
+        typedef SparseInputsT<Scalar> SparseInputsType;
+        typedef TrainingEntryT<Scalar> TrainingEntryType;
+        typedef TrainingSetT<Scalar> TrainingSetType;
+        typedef TrainingDataT<Scalar> TrainingDataType;
+
+    public:
+
+        NNTrainerT( Settings const& settings, NetworkType* networkToTrain );
+
+        void Train( TrainingDataType const& trainingData );
+
+        // Trains chunk by chunk from disk, every generation is one pass over the training split followed by one over the test split.
+        // Mini-batches do not span chunks, so the chunk size should be a multiple of the batch size.
+        void Train( StreamingDataSourceT<Scalar>& dataSource );
+
+        // Trains on the batches staged by the producer thread of the pipeline, which prepares the next batches while these train
+        void Train( TrainingPipelineT<Scalar>& pipeline );
+
+        // Loads the weights, momentum deltas and counters of the checkpoint at m_checkpointPath, the next Train continues from its
+        // generation. Returns false, leaving the trainer untouched, if it cannot be read or was written for another topology.
+        bool ResumeFromCheckpoint();
+
+        inline uint32_t GetCurrentGeneration() const { return m_currentGeneration; }
+        inline double GetTrainingSetAccuracy() const { return m_trainingSetAccuracy; }
+        inline double GetTrainingSetMSE() const { return m_trainingSetMSE; }
+        inline double GetTestSetAccuracy() const { return m_testSetAccuracy; }
+        inline double GetTestSetMSE() const { return m_testSetMSE; }
+        inline double GetSamplesPerSecond() const { return m_samplesPerSecond; }
 
-        void Train( TrainingData const& trainingData );
+    private:
+
+        // Per worker scratch for up to numRows samples, every matrix is row-major with one row per sample
+        struct BatchBuffers
+        {
+            AlignedBuffer<Scalar>   m_arena;
+            std::vector<Scalar*>    m_activations;              // Per layer: numRows x ( width + 1 ), last column is the bias neuron (none for the outputs)
+            std::vector<Scalar*>    m_errorGradients;           // Per layer: numRows x width, none for the inputs
+
+            // Inputs of a shard with sparse rows in CSR form, they replace the input activations
+            std::vector<int32_t>    m_rowOffsets;
+            std::vector<int32_t>    m_columnIndices;
+            std::vector<Scalar>     m_values;
+        };
+
+        // Weight gradients and statistics summed over one shard, the weight gradients use the same layout as the network weights
+        struct GradientBuffers
+        {
+            AlignedBuffer<Scalar>   m_weights;
+            double                  m_incorrectEntries = 0;
+            double                  m_squaredError = 0;
+        };
+
+        // Incorrect entries and summed squared error over a set, accumulated over any number of chunks of it
+        struct SetStatistics
+        {
+            double                  m_incorrectEntries = 0;
+            double                  m_squaredError = 0;
+            size_t                  m_numEntries = 0;
+        };
+
+        // Training state of a checkpoint, copied at the end of a generation so the writer thread never reads the weights being trained
+        struct CheckpointState
+        {
+            AlignedBuffer<Scalar>   m_weights;
+            AlignedBuffer<Scalar>   m_deltas;
+            AlignedBuffer<Scalar>   m_bestWeights;              // Empty without early stopping
+            uint32_t                m_generation = 0;
+            uint32_t                m_numGenerationsWithoutImprovement = 0;
+            GenerationMetrics       m_bestResults = {};
+        };
+
+        // Per thread state of the asynchronous mode, the weights themselves are shared
+        struct AsyncWorkerState
+        {
+            BatchBuffers            m_buffers;                  // Single row
+            AlignedBuffer<Scalar>   m_deltas;                   // Private momentum deltas
+            std::vector<Scalar>     m_denseInputs;              // Sparse samples are expanded here, every weight is updated anyway
+            double                  m_incorrectEntries = 0;
+            double                  m_squaredError = 0;
+        };
 
     private:
 
-        inline double GetOutputErrorGradient( double desiredValue, double outputValue ) const { return outputValue * ( 1.0 - outputValue ) * ( desiredValue - outputValue ); }
-        double GetHiddenErrorGradient( int32_t hiddenIdx ) const;
+        inline bool IsTrainingComplete() const
+        {
+            return ( m_trainingSetAccuracy >= m_desiredAccuracy && m_testSetAccuracy >= m_desiredAccuracy ) || m_currentGeneration >= m_maxGenerations ||
+                ( m_earlyStoppingPatience > 0 && m_numGenerationsWithoutImprovement >= m_earlyStoppingPatience );
+        }
 
-        void RunGeneration( TrainingSet const& trainingSet );
-        void Backpropagate( std::vector<int32_t> const& expectedOutputs );
-        void UpdateWeights();
 
-        void GetSetAccuracyAndMSE( TrainingSet const& trainingSet, double& accuracy, double& mse ) const;
+        // Activations of a layer are stored with the bias neuron as an extra column, except for the output layer
+        inline int32_t GetActivationStride( int32_t layerIdx ) const { return m_networkToTrain->m_layerWidths[layerIdx] + ( layerIdx < m_networkToTrain->GetNumWeightLayers() ? 1 : 0 ); }
+        inline Scalar* GetErrorGradients( int32_t layerIdx ) { return m_arena.data() + m_errorGradientOffsets[layerIdx]; }
+        inline Scalar const* GetErrorGradients( int32_t layerIdx ) const { return m_arena.data() + m_errorGradientOffsets[layerIdx]; }
+
+        void AllocateBatchBuffers( BatchBuffers& buffers, size_t numRows ) const;
+
+        // First layer weights the rows of the zero inputs of a sparse sample would have used
+        inline uint64_t GetNumSkippedWeights( int32_t numNonzeros ) const { return (uint64_t) ( m_networkToTrain->m_numInputs - numNonzeros ) * m_networkToTrain->GetLayerWidth( 1 ); }
+
+        // Runs every generation until the stopping conditions are met, runTraining( statistics ) trains on the whole training set once and
+        // runTest( network, statistics ) evaluates the test set on the given network, which may run on another thread on a weight snapshot
+        template<typename TrainFunction, typename TestFunction>
+        void TrainGenerations( TrainFunction const& runTraining, TestFunction const& runTest );
+
+        // Rows is a training set or a staged batch, accessed through size(), GetInputs( rowIdx ), GetExpectedOutputs( rowIdx ) and, for
+        // sparse rows, IsSparse( rowIdx ) and GetSparseInputs( rowIdx )
+        template<typename Rows>
+        void RunGeneration( Rows const& rows, SetStatistics& statistics );
+
+        // Error gradients, momentum deltas and weight update of one sample in a single sweep over the weights. With sparseInputs only
+        // the first layer rows of the nonzero inputs and the bias row get this sample's deltas, the other rows are left to the lazy
+        // momentum below.
+        void Backpropagate( int32_t const* expectedOutputs, SparseInputsType const* sparseInputs = nullptr );
+
+        // Lazy momentum of the serial loop: a first layer row of an input that is zero in a sample only decays its delta and adds it to
+        // its weights. Those steps are applied in one go, with precomputed powers and sums of the momentum, when a sample uses the row
+        // again or when the rows are flushed at the end of a pass (and before a dense sample), so a sparse sample costs its nonzeros.
+        void CatchUpInputRow( int32_t inputIdx );
+        void FlushInputRows();
+
+        template<typename Rows>
+        void RunBatchedGeneration( Rows const& rows, SetStatistics& statistics );
+        template<typename Rows>
+        void AccumulateBatchGradients( Rows const& rows, size_t firstEntry, size_t numEntries, BatchBuffers& buffers, GradientBuffers& gradients ) const;
+        void ReduceShardGradients( size_t numShards );
+        void ApplyBatchGradients( GradientBuffers const& gradients );
+
+        template<typename Rows>
+        void RunAsynchronousGeneration( Rows const& rows, SetStatistics& statistics );
+        void TrainEntryAsynchronous( Scalar const* inputs, int32_t const* expectedOutputs, AsyncWorkerState& worker );
+
+        // Keeps the weights of the generation with the lowest test MSE so far, weights are those the test results were measured on
+        void RecordTestResults( GenerationMetrics const& metrics, Scalar const* weights );
+
+        void CaptureCheckpoint( CheckpointState& state ) const;
+        bool WriteCheckpoint( CheckpointState const& state ) const;
+
+        template<typename Rows>
+        void AccumulateSetStatistics( NetworkType const& network, Rows const& rows, SetStatistics& statistics ) const;
+        void GetAccuracyAndMSE( SetStatistics const& statistics, double& accuracy, double& mse ) const;
 
     private:
         
-        Network*                    m_networkToTrain;                 // Network to train
+        NetworkType*                m_networkToTrain;                 // Network to train
+        WorkspaceType               m_workspace;                // Activations of the sample being trained by the serial loop
 
         // Training settings
-        double                      m_learningRate;             // Sets the step size of the weight update
-        double                      m_momentum;                 // Improves stochastic learning 
+        Scalar                      m_learningRate;             // Sets the step size of the weight update
+        Scalar                      m_momentum;                 // Improves stochastic learning 
         double                      m_desiredAccuracy;          // Target accuracy for training
+        uint32_t                    m_batchSize;                // Samples per weight update
+        ParallelMode                m_parallelMode;             // How the worker threads share the training work
         uint32_t                    m_maxGenerations;                // Max number of training Generations
+        bool                        m_overlapEvaluation;        // Evaluate the test set in the background on a weight snapshot
+        bool                        m_logProgress;              // Report the generations
+        uint32_t                    m_reportInterval;           // Generations between reports
+        std::string                 m_logPath;                  // Metrics file written while training, none if empty
+        MetricsFormat               m_logFormat;
+
+        // Training data: momentum deltas in the layout of the network weights, then the error gradients of every layer after the inputs
+        AlignedBuffer<Scalar>       m_arena;
+        std::vector<size_t>         m_errorGradientOffsets;     // Start of the error gradients of every layer in the arena
+
+        // Parallel training, only allocated when used
+        std::unique_ptr<ThreadPool> m_threadPool;               // Workers processing batch shards or asynchronous slices
+        std::vector<BatchBuffers>   m_workerBuffers;            // Private scratch of every worker
+        std::vector<GradientBuffers> m_shardGradients;          // Gradients of every shard of a batch, summed in a fixed order
+        std::vector<AsyncWorkerState> m_asyncWorkers;           // Private state of every thread in asynchronous mode
 
-        // Training data
-        std::vector<double>         m_deltaInputHidden;         // Delta of input hidden layer
-        std::vector<double>         m_deltaHiddenOutput;        // Delta of hidden output layer
-        std::vector<double>         m_errorGradientsHidden;     // Error gradients for the hidden layer
-        std::vector<double>         m_errorGradientsOutput;     // Error gradients for the outputs
+        // Lazy momentum of sparse samples in the serial loop
+        uint32_t                    m_numSparseSteps;           // Sparse samples trained since the last flush
+        std::vector<uint32_t>       m_inputRowSteps;            // Sparse steps every first layer row has been brought up to
+        std::vector<Scalar>         m_momentumPowers;           // momentum^k
+        std::vector<Scalar>         m_momentumSums;             // momentum + momentum^2 + ... + momentum^k
+
+        // Early stopping
+        uint32_t                    m_earlyStoppingPatience;    // Generations without improvement before training stops, 0 disables it
+        double                      m_minMSEImprovement;
+        uint32_t                    m_numGenerationsWithoutImprovement;
+        GenerationMetrics           m_bestResults;              // Generation with the lowest test MSE, whose MSE is HUGE_VAL before the first
+        AlignedBuffer<Scalar>       m_bestWeights;              // Its weights, only allocated with early stopping
+
+        // Checkpoints
+        std::string                 m_checkpointPath;           // None if empty
+        uint32_t                    m_checkpointInterval;       // Generations between checkpoints
+        bool                        m_isResuming;               // The next Train continues from a loaded checkpoint
 
         uint32_t                    m_currentGeneration;             // Generation counter
         double                      m_trainingSetAccuracy;
         double                      m_testSetAccuracy;
         double                      m_trainingSetMSE;
         double                      m_testSetMSE;
-		std::fstream logFile;
+        double                      m_samplesPerSecond;         // Training throughput of the last generation
+
+        // Work per sample for the profiling counters, see Profiling::Counter
+        uint64_t                    m_numUsedWeights;           // Weights without the padding between layers
+        uint64_t                    m_activationBytes;          // Activations and error gradients of all layers
     };
+
+    // Double precision is the default
+    typedef NNTrainerT<double> NNTrainer;
+    typedef NNTrainerT<float> NNTrainerFloat;
 }
\ No newline at end of file
@@ -1,146 +1,467 @@
 #include "NeuralNetwork.h"
+#include "NNKernels.h"
+#include "MappedFile.h"
+#include "ModelFile.h"
 #include <random>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
 
 //-------------------------------------------------------------------------
 
 namespace BPN
 {
-    Network::Network( Settings const& settings )
-        : m_numInputs( settings.m_numInputs )
-        , m_numHidden( settings.m_numHidden )
-        , m_numOutputs( settings.m_numOutputs )
+    // Number of rows evaluated together by EvaluateBatch, bounds the scratch memory to a few blocks of activations
+    static int32_t const k_batchBlockRows = 64;
+
+    // Flower of every output of the Iris network, in the order of its output neurons
+    static char const* const k_flowerNames[3] = { "Iris-setosa", "Iris-versicolor", "Iris-virginica" };
+
+    // Index of the single highest value, -1 if several share it
+    template<typename Scalar>
+    static int32_t GetUniqueMaxIndex( int32_t count, Scalar const* values )
+    {
+        int32_t bestIdx = 0;
+        bool isUnique = true;
+        for ( int32_t idx = 1; idx < count; idx++ )
+        {
+            if ( values[idx] > values[bestIdx] )
+            {
+                bestIdx = idx;
+                isUnique = true;
+            }
+            else if ( values[idx] == values[bestIdx] )
+            {
+                isUnique = false;
+            }
+        }
+
+        return isUnique ? bestIdx : -1;
+    }
+
+    template<typename Scalar>
+    NetworkT<Scalar>::NetworkT( Settings const& settings )
+        : m_hiddenActivation( settings.m_hiddenActivation )
+        , m_outputActivation( settings.m_outputActivation )
     {
-        assert( settings.m_numInputs > 0 && settings.m_numOutputs > 0 && settings.m_numHidden > 0 );
-        InitializeNetwork();
+        assert( m_hiddenActivation != Activation::Softmax );
+        if ( settings.m_layerWidths.empty() )
+        {
+            InitializeNetwork( { settings.m_numInputs, settings.m_numHidden, settings.m_numOutputs } );
+        }
+        else
+        {
+            InitializeNetwork( settings.m_layerWidths );
+        }
+
         InitializeWeights();
     }
 
-	void Network::InitializeNetwork()
+    template<typename Scalar>
+	void NetworkT<Scalar>::InitializeNetwork( std::vector<uint32_t> const& layerWidths, Scalar* externalWeights )
 	{
-		// Create storage and initialize the neurons and the outputs
-		//-------------------------------------------------------------------------
+        assert( layerWidths.size() >= 2 );
 
-		// Add bias neurons
-		int32_t const totalNumInputs = m_numInputs + 1;
-		int32_t const totalNumHiddens = m_numHidden + 1;
+        m_layerWidths.assign( layerWidths.begin(), layerWidths.end() );
+        assert( std::find( m_layerWidths.begin(), m_layerWidths.end(), 0 ) == m_layerWidths.end() );
 
-		m_inputNeurons.resize(totalNumInputs);
-		m_hiddenNeurons.resize(totalNumHiddens);
-		m_outputNeurons.resize(m_numOutputs);
-		m_clampedOutputs.resize(m_numOutputs);
+        m_numInputs = m_layerWidths.front();
+        m_numOutputs = m_layerWidths.back();
 
-		memset(m_inputNeurons.data(), 0, m_inputNeurons.size() * sizeof(double));
-		memset(m_hiddenNeurons.data(), 0, m_hiddenNeurons.size() * sizeof(double));
-		memset(m_outputNeurons.data(), 0, m_outputNeurons.size() * sizeof(double));
-		memset(m_clampedOutputs.data(), 0, m_clampedOutputs.size() * sizeof(int32_t));
+		// Lay out the weights of every layer, each block starting on a cache line
+		//-------------------------------------------------------------------------
 
-		// Set bias values
-		m_inputNeurons.back() = -1.0;
-		m_hiddenNeurons.back() = -1.0;
+        m_numWeights = 0;
+        m_weightOffsets.resize( GetNumWeightLayers() );
+        for ( int32_t layerIdx = 0; layerIdx < GetNumWeightLayers(); layerIdx++ )
+        {
+            m_weightOffsets[layerIdx] = m_numWeights;
+            m_numWeights += AlignCount<Scalar>( (size_t) ( m_layerWidths[layerIdx] + 1 ) * m_layerWidths[layerIdx + 1] );
+        }
 
-		// Create storage and initialize and layer weights
+		// Create storage, external weights take no space in the arena
 		//-------------------------------------------------------------------------
 
-		int32_t const numInputHiddenWeights = totalNumInputs * totalNumHiddens;
-		int32_t const numHiddenOutputWeights = totalNumHiddens * m_numOutputs;
-		m_weightsInputHidden.resize(numInputHiddenWeights);
-		m_weightsHiddenOutput.resize(numHiddenOutputWeights);
-
+        m_arena.Resize( ( externalWeights == nullptr ) ? m_numWeights : 0 );
+        m_weights = ( externalWeights == nullptr ) ? m_arena.data() : externalWeights;
+        m_workspace = NetworkWorkspaceT<Scalar>( *this );
 	}
-    void Network::InitializeWeights()
+
+    template<typename Scalar>
+    NetworkT<Scalar>& NetworkT<Scalar>::operator=( NetworkT const& other )
+    {
+        if ( this != &other )
+        {
+            InitializeNetwork( std::vector<uint32_t>( other.m_layerWidths.begin(), other.m_layerWidths.end() ) );
+            memcpy( m_weights, other.m_weights, m_numWeights * sizeof( Scalar ) );
+            m_hiddenActivation = other.m_hiddenActivation;
+            m_outputActivation = other.m_outputActivation;
+            m_workspace = other.m_workspace;
+            m_mappedFile.reset();
+        }
+        return *this;
+    }
+
+    template<typename Scalar>
+    void NetworkT<Scalar>::InitializeWeights()
     {
         std::random_device rd;
         std::mt19937 generator( rd() );
 
-        double const distributionRangeHalfWidth = ( 2.4 / m_numInputs );
-        double const standardDeviation = distributionRangeHalfWidth * 2 / 6;
-        std::normal_distribution<> normalDistribution( 0, standardDeviation );
-
-        // Set weights to normally distributed random values between [-2.4 / numInputs, 2.4 / numInputs]
-        for ( int32_t inputIdx = 0; inputIdx <= m_numInputs; inputIdx++ )
+        for ( int32_t layerIdx = 0; layerIdx < GetNumWeightLayers(); layerIdx++ )
         {
-            for ( int32_t hiddenIdx = 0; hiddenIdx < m_numHidden; hiddenIdx++ )
+            int32_t const numLayerInputs = m_layerWidths[layerIdx];
+            int32_t const numLayerOutputs = m_layerWidths[layerIdx + 1];
+
+            double const distributionRangeHalfWidth = ( 2.4 / numLayerInputs );
+            double const standardDeviation = distributionRangeHalfWidth * 2 / 6;
+            std::normal_distribution<> normalDistribution( 0, standardDeviation );
+
+            // Set weights to normally distributed random values between [-2.4 / numLayerInputs, 2.4 / numLayerInputs], including the bias row
+            for ( int32_t neuronIdx = 0; neuronIdx <= numLayerInputs; neuronIdx++ )
             {
-                int32_t const weightIdx = GetInputHiddenWeightIndex( inputIdx, hiddenIdx );
-                double const weight = normalDistribution( generator );
-                m_weightsInputHidden[weightIdx] = weight;
+                for ( int32_t nextNeuronIdx = 0; nextNeuronIdx < numLayerOutputs; nextNeuronIdx++ )
+                {
+                    m_weights[GetWeightIndex( layerIdx, neuronIdx, nextNeuronIdx )] = static_cast<Scalar>( normalDistribution( generator ) );
+                }
             }
         }
+    }
 
-        // Set weights to normally distributed random values between [-2.4 / numInputs, 2.4 / numInputs]
-        for ( int32_t hiddenIdx = 0; hiddenIdx <= m_numHidden; hiddenIdx++ )
+    template<typename Scalar>
+    NetworkWorkspaceT<Scalar>::NetworkWorkspaceT( NetworkT<Scalar> const& network )
+    {
+        // Add bias neurons, the output layer has none
+        size_t numNeuronValues = 0;
+        m_neuronOffsets.resize( network.GetNumLayers() );
+        for ( int32_t layerIdx = 0; layerIdx < network.GetNumLayers(); layerIdx++ )
         {
-            for ( int32_t outputIdx = 0; outputIdx < m_numOutputs; outputIdx++ )
-            {
-                int32_t const weightIdx = GetHiddenOutputWeightIndex( hiddenIdx, outputIdx );
-                double const weight = normalDistribution( generator );
-                m_weightsHiddenOutput[weightIdx] = weight;
-            }
+            m_neuronOffsets[layerIdx] = numNeuronValues;
+            numNeuronValues += AlignCount<Scalar>( network.GetLayerWidth( layerIdx ) + ( layerIdx + 1 < network.GetNumLayers() ? 1 : 0 ) );
+        }
+
+        m_neurons.Resize( numNeuronValues );
+        m_clampedOutputs.assign( network.GetNumOutputs(), 0 );
+
+		// Set bias values
+        for ( int32_t layerIdx = 0; layerIdx + 1 < network.GetNumLayers(); layerIdx++ )
+        {
+            GetNeurons( layerIdx )[network.GetLayerWidth( layerIdx )] = Scalar( -1 );
         }
     }
 
-    std::string const& Network::Evaluate( std::vector<double> const& input )
+    //-------------------------------------------------------------------------
+
+    template<typename Scalar>
+    std::string const& NetworkT<Scalar>::Evaluate( std::vector<Scalar> const& input )
     {
-        assert( input.size() == m_numInputs );
-        assert( m_inputNeurons.back() == -1.0 && m_hiddenNeurons.back() == -1.0 );
+        return Evaluate( input, m_workspace );
+    }
+
+    template<typename Scalar>
+    std::string const& NetworkT<Scalar>::Evaluate( Scalar const* input )
+    {
+        return Evaluate( input, m_workspace );
+    }
+
+    template<typename Scalar>
+    std::string const& NetworkT<Scalar>::Evaluate( std::vector<Scalar> const& input, NetworkWorkspaceT<Scalar>& workspace ) const
+    {
+        assert( input.size() == (size_t) m_numInputs );
+        return Evaluate( input.data(), workspace );
+    }
+
+    template<typename Scalar>
+    std::string const& NetworkT<Scalar>::Evaluate( Scalar const* input, NetworkWorkspaceT<Scalar>& workspace ) const
+    {
+        assert( workspace.m_neuronOffsets.size() == m_layerWidths.size() && workspace.m_clampedOutputs.size() == (size_t) m_numOutputs );
 
         // Set input values
         //-------------------------------------------------------------------------
 
-        memcpy( m_inputNeurons.data(), input.data(), input.size() * sizeof( double ) );
+        memcpy( workspace.GetNeurons( 0 ), input, m_numInputs * sizeof( Scalar ) );
+        return EvaluateLayers( 0, workspace );
+    }
+
+    template<typename Scalar>
+    std::string const& NetworkT<Scalar>::Evaluate( SparseInputsT<Scalar> const& input, NetworkWorkspaceT<Scalar>& workspace ) const
+    {
+        assert( workspace.m_neuronOffsets.size() == m_layerWidths.size() && workspace.m_clampedOutputs.size() == (size_t) m_numOutputs );
+        assert( input.m_numNonzeros == 0 || ( input.m_indices[0] >= 0 && input.m_indices[input.m_numNonzeros - 1] < m_numInputs ) );
+
+        // First layer: the bias row (bias neuron is -1) plus the weight rows of the nonzero inputs
+        //-------------------------------------------------------------------------
+
+        int32_t const numLayerOutputs = m_layerWidths[1];
+        Scalar const* const layerWeights = GetLayerWeights( 0 );
+        Scalar* const layerOutputs = workspace.GetNeurons( 1 );
+        int32_t const rowOffsets[2] = { 0, input.m_numNonzeros };
 
-        // Update hidden neurons
+        Kernels::BroadcastRow( 1, numLayerOutputs, Scalar( -1 ), layerWeights + (size_t) m_numInputs * numLayerOutputs, layerOutputs, numLayerOutputs );
+        Kernels::SparseGemmNN( 1, numLayerOutputs, rowOffsets, input.m_indices, input.m_values, layerWeights, numLayerOutputs, layerOutputs, numLayerOutputs );
+        Kernels::Activate( GetLayerActivation( 1 ), 1, numLayerOutputs, layerOutputs, numLayerOutputs );
+
+        return EvaluateLayers( 1, workspace );
+    }
+
+    template<typename Scalar>
+    std::string const& NetworkT<Scalar>::EvaluateLayers( int32_t firstLayerIdx, NetworkWorkspaceT<Scalar>& workspace ) const
+    {
+        // Every layer: weighted sum of the previous layer and its bias neuron, one unit-stride weight row per previous neuron
         //-------------------------------------------------------------------------
 
-        for ( int32_t hiddenIdx = 0; hiddenIdx < m_numHidden; hiddenIdx++ )
+        for ( int32_t layerIdx = firstLayerIdx; layerIdx < GetNumWeightLayers(); layerIdx++ )
+        {
+            int32_t const numLayerInputs = m_layerWidths[layerIdx] + 1;
+            int32_t const numLayerOutputs = m_layerWidths[layerIdx + 1];
+            Scalar* const layerOutputs = workspace.GetNeurons( layerIdx + 1 );
+            assert( workspace.GetNeurons( layerIdx )[numLayerInputs - 1] == Scalar( -1 ) );
+
+            memset( layerOutputs, 0, numLayerOutputs * sizeof( Scalar ) );
+            Kernels::GemmNN( 1, numLayerOutputs, numLayerInputs, workspace.GetNeurons( layerIdx ), numLayerInputs, GetLayerWeights( layerIdx ), numLayerOutputs, layerOutputs, numLayerOutputs );
+
+            // Apply activation function
+            Kernels::Activate( GetLayerActivation( layerIdx + 1 ), 1, numLayerOutputs, layerOutputs, numLayerOutputs );
+        }
+
+        Scalar const* const outputNeurons = workspace.GetNeurons( GetNumLayers() - 1 );
+        std::vector<int32_t>& clampedOutputs = workspace.m_clampedOutputs;
+        std::string& suggestedFlower = workspace.m_suggestedFlower;
+
+        for ( int32_t outputIdx = 0; outputIdx < m_numOutputs; outputIdx++ )
+        {
+            // Clamp the result
+        	if (outputNeurons[outputIdx] >= 0.5)
+				clampedOutputs[outputIdx] = 1;
+			else
+				clampedOutputs[outputIdx] = 0;
+        }
+
+        // Set the return string, only networks with one output per flower name one
+        int32_t const bestIdx = ( m_numOutputs == 3 ) ? GetUniqueMaxIndex( m_numOutputs, outputNeurons ) : -1;
+        suggestedFlower = ( bestIdx >= 0 ) ? k_flowerNames[bestIdx] : "No fitting flower found, more training is needed.";
+
+        return suggestedFlower;
+    }
+
+    template<typename Scalar>
+    void NetworkT<Scalar>::EvaluateBatch( Scalar const* inputs, int32_t numRows, int32_t* classIndices, Scalar* outputs ) const
+    {
+        assert( inputs != nullptr && classIndices != nullptr && numRows >= 0 );
+
+        // Hidden activations keep an extra column holding the bias neuron so that the next layer is a single product, two blocks are used alternately
+        int32_t const blockRows = std::min( numRows, k_batchBlockRows );
+        int32_t maxHiddenStride = 0;
+        for ( int32_t layerIdx = 1; layerIdx < GetNumLayers() - 1; layerIdx++ )
         {
-            m_hiddenNeurons[hiddenIdx] = 0;
+            maxHiddenStride = std::max( maxHiddenStride, m_layerWidths[layerIdx] + 1 );
+        }
+
+        AlignedBuffer<Scalar> hiddenBlocks[2];
+        hiddenBlocks[0].Resize( (size_t) blockRows * maxHiddenStride );
+        hiddenBlocks[1].Resize( GetNumLayers() > 3 ? (size_t) blockRows * maxHiddenStride : 0 );
+        AlignedBuffer<Scalar> outputBlock( outputs == nullptr ? (size_t) blockRows * m_numOutputs : 0 );
+
+        for ( int32_t rowStart = 0; rowStart < numRows; rowStart += k_batchBlockRows )
+        {
+            int32_t const rowCount = std::min( k_batchBlockRows, numRows - rowStart );
+            Scalar* const outputRows = ( outputs != nullptr ) ? outputs + (int64_t) rowStart * m_numOutputs : outputBlock.data();
+
+            // First layer reads the inputs directly, so its bias contribution (bias neuron is -1) is added separately
+            Scalar const* layerInputs = inputs + (int64_t) rowStart * m_numInputs;
+            int32_t layerInputStride = m_numInputs;
 
-            // Get weighted sum of pattern and bias neuron
-            for ( int32_t inputIdx = 0; inputIdx <= m_numInputs; inputIdx++ )
+            for ( int32_t layerIdx = 0; layerIdx < GetNumWeightLayers(); layerIdx++ )
             {
-                int32_t const weightIdx = GetInputHiddenWeightIndex( inputIdx, hiddenIdx );
-                m_hiddenNeurons[hiddenIdx] += m_inputNeurons[inputIdx] * m_weightsInputHidden[weightIdx];
+                int32_t const numLayerInputs = m_layerWidths[layerIdx];
+                int32_t const numLayerOutputs = m_layerWidths[layerIdx + 1];
+                bool const isOutputLayer = ( layerIdx + 1 == GetNumWeightLayers() );
+                Scalar const* const layerWeights = GetLayerWeights( layerIdx );
+
+                Scalar* const layerOutputs = isOutputLayer ? outputRows : hiddenBlocks[layerIdx % 2].data();
+                int32_t const layerOutputStride = isOutputLayer ? numLayerOutputs : numLayerOutputs + 1;
+
+                if ( layerIdx == 0 )
+                {
+                    Scalar const* const biasWeights = layerWeights + (size_t) numLayerInputs * numLayerOutputs;
+                    Kernels::BroadcastRow( rowCount, numLayerOutputs, Scalar( -1 ), biasWeights, layerOutputs, layerOutputStride );
+                    Kernels::GemmNN( rowCount, numLayerOutputs, numLayerInputs, layerInputs, layerInputStride, layerWeights, numLayerOutputs, layerOutputs, layerOutputStride );
+                }
+                else
+                {
+                    // The bias neuron is part of the previous block
+                    memset( layerOutputs, 0, (size_t) rowCount * layerOutputStride * sizeof( Scalar ) );
+                    Kernels::GemmNN( rowCount, numLayerOutputs, numLayerInputs + 1, layerInputs, layerInputStride, layerWeights, numLayerOutputs, layerOutputs, layerOutputStride );
+                }
+
+                Kernels::Activate( GetLayerActivation( layerIdx + 1 ), rowCount, numLayerOutputs, layerOutputs, layerOutputStride );
+
+                if ( !isOutputLayer )
+                {
+                    for ( int32_t rowIdx = 0; rowIdx < rowCount; rowIdx++ )
+                    {
+                        layerOutputs[(size_t) rowIdx * layerOutputStride + numLayerOutputs] = Scalar( -1 );
+                    }
+                }
+
+                layerInputs = layerOutputs;
+                layerInputStride = layerOutputStride;
             }
 
-            // Apply activation function
-			m_hiddenNeurons[hiddenIdx] = 1.0 / (1.0 + std::exp(-m_hiddenNeurons[hiddenIdx]));
-		}
+            // Pick the single highest output, same rule as Evaluate
+            //-------------------------------------------------------------------------
+
+            for ( int32_t rowIdx = 0; rowIdx < rowCount; rowIdx++ )
+            {
+                classIndices[rowStart + rowIdx] = GetUniqueMaxIndex( m_numOutputs, outputRows + (int64_t) rowIdx * m_numOutputs );
+            }
+        }
+    }
+
+    template<typename Scalar>
+    bool NetworkT<Scalar>::Save( std::string const& filename ) const
+    {
+        std::vector<uint32_t> const layerWidths( m_layerWidths.begin(), m_layerWidths.end() );
+        size_t const widthBytes = layerWidths.size() * sizeof( uint32_t );
+        size_t const weightBytes = m_numWeights * sizeof( Scalar );
+
+        ModelFileHeader header = {};
+        memcpy( header.m_magic, k_modelFileMagic, sizeof( header.m_magic ) );
+        header.m_version = k_modelFileVersion;
+        header.m_scalarSize = sizeof( Scalar );
+        header.m_numLayers = (uint32_t) layerWidths.size();
+        header.m_weightsOffset = AlignCount<uint8_t>( sizeof( ModelFileHeader ) + widthBytes );
+        header.m_numWeights = m_numWeights;
+        header.m_checksum = ComputeModelChecksum( m_weights, weightBytes, ComputeModelChecksum( layerWidths.data(), widthBytes ) );
+        header.m_hiddenActivation = (uint8_t) m_hiddenActivation;
+        header.m_outputActivation = (uint8_t) m_outputActivation;
+
+        std::ofstream file( filename, std::ios::out | std::ios::binary | std::ios::trunc );
+        if ( !file.is_open() )
+        {
+            std::cout << "Error opening model file: " << filename << std::endl;
+            return false;
+        }
+
+        std::vector<char> const padding( header.m_weightsOffset - sizeof( ModelFileHeader ) - widthBytes, 0 );
+        file.write( reinterpret_cast<char const*>( &header ), sizeof( header ) );
+        file.write( reinterpret_cast<char const*>( layerWidths.data() ), widthBytes );
+        file.write( padding.data(), padding.size() );
+        file.write( reinterpret_cast<char const*>( m_weights ), weightBytes );
+        file.close();
+
+        if ( !file )
+        {
+            std::cout << "Error writing model file: " << filename << std::endl;
+            return false;
+        }
 
-        // Calculate output values - include bias neuron
+        return true;
+    }
+
+    template<typename Scalar>
+    bool NetworkT<Scalar>::Load( std::string const& filename, bool verifyChecksum )
+    {
+        std::shared_ptr<MappedFile> mappedFile = std::make_shared<MappedFile>();
+        if ( !mappedFile->Open( filename ) )
+        {
+            std::cout << "Error opening model file: " << filename << std::endl;
+            return false;
+        }
+
+        // Validate everything before touching the network
         //-------------------------------------------------------------------------
 
-        for ( int32_t outputIdx = 0; outputIdx < m_numOutputs; outputIdx++ )
+        ModelFileHeader header = {};
+        if ( mappedFile->size() < k_modelFileHeaderSizeV1 )
         {
-            m_outputNeurons[outputIdx] = 0;
+            std::cout << "Not a model file: " << filename << std::endl;
+            return false;
+        }
+        memcpy( &header, mappedFile->data(), k_modelFileHeaderSizeV1 );
 
-            // Get weighted sum of pattern and bias neuron
-            for ( int32_t hiddenIdx = 0; hiddenIdx <= m_numHidden; hiddenIdx++ )
+        if ( memcmp( header.m_magic, k_modelFileMagic, sizeof( header.m_magic ) ) != 0 || header.m_version == 0 || header.m_version > k_modelFileVersion )
+        {
+            std::cout << "Not a model file of version " << k_modelFileVersion << " or older: " << filename << std::endl;
+            return false;
+        }
+
+        size_t headerSize = k_modelFileHeaderSizeV1;
+        if ( header.m_version >= 2 )
+        {
+            headerSize = sizeof( ModelFileHeader );
+            if ( mappedFile->size() < headerSize )
             {
-                int32_t const weightIdx = GetHiddenOutputWeightIndex( hiddenIdx, outputIdx );
-                m_outputNeurons[outputIdx] += m_hiddenNeurons[hiddenIdx] * m_weightsHiddenOutput[weightIdx];
+                std::cout << "Not a model file: " << filename << std::endl;
+                return false;
             }
+            memcpy( &header, mappedFile->data(), headerSize );
+        }
 
-            // Apply activation function and clamp the result
+        if ( header.m_hiddenActivation >= (uint8_t) Activation::Count || header.m_outputActivation >= (uint8_t) Activation::Count
+            || header.m_hiddenActivation == (uint8_t) Activation::Softmax )
+        {
+            std::cout << "Model file has an unknown activation: " << filename << std::endl;
+            return false;
+        }
 
-			m_outputNeurons[outputIdx] = 1.0 / (1.0 + std::exp(-m_outputNeurons[outputIdx]));
-        	if (m_outputNeurons[outputIdx] >= 0.5)
-				m_clampedOutputs[outputIdx] = 1;
-			else
-				m_clampedOutputs[outputIdx] = 0;
+        if ( header.m_scalarSize != sizeof( Scalar ) )
+        {
+            std::cout << "Model file holds " << header.m_scalarSize << " byte weights, the network uses " << sizeof( Scalar ) << ": " << filename << std::endl;
+            return false;
         }
 
-		// Set the return string
-		if (m_outputNeurons[0] > m_outputNeurons[1] && m_outputNeurons[0] > m_outputNeurons[2])
-			m_suggestedFlower = "Iris-setosa";
-		else if (m_outputNeurons[1] > m_outputNeurons[0] && m_outputNeurons[1] > m_outputNeurons[2])
-			m_suggestedFlower = "Iris-versicolor";
-		else if (m_outputNeurons[2] > m_outputNeurons[0] && m_outputNeurons[2] > m_outputNeurons[1])
-			m_suggestedFlower = "Iris-virginica";
-		else
-			m_suggestedFlower = "No fitting flower found, more training is needed.";
+        size_t const widthBytes = (size_t) header.m_numLayers * sizeof( uint32_t );
+        if ( header.m_numLayers < 2 || headerSize + widthBytes > header.m_weightsOffset || header.m_weightsOffset % k_cacheLineSize != 0
+            || header.m_weightsOffset > mappedFile->size() || header.m_numWeights > ( mappedFile->size() - header.m_weightsOffset ) / sizeof( Scalar ) )
+        {
+            std::cout << "Model file is truncated or corrupt: " << filename << std::endl;
+            return false;
+        }
+
+        std::vector<uint32_t> layerWidths( header.m_numLayers );
+        memcpy( layerWidths.data(), mappedFile->data() + headerSize, widthBytes );
 
-        return m_suggestedFlower;
+        // The weight block must have exactly the layout of these layers
+        size_t numWeights = 0;
+        for ( uint32_t layerIdx = 0; layerIdx + 1 < header.m_numLayers; layerIdx++ )
+        {
+            if ( layerWidths[layerIdx] == 0 || layerWidths[layerIdx + 1] == 0 )
+            {
+                numWeights = 0;
+                break;
+            }
+            numWeights += AlignCount<Scalar>( (size_t) ( layerWidths[layerIdx] + 1 ) * layerWidths[layerIdx + 1] );
+        }
+
+        Scalar* const weights = reinterpret_cast<Scalar*>( mappedFile->data() + header.m_weightsOffset );
+        if ( numWeights == 0 || numWeights != header.m_numWeights )
+        {
+            std::cout << "Model file layer widths do not match its weights: " << filename << std::endl;
+            return false;
+        }
+
+        if ( verifyChecksum && header.m_checksum != ComputeModelChecksum( weights, numWeights * sizeof( Scalar ), ComputeModelChecksum( layerWidths.data(), widthBytes ) ) )
+        {
+            std::cout << "Model file checksum mismatch: " << filename << std::endl;
+            return false;
+        }
+
+        // Point the network at the mapped weights
+        //-------------------------------------------------------------------------
+
+        InitializeNetwork( layerWidths, weights );
+        m_hiddenActivation = (Activation) header.m_hiddenActivation;
+        m_outputActivation = (Activation) header.m_outputActivation;
+        m_mappedFile = std::move( mappedFile );
+        return true;
     }
-}
\ No newline at end of file
+
+    template class NetworkWorkspaceT<double>;
+    template class NetworkWorkspaceT<float>;
+    template class NetworkT<double>;
+    template class NetworkT<float>;
+}
@@ -1,55 +1,204 @@
-// Neural network with a single hidden layer
+// Fully connected feed forward neural network with any number of hidden layers
 #pragma once
+#include "Activations.h"
+#include "AlignedBuffer.h"
 #include <stdint.h>
+#include <cassert>
+#include <memory>
+#include <string>
 #include <vector>
 
 //-------------------------------------------------------------------------
 
 namespace BPN
 {
-    class Network
-    {
-        friend class NNTrainer;
+    template<typename Scalar> class NNTrainerT;
+    template<typename Scalar> class NetworkT;
+    class MappedFile;
 
+    // Parts of the network that do not depend on the scalar type
+    class NetworkBase
+    {
     public:
 
         struct Settings
         {
-            uint32_t                        m_numInputs;
-            uint32_t                        m_numHidden;
-            uint32_t                        m_numOutputs;
+            uint32_t                        m_numInputs = 0;
+            uint32_t                        m_numHidden = 0;
+            uint32_t                        m_numOutputs = 0;
+            std::vector<uint32_t>           m_layerWidths = {};         // Neurons of every layer from the inputs to the outputs, replaces the three values above when set
+            Activation                      m_hiddenActivation = Activation::Sigmoid;  // Every hidden layer, softmax is only allowed for the outputs
+            Activation                      m_outputActivation = Activation::Sigmoid;
         };
+    };
+
+    // Nonzero inputs of one sample: input m_indices[i] has the value m_values[i], the indices ascend and all other inputs are zero
+    template<typename Scalar>
+    struct SparseInputsT
+    {
+        int32_t                             m_numNonzeros = 0;
+        int32_t const*                      m_indices = nullptr;
+        Scalar const*                       m_values = nullptr;
+    };
+
+    //-------------------------------------------------------------------------
+
+    // Per thread evaluation state: the activations of every layer for one sample and the results of the last Evaluate. The network
+    // itself is only read while evaluating, so any number of threads can share one network, each with its own workspace.
+    template<typename Scalar>
+    class NetworkWorkspaceT
+    {
+        template<typename> friend class NetworkT;
+        template<typename> friend class NNTrainerT;
 
     public:
 
-        Network( Settings const& settings );
-		std::string const& Evaluate(std::vector<double> const& input);
+        NetworkWorkspaceT() = default;
+
+        // Fits every network with the layer widths of network
+        explicit NetworkWorkspaceT( NetworkT<Scalar> const& network );
+
+        // Results of the last Evaluate: the output activations, each of them clamped to 0 or 1, and the flower of the single highest output
+        inline Scalar const* GetOutputs() const { return GetNeurons( (int32_t) m_neuronOffsets.size() - 1 ); }
+        inline std::vector<int32_t> const& GetClampedOutputs() const { return m_clampedOutputs; }
+        inline std::string const& GetSuggestedFlower() const { return m_suggestedFlower; }
+
+    private:
 
-        std::vector<double> const& GetInputHiddenWeights() const { return m_weightsInputHidden; }
-        std::vector<double> const& GetHiddenOutputWeights() const { return m_weightsHiddenOutput; }
-		std::string				m_suggestedFlower;
+        // Activations of a layer, every layer but the output layer ends with its bias neuron (-1)
+        inline Scalar* GetNeurons( int32_t layerIdx ) { return m_neurons.data() + m_neuronOffsets[layerIdx]; }
+        inline Scalar const* GetNeurons( int32_t layerIdx ) const { return m_neurons.data() + m_neuronOffsets[layerIdx]; }
 
     private:
-        void InitializeNetwork();
+
+        std::vector<size_t>     m_neuronOffsets;            // Start of the activations of every layer in m_neurons, each on a cache line
+        AlignedBuffer<Scalar>   m_neurons;
+        std::vector<int32_t>    m_clampedOutputs;
+        std::string             m_suggestedFlower;
+    };
+
+    //-------------------------------------------------------------------------
+
+    // Immutable model: the layer widths and the weights. Evaluation only reads it, the activations live in a NetworkWorkspaceT.
+    // Scalar is the type of the weights and activations, double or float
+    template<typename Scalar>
+    class NetworkT : public NetworkBase
+    {
+        template<typename> friend class NetworkT;
+        template<typename> friend class NNTrainerT;
+
+    public:
+
+        NetworkT( Settings const& settings );
+
+        // Copies always own their weights, even when other uses the weights of a model file
+        NetworkT( NetworkT const& other ) { *this = other; }
+        NetworkT( NetworkT&& other ) = default;
+        NetworkT& operator=( NetworkT const& other );
+        NetworkT& operator=( NetworkT&& other ) = default;
+
+        // Writes the layer widths and the weights to a binary model file (see ModelFile.h), returns false if it cannot be written
+        bool Save( std::string const& filename ) const;
+
+        // Replaces the layers and the weights with those of a model file. The weights are not copied, the network points into the memory
+        // mapped file, so loading is instant and processes loading the same file share its pages. The mapping is copy-on-write, training
+        // the network never changes the file. Returns false (and leaves the network untouched) if the file cannot be mapped, holds
+        // another scalar type or version, or its checksum does not match.
+        bool Load( std::string const& filename, bool verifyChecksum = true );
+
+        // True if the weights live in a model file mapped by Load
+        inline bool IsMapped() const { return m_mappedFile != nullptr; }
+
+        // Evaluates one sample into workspace and returns the suggested flower, safe to call from many threads with one workspace each
+        std::string const& Evaluate( Scalar const* input, NetworkWorkspaceT<Scalar>& workspace ) const;
+        std::string const& Evaluate( std::vector<Scalar> const& input, NetworkWorkspaceT<Scalar>& workspace ) const;
+
+        // Same for a sparse sample, the first layer only reads the weight rows of the nonzero inputs. The input activations of the
+        // workspace are not written.
+        std::string const& Evaluate( SparseInputsT<Scalar> const& input, NetworkWorkspaceT<Scalar>& workspace ) const;
+
+        // Single threaded convenience, evaluates into the workspace owned by the network
+		std::string const& Evaluate(std::vector<Scalar> const& input);
+        std::string const& Evaluate( Scalar const* input );
+        inline NetworkWorkspaceT<Scalar> const& GetWorkspace() const { return m_workspace; }
+
+        // Evaluates numRows samples stored contiguously as a row-major numRows x numInputs matrix, leaves the neuron buffers untouched
+        // classIndices receives the index of the single highest output per row (-1 if there is none), outputs (optional) the numRows x numOutputs activations
+        void EvaluateBatch( Scalar const* inputs, int32_t numRows, int32_t* classIndices, Scalar* outputs ) const;
+
+        inline int32_t GetNumInputs() const { return m_numInputs; }
+        inline int32_t GetNumOutputs() const { return m_numOutputs; }
+
+        // Layers including the input and the output layer, a network with one hidden layer has 3
+        inline int32_t GetNumLayers() const { return (int32_t) m_layerWidths.size(); }
+        inline int32_t GetLayerWidth( int32_t layerIdx ) const { return m_layerWidths[layerIdx]; }
+
+        inline Activation GetHiddenActivation() const { return m_hiddenActivation; }
+        inline Activation GetOutputActivation() const { return m_outputActivation; }
+
+        // Activation of the neurons of a layer after the inputs
+        inline Activation GetLayerActivation( int32_t layerIdx ) const { return ( layerIdx + 1 == GetNumLayers() ) ? m_outputActivation : m_hiddenActivation; }
+
+        // All weights of all layers as one block (including the alignment padding between layers, which is always zero), used to compare and copy weights
+        inline Scalar const* GetWeights() const { return m_weights; }
+        inline size_t GetNumWeights() const { return m_numWeights; }
+
+        // Weights connecting layer layerIdx to layer layerIdx + 1: ( width + 1 ) x nextWidth row-major, one row per neuron of layerIdx, the last row holds the bias weights
+        inline Scalar const* GetLayerWeights( int32_t layerIdx ) const { return m_weights + m_weightOffsets[layerIdx]; }
+
+        // Copies the weights of a network with the same layer widths, converting them to this network's scalar type
+        template<typename OtherScalar>
+        void CopyWeights( NetworkT<OtherScalar> const& other );
+
+    private:
+        // Lays out the weights and creates the workspace, the weights are allocated in the arena unless externalWeights is given
+        void InitializeNetwork( std::vector<uint32_t> const& layerWidths, Scalar* externalWeights = nullptr );
         void InitializeWeights();
 
-        int32_t GetInputHiddenWeightIndex( int32_t inputIdx, int32_t hiddenIdx ) const { return inputIdx * m_numHidden + hiddenIdx; }
-        int32_t GetHiddenOutputWeightIndex( int32_t hiddenIdx, int32_t outputIdx ) const { return hiddenIdx * m_numOutputs + outputIdx; }
+        // Evaluate from the weighted sums of layer firstLayerIdx + 1 onwards, the activations of layer firstLayerIdx are set
+        std::string const& EvaluateLayers( int32_t firstLayerIdx, NetworkWorkspaceT<Scalar>& workspace ) const;
+
+        inline int32_t GetNumWeightLayers() const { return (int32_t) m_layerWidths.size() - 1; }
+        inline Scalar* GetLayerWeights( int32_t layerIdx ) { return m_weights + m_weightOffsets[layerIdx]; }
+        inline size_t GetWeightIndex( int32_t layerIdx, int32_t neuronIdx, int32_t nextNeuronIdx ) const { return m_weightOffsets[layerIdx] + (size_t) neuronIdx * m_layerWidths[layerIdx + 1] + nextNeuronIdx; }
 
     private:
 
         int32_t                 m_numInputs;
-        int32_t                 m_numHidden;
         int32_t                 m_numOutputs;
 
-        std::vector<double>     m_inputNeurons;
-        std::vector<double>     m_hiddenNeurons;
-        std::vector<double>     m_outputNeurons;
-
-        std::vector<int32_t>    m_clampedOutputs;
+        std::vector<int32_t>    m_layerWidths;              // Neurons per layer without the bias neurons
+        Activation              m_hiddenActivation = Activation::Sigmoid;
+        Activation              m_outputActivation = Activation::Sigmoid;
+        std::vector<size_t>     m_weightOffsets;            // Start of the weights of every layer in m_weights, each on a cache line
+        size_t                  m_numWeights;
 
-        std::vector<double>     m_weightsInputHidden;
-        std::vector<double>     m_weightsHiddenOutput;
+        AlignedBuffer<Scalar>   m_arena;                    // Weights and biases of all layers in one allocation, unless they are mapped
+        Scalar*                 m_weights;                  // Weights of all layers, in the arena or in the mapped model file
+        std::shared_ptr<MappedFile> m_mappedFile;           // Model file holding the weights, null if they are in the arena
 
+        NetworkWorkspaceT<Scalar> m_workspace;              // Used by the single threaded Evaluate overloads only
     };
+
+    template<typename Scalar>
+    template<typename OtherScalar>
+    void NetworkT<Scalar>::CopyWeights( NetworkT<OtherScalar> const& other )
+    {
+        assert( m_layerWidths == other.m_layerWidths );
+
+        for ( int32_t layerIdx = 0; layerIdx < GetNumWeightLayers(); layerIdx++ )
+        {
+            size_t const numLayerWeights = (size_t) ( m_layerWidths[layerIdx] + 1 ) * m_layerWidths[layerIdx + 1];
+            Scalar* const weights = GetLayerWeights( layerIdx );
+            OtherScalar const* const otherWeights = other.GetLayerWeights( layerIdx );
+            for ( size_t weightIdx = 0; weightIdx < numLayerWeights; weightIdx++ )
+            {
+                weights[weightIdx] = static_cast<Scalar>( otherWeights[weightIdx] );
+            }
+        }
+    }
+
+    // Double precision is the default, float halves the memory traffic and doubles the SIMD lanes
+    typedef NetworkT<double> Network;
+    typedef NetworkT<float> NetworkFloat;
 }
\ No newline at end of file
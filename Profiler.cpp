@@ -0,0 +1,444 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Profiling
+    {
+        static char const* const k_phaseNames[] =
+        {
+            "TrainingPass",
+            "TestPass",
+            "Forward",
+            "Backpropagate",
+            "BatchGradients",
+            "ReduceGradients",
+            "ApplyGradients",
+            "AsyncSample",
+            "SetStatistics",
+            "ReadData",
+            "ParseText",
+            "ReadCache",
+            "ReadChunk",
+        };
+
+        static_assert( sizeof( k_phaseNames ) / sizeof( k_phaseNames[0] ) == (size_t) Phase::Count, "Every phase needs a name" );
+
+        char const* GetPhaseName( Phase phase )
+        {
+            return k_phaseNames[(size_t) phase];
+        }
+
+#if BPN_PROFILING
+
+        typedef std::chrono::steady_clock Clock;
+
+        // Four buckets per power of two up to 2^64 ns
+        static size_t const k_numHistogramBuckets = 252;
+
+        static size_t GetHistogramBucket( uint64_t nanoseconds )
+        {
+            if ( nanoseconds < 4 )
+            {
+                return (size_t) nanoseconds;
+            }
+
+            uint32_t highestBit = 2;
+            while ( highestBit < 63 && ( nanoseconds >> ( highestBit + 1 ) ) != 0 )
+            {
+                highestBit++;
+            }
+            return ( highestBit - 1 ) * 4 + ( ( nanoseconds >> ( highestBit - 2 ) ) & 3 );
+        }
+
+        static double GetHistogramBucketMiddle( size_t bucketIdx )
+        {
+            if ( bucketIdx < 4 )
+            {
+                return (double) bucketIdx;
+            }
+
+            uint32_t const highestBit = (uint32_t) ( bucketIdx / 4 ) + 1;
+            double const width = std::ldexp( 1.0, (int) highestBit - 2 );
+            return ( 4 + bucketIdx % 4 ) * width + width / 2;
+        }
+
+        static uint32_t GetSampleInterval( Phase phase )
+        {
+            switch ( phase )
+            {
+                case Phase::Forward:
+                case Phase::Backpropagate:
+                case Phase::AsyncSample:
+                    return k_sampleInterval;
+
+                default:
+                    return 1;
+            }
+        }
+
+        // Every value has a single writer, the thread owning the profile, so it is updated with a relaxed load and store instead of a locked add
+        static inline void AddRelaxed( std::atomic<uint64_t>& value, uint64_t amount )
+        {
+            value.store( value.load( std::memory_order_relaxed ) + amount, std::memory_order_relaxed );
+        }
+
+        struct PhaseProfile
+        {
+            std::atomic<uint64_t>   m_numCalls;
+            std::atomic<uint64_t>   m_numTimedCalls;
+            std::atomic<uint64_t>   m_totalNanoseconds;         // Of the timed calls
+            std::atomic<uint64_t>   m_maxNanoseconds;
+            std::atomic<uint64_t>   m_histogram[k_numHistogramBuckets];
+        };
+
+        struct ThreadProfile
+        {
+            ThreadProfile() { Clear(); }
+
+            void Clear()
+            {
+                for ( auto& phase : m_phases )
+                {
+                    phase.m_numCalls.store( 0, std::memory_order_relaxed );
+                    phase.m_numTimedCalls.store( 0, std::memory_order_relaxed );
+                    phase.m_totalNanoseconds.store( 0, std::memory_order_relaxed );
+                    phase.m_maxNanoseconds.store( 0, std::memory_order_relaxed );
+                    for ( auto& bucket : phase.m_histogram )
+                    {
+                        bucket.store( 0, std::memory_order_relaxed );
+                    }
+                }
+
+                for ( auto& counter : m_counters )
+                {
+                    counter.store( 0, std::memory_order_relaxed );
+                }
+            }
+
+            // Only called with the registry locked, target is the retired profile
+            void AddTo( ThreadProfile& target ) const
+            {
+                for ( size_t phaseIdx = 0; phaseIdx < (size_t) Phase::Count; phaseIdx++ )
+                {
+                    PhaseProfile const& phase = m_phases[phaseIdx];
+                    PhaseProfile& targetPhase = target.m_phases[phaseIdx];
+                    AddRelaxed( targetPhase.m_numCalls, phase.m_numCalls.load( std::memory_order_relaxed ) );
+                    AddRelaxed( targetPhase.m_numTimedCalls, phase.m_numTimedCalls.load( std::memory_order_relaxed ) );
+                    AddRelaxed( targetPhase.m_totalNanoseconds, phase.m_totalNanoseconds.load( std::memory_order_relaxed ) );
+                    targetPhase.m_maxNanoseconds.store( std::max( targetPhase.m_maxNanoseconds.load( std::memory_order_relaxed ), phase.m_maxNanoseconds.load( std::memory_order_relaxed ) ), std::memory_order_relaxed );
+                    for ( size_t bucketIdx = 0; bucketIdx < k_numHistogramBuckets; bucketIdx++ )
+                    {
+                        AddRelaxed( targetPhase.m_histogram[bucketIdx], phase.m_histogram[bucketIdx].load( std::memory_order_relaxed ) );
+                    }
+                }
+
+                for ( size_t counterIdx = 0; counterIdx < (size_t) Counter::Count; counterIdx++ )
+                {
+                    AddRelaxed( target.m_counters[counterIdx], m_counters[counterIdx].load( std::memory_order_relaxed ) );
+                }
+            }
+
+            PhaseProfile            m_phases[(size_t) Phase::Count];
+            std::atomic<uint64_t>   m_counters[(size_t) Counter::Count];
+        };
+
+        struct Registry
+        {
+            std::mutex                      m_mutex;
+            std::vector<ThreadProfile*>     m_threads;                                          // Profiles of the running threads
+            ThreadProfile                   m_retired;                                          // Sum of the profiles of exited threads
+            uint32_t                        m_numRetiredThreads[(size_t) Phase::Count] = {};   // Exited threads that recorded each phase
+            uint64_t                        m_generationStart[(size_t) Counter::Count] = {};   // Counters when the current generation started
+            std::vector<GenerationCounters> m_generations;
+        };
+
+        static Registry& GetRegistry()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        // Registers the profile of a thread on its first record and folds it into the retired profile when the thread exits, so
+        // short lived threads (one evaluation worker per Train) do not pile up
+        struct ThreadProfileOwner
+        {
+            ThreadProfileOwner()
+                : m_profile( new ThreadProfile() )
+            {
+                Registry& registry = GetRegistry();
+                std::lock_guard<std::mutex> lock( registry.m_mutex );
+                registry.m_threads.push_back( m_profile.get() );
+            }
+
+            ~ThreadProfileOwner()
+            {
+                Registry& registry = GetRegistry();
+                std::lock_guard<std::mutex> lock( registry.m_mutex );
+                m_profile->AddTo( registry.m_retired );
+                for ( size_t phaseIdx = 0; phaseIdx < (size_t) Phase::Count; phaseIdx++ )
+                {
+                    registry.m_numRetiredThreads[phaseIdx] += ( m_profile->m_phases[phaseIdx].m_numCalls.load( std::memory_order_relaxed ) > 0 ) ? 1 : 0;
+                }
+                registry.m_threads.erase( std::find( registry.m_threads.begin(), registry.m_threads.end(), m_profile.get() ) );
+            }
+
+            std::unique_ptr<ThreadProfile>  m_profile;
+        };
+
+        static ThreadProfile& GetThreadProfile()
+        {
+            thread_local ThreadProfileOwner owner;
+            return *owner.m_profile;
+        }
+
+        // Only called with the registry locked
+        static void SumCounters( Registry const& registry, uint64_t* counters )
+        {
+            for ( size_t counterIdx = 0; counterIdx < (size_t) Counter::Count; counterIdx++ )
+            {
+                counters[counterIdx] = registry.m_retired.m_counters[counterIdx].load( std::memory_order_relaxed );
+                for ( ThreadProfile const* profile : registry.m_threads )
+                {
+                    counters[counterIdx] += profile->m_counters[counterIdx].load( std::memory_order_relaxed );
+                }
+            }
+        }
+
+        //-------------------------------------------------------------------------
+
+        thread_local uint32_t t_callsUntilTimed[(size_t) Phase::Count] = {};
+
+        // Shortest time between two clock reads, subtracted from every timed call so that short phases are not inflated by the timer
+        static uint64_t MeasureClockOverhead()
+        {
+            int64_t minNanoseconds = INT64_MAX;
+            for ( int32_t i = 0; i < 1000; i++ )
+            {
+                Clock::time_point const start = Clock::now();
+                minNanoseconds = std::min<int64_t>( minNanoseconds, std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - start ).count() );
+            }
+            return (uint64_t) std::max<int64_t>( minNanoseconds, 0 );
+        }
+
+        void ScopedTimer::Start( Phase phase )
+        {
+            // This call stands for itself and the untimed calls until the next timed one
+            uint32_t const sampleInterval = GetSampleInterval( phase );
+            t_callsUntilTimed[(size_t) phase] = sampleInterval - 1;
+
+            m_profile = &GetThreadProfile().m_phases[(size_t) phase];
+            AddRelaxed( m_profile->m_numCalls, sampleInterval );
+            m_start = Clock::now();
+        }
+
+        void ScopedTimer::Stop()
+        {
+            Clock::time_point const end = Clock::now();
+            static uint64_t const clockOverhead = MeasureClockOverhead();
+            uint64_t const elapsed = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>( end - m_start ).count();
+            uint64_t const nanoseconds = elapsed - std::min( elapsed, clockOverhead );
+            AddRelaxed( m_profile->m_numTimedCalls, 1 );
+            AddRelaxed( m_profile->m_totalNanoseconds, nanoseconds );
+            AddRelaxed( m_profile->m_histogram[GetHistogramBucket( nanoseconds )], 1 );
+            if ( nanoseconds > m_profile->m_maxNanoseconds.load( std::memory_order_relaxed ) )
+            {
+                m_profile->m_maxNanoseconds.store( nanoseconds, std::memory_order_relaxed );
+            }
+        }
+
+        void AddCount( Counter counter, uint64_t value )
+        {
+            AddRelaxed( GetThreadProfile().m_counters[(size_t) counter], value );
+        }
+
+        void Reset()
+        {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock( registry.m_mutex );
+            for ( ThreadProfile* profile : registry.m_threads )
+            {
+                profile->Clear();
+            }
+            registry.m_retired.Clear();
+            std::fill( std::begin( registry.m_numRetiredThreads ), std::end( registry.m_numRetiredThreads ), 0 );
+            std::fill( std::begin( registry.m_generationStart ), std::end( registry.m_generationStart ), 0 );
+            registry.m_generations.clear();
+        }
+
+        void EndGeneration( uint32_t generation, double seconds )
+        {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock( registry.m_mutex );
+
+            GenerationCounters record = { generation, seconds, {} };
+            uint64_t counters[(size_t) Counter::Count];
+            SumCounters( registry, counters );
+            for ( size_t counterIdx = 0; counterIdx < (size_t) Counter::Count; counterIdx++ )
+            {
+                record.m_counters[counterIdx] = counters[counterIdx] - registry.m_generationStart[counterIdx];
+                registry.m_generationStart[counterIdx] = counters[counterIdx];
+            }
+            registry.m_generations.push_back( record );
+        }
+
+        Summary GetSummary()
+        {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock( registry.m_mutex );
+
+            Summary summary;
+            std::vector<uint64_t> histogram( k_numHistogramBuckets );
+
+            for ( size_t phaseIdx = 0; phaseIdx < (size_t) Phase::Count; phaseIdx++ )
+            {
+                PhaseSummary& phaseSummary = summary.m_phases[phaseIdx];
+                phaseSummary.m_numThreads = registry.m_numRetiredThreads[phaseIdx];
+                std::fill( histogram.begin(), histogram.end(), 0 );
+                uint64_t totalNanoseconds = 0;
+                uint64_t maxNanoseconds = 0;
+
+                auto const addProfile = [&] ( PhaseProfile const& profile )
+                {
+                    phaseSummary.m_numCalls += profile.m_numCalls.load( std::memory_order_relaxed );
+                    phaseSummary.m_numTimedCalls += profile.m_numTimedCalls.load( std::memory_order_relaxed );
+                    totalNanoseconds += profile.m_totalNanoseconds.load( std::memory_order_relaxed );
+                    maxNanoseconds = std::max( maxNanoseconds, profile.m_maxNanoseconds.load( std::memory_order_relaxed ) );
+                    for ( size_t bucketIdx = 0; bucketIdx < k_numHistogramBuckets; bucketIdx++ )
+                    {
+                        histogram[bucketIdx] += profile.m_histogram[bucketIdx].load( std::memory_order_relaxed );
+                    }
+                };
+
+                addProfile( registry.m_retired.m_phases[phaseIdx] );
+                for ( ThreadProfile const* profile : registry.m_threads )
+                {
+                    addProfile( profile->m_phases[phaseIdx] );
+                    phaseSummary.m_numThreads += ( profile->m_phases[phaseIdx].m_numCalls.load( std::memory_order_relaxed ) > 0 ) ? 1 : 0;
+                }
+
+                if ( phaseSummary.m_numTimedCalls == 0 )
+                {
+                    continue;
+                }
+
+                phaseSummary.m_meanNanoseconds = (double) totalNanoseconds / phaseSummary.m_numTimedCalls;
+                phaseSummary.m_totalSeconds = phaseSummary.m_meanNanoseconds * phaseSummary.m_numCalls * 1e-9;
+                phaseSummary.m_maxNanoseconds = (double) maxNanoseconds;
+
+                // Walk the histogram up to the buckets holding the 50th and the 99th percentile
+                uint64_t const p50Rank = ( phaseSummary.m_numTimedCalls + 1 ) / 2;
+                uint64_t const p99Rank = std::max<uint64_t>( ( phaseSummary.m_numTimedCalls * 99 + 99 ) / 100, 1 );
+                uint64_t numBelow = 0;
+                for ( size_t bucketIdx = 0; bucketIdx < k_numHistogramBuckets; bucketIdx++ )
+                {
+                    if ( numBelow < p50Rank && numBelow + histogram[bucketIdx] >= p50Rank )
+                    {
+                        phaseSummary.m_p50Nanoseconds = GetHistogramBucketMiddle( bucketIdx );
+                    }
+                    if ( numBelow < p99Rank && numBelow + histogram[bucketIdx] >= p99Rank )
+                    {
+                        phaseSummary.m_p99Nanoseconds = GetHistogramBucketMiddle( bucketIdx );
+                    }
+                    numBelow += histogram[bucketIdx];
+                }
+
+                // The middle of the top bucket can lie above the slowest call
+                phaseSummary.m_p50Nanoseconds = std::min( phaseSummary.m_p50Nanoseconds, phaseSummary.m_maxNanoseconds );
+                phaseSummary.m_p99Nanoseconds = std::min( phaseSummary.m_p99Nanoseconds, phaseSummary.m_maxNanoseconds );
+            }
+
+            SumCounters( registry, summary.m_counters );
+            summary.m_generations = registry.m_generations;
+            return summary;
+        }
+
+        void PrintSummary()
+        {
+            Summary const summary = GetSummary();
+
+            std::ios::fmtflags const flags = std::cout.flags();
+            std::streamsize const precision = std::cout.precision();
+
+            std::cout << std::endl << "Profile (the per sample phases are timed on 1 of " << k_sampleInterval << " calls)" << std::endl;
+            std::cout << "Phase                   Calls    Total ms     Mean ns      p50 ns      p99 ns      Max ns  Threads" << std::endl;
+            std::cout << std::fixed << std::setprecision( 1 );
+            for ( size_t phaseIdx = 0; phaseIdx < (size_t) Phase::Count; phaseIdx++ )
+            {
+                PhaseSummary const& phase = summary.m_phases[phaseIdx];
+                if ( phase.m_numCalls == 0 )
+                {
+                    continue;
+                }
+
+                std::cout << std::left << std::setw( 16 ) << k_phaseNames[phaseIdx] << std::right << std::setw( 12 ) << phase.m_numCalls << std::setw( 12 ) << phase.m_totalSeconds * 1e3
+                    << std::setw( 12 ) << phase.m_meanNanoseconds << std::setw( 12 ) << phase.m_p50Nanoseconds << std::setw( 12 ) << phase.m_p99Nanoseconds
+                    << std::setw( 12 ) << phase.m_maxNanoseconds << std::setw( 9 ) << phase.m_numThreads << std::endl;
+            }
+
+            uint64_t const* const counters = summary.m_counters;
+            std::cout << std::setprecision( 3 ) << "Trained samples " << counters[(size_t) Counter::TrainedSamples] << ", evaluated samples " << counters[(size_t) Counter::EvaluatedSamples]
+                << ", " << counters[(size_t) Counter::Flops] * 1e-9 << " GFLOP, " << counters[(size_t) Counter::BytesTouched] * 1e-9 << " GB touched (estimates)" << std::endl;
+
+            if ( !summary.m_generations.empty() )
+            {
+                // Counters of the training passes and of the test passes that ran during them
+                double totalSeconds = 0;
+                double minSeconds = summary.m_generations.front().m_seconds;
+                double maxSeconds = minSeconds;
+                uint64_t flops = 0;
+                uint64_t bytes = 0;
+                for ( auto const& generation : summary.m_generations )
+                {
+                    totalSeconds += generation.m_seconds;
+                    minSeconds = std::min( minSeconds, generation.m_seconds );
+                    maxSeconds = std::max( maxSeconds, generation.m_seconds );
+                    flops += generation.m_counters[(size_t) Counter::Flops];
+                    bytes += generation.m_counters[(size_t) Counter::BytesTouched];
+                }
+
+                size_t const numGenerations = summary.m_generations.size();
+                std::cout << numGenerations << " generations: training pass " << minSeconds * 1e3 << " / " << totalSeconds * 1e3 / numGenerations << " / " << maxSeconds * 1e3
+                    << " ms (min / mean / max), " << flops * 1e-6 / numGenerations << " MFLOP and " << bytes * 1e-6 / numGenerations << " MB per generation";
+                if ( totalSeconds > 0 )
+                {
+                    std::cout << ", " << flops * 1e-9 / totalSeconds << " GFLOP/s";
+                }
+                std::cout << std::endl;
+            }
+
+            std::cout.flags( flags );
+            std::cout.precision( precision );
+        }
+
+#else
+
+        void Reset()
+        {
+        }
+
+        void EndGeneration( uint32_t, double )
+        {
+        }
+
+        Summary GetSummary()
+        {
+            return Summary();
+        }
+
+        void PrintSummary()
+        {
+            std::cout << std::endl << "Profiling is disabled in this build (BPN_PROFILING=0)" << std::endl;
+        }
+
+#endif
+    }
+}
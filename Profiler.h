@@ -0,0 +1,155 @@
+// Phase timers and work counters of training and data loading
+//
+// Every thread records into its own profile without locks, GetSummary adds up the profiles of all threads. Build with BPN_PROFILING=0
+// (the CMake option BPN_PROFILING=OFF) to compile every timer and counter out, the summary then only reports that profiling is disabled.
+#pragma once
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#if !defined( BPN_PROFILING )
+#define BPN_PROFILING 1
+#endif
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace Profiling
+    {
+        enum class Phase : uint8_t
+        {
+            TrainingPass,           // One generation over the training set
+            TestPass,               // Test set accuracy and MSE after one generation
+            Forward,                // Evaluate of one training sample in the serial loop
+            Backpropagate,          // Error gradients, momentum deltas and weight update of one sample
+            BatchGradients,         // Forward and backward pass over one shard of a mini-batch
+            ReduceGradients,        // Summing the shard gradients of one mini-batch
+            ApplyGradients,         // Momentum step of one mini-batch
+            AsyncSample,            // Forward pass, backward pass and in place update of one sample in asynchronous mode
+            SetStatistics,          // Accuracy and MSE of a set or of a chunk of it
+            ReadData,               // TrainingFileReader::ReadData
+            ParseText,              // Parsing the lines of one read buffer of a CSV file
+            ReadCache,              // Loading the binary dataset cache
+            ReadChunk,              // One chunk of a streaming data source
+            Count
+        };
+
+        enum class Counter : uint8_t
+        {
+            TrainedSamples,
+            EvaluatedSamples,       // Test samples and other evaluations outside of training
+            Flops,                  // Estimate: two per weight for the forward pass, the hidden error gradients, the deltas and the update each
+            BytesTouched,           // Estimate: every access to the weights, deltas and gradients counts, as if nothing was cached
+            Count
+        };
+
+        // The per sample phases run millions of times per second, only every k_sampleInterval-th call per thread is timed and the total
+        // time is extrapolated from those. Their call counts are rounded up to whole intervals.
+        static uint32_t const k_sampleInterval = 16;
+
+        struct PhaseSummary
+        {
+            uint64_t                m_numCalls = 0;
+            uint64_t                m_numTimedCalls = 0;
+            double                  m_totalSeconds = 0;         // Extrapolated to all calls for the sampled phases
+            double                  m_meanNanoseconds = 0;
+            double                  m_p50Nanoseconds = 0;       // Percentiles from a histogram with four buckets per power of two
+            double                  m_p99Nanoseconds = 0;
+            double                  m_maxNanoseconds = 0;
+            uint32_t                m_numThreads = 0;           // Threads that recorded the phase
+        };
+
+        // Counters added up over one generation, on all threads
+        struct GenerationCounters
+        {
+            uint32_t                m_generation;
+            double                  m_seconds;                  // Training pass
+            uint64_t                m_counters[(size_t) Counter::Count];
+        };
+
+        struct Summary
+        {
+            PhaseSummary            m_phases[(size_t) Phase::Count];
+            uint64_t                m_counters[(size_t) Counter::Count] = {};
+            std::vector<GenerationCounters> m_generations;
+        };
+
+        char const* GetPhaseName( Phase phase );
+
+        inline constexpr bool IsEnabled() { return BPN_PROFILING != 0; }
+
+        // Clears the profiles of all threads, records made at the same time on other threads may survive
+        void Reset();
+
+        // Stores the counters added since the previous generation ended
+        void EndGeneration( uint32_t generation, double seconds );
+
+        Summary GetSummary();
+
+        // Phases, counters, throughput and the per generation counters, printed to the console
+        void PrintSummary();
+
+        //-------------------------------------------------------------------------
+
+#if BPN_PROFILING
+
+        struct PhaseProfile;
+
+        // Calls of every phase on this thread until the next timed one
+        extern thread_local uint32_t t_callsUntilTimed[(size_t) Phase::Count];
+
+        // Records the time from construction to destruction as one call of phase on the calling thread. The untimed calls of the per
+        // sample phases only count down inline, the clock and the profile are touched out of line.
+        class ScopedTimer
+        {
+        public:
+
+            explicit ScopedTimer( Phase phase )
+                : m_profile( nullptr )
+            {
+                if ( t_callsUntilTimed[(size_t) phase]-- == 0 )
+                {
+                    Start( phase );
+                }
+            }
+
+            ~ScopedTimer()
+            {
+                if ( m_profile != nullptr )
+                {
+                    Stop();
+                }
+            }
+
+            ScopedTimer( ScopedTimer const& ) = delete;
+            ScopedTimer& operator=( ScopedTimer const& ) = delete;
+
+        private:
+
+            void Start( Phase phase );
+            void Stop();
+
+        private:
+
+            PhaseProfile*                           m_profile;  // Null if this call is not timed
+            std::chrono::steady_clock::time_point   m_start;
+        };
+
+        void AddCount( Counter counter, uint64_t value );
+
+#define BPN_PROFILE_CONCAT_INNER( a, b ) a##b
+#define BPN_PROFILE_CONCAT( a, b ) BPN_PROFILE_CONCAT_INNER( a, b )
+#define BPN_PROFILE_SCOPE( phase ) ::BPN::Profiling::ScopedTimer const BPN_PROFILE_CONCAT( profileTimer, __LINE__ )( ::BPN::Profiling::Phase::phase )
+#define BPN_PROFILE_COUNT( counter, value ) ::BPN::Profiling::AddCount( ::BPN::Profiling::Counter::counter, (uint64_t) ( value ) )
+#define BPN_PROFILE_END_GENERATION( generation, seconds ) ::BPN::Profiling::EndGeneration( generation, seconds )
+
+#else
+
+#define BPN_PROFILE_SCOPE( phase ) ( (void) 0 )
+#define BPN_PROFILE_COUNT( counter, value ) ( (void) 0 )
+#define BPN_PROFILE_END_GENERATION( generation, seconds ) ( (void) 0 )
+
+#endif
+    }
+}
@@ -0,0 +1,230 @@
+#include "QuantizedNetwork.h"
+#include "NNKernels.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    static int32_t const k_maxQuantized = 127;
+
+    // Weight rows and activations are padded to a multiple of one 128 bit vector of int8 values
+    static int32_t const k_rowAlignment = 16;
+
+    static inline int8_t Quantize( float value, float inverseScale )
+    {
+        int32_t const quantized = (int32_t) std::lrint( value * inverseScale );
+        return (int8_t) std::min( std::max( quantized, -k_maxQuantized ), k_maxQuantized );
+    }
+
+    QuantizedNetwork::QuantizedNetwork( Network const& network, TrainingSet const& calibrationSet )
+    {
+        std::vector<std::vector<double>> minActivations, maxActivations;
+        Calibrate( network, calibrationSet, minActivations, maxActivations );
+
+        int32_t maxWidth = 0;
+        m_layers.resize( network.GetNumLayers() - 1 );
+        for ( int32_t layerIdx = 0; layerIdx < (int32_t) m_layers.size(); layerIdx++ )
+        {
+            Layer& layer = m_layers[layerIdx];
+            layer.m_numInputs = network.GetLayerWidth( layerIdx );
+            layer.m_numOutputs = network.GetLayerWidth( layerIdx + 1 );
+            layer.m_weightStride = ( layer.m_numInputs + k_rowAlignment - 1 ) / k_rowAlignment * k_rowAlignment;
+            layer.m_activation = network.GetLayerActivation( layerIdx + 1 );
+            layer.m_weights.Resize( (size_t) layer.m_numOutputs * layer.m_weightStride );
+            layer.m_biases.resize( layer.m_numOutputs );
+            layer.m_outputScales.resize( layer.m_numOutputs );
+            maxWidth = std::max( maxWidth, layer.m_weightStride );
+
+            // Input ranges: the int8 values -127..127 cover [min, max] of the calibration samples
+            std::vector<double> inputScales( layer.m_numInputs );
+            layer.m_inputOffsets.resize( layer.m_numInputs );
+            layer.m_inverseInputScales.resize( layer.m_numInputs );
+            for ( int32_t inputIdx = 0; inputIdx < layer.m_numInputs; inputIdx++ )
+            {
+                double const range = maxActivations[layerIdx][inputIdx] - minActivations[layerIdx][inputIdx];
+                inputScales[inputIdx] = range > 0 ? range / ( 2 * k_maxQuantized ) : 1.0;
+                layer.m_inputOffsets[inputIdx] = (float) ( ( maxActivations[layerIdx][inputIdx] + minActivations[layerIdx][inputIdx] ) / 2 );
+                layer.m_inverseInputScales[inputIdx] = (float) ( 1.0 / inputScales[inputIdx] );
+            }
+
+            // Network stores one row per input neuron with the bias row last. With x = offset + scale * q the sum of an output neuron is
+            // sum( q * scale * w ) + sum( offset * w ) - bias weight, the first part is quantized per output neuron, the rest is its bias
+            double const* const weights = network.GetLayerWeights( layerIdx );
+            std::vector<double> scaledWeights( layer.m_numInputs );
+            for ( int32_t outputIdx = 0; outputIdx < layer.m_numOutputs; outputIdx++ )
+            {
+                double maxWeight = 0;
+                double bias = -weights[(size_t) layer.m_numInputs * layer.m_numOutputs + outputIdx];
+                for ( int32_t inputIdx = 0; inputIdx < layer.m_numInputs; inputIdx++ )
+                {
+                    double const weight = weights[(size_t) inputIdx * layer.m_numOutputs + outputIdx];
+                    scaledWeights[inputIdx] = weight * inputScales[inputIdx];
+                    maxWeight = std::max( maxWeight, std::fabs( scaledWeights[inputIdx] ) );
+                    bias += layer.m_inputOffsets[inputIdx] * weight;
+                }
+
+                double const weightScale = maxWeight > 0 ? maxWeight / k_maxQuantized : 1.0;
+                int8_t* const weightRow = layer.m_weights.data() + (size_t) outputIdx * layer.m_weightStride;
+                for ( int32_t inputIdx = 0; inputIdx < layer.m_numInputs; inputIdx++ )
+                {
+                    weightRow[inputIdx] = Quantize( (float) scaledWeights[inputIdx], (float) ( 1.0 / weightScale ) );
+                }
+
+                layer.m_biases[outputIdx] = (int32_t) std::lrint( bias / weightScale );
+                layer.m_outputScales[outputIdx] = (float) weightScale;
+            }
+        }
+
+        m_activations[0].Resize( maxWidth );
+        m_activations[1].Resize( maxWidth );
+        m_sums.resize( maxWidth );
+        m_outputs.resize( GetNumOutputs() );
+    }
+
+    void QuantizedNetwork::Calibrate( Network const& network, TrainingSet const& calibrationSet, std::vector<std::vector<double>>& minActivations, std::vector<std::vector<double>>& maxActivations ) const
+    {
+        int32_t const numWeightLayers = network.GetNumLayers() - 1;
+        minActivations.resize( numWeightLayers );
+        maxActivations.resize( numWeightLayers );
+        for ( int32_t layerIdx = 0; layerIdx < numWeightLayers; layerIdx++ )
+        {
+            minActivations[layerIdx].assign( network.GetLayerWidth( layerIdx ), calibrationSet.empty() ? 0.0 : HUGE_VAL );
+            maxActivations[layerIdx].assign( network.GetLayerWidth( layerIdx ), calibrationSet.empty() ? 0.0 : -HUGE_VAL );
+        }
+
+        std::vector<double> layerInputs, layerOutputs;
+        for ( auto const& entry : calibrationSet )
+        {
+            assert( entry.IsSparse() || entry.m_inputs.size() == (size_t) network.GetNumInputs() );
+            layerInputs.resize( network.GetNumInputs() );
+            entry.GetDenseInputs( network.GetNumInputs(), layerInputs.data() );
+
+            for ( int32_t layerIdx = 0; layerIdx < numWeightLayers; layerIdx++ )
+            {
+                for ( size_t neuronIdx = 0; neuronIdx < layerInputs.size(); neuronIdx++ )
+                {
+                    minActivations[layerIdx][neuronIdx] = std::min( minActivations[layerIdx][neuronIdx], layerInputs[neuronIdx] );
+                    maxActivations[layerIdx][neuronIdx] = std::max( maxActivations[layerIdx][neuronIdx], layerInputs[neuronIdx] );
+                }
+                if ( layerIdx + 1 == numWeightLayers )
+                {
+                    break;
+                }
+
+                // Same sums as Network::Evaluate in double precision, the output layer is not needed
+                int32_t const numLayerInputs = network.GetLayerWidth( layerIdx );
+                int32_t const numLayerOutputs = network.GetLayerWidth( layerIdx + 1 );
+                double const* const weights = network.GetLayerWeights( layerIdx );
+
+                layerOutputs.assign( weights + (size_t) numLayerInputs * numLayerOutputs, weights + (size_t) ( numLayerInputs + 1 ) * numLayerOutputs );
+                for ( auto& value : layerOutputs )
+                {
+                    value = -value;
+                }
+
+                for ( int32_t inputIdx = 0; inputIdx < numLayerInputs; inputIdx++ )
+                {
+                    for ( int32_t outputIdx = 0; outputIdx < numLayerOutputs; outputIdx++ )
+                    {
+                        layerOutputs[outputIdx] += layerInputs[inputIdx] * weights[(size_t) inputIdx * numLayerOutputs + outputIdx];
+                    }
+                }
+
+                Kernels::Activate( network.GetLayerActivation( layerIdx + 1 ), 1, numLayerOutputs, layerOutputs.data(), numLayerOutputs );
+
+                layerInputs.swap( layerOutputs );
+            }
+        }
+    }
+
+    int32_t QuantizedNetwork::Evaluate( double const* input, float* outputs )
+    {
+        assert( input != nullptr );
+
+        // Quantize the inputs
+        //-------------------------------------------------------------------------
+
+        Layer const& inputLayer = m_layers.front();
+        for ( int32_t inputIdx = 0; inputIdx < GetNumInputs(); inputIdx++ )
+        {
+            m_activations[0][inputIdx] = Quantize( (float) input[inputIdx] - inputLayer.m_inputOffsets[inputIdx], inputLayer.m_inverseInputScales[inputIdx] );
+        }
+
+        // Every layer: int32 sums over the whole padded row (the padding weights are zero), activation in float, requantized for the next layer
+        //-------------------------------------------------------------------------
+
+        for ( int32_t layerIdx = 0; layerIdx < (int32_t) m_layers.size(); layerIdx++ )
+        {
+            Layer const& layer = m_layers[layerIdx];
+            bool const isOutputLayer = ( layerIdx + 1 == (int32_t) m_layers.size() );
+            int8_t const* const layerInputs = m_activations[layerIdx % 2].data();
+            int8_t* const layerOutputs = m_activations[( layerIdx + 1 ) % 2].data();
+            Layer const* const nextLayer = isOutputLayer ? nullptr : &m_layers[layerIdx + 1];
+
+            for ( int32_t outputIdx = 0; outputIdx < layer.m_numOutputs; outputIdx++ )
+            {
+                int8_t const* const weightRow = layer.m_weights.data() + (size_t) outputIdx * layer.m_weightStride;
+
+                int32_t sum = 0;
+                for ( int32_t inputIdx = 0; inputIdx < layer.m_weightStride; inputIdx++ )
+                {
+                    sum += (int32_t) layerInputs[inputIdx] * (int32_t) weightRow[inputIdx];
+                }
+
+                m_sums[outputIdx] = (float) ( sum + layer.m_biases[outputIdx] ) * layer.m_outputScales[outputIdx];
+            }
+
+            Kernels::Activate( layer.m_activation, 1, layer.m_numOutputs, m_sums.data(), layer.m_numOutputs );
+            for ( int32_t outputIdx = 0; outputIdx < layer.m_numOutputs; outputIdx++ )
+            {
+                if ( isOutputLayer )
+                {
+                    m_outputs[outputIdx] = m_sums[outputIdx];
+                }
+                else
+                {
+                    layerOutputs[outputIdx] = Quantize( m_sums[outputIdx] - nextLayer->m_inputOffsets[outputIdx], nextLayer->m_inverseInputScales[outputIdx] );
+                }
+            }
+        }
+
+        if ( outputs != nullptr )
+        {
+            std::copy( m_outputs.begin(), m_outputs.end(), outputs );
+        }
+
+        // Pick the single highest output
+        //-------------------------------------------------------------------------
+
+        int32_t bestIdx = 0;
+        bool isUnique = true;
+        for ( int32_t outputIdx = 1; outputIdx < GetNumOutputs(); outputIdx++ )
+        {
+            if ( m_outputs[outputIdx] > m_outputs[bestIdx] )
+            {
+                bestIdx = outputIdx;
+                isUnique = true;
+            }
+            else if ( m_outputs[outputIdx] == m_outputs[bestIdx] )
+            {
+                isUnique = false;
+            }
+        }
+
+        return isUnique ? bestIdx : -1;
+    }
+
+    size_t QuantizedNetwork::GetModelBytes() const
+    {
+        size_t numBytes = 0;
+        for ( auto const& layer : m_layers )
+        {
+            numBytes += layer.m_weights.size() * sizeof( int8_t ) + layer.m_biases.size() * sizeof( int32_t ) + layer.m_outputScales.size() * sizeof( float )
+                + ( layer.m_inputOffsets.size() + layer.m_inverseInputScales.size() ) * sizeof( float );
+        }
+        return numBytes;
+    }
+}
@@ -0,0 +1,56 @@
+// Int8 inference only copy of a trained network
+#pragma once
+#include "NNTrainer.h"
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // Weights are stored as int8 with one scale per output neuron (per output channel) and the weighted sums are accumulated in int32.
+    // Every activation is quantized to int8 over its own calibrated range: x = offset + scale * q. Scale and offset are folded into the
+    // weights and the bias of the layer reading it, so the sums stay pure int8 products. Only the activation function runs in float,
+    // its result is requantized for the next layer.
+    class QuantizedNetwork
+    {
+    public:
+
+        // Quantizes the weights of network, the range of every activation is the smallest and largest value seen while evaluating
+        // network on the calibration samples
+        QuantizedNetwork( Network const& network, TrainingSet const& calibrationSet );
+
+        // Index of the single highest output, -1 if there is none (same rule as Network::EvaluateBatch), outputs (optional) receives
+        // the activations of the output layer
+        int32_t Evaluate( double const* input, float* outputs = nullptr );
+
+        inline int32_t GetNumInputs() const { return m_layers.front().m_numInputs; }
+        inline int32_t GetNumOutputs() const { return m_layers.back().m_numOutputs; }
+
+        // Memory used by the quantized weights, biases and scales
+        size_t GetModelBytes() const;
+
+    private:
+
+        struct Layer
+        {
+            int32_t                 m_numInputs;
+            int32_t                 m_numOutputs;
+            int32_t                 m_weightStride;             // Inputs rounded up to a whole vector of int8 values
+            Activation              m_activation;               // Of the output neurons
+            std::vector<float>      m_inputOffsets;             // Real value of every input quantized to 0
+            std::vector<float>      m_inverseInputScales;       // Int8 steps per real unit of every input
+            AlignedBuffer<int8_t>   m_weights;                  // One row of m_weightStride values per output neuron (transposed compared to Network)
+            std::vector<int32_t>    m_biases;                   // Bias of every output neuron in the scale of its sum
+            std::vector<float>      m_outputScales;             // Real value of one step of the int32 sum of every output neuron
+        };
+
+        // Smallest and largest activation of every neuron feeding a weight layer, one vector per weight layer
+        void Calibrate( Network const& network, TrainingSet const& calibrationSet, std::vector<std::vector<double>>& minActivations, std::vector<std::vector<double>>& maxActivations ) const;
+
+    private:
+
+        std::vector<Layer>          m_layers;
+        AlignedBuffer<int8_t>       m_activations[2];           // Int8 inputs of the current layer, two buffers used alternately
+        std::vector<float>          m_sums;                     // Real sums of the current layer, activated in place
+        std::vector<float>          m_outputs;
+    };
+}
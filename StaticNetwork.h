@@ -0,0 +1,148 @@
+// Inference only copy of a single hidden layer network with its topology fixed at compile time
+#pragma once
+#include "NeuralNetwork.h"
+#include <array>
+#include <cmath>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // All sizes are constants and the weights live in std::array members, so Evaluate has no heap access, no bounds and loops the
+    // compiler can fully unroll for small networks. The weight layout matches Network: one row per input neuron, bias row last.
+    template<uint32_t Inputs, uint32_t Hidden, uint32_t Outputs>
+    class StaticNetwork
+    {
+        static_assert( Inputs > 0 && Hidden > 0 && Outputs > 0, "every layer needs at least one neuron" );
+
+    public:
+
+        static constexpr uint32_t k_numInputs = Inputs;
+        static constexpr uint32_t k_numHidden = Hidden;
+        static constexpr uint32_t k_numOutputs = Outputs;
+
+        typedef std::array<double, Inputs> InputArray;
+        typedef std::array<double, Outputs> OutputArray;
+
+    public:
+
+        StaticNetwork()
+        {
+            m_weightsInputHidden.fill( {} );
+            m_weightsHiddenOutput.fill( {} );
+        }
+
+        explicit StaticNetwork( Network const& network )
+            : StaticNetwork()
+        {
+            Load( network );
+        }
+
+        // Copies the weights of a sigmoid network with the same topology, returns false (and leaves the weights untouched) if it has another
+        // shape or other activations
+        bool Load( Network const& network )
+        {
+            if ( network.GetNumLayers() != 3 || network.GetLayerWidth( 0 ) != (int32_t) Inputs || network.GetLayerWidth( 1 ) != (int32_t) Hidden || network.GetLayerWidth( 2 ) != (int32_t) Outputs
+                || network.GetHiddenActivation() != Activation::Sigmoid || network.GetOutputActivation() != Activation::Sigmoid )
+            {
+                return false;
+            }
+
+            double const* const weightsInputHidden = network.GetLayerWeights( 0 );
+            for ( uint32_t inputIdx = 0; inputIdx <= Inputs; inputIdx++ )
+            {
+                for ( uint32_t hiddenIdx = 0; hiddenIdx < Hidden; hiddenIdx++ )
+                {
+                    m_weightsInputHidden[inputIdx][hiddenIdx] = weightsInputHidden[inputIdx * Hidden + hiddenIdx];
+                }
+            }
+
+            double const* const weightsHiddenOutput = network.GetLayerWeights( 1 );
+            for ( uint32_t hiddenIdx = 0; hiddenIdx <= Hidden; hiddenIdx++ )
+            {
+                for ( uint32_t outputIdx = 0; outputIdx < Outputs; outputIdx++ )
+                {
+                    m_weightsHiddenOutput[hiddenIdx][outputIdx] = weightsHiddenOutput[hiddenIdx * Outputs + outputIdx];
+                }
+            }
+
+            return true;
+        }
+
+        // Sigmoid activations of the output layer
+        void Evaluate( InputArray const& input, OutputArray& outputs ) const
+        {
+            // Hidden layer, starting from the bias neuron (-1)
+            std::array<double, Hidden> hidden;
+            for ( uint32_t hiddenIdx = 0; hiddenIdx < Hidden; hiddenIdx++ )
+            {
+                hidden[hiddenIdx] = -m_weightsInputHidden[Inputs][hiddenIdx];
+            }
+
+            for ( uint32_t inputIdx = 0; inputIdx < Inputs; inputIdx++ )
+            {
+                for ( uint32_t hiddenIdx = 0; hiddenIdx < Hidden; hiddenIdx++ )
+                {
+                    hidden[hiddenIdx] += input[inputIdx] * m_weightsInputHidden[inputIdx][hiddenIdx];
+                }
+            }
+
+            for ( uint32_t hiddenIdx = 0; hiddenIdx < Hidden; hiddenIdx++ )
+            {
+                hidden[hiddenIdx] = Sigmoid( hidden[hiddenIdx] );
+            }
+
+            // Output layer
+            for ( uint32_t outputIdx = 0; outputIdx < Outputs; outputIdx++ )
+            {
+                outputs[outputIdx] = -m_weightsHiddenOutput[Hidden][outputIdx];
+            }
+
+            for ( uint32_t hiddenIdx = 0; hiddenIdx < Hidden; hiddenIdx++ )
+            {
+                for ( uint32_t outputIdx = 0; outputIdx < Outputs; outputIdx++ )
+                {
+                    outputs[outputIdx] += hidden[hiddenIdx] * m_weightsHiddenOutput[hiddenIdx][outputIdx];
+                }
+            }
+
+            for ( uint32_t outputIdx = 0; outputIdx < Outputs; outputIdx++ )
+            {
+                outputs[outputIdx] = Sigmoid( outputs[outputIdx] );
+            }
+        }
+
+        // Index of the single highest output, -1 if there is none (same rule as Network::EvaluateBatch)
+        int32_t EvaluateClass( InputArray const& input ) const
+        {
+            OutputArray outputs;
+            Evaluate( input, outputs );
+
+            int32_t bestIdx = 0;
+            bool isUnique = true;
+            for ( uint32_t outputIdx = 1; outputIdx < Outputs; outputIdx++ )
+            {
+                if ( outputs[outputIdx] > outputs[bestIdx] )
+                {
+                    bestIdx = (int32_t) outputIdx;
+                    isUnique = true;
+                }
+                else if ( outputs[outputIdx] == outputs[bestIdx] )
+                {
+                    isUnique = false;
+                }
+            }
+
+            return isUnique ? bestIdx : -1;
+        }
+
+    private:
+
+        static inline double Sigmoid( double value ) { return 1.0 / ( 1.0 + std::exp( -value ) ); }
+
+    private:
+
+        std::array<std::array<double, Hidden>, Inputs + 1>      m_weightsInputHidden;
+        std::array<std::array<double, Outputs>, Hidden + 1>     m_weightsHiddenOutput;
+    };
+}
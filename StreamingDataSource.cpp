@@ -0,0 +1,224 @@
+#include "StreamingDataSource.h"
+#include "TrainingFileReader.h"
+#include "Profiler.h"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // FNV-1a over the line, then a 64-bit finalizer (splitmix64) so that the seed and every input byte affect all bits of the result
+    static uint64_t HashLine( char const* lineBegin, char const* lineEnd, uint64_t seed )
+    {
+        uint64_t hash = 14695981039346656037ull ^ seed;
+        for ( char const* cursor = lineBegin; cursor != lineEnd; cursor++ )
+        {
+            hash ^= (uint8_t) *cursor;
+            hash *= 1099511628211ull;
+        }
+
+        hash ^= hash >> 30;
+        hash *= 0xbf58476d1ce4e5b9ull;
+        hash ^= hash >> 27;
+        hash *= 0x94d049bb133111ebull;
+        hash ^= hash >> 31;
+        return hash;
+    }
+
+    template<typename Scalar>
+    StreamingDataSourceT<Scalar>::StreamingDataSourceT( std::string const& filename, int32_t numInputs, int32_t numOutputs, Settings const& settings )
+        : m_filename( filename )
+        , m_numInputs( numInputs )
+        , m_numOutputs( numOutputs )
+        , m_settings( settings )
+    {
+        assert( !filename.empty() && numInputs > 0 && numOutputs > 0 );
+
+        m_settings.m_chunkSize = std::max( m_settings.m_chunkSize, (size_t) 1 );
+
+        // The hash is uniform over all 64-bit values, the threshold is the test fraction of that range
+        double const testFraction = std::min( std::max( m_settings.m_testFraction, 0.0 ), 1.0 );
+        m_testThreshold = ( testFraction >= 1.0 ) ? UINT64_MAX : (uint64_t) ( testFraction * 18446744073709551616.0 );
+    }
+
+    template<typename Scalar>
+    bool StreamingDataSourceT<Scalar>::Rewind( Split split )
+    {
+        m_file.close();
+        m_file.clear();
+        m_file.open( m_filename, std::ios::in | std::ios::binary );
+
+        m_split = split;
+        m_endOfFile = !m_file.is_open();
+        m_lineNumber = 0;
+        m_buffer.resize( k_readBufferSize );
+        m_bufferBegin = 0;
+        m_bufferEnd = 0;
+        m_shuffleBuffer.clear();
+        m_numEntriesRead = 0;
+        m_errors.clear();
+        m_numMalformedLines = 0;
+
+        if ( split == Split::Training )
+        {
+            m_random.seed( m_settings.m_seed + 0x9e3779b97f4a7c15ull * ++m_passIdx );
+        }
+
+        return m_file.is_open();
+    }
+
+    template<typename Scalar>
+    bool StreamingDataSourceT<Scalar>::ReadChunk( TrainingSetType& chunk )
+    {
+        BPN_PROFILE_SCOPE( ReadChunk );
+
+        // The entries already in chunk are overwritten in place, so their vectors are reused from chunk to chunk
+        size_t const chunkSize = m_settings.m_chunkSize;
+        bool const shuffle = ( m_split == Split::Training && m_settings.m_shuffleBufferSize > 0 );
+        size_t numEntries = 0;
+        chunk.resize( chunkSize );
+
+        while ( numEntries < chunkSize )
+        {
+            if ( !shuffle )
+            {
+                if ( !ReadEntry( chunk[numEntries] ) )
+                {
+                    break;
+                }
+                numEntries++;
+            }
+            else if ( ReadEntry( m_pendingEntry ) )
+            {
+                // Fill the shuffle buffer first, then every new entry takes the place of a random one
+                if ( m_shuffleBuffer.size() < m_settings.m_shuffleBufferSize )
+                {
+                    m_shuffleBuffer.push_back( std::move( m_pendingEntry ) );
+                    continue;
+                }
+
+                size_t const bufferIdx = std::uniform_int_distribution<size_t>( 0, m_shuffleBuffer.size() - 1 )( m_random );
+                std::swap( chunk[numEntries], m_shuffleBuffer[bufferIdx] );
+                std::swap( m_shuffleBuffer[bufferIdx], m_pendingEntry );
+                numEntries++;
+            }
+            else if ( !m_shuffleBuffer.empty() )
+            {
+                // End of the file: drain the shuffle buffer in random order
+                size_t const bufferIdx = std::uniform_int_distribution<size_t>( 0, m_shuffleBuffer.size() - 1 )( m_random );
+                std::swap( chunk[numEntries], m_shuffleBuffer[bufferIdx] );
+                std::swap( m_shuffleBuffer[bufferIdx], m_shuffleBuffer.back() );
+                m_shuffleBuffer.pop_back();
+                numEntries++;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        chunk.resize( numEntries );
+        m_numEntriesRead += numEntries;
+        return numEntries > 0;
+    }
+
+    template<typename Scalar>
+    bool StreamingDataSourceT<Scalar>::ReadLine( char const*& lineBegin, char const*& lineEnd )
+    {
+        while ( true )
+        {
+            char const* const bufferBegin = m_buffer.data() + m_bufferBegin;
+            char const* const bufferEnd = m_buffer.data() + m_bufferEnd;
+
+            if ( char const* const lineBreak = static_cast<char const*>( memchr( bufferBegin, '\n', bufferEnd - bufferBegin ) ) )
+            {
+                lineBegin = bufferBegin;
+                lineEnd = lineBreak;
+                m_bufferBegin = lineBreak + 1 - m_buffer.data();
+                m_lineNumber++;
+                return true;
+            }
+
+            if ( m_endOfFile )
+            {
+                // Last line without a line break
+                if ( bufferBegin == bufferEnd )
+                {
+                    return false;
+                }
+
+                lineBegin = bufferBegin;
+                lineEnd = bufferEnd;
+                m_bufferBegin = m_bufferEnd;
+                m_lineNumber++;
+                return true;
+            }
+
+            size_t const numCarried = m_bufferEnd - m_bufferBegin;
+            memmove( m_buffer.data(), bufferBegin, numCarried );
+            m_bufferBegin = 0;
+            m_bufferEnd = numCarried;
+
+            // A single line longer than the buffer
+            if ( numCarried == m_buffer.size() )
+            {
+                m_buffer.resize( m_buffer.size() * 2 );
+            }
+
+            m_file.read( m_buffer.data() + numCarried, m_buffer.size() - numCarried );
+            size_t const numRead = (size_t) m_file.gcount();
+            m_bufferEnd += numRead;
+            m_endOfFile = ( numRead == 0 );
+        }
+    }
+
+    template<typename Scalar>
+    bool StreamingDataSourceT<Scalar>::ReadEntry( TrainingEntryType& entry )
+    {
+        char const* lineBegin;
+        char const* lineEnd;
+        std::string error;
+
+        while ( ReadLine( lineBegin, lineEnd ) )
+        {
+            // Lines of the other split are only hashed, never parsed
+            TrimLine( lineBegin, lineEnd );
+            if ( lineBegin == lineEnd || GetLineSplit( lineBegin, lineEnd ) != m_split )
+            {
+                continue;
+            }
+
+            switch ( ParseTrainingLine( lineBegin, lineEnd, m_numInputs, m_numOutputs, entry, error ) )
+            {
+            case LineParseResult::Entry:
+                return true;
+
+            case LineParseResult::Blank:
+                break;
+
+            case LineParseResult::Malformed:
+                m_numMalformedLines++;
+                if ( m_errors.size() < k_maxStoredErrors )
+                {
+                    m_errors.push_back( { m_lineNumber, error } );
+                }
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    template<typename Scalar>
+    typename StreamingDataSourceT<Scalar>::Split StreamingDataSourceT<Scalar>::GetLineSplit( char const* lineBegin, char const* lineEnd ) const
+    {
+        // Identical lines always end up in the same split, so duplicates cannot leak from the training into the test split
+        return ( HashLine( lineBegin, lineEnd, m_settings.m_seed ) < m_testThreshold ) ? Split::Test : Split::Training;
+    }
+
+    template class StreamingDataSourceT<double>;
+    template class StreamingDataSourceT<float>;
+}
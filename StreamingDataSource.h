@@ -0,0 +1,109 @@
+// Training file read chunk by chunk straight from disk, for data sets that do not fit in memory
+#pragma once
+
+#include "NNTrainer.h"
+#include <fstream>
+#include <random>
+#include <string>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // Reads the same comma separated lines as TrainingFileReader, but never holds more than the shuffle buffer and one chunk of entries.
+    // Every line is assigned to the training or the test split by a hash of its content, so the split is the same on every pass and on
+    // every run with the same seed, without keeping any per line state. Training passes are shuffled approximately by a bounded shuffle
+    // buffer: each entry read replaces a random entry of the buffer, which is returned instead.
+    template<typename Scalar>
+    class StreamingDataSourceT
+    {
+    public:
+
+        typedef TrainingEntryT<Scalar> TrainingEntryType;
+        typedef TrainingSetT<Scalar> TrainingSetType;
+
+        enum class Split
+        {
+            Training,
+            Test,
+        };
+
+        struct Settings
+        {
+            size_t      m_chunkSize = 1024;             // Entries returned by every ReadChunk, a multiple of the batch size keeps the batches whole
+            size_t      m_shuffleBufferSize = 16384;    // Training entries held back for shuffling, 0 reads them in file order
+            double      m_testFraction = 0.25;          // Expected fraction of the lines in the test split
+            uint64_t    m_seed = 0;                     // Selects the split and the shuffle order
+        };
+
+        struct ParseError
+        {
+            uint64_t                    m_lineNumber;           // 1-based
+            std::string                 m_message;
+        };
+
+    public:
+
+        StreamingDataSourceT( std::string const& filename, int32_t numInputs, int32_t numOutputs, Settings const& settings );
+
+        // Starts a pass over one split from the beginning of the file, returns false if the file cannot be opened
+        bool Rewind( Split split );
+
+        // Replaces the contents of chunk with the next entries of the split, returns false once the pass is complete
+        bool ReadChunk( TrainingSetType& chunk );
+
+        inline Split GetSplit() const { return m_split; }
+        inline std::string const& GetFilename() const { return m_filename; }
+        inline Settings const& GetSettings() const { return m_settings; }
+
+        // Statistics of the current pass: entries returned so far and the malformed lines of the split, which are skipped
+        inline uint64_t GetNumEntriesRead() const { return m_numEntriesRead; }
+        inline std::vector<ParseError> const& GetErrors() const { return m_errors; }
+        inline uint64_t GetNumMalformedLines() const { return m_numMalformedLines; }
+
+    private:
+
+        // Next line of the file without its line break, refills the read buffer as needed. Returns false at the end of the file.
+        bool ReadLine( char const*& lineBegin, char const*& lineEnd );
+
+        // Parses the next line of the current split into entry, returns false at the end of the file
+        bool ReadEntry( TrainingEntryType& entry );
+
+        Split GetLineSplit( char const* lineBegin, char const* lineEnd ) const;
+
+    private:
+
+        static size_t const             k_readBufferSize = 1 << 20;
+        static size_t const             k_maxStoredErrors = 20;
+
+        std::string                     m_filename;
+        int32_t                         m_numInputs;
+        int32_t                         m_numOutputs;
+        Settings                        m_settings;
+        uint64_t                        m_testThreshold;        // Lines whose hash is below it belong to the test split
+
+        // Current pass
+        std::ifstream                   m_file;
+        Split                           m_split = Split::Training;
+        bool                            m_endOfFile = true;
+        uint64_t                        m_lineNumber = 0;
+        uint32_t                        m_passIdx = 0;          // Training passes so far, every pass is shuffled differently
+        std::mt19937_64                 m_random;
+
+        // Lines are split in place, a partial line at the end of the buffer is moved to its front before the next read
+        std::vector<char>               m_buffer;
+        size_t                          m_bufferBegin = 0;
+        size_t                          m_bufferEnd = 0;
+
+        TrainingSetType                 m_shuffleBuffer;
+        TrainingEntryType               m_pendingEntry;         // Entry just read, swapped into the shuffle buffer
+
+        uint64_t                        m_numEntriesRead = 0;
+        std::vector<ParseError>         m_errors;
+        uint64_t                        m_numMalformedLines = 0;
+    };
+
+    // Double precision is the default
+    typedef StreamingDataSourceT<double> StreamingDataSource;
+    typedef StreamingDataSourceT<float> StreamingDataSourceFloat;
+}
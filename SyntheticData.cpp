@@ -0,0 +1,121 @@
+#include "SyntheticData.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace SyntheticData
+    {
+        // Labels understood by TrainingFileReader, in the order of the expected outputs
+        static char const* const k_classNames[] = { "Iris-setosa", "Iris-versicolor", "Iris-virginica" };
+
+        TrainingData Generate( Settings const& settings )
+        {
+            std::mt19937_64 generator( settings.m_seed );
+            std::uniform_real_distribution<double> centerDistribution( 0.0, 8.0 );
+            std::uniform_int_distribution<uint32_t> classDistribution( 0, std::max( settings.m_numOutputs, 1u ) - 1 );
+            std::normal_distribution<double> noiseDistribution( 0.0, settings.m_noise );
+            std::uniform_real_distribution<double> densityDistribution( 0.0, 1.0 );
+
+            std::vector<std::vector<double>> centers( settings.m_numOutputs );
+            for ( auto& center : centers )
+            {
+                center.resize( settings.m_numInputs );
+                for ( auto& value : center )
+                {
+                    value = centerDistribution( generator );
+                }
+            }
+
+            // The rows are in random order already, so the test set is simply the tail
+            size_t const numTestRows = (size_t) ( settings.m_numRows * settings.m_testFraction );
+            TrainingData data;
+            data.m_trainingSet.resize( settings.m_numRows - numTestRows );
+            data.m_testSet.resize( numTestRows );
+
+            for ( size_t rowIdx = 0; rowIdx < settings.m_numRows; rowIdx++ )
+            {
+                TrainingEntry& entry = ( rowIdx < data.m_trainingSet.size() ) ? data.m_trainingSet[rowIdx] : data.m_testSet[rowIdx - data.m_trainingSet.size()];
+                uint32_t const classIdx = classDistribution( generator );
+
+                if ( settings.m_inputDensity < 1.0 )
+                {
+                    for ( uint32_t inputIdx = 0; inputIdx < settings.m_numInputs; inputIdx++ )
+                    {
+                        if ( densityDistribution( generator ) < settings.m_inputDensity )
+                        {
+                            entry.m_inputIndices.push_back( (int32_t) inputIdx );
+                            entry.m_inputValues.push_back( centers[classIdx][inputIdx] + noiseDistribution( generator ) );
+                        }
+                    }
+                }
+                else
+                {
+                    entry.m_inputs.resize( settings.m_numInputs );
+                    for ( uint32_t inputIdx = 0; inputIdx < settings.m_numInputs; inputIdx++ )
+                    {
+                        entry.m_inputs[inputIdx] = centers[classIdx][inputIdx] + noiseDistribution( generator );
+                    }
+                }
+
+                entry.m_expectedOutputs.assign( settings.m_numOutputs, 0 );
+                entry.m_expectedOutputs[classIdx] = 1;
+            }
+
+            return data;
+        }
+
+        bool WriteCsv( std::string const& filename, TrainingSet const& rows )
+        {
+            int32_t const maxClasses = (int32_t) ( sizeof( k_classNames ) / sizeof( k_classNames[0] ) );
+            if ( !rows.empty() && (int32_t) rows.front().m_expectedOutputs.size() > maxClasses )
+            {
+                std::cout << "CSV files hold at most " << maxClasses << " classes" << std::endl;
+                return false;
+            }
+
+            std::ofstream file( filename, std::ios::out | std::ios::binary | std::ios::trunc );
+            if ( !file.is_open() )
+            {
+                std::cout << "Error opening output file: " << filename << std::endl;
+                return false;
+            }
+
+            std::string line;
+            char value[32];
+            for ( auto const& entry : rows )
+            {
+                line.clear();
+                for ( double input : entry.m_inputs )
+                {
+                    snprintf( value, sizeof( value ), "%.4f,", input );
+                    line += value;
+                }
+
+                // A sparse row needs at least one pair, an all zero row is written as 0:0
+                for ( size_t nonzeroIdx = 0; nonzeroIdx < entry.m_inputIndices.size(); nonzeroIdx++ )
+                {
+                    snprintf( value, sizeof( value ), "%d:%.4f,", entry.m_inputIndices[nonzeroIdx], entry.m_inputValues[nonzeroIdx] );
+                    line += value;
+                }
+                if ( entry.IsSparse() && entry.m_inputIndices.empty() )
+                {
+                    line += "0:0,";
+                }
+
+                auto const classIdx = std::max_element( entry.m_expectedOutputs.begin(), entry.m_expectedOutputs.end() ) - entry.m_expectedOutputs.begin();
+                line += k_classNames[classIdx];
+                line += '\n';
+                file.write( line.data(), line.size() );
+            }
+
+            file.close();
+            return !file.fail();
+        }
+    }
+}
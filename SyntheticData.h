@@ -0,0 +1,32 @@
+// Generated data sets of any size and shape for benchmarks
+#pragma once
+
+#include "NNTrainer.h"
+#include <string>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    namespace SyntheticData
+    {
+        struct Settings
+        {
+            uint32_t                m_numInputs = 4;
+            uint32_t                m_numOutputs = 3;
+            size_t                  m_numRows = 1000;           // Training and test rows together
+            double                  m_testFraction = 0.25;
+            double                  m_noise = 1.0;              // Standard deviation of the inputs around the center of their class
+            double                  m_inputDensity = 1.0;       // Below 1 rows are sparse, each input is nonzero with this probability
+            uint64_t                m_seed = 0;
+        };
+
+        // Gaussian clusters: every class has a random center in [0, 8] per input, each row is the center of a random class plus normal
+        // noise, so the data can be learned. Sparse rows keep a random subset of those inputs. The same settings always give the same data.
+        TrainingData Generate( Settings const& settings );
+
+        // Writes rows in the CSV format of TrainingFileReader, sparse rows as index:value pairs, whose class labels are the three Iris names, so rows may have at most
+        // three outputs. Returns false if they have more or the file cannot be written.
+        bool WriteCsv( std::string const& filename, TrainingSet const& rows );
+    }
+}
@@ -0,0 +1,177 @@
+#include "ThreadPool.h"
+#include <cassert>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    ThreadPool::ThreadPool( uint32_t numThreads )
+        : m_task( nullptr )
+        , m_taskCount( 0 )
+        , m_nextTask( 0 )
+        , m_busyWorkers( 0 )
+        , m_loopCounter( 0 )
+        , m_shutdown( false )
+    {
+        assert( numThreads > 0 );
+
+        for ( uint32_t workerIdx = 1; workerIdx < numThreads; workerIdx++ )
+        {
+            m_threads.emplace_back( &ThreadPool::WorkerLoop, this, workerIdx );
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_shutdown = true;
+        }
+        m_workAvailable.notify_all();
+
+        for ( auto& thread : m_threads )
+        {
+            thread.join();
+        }
+    }
+
+    void ThreadPool::ParallelFor( size_t count, Task const& task )
+    {
+        if ( count == 0 )
+        {
+            return;
+        }
+
+        // Nothing to share, run inline
+        if ( m_threads.empty() || count == 1 )
+        {
+            for ( size_t taskIdx = 0; taskIdx < count; taskIdx++ )
+            {
+                task( taskIdx, 0 );
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_task = &task;
+            m_taskCount = count;
+            m_nextTask = 0;
+            m_busyWorkers = (uint32_t) m_threads.size();
+            m_loopCounter++;
+        }
+        m_workAvailable.notify_all();
+
+        RunTasks( 0 );
+
+        // Wait for the workers to leave the loop before the task goes out of scope
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_workDone.wait( lock, [this] () { return m_busyWorkers == 0; } );
+        m_task = nullptr;
+    }
+
+    void ThreadPool::WorkerLoop( uint32_t workerIdx )
+    {
+        uint64_t lastLoop = 0;
+
+        while ( true )
+        {
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_workAvailable.wait( lock, [this, lastLoop] () { return m_shutdown || m_loopCounter != lastLoop; } );
+                if ( m_shutdown )
+                {
+                    return;
+                }
+                lastLoop = m_loopCounter;
+            }
+
+            RunTasks( workerIdx );
+
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                m_busyWorkers--;
+            }
+            m_workDone.notify_one();
+        }
+    }
+
+    void ThreadPool::RunTasks( uint32_t workerIdx )
+    {
+        while ( true )
+        {
+            size_t const taskIdx = m_nextTask.fetch_add( 1 );
+            if ( taskIdx >= m_taskCount )
+            {
+                break;
+            }
+
+            ( *m_task )( taskIdx, workerIdx );
+        }
+    }
+
+    //-------------------------------------------------------------------------
+
+    BackgroundWorker::BackgroundWorker()
+        : m_shutdown( false )
+    {
+        m_thread = std::thread( &BackgroundWorker::WorkerLoop, this );
+    }
+
+    BackgroundWorker::~BackgroundWorker()
+    {
+        Wait();
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_shutdown = true;
+        }
+        m_taskAvailable.notify_one();
+        m_thread.join();
+    }
+
+    void BackgroundWorker::Run( std::function<void()> task )
+    {
+        assert( task );
+        Wait();
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_task = std::move( task );
+        }
+        m_taskAvailable.notify_one();
+    }
+
+    void BackgroundWorker::Wait()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_taskDone.wait( lock, [this] () { return !m_task; } );
+    }
+
+    bool BackgroundWorker::IsIdle()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return !m_task;
+    }
+
+    void BackgroundWorker::WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while ( true )
+        {
+            m_taskAvailable.wait( lock, [this] () { return m_shutdown || m_task; } );
+            if ( m_shutdown )
+            {
+                return;
+            }
+
+            // The task stays set while it runs, so Wait keeps blocking until it is cleared
+            lock.unlock();
+            m_task();
+            lock.lock();
+
+            m_task = nullptr;
+            m_taskDone.notify_all();
+        }
+    }
+}
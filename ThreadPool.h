@@ -0,0 +1,92 @@
+// Fixed size pool of worker threads running indexed parallel loops, and a single background worker
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    class ThreadPool
+    {
+    public:
+
+        // Task signature: task index in [0, count), index of the worker running it in [0, numThreads)
+        typedef std::function<void( size_t taskIdx, uint32_t workerIdx )> Task;
+
+    public:
+
+        // The calling thread takes part in every loop, so numThreads - 1 threads are started
+        explicit ThreadPool( uint32_t numThreads );
+        ~ThreadPool();
+
+        ThreadPool( ThreadPool const& ) = delete;
+        ThreadPool& operator=( ThreadPool const& ) = delete;
+
+        inline uint32_t GetNumThreads() const { return (uint32_t) m_threads.size() + 1; }
+
+        // Runs task for every index in [0, count) and returns once all of them have completed
+        void ParallelFor( size_t count, Task const& task );
+
+    private:
+
+        void WorkerLoop( uint32_t workerIdx );
+        void RunTasks( uint32_t workerIdx );
+
+    private:
+
+        std::vector<std::thread>        m_threads;
+
+        std::mutex                      m_mutex;
+        std::condition_variable         m_workAvailable;
+        std::condition_variable         m_workDone;
+
+        Task const*                     m_task;                     // Loop body of the current ParallelFor
+        size_t                          m_taskCount;                // Number of tasks of the current ParallelFor
+        std::atomic<size_t>             m_nextTask;                 // Next task index to hand out
+        uint32_t                        m_busyWorkers;              // Background workers still inside the current loop
+        uint64_t                        m_loopCounter;              // Incremented for every ParallelFor, wakes up the workers
+        bool                            m_shutdown;
+    };
+
+    //-------------------------------------------------------------------------
+
+    // One thread running one task at a time behind the back of the calling thread
+    class BackgroundWorker
+    {
+    public:
+
+        BackgroundWorker();
+        ~BackgroundWorker();
+
+        BackgroundWorker( BackgroundWorker const& ) = delete;
+        BackgroundWorker& operator=( BackgroundWorker const& ) = delete;
+
+        // Starts task and returns right away, waits for the previous task first
+        void Run( std::function<void()> task );
+
+        // Returns once the last task has completed
+        void Wait();
+
+        // True if no task is running, so Run would start the next one right away
+        bool IsIdle();
+
+    private:
+
+        void WorkerLoop();
+
+    private:
+
+        std::mutex                      m_mutex;
+        std::condition_variable         m_taskAvailable;
+        std::condition_variable         m_taskDone;
+        std::function<void()>           m_task;                     // Empty once the task has completed
+        bool                            m_shutdown;
+        std::thread                     m_thread;
+    };
+}
@@ -1,18 +1,62 @@
 #include "TrainingFileReader.h"
+#include "DatasetCache.h"
+#include "MappedFile.h"
+#include "Profiler.h"
 #include <cassert>
-#include <iosfwd>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
 #include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <random>
 
 //-------------------------------------------------------------------------
 
 
 namespace BPN
 {
-	TrainingFileReader::TrainingFileReader(std::string const& filename, int32_t numInputs, int32_t numOutputs)
+	// Class labels in the order of the expected outputs
+	static char const* const k_classNames[] = { "Iris-setosa", "Iris-versicolor", "Iris-virginica" };
+
+	static inline bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	void TrimLine(char const*& lineBegin, char const*& lineEnd)
+	{
+		while (lineBegin != lineEnd && IsSpace(*lineBegin))
+		{
+			lineBegin++;
+		}
+		while (lineEnd != lineBegin && IsSpace(lineEnd[-1]))
+		{
+			lineEnd--;
+		}
+	}
+
+	// Size and modification time identifying the current content of a file, false if it does not exist
+	static bool GetFileIdentity(std::string const& filename, uint64_t& size, int64_t& modifiedTime)
+	{
+		std::error_code errorCode;
+		size = (uint64_t)std::filesystem::file_size(filename, errorCode);
+		if (errorCode)
+		{
+			return false;
+		}
+
+		modifiedTime = (int64_t)std::filesystem::last_write_time(filename, errorCode).time_since_epoch().count();
+		return !errorCode;
+	}
+
+	TrainingFileReader::TrainingFileReader(std::string const& filename, int32_t numInputs, int32_t numOutputs, bool useCache)
 		: m_filename(filename)
 		, m_numInputs(numInputs)
 		, m_numOutputs(numOutputs)
+		, m_useCache(useCache)
 	{
 		assert(!filename.empty() && m_numInputs > 0 && m_numOutputs > 0);
 	}
@@ -20,73 +64,102 @@ namespace BPN
 	bool TrainingFileReader::ReadData()
 	{
 		assert(!m_filename.empty());
+		BPN_PROFILE_SCOPE(ReadData);
 
-		std::fstream inputFile;
-		inputFile.open(m_filename, std::ios::in);
+		m_entries.clear();
+		m_data = TrainingData();
+		m_errors.clear();
+		m_numMalformedLines = 0;
+		m_numBytesRead = 0;
+		m_loadedFromCache = false;
 
-		if (inputFile.is_open())
+		if (m_useCache && ReadCache())
 		{
-			std::string line;
+			m_loadedFromCache = true;
+			CreateTrainingData();
+			std::cout << "Input file: " << m_filename << "\nRead complete: " << m_data.m_trainingSet.size() + m_data.m_testSet.size() << " inputs loaded from " << GetCacheFilename() << std::endl;
+			return true;
+		}
 
-			// Read data
+		std::ifstream inputFile(m_filename, std::ios::in | std::ios::binary);
+
+		if (inputFile.is_open())
+		{
+			// Read data: lines are parsed in place in one large buffer, a partial line at its end is moved to the front before the next read
 			//-------------------------------------------------------------------------
 
-			int32_t const totalValuesToRead = m_numInputs + m_numOutputs;
+			std::vector<char> buffer(k_readBufferSize);
+			size_t numCarried = 0;
+			uint64_t lineNumber = 0;
 
-			while (!inputFile.eof())
+			while (true)
 			{
-				std::getline(inputFile, line);
-				if (line.length() > 2)
-				{
-					m_entries.push_back(TrainingEntry());
-					TrainingEntry& entry = m_entries.back();
+				inputFile.read(buffer.data() + numCarried, buffer.size() - numCarried);
+				size_t const numRead = (size_t)inputFile.gcount();
+				m_numBytesRead += numRead;
 
-					char* cstr = new char[line.size() + 1];
-					strcpy_s(cstr, line.size() + 1, line.c_str());
+				char const* lineBegin = buffer.data();
+				char const* const bufferEnd = buffer.data() + numCarried + numRead;
 
-					for (int i = 0; i < m_numInputs; i++)
-					{
-						std::string stringNumber = line.substr(0, line.find(","));
-						bool isANumber = (stringNumber.find_first_not_of("0123456789.") == std::string::npos);
-						if (isANumber) {
-							entry.m_inputs.push_back(std::stof(stringNumber));
-						}
-						else
-							return false;
-
-						line.erase(0, line.find(",") + 1);
-					}
-					if (line._Equal("Iris-setosa"))
+				if (numRead == 0)
+				{
+					// Last line without a line break
+					if (numCarried > 0)
 					{
-					entry.m_expectedOutputs.push_back(1);
-					entry.m_expectedOutputs.push_back(0);
-					entry.m_expectedOutputs.push_back(0);
+						ParseLine(lineBegin, bufferEnd, ++lineNumber);
 					}
-					else if (line._Equal("Iris-versicolor"))
+					break;
+				}
 
-					//else if (pToken == "Iris-versicolor")
-					{
-						entry.m_expectedOutputs.push_back(0);
-						entry.m_expectedOutputs.push_back(1);
-						entry.m_expectedOutputs.push_back(0);
-					}
-					else if (line._Equal("Iris-virginica"))
+				{
+					BPN_PROFILE_SCOPE(ParseText);
+					while (char const* lineEnd = static_cast<char const*>(memchr(lineBegin, '\n', bufferEnd - lineBegin)))
 					{
-						entry.m_expectedOutputs.push_back(0);
-						entry.m_expectedOutputs.push_back(0);
-						entry.m_expectedOutputs.push_back(1);
+						ParseLine(lineBegin, lineEnd, ++lineNumber);
+						lineBegin = lineEnd + 1;
 					}
 				}
+
+				numCarried = bufferEnd - lineBegin;
+				memmove(buffer.data(), lineBegin, numCarried);
+
+				// A single line longer than the buffer
+				if (numCarried == buffer.size())
+				{
+					buffer.resize(buffer.size() * 2);
+				}
 			}
 
 			inputFile.close();
 
+			if (m_numMalformedLines > 0)
+			{
+				for (auto const& error : m_errors)
+				{
+					std::cout << m_filename << "(" << error.m_lineNumber << "): " << error.m_message << std::endl;
+				}
+				if (m_numMalformedLines > m_errors.size())
+				{
+					std::cout << m_filename << ": " << m_numMalformedLines - m_errors.size() << " more malformed lines" << std::endl;
+				}
+				std::cout << "Error reading input file: " << m_filename << ", " << m_numMalformedLines << " malformed lines" << std::endl;
+				return false;
+			}
+
+			// The cache keeps the rows in file order, they are shuffled every time they are read. Its dense float columns cannot hold
+			// sparse rows, files with sparse rows are parsed every time.
+			bool const hasSparseEntries = std::any_of(m_entries.begin(), m_entries.end(), [](TrainingEntry const& entry) { return entry.IsSparse(); });
+			if (m_useCache && !m_entries.empty() && !hasSparseEntries)
+			{
+				WriteCache();
+			}
+
 			if (!m_entries.empty())
 			{
 				CreateTrainingData();
 			}
 
-			std::cout << "Input file: " << m_filename << "\nRead complete: " << m_entries.size() << " inputs loaded" << std::endl;
+			std::cout << "Input file: " << m_filename << "\nRead complete: " << m_data.m_trainingSet.size() + m_data.m_testSet.size() << " inputs loaded" << std::endl;
 			return true;
 		}
 		else
@@ -96,25 +169,321 @@ namespace BPN
 		}
 	}
 
-	void TrainingFileReader::CreateTrainingData()
+	static void SkipSpaces(char const*& cursor, char const* lineEnd)
 	{
-		assert(!m_entries.empty());
+		while (cursor != lineEnd && IsSpace(*cursor))
+		{
+			cursor++;
+		}
+	}
 
-		std::random_shuffle(m_entries.begin(), m_entries.end());
+	// Single precision like the float columns of the cache, so parsed and cached data train identically
+	static bool ParseValue(char const*& cursor, char const* lineEnd, float& value)
+	{
+		std::from_chars_result const result = std::from_chars(cursor, lineEnd, value);
+		cursor = result.ptr;
+		return result.ec == std::errc();
+	}
 
-		// Training set
-		int32_t const numEntries = (int32_t)m_entries.size();
-		int32_t const numTrainingEntries = (int32_t)(0.75 * numEntries);
+	static bool ParseSeparator(char const*& cursor, char const* lineEnd, char separator)
+	{
+		SkipSpaces(cursor, lineEnd);
+		if (cursor == lineEnd || *cursor != separator)
+		{
+			return false;
+		}
+		cursor++;
+		SkipSpaces(cursor, lineEnd);
+		return true;
+	}
 
-		int32_t entryIdx = 0;
-		for (; entryIdx < numTrainingEntries; entryIdx++)
+	// The class label is the first field without a ':'
+	static bool IsSparseField(char const* cursor, char const* lineEnd)
+	{
+		char const* const fieldEnd = std::find(cursor, lineEnd, ',');
+		return std::find(cursor, fieldEnd, ':') != fieldEnd;
+	}
+
+	// numInputs comma separated values
+	template<typename Scalar>
+	static bool ParseDenseInputs(char const*& cursor, char const* lineEnd, int32_t numInputs, TrainingEntryT<Scalar>& entry, std::string& error)
+	{
+		entry.m_inputs.resize(numInputs);
+		entry.m_inputIndices.clear();
+		entry.m_inputValues.clear();
+
+		for (int32_t inputIdx = 0; inputIdx < numInputs; inputIdx++)
 		{
-			m_data.m_trainingSet.push_back(m_entries[entryIdx]);
+			float value;
+			if (!ParseValue(cursor, lineEnd, value))
+			{
+				error = "value " + std::to_string(inputIdx + 1) + " is not a number";
+				return false;
+			}
+			entry.m_inputs[inputIdx] = value;
+
+			if (!ParseSeparator(cursor, lineEnd, ','))
+			{
+				error = "expected ',' after value " + std::to_string(inputIdx + 1);
+				return false;
+			}
 		}
+		return true;
+	}
+
+	// Comma separated index:value pairs up to the class label, zero based indices in ascending order. Zero values are dropped.
+	template<typename Scalar>
+	static bool ParseSparseInputs(char const*& cursor, char const* lineEnd, int32_t numInputs, TrainingEntryT<Scalar>& entry, std::string& error)
+	{
+		entry.m_inputs.clear();
+		entry.m_inputIndices.clear();
+		entry.m_inputValues.clear();
 
-			for (; entryIdx < numEntries; entryIdx++)
+		int32_t previousIdx = -1;
+		for (int32_t pairIdx = 1; IsSparseField(cursor, lineEnd); pairIdx++)
 		{
-			m_data.m_testSet.push_back(m_entries[entryIdx]);
+			int32_t inputIdx;
+			std::from_chars_result const result = std::from_chars(cursor, lineEnd, inputIdx);
+			cursor = result.ptr;
+			if (result.ec != std::errc() || inputIdx < 0 || inputIdx >= numInputs)
+			{
+				error = "index of pair " + std::to_string(pairIdx) + " is not in [0, " + std::to_string(numInputs) + ")";
+				return false;
+			}
+
+			if (inputIdx <= previousIdx)
+			{
+				error = "index of pair " + std::to_string(pairIdx) + " is not ascending";
+				return false;
+			}
+			previousIdx = inputIdx;
+
+			float value;
+			if (!ParseSeparator(cursor, lineEnd, ':') || !ParseValue(cursor, lineEnd, value))
+			{
+				error = "value of pair " + std::to_string(pairIdx) + " is not a number";
+				return false;
+			}
+
+			if (!ParseSeparator(cursor, lineEnd, ','))
+			{
+				error = "expected ',' after pair " + std::to_string(pairIdx);
+				return false;
+			}
+
+			if (value != 0.0f)
+			{
+				entry.m_inputIndices.push_back(inputIdx);
+				entry.m_inputValues.push_back(value);
+			}
 		}
+
+		if (previousIdx < 0)
+		{
+			error = "no index:value pairs";
+			return false;
+		}
+		return true;
+	}
+
+	template<typename Scalar>
+	LineParseResult ParseTrainingLine(char const* lineBegin, char const* lineEnd, int32_t numInputs, int32_t numOutputs, TrainingEntryT<Scalar>& entry, std::string& error)
+	{
+		// Skip blank lines, ignore surrounding white space and a carriage return
+		TrimLine(lineBegin, lineEnd);
+		if (lineBegin == lineEnd)
+		{
+			return LineParseResult::Blank;
+		}
+
+		// Inputs, sparse if the first field is an index:value pair
+		//-------------------------------------------------------------------------
+
+		char const* cursor = lineBegin;
+		if (IsSparseField(lineBegin, lineEnd) ? !ParseSparseInputs(cursor, lineEnd, numInputs, entry, error) : !ParseDenseInputs(cursor, lineEnd, numInputs, entry, error))
+		{
+			return LineParseResult::Malformed;
+		}
+
+		// Class label
+		//-------------------------------------------------------------------------
+
+		size_t const labelLength = lineEnd - cursor;
+		int32_t classIdx = -1;
+		for (int32_t nameIdx = 0; nameIdx < (int32_t)(sizeof(k_classNames) / sizeof(k_classNames[0])); nameIdx++)
+		{
+			if (strlen(k_classNames[nameIdx]) == labelLength && memcmp(k_classNames[nameIdx], cursor, labelLength) == 0)
+			{
+				classIdx = nameIdx;
+				break;
+			}
+		}
+
+		if (classIdx < 0 || classIdx >= numOutputs)
+		{
+			error = "unknown class label '" + std::string(cursor, labelLength) + "'";
+			return LineParseResult::Malformed;
+		}
+
+		entry.m_expectedOutputs.assign(numOutputs, 0);
+		entry.m_expectedOutputs[classIdx] = 1;
+		return LineParseResult::Entry;
+	}
+
+	template LineParseResult ParseTrainingLine(char const*, char const*, int32_t, int32_t, TrainingEntryT<double>&, std::string&);
+	template LineParseResult ParseTrainingLine(char const*, char const*, int32_t, int32_t, TrainingEntryT<float>&, std::string&);
+
+	void TrainingFileReader::ParseLine(char const* lineBegin, char const* lineEnd, uint64_t lineNumber)
+	{
+		m_entries.push_back(TrainingEntry());
+
+		std::string error;
+		switch (ParseTrainingLine(lineBegin, lineEnd, m_numInputs, m_numOutputs, m_entries.back(), error))
+		{
+		case LineParseResult::Entry:
+			break;
+
+		case LineParseResult::Blank:
+			m_entries.pop_back();
+			break;
+
+		case LineParseResult::Malformed:
+			m_entries.pop_back();
+			m_numMalformedLines++;
+			if (m_errors.size() < k_maxStoredErrors)
+			{
+				m_errors.push_back({ lineNumber, error });
+			}
+			break;
+		}
+	}
+
+	bool TrainingFileReader::ReadCache()
+	{
+		BPN_PROFILE_SCOPE(ReadCache);
+
+		uint64_t sourceSize;
+		int64_t sourceModifiedTime;
+		MappedFile cacheFile;
+		if (!GetFileIdentity(m_filename, sourceSize, sourceModifiedTime) || !cacheFile.Open(GetCacheFilename()) || cacheFile.size() < sizeof(DatasetCacheHeader))
+		{
+			return false;
+		}
+
+		DatasetCacheHeader header;
+		memcpy(&header, cacheFile.data(), sizeof(header));
+
+		if (memcmp(header.m_magic, k_datasetCacheMagic, sizeof(header.m_magic)) != 0 || header.m_version != k_datasetCacheVersion
+			|| header.m_sourceSize != sourceSize || header.m_sourceModifiedTime != sourceModifiedTime
+			|| header.m_numInputs != (uint32_t)m_numInputs || header.m_numOutputs != (uint32_t)m_numOutputs
+			|| header.m_columnStride != AlignCount<float>(header.m_numRows) || header.m_columnsOffset % k_cacheLineSize != 0
+			|| header.m_columnsOffset > cacheFile.size() || (cacheFile.size() - header.m_columnsOffset) / sizeof(float) / (m_numInputs + 1) < header.m_columnStride)
+		{
+			return false;
+		}
+
+		// Rows from the columns, the labels become one-hot expected outputs. The trainer consumes TrainingEntry rows, so every row
+		// still gets its own heap vectors and the mapping itself is dropped once they are filled.
+		//-------------------------------------------------------------------------
+
+		float const* const features = reinterpret_cast<float const*>(cacheFile.data() + header.m_columnsOffset);
+		int32_t const* const labels = reinterpret_cast<int32_t const*>(features + (size_t)m_numInputs * header.m_columnStride);
+
+		m_entries.resize((size_t)header.m_numRows);
+		for (size_t rowIdx = 0; rowIdx < m_entries.size(); rowIdx++)
+		{
+			if (labels[rowIdx] < 0 || labels[rowIdx] >= m_numOutputs)
+			{
+				m_entries.clear();
+				return false;
+			}
+
+			TrainingEntry& entry = m_entries[rowIdx];
+			entry.m_inputs.resize(m_numInputs);
+			for (int32_t inputIdx = 0; inputIdx < m_numInputs; inputIdx++)
+			{
+				entry.m_inputs[inputIdx] = features[(size_t)inputIdx * header.m_columnStride + rowIdx];
+			}
+
+			entry.m_expectedOutputs.assign(m_numOutputs, 0);
+			entry.m_expectedOutputs[labels[rowIdx]] = 1;
+		}
+
+		m_numBytesRead = cacheFile.size();
+		return true;
+	}
+
+	void TrainingFileReader::WriteCache() const
+	{
+		DatasetCacheHeader header = {};
+		memcpy(header.m_magic, k_datasetCacheMagic, sizeof(header.m_magic));
+		header.m_version = k_datasetCacheVersion;
+		header.m_numInputs = m_numInputs;
+		header.m_numOutputs = m_numOutputs;
+		header.m_numRows = m_entries.size();
+		header.m_columnStride = AlignCount<float>(m_entries.size());
+		header.m_columnsOffset = AlignCount<uint8_t>(sizeof(DatasetCacheHeader));
+
+		if (!GetFileIdentity(m_filename, header.m_sourceSize, header.m_sourceModifiedTime))
+		{
+			return;
+		}
+
+		// Every column is gathered into one buffer, its padding stays zero
+		std::vector<float> column(header.m_columnStride);
+		std::vector<int32_t> labelColumn(header.m_columnStride);
+		std::vector<char> const headerPadding(header.m_columnsOffset - sizeof(DatasetCacheHeader), 0);
+
+		// Written under a temporary name and renamed, so a reader never maps a partial cache
+		std::string const temporaryFilename = GetCacheFilename() + ".tmp";
+		std::ofstream cacheFile(temporaryFilename, std::ios::out | std::ios::binary | std::ios::trunc);
+		cacheFile.write(reinterpret_cast<char const*>(&header), sizeof(header));
+		cacheFile.write(headerPadding.data(), headerPadding.size());
+
+		for (int32_t inputIdx = 0; inputIdx < m_numInputs; inputIdx++)
+		{
+			for (size_t rowIdx = 0; rowIdx < m_entries.size(); rowIdx++)
+			{
+				column[rowIdx] = (float)m_entries[rowIdx].m_inputs[inputIdx];
+			}
+			cacheFile.write(reinterpret_cast<char const*>(column.data()), column.size() * sizeof(float));
+		}
+
+		for (size_t rowIdx = 0; rowIdx < m_entries.size(); rowIdx++)
+		{
+			std::vector<int32_t> const& expectedOutputs = m_entries[rowIdx].m_expectedOutputs;
+			labelColumn[rowIdx] = (int32_t)(std::max_element(expectedOutputs.begin(), expectedOutputs.end()) - expectedOutputs.begin());
+		}
+		cacheFile.write(reinterpret_cast<char const*>(labelColumn.data()), labelColumn.size() * sizeof(int32_t));
+		cacheFile.close();
+
+		std::error_code errorCode;
+		if (cacheFile)
+		{
+			std::filesystem::rename(temporaryFilename, GetCacheFilename(), errorCode);
+		}
+
+		if (!cacheFile || errorCode)
+		{
+			std::remove(temporaryFilename.c_str());
+			std::cout << "Could not write the cache file: " << GetCacheFilename() << std::endl;
+		}
+	}
+
+	void TrainingFileReader::CreateTrainingData()
+	{
+		assert(!m_entries.empty());
+
+		std::random_device randomDevice;
+		std::shuffle(m_entries.begin(), m_entries.end(), std::mt19937(randomDevice()));
+
+		// Training set
+		int32_t const numEntries = (int32_t)m_entries.size();
+		int32_t const numTrainingEntries = (int32_t)(0.75 * numEntries);
+
+		// The entries are moved, so the data is held only once
+		m_data.m_trainingSet.assign(std::make_move_iterator(m_entries.begin()), std::make_move_iterator(m_entries.begin() + numTrainingEntries));
+		m_data.m_testSet.assign(std::make_move_iterator(m_entries.begin() + numTrainingEntries), std::make_move_iterator(m_entries.begin() + numEntries));
+		std::vector<TrainingEntry>().swap(m_entries);
 	}
 }
\ No newline at end of file
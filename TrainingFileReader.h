@@ -5,30 +5,84 @@
 
 namespace BPN
 {
+    enum class LineParseResult
+    {
+        Entry,
+        Blank,
+        Malformed,
+    };
+
+    // Parses one line without its line break: numInputs comma separated numbers and a class label, which becomes a one-hot entry of
+    // numOutputs expected outputs. Allocates nothing but the vectors of entry, error receives the reason a line is malformed.
+    template<typename Scalar>
+    LineParseResult ParseTrainingLine( char const* lineBegin, char const* lineEnd, int32_t numInputs, int32_t numOutputs, TrainingEntryT<Scalar>& entry, std::string& error );
+
+    // Moves lineBegin and lineEnd past surrounding white space and carriage returns
+    void TrimLine( char const*& lineBegin, char const*& lineEnd );
+
+    // Reads comma separated lines of numInputs numbers followed by a class label (e.g. "5.1,3.5,1.4,0.2,Iris-setosa")
     class TrainingFileReader
     {
     public:
 
-        TrainingFileReader( std::string const& filename, int32_t numInputs, int32_t numOutputs );
+        struct ParseError
+        {
+            uint64_t                    m_lineNumber;           // 1-based
+            std::string                 m_message;
+        };
+
+    public:
+
+        // With useCache the parsed file is also written as a columnar binary cache (see DatasetCache.h) next to it, later reads map the
+        // cache instead of parsing the text as long as the size and modification time of the file are unchanged. The entries are still
+        // built row by row from the cache, it saves the parsing but not the per-row allocations.
+        TrainingFileReader( std::string const& filename, int32_t numInputs, int32_t numOutputs, bool useCache = false );
 
+        // Returns false if the file cannot be opened or has malformed lines, every malformed line is reported with its line number
         bool ReadData();
 
+        inline std::string GetCacheFilename() const { return m_filename + ".cache"; }
+        inline bool WasLoadedFromCache() const { return m_loadedFromCache; }
+
         inline int32_t GetNumInputs() const { return m_numInputs; }
         inline int32_t GetNumOutputs() const { return m_numOutputs; }
 
         TrainingData const& GetTrainingData() const { return m_data; }
 
+        // First malformed lines of the last ReadData (at most k_maxStoredErrors) and how many there were in total
+        inline std::vector<ParseError> const& GetErrors() const { return m_errors; }
+        inline uint64_t GetNumMalformedLines() const { return m_numMalformedLines; }
+
+        inline uint64_t GetNumBytesRead() const { return m_numBytesRead; }
+
     private:
 
+        // Parses one line into a new entry, records an error and drops the entry if it is malformed
+        void ParseLine( char const* lineBegin, char const* lineEnd, uint64_t lineNumber );
+
+        // Fills m_entries from the cache by copying the columns into one TrainingEntry per row, returns false if there is none or it
+        // does not belong to the current file
+        bool ReadCache();
+        void WriteCache() const;
+
         void CreateTrainingData();
 
     private:
 
+        static size_t const             k_readBufferSize = 1 << 20;
+        static size_t const             k_maxStoredErrors = 20;
+
         std::string                     m_filename;
         int32_t                         m_numInputs;
         int32_t                         m_numOutputs;
+        bool                            m_useCache;
+        bool                            m_loadedFromCache = false;
 
         std::vector<TrainingEntry>      m_entries;
         TrainingData                    m_data;
+
+        std::vector<ParseError>         m_errors;
+        uint64_t                        m_numMalformedLines = 0;
+        uint64_t                        m_numBytesRead = 0;
     };
 }
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include "TrainingPipeline.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <random>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    template<typename Scalar>
+    TrainingPipelineT<Scalar>::TrainingPipelineT( TrainingDataType const& data, Settings const& settings )
+        : m_data( data )
+        , m_settings( settings )
+    {
+        m_settings.m_batchSize = std::max( m_settings.m_batchSize, (size_t) 1 );
+        m_settings.m_numBuffers = std::max( m_settings.m_numBuffers, 2u );
+
+        TrainingSetType const& firstSet = data.m_trainingSet.empty() ? data.m_testSet : data.m_trainingSet;
+        if ( !firstSet.empty() )
+        {
+            m_numInputs = (int32_t) firstSet[0].m_inputs.size();
+            m_numOutputs = (int32_t) firstSet[0].m_expectedOutputs.size();
+        }
+
+        if ( m_settings.m_numInputs > 0 )
+        {
+            m_numInputs = m_settings.m_numInputs;
+        }
+        else if ( !firstSet.empty() && firstSet[0].IsSparse() )
+        {
+            for ( TrainingSetType const* set : { &data.m_trainingSet, &data.m_testSet } )
+            {
+                for ( auto const& entry : *set )
+                {
+                    if ( !entry.m_inputIndices.empty() )
+                    {
+                        m_numInputs = std::max( m_numInputs, entry.m_inputIndices.back() + 1 );
+                    }
+                }
+            }
+        }
+
+        // Normalization over the training set
+        //-------------------------------------------------------------------------
+
+        m_inputOffsets.assign( m_numInputs, Scalar( 0 ) );
+        m_inputScales.assign( m_numInputs, Scalar( 1 ) );
+
+        if ( m_settings.m_normalizeInputs && !data.m_trainingSet.empty() )
+        {
+            // Row by row, so sparse entries only add their nonzero inputs
+            std::vector<double> sums( m_numInputs, 0.0 );
+            std::vector<double> squaredSums( m_numInputs, 0.0 );
+            for ( auto const& entry : data.m_trainingSet )
+            {
+                if ( entry.IsSparse() )
+                {
+                    for ( size_t nonzeroIdx = 0; nonzeroIdx < entry.m_inputIndices.size(); nonzeroIdx++ )
+                    {
+                        double const value = entry.m_inputValues[nonzeroIdx];
+                        sums[entry.m_inputIndices[nonzeroIdx]] += value;
+                        squaredSums[entry.m_inputIndices[nonzeroIdx]] += value * value;
+                    }
+                    continue;
+                }
+
+                for ( int32_t inputIdx = 0; inputIdx < m_numInputs; inputIdx++ )
+                {
+                    sums[inputIdx] += entry.m_inputs[inputIdx];
+                    squaredSums[inputIdx] += (double) entry.m_inputs[inputIdx] * entry.m_inputs[inputIdx];
+                }
+            }
+
+            for ( int32_t inputIdx = 0; inputIdx < m_numInputs; inputIdx++ )
+            {
+                double const mean = sums[inputIdx] / data.m_trainingSet.size();
+                double const variance = std::max( squaredSums[inputIdx] / data.m_trainingSet.size() - mean * mean, 0.0 );
+                m_inputOffsets[inputIdx] = static_cast<Scalar>( mean );
+                m_inputScales[inputIdx] = static_cast<Scalar>( ( variance > 0 ) ? 1.0 / std::sqrt( variance ) : 1.0 );
+            }
+        }
+
+        // The test set never changes, it is staged once in file order
+        //-------------------------------------------------------------------------
+
+        std::vector<size_t> testOrder( data.m_testSet.size() );
+        std::iota( testOrder.begin(), testOrder.end(), (size_t) 0 );
+        m_testInputs.Resize( testOrder.size() * m_numInputs );
+        m_testExpectedOutputs.Resize( testOrder.size() * m_numOutputs );
+        StageRows( data.m_testSet, testOrder.data(), testOrder.size(), m_testInputs.data(), m_testExpectedOutputs.data() );
+        m_testBatch = { m_testInputs.data(), m_testExpectedOutputs.data(), testOrder.size(), m_numInputs, m_numOutputs };
+
+        m_buffers.resize( m_settings.m_numBuffers );
+        for ( auto& buffer : m_buffers )
+        {
+            buffer.m_inputs.Resize( m_settings.m_batchSize * m_numInputs );
+            buffer.m_expectedOutputs.Resize( m_settings.m_batchSize * m_numOutputs );
+        }
+
+        m_producer = std::thread( &TrainingPipelineT::ProducerLoop, this );
+    }
+
+    template<typename Scalar>
+    TrainingPipelineT<Scalar>::~TrainingPipelineT()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_shutdown = true;
+        }
+        m_bufferFree.notify_all();
+        m_producer.join();
+    }
+
+    template<typename Scalar>
+    typename TrainingPipelineT<Scalar>::TrainingBatchType const* TrainingPipelineT<Scalar>::AcquireBatch()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        m_numAcquires++;
+        m_queueDepthSum += m_numStaged;
+        m_metrics.m_maxQueueDepth = std::max( m_metrics.m_maxQueueDepth, (uint32_t) m_numStaged );
+
+        if ( m_numStaged == 0 )
+        {
+            auto const waitStart = std::chrono::high_resolution_clock::now();
+            m_batchReady.wait( lock, [this] () { return m_numStaged > 0; } );
+            m_metrics.m_trainerStallSeconds += std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - waitStart ).count();
+        }
+
+        Buffer const& buffer = m_buffers[m_readIdx];
+        if ( buffer.m_batch.m_numRows == 0 )
+        {
+            // End of the epoch, the marker is released right away
+            m_readIdx = ( m_readIdx + 1 ) % m_buffers.size();
+            m_numStaged--;
+            lock.unlock();
+            m_bufferFree.notify_one();
+            return nullptr;
+        }
+
+        m_metrics.m_numBatches++;
+        return &buffer.m_batch;
+    }
+
+    template<typename Scalar>
+    void TrainingPipelineT<Scalar>::ReleaseBatch()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            assert( m_numStaged > 0 );
+            m_readIdx = ( m_readIdx + 1 ) % m_buffers.size();
+            m_numStaged--;
+        }
+        m_bufferFree.notify_one();
+    }
+
+    template<typename Scalar>
+    typename TrainingPipelineT<Scalar>::Metrics TrainingPipelineT<Scalar>::GetMetrics() const
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        Metrics metrics = m_metrics;
+        metrics.m_averageQueueDepth = ( m_numAcquires > 0 ) ? (double) m_queueDepthSum / m_numAcquires : 0;
+        return metrics;
+    }
+
+    template<typename Scalar>
+    void TrainingPipelineT<Scalar>::ResetMetrics()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_metrics = Metrics();
+        m_numAcquires = 0;
+        m_queueDepthSum = 0;
+    }
+
+    template<typename Scalar>
+    void TrainingPipelineT<Scalar>::ProducerLoop()
+    {
+        TrainingSetType const& trainingSet = m_data.m_trainingSet;
+        std::vector<size_t> order( trainingSet.size() );
+        std::iota( order.begin(), order.end(), (size_t) 0 );
+        std::mt19937_64 generator( m_settings.m_seed );
+
+        while ( true )
+        {
+            auto const shuffleStart = std::chrono::high_resolution_clock::now();
+            std::shuffle( order.begin(), order.end(), generator );
+            double busySeconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - shuffleStart ).count();
+
+            // Every batch of the epoch, then an empty one marking its end
+            for ( size_t firstRow = 0; firstRow < order.size(); firstRow += m_settings.m_batchSize )
+            {
+                Buffer* const buffer = WaitForFreeBuffer();
+                if ( buffer == nullptr )
+                {
+                    return;
+                }
+
+                auto const stageStart = std::chrono::high_resolution_clock::now();
+                size_t const numRows = std::min( m_settings.m_batchSize, order.size() - firstRow );
+                StageRows( trainingSet, order.data() + firstRow, numRows, buffer->m_inputs.data(), buffer->m_expectedOutputs.data() );
+                buffer->m_batch = { buffer->m_inputs.data(), buffer->m_expectedOutputs.data(), numRows, m_numInputs, m_numOutputs };
+                busySeconds += std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - stageStart ).count();
+
+                PublishBuffer( busySeconds );
+                busySeconds = 0;
+            }
+
+            Buffer* const markerBuffer = WaitForFreeBuffer();
+            if ( markerBuffer == nullptr )
+            {
+                return;
+            }
+            markerBuffer->m_batch.m_numRows = 0;
+            PublishBuffer( busySeconds );
+        }
+    }
+
+    template<typename Scalar>
+    typename TrainingPipelineT<Scalar>::Buffer* TrainingPipelineT<Scalar>::WaitForFreeBuffer()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        if ( m_numStaged == m_buffers.size() && !m_shutdown )
+        {
+            auto const waitStart = std::chrono::high_resolution_clock::now();
+            m_bufferFree.wait( lock, [this] () { return m_numStaged < m_buffers.size() || m_shutdown; } );
+            m_metrics.m_producerStallSeconds += std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - waitStart ).count();
+        }
+
+        // The buffer at m_writeIdx is neither staged nor held by the trainer, so it is filled without the lock
+        return m_shutdown ? nullptr : &m_buffers[m_writeIdx];
+    }
+
+    template<typename Scalar>
+    void TrainingPipelineT<Scalar>::PublishBuffer( double busySeconds )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_writeIdx = ( m_writeIdx + 1 ) % m_buffers.size();
+            m_numStaged++;
+            m_metrics.m_producerBusySeconds += busySeconds;
+        }
+        m_batchReady.notify_one();
+    }
+
+    template<typename Scalar>
+    void TrainingPipelineT<Scalar>::StageRows( TrainingSetType const& set, size_t const* entryIndices, size_t numRows, Scalar* inputs, int32_t* expectedOutputs ) const
+    {
+        for ( size_t rowIdx = 0; rowIdx < numRows; rowIdx++ )
+        {
+            auto const& entry = set[entryIndices[rowIdx]];
+            Scalar* const inputRow = inputs + rowIdx * m_numInputs;
+
+            entry.GetDenseInputs( m_numInputs, inputRow );
+            if ( m_settings.m_normalizeInputs )
+            {
+                for ( int32_t inputIdx = 0; inputIdx < m_numInputs; inputIdx++ )
+                {
+                    inputRow[inputIdx] = ( inputRow[inputIdx] - m_inputOffsets[inputIdx] ) * m_inputScales[inputIdx];
+                }
+            }
+
+            memcpy( expectedOutputs + rowIdx * m_numOutputs, entry.m_expectedOutputs.data(), m_numOutputs * sizeof( int32_t ) );
+        }
+    }
+
+    template class TrainingPipelineT<double>;
+    template class TrainingPipelineT<float>;
+}
@@ -0,0 +1,122 @@
+// Producer thread staging shuffled training batches in contiguous buffers while the trainer works on the previous ones
+#pragma once
+
+#include "NNTrainer.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+//-------------------------------------------------------------------------
+
+namespace BPN
+{
+    // The producer shuffles the training set every epoch and gathers the next rows into a free buffer: inputs (optionally normalized)
+    // and one-hot expected outputs as two row-major matrices, so the trainer reads neither the entries nor their separately allocated
+    // vectors. Sparse entries are staged dense. With m_numBuffers buffers the producer runs up to m_numBuffers - 1 batches ahead of the batch being trained.
+    template<typename Scalar>
+    class TrainingPipelineT
+    {
+    public:
+
+        typedef TrainingSetT<Scalar> TrainingSetType;
+        typedef TrainingDataT<Scalar> TrainingDataType;
+        typedef TrainingBatchT<Scalar> TrainingBatchType;
+
+        struct Settings
+        {
+            size_t      m_batchSize = 256;          // Rows per staged batch, a multiple of the trainer batch size keeps its mini-batches whole
+            uint32_t    m_numBuffers = 3;           // Staged batches in flight, 2 for double and 3 for triple buffering
+            bool        m_normalizeInputs = false;  // Scale every input to zero mean and unit variance over the training set, the test set alike
+            uint64_t    m_seed = 0;                 // Shuffle order of the training set
+            int32_t     m_numInputs = 0;            // Inputs per row, 0 takes the size of the first entry or the largest sparse index + 1
+        };
+
+        struct Metrics
+        {
+            uint64_t    m_numBatches = 0;           // Training batches handed to the trainer
+            double      m_averageQueueDepth = 0;    // Staged batches ready whenever the trainer asked for the next one
+            uint32_t    m_maxQueueDepth = 0;
+            double      m_trainerStallSeconds = 0;  // Trainer waiting for a batch: the producer is the bottleneck
+            double      m_producerStallSeconds = 0; // Producer waiting for a free buffer: the trainer is the bottleneck
+            double      m_producerBusySeconds = 0;  // Shuffling, gathering and converting
+        };
+
+    public:
+
+        // Starts the producer right away, the data must outlive the pipeline
+        TrainingPipelineT( TrainingDataType const& data, Settings const& settings );
+        ~TrainingPipelineT();
+
+        TrainingPipelineT( TrainingPipelineT const& ) = delete;
+        TrainingPipelineT& operator=( TrainingPipelineT const& ) = delete;
+
+        // Next staged training batch, waits for the producer if none is ready. Returns null once per epoch, after the last batch of a pass
+        // over the training set. The batch stays valid until ReleaseBatch.
+        TrainingBatchType const* AcquireBatch();
+        void ReleaseBatch();
+
+        // The whole test set, staged once with the same conversion
+        inline TrainingBatchType const& GetTestBatch() const { return m_testBatch; }
+
+        // Normalization applied to every input: ( value - offset ) * scale, offset 0 and scale 1 when disabled
+        inline std::vector<Scalar> const& GetInputOffsets() const { return m_inputOffsets; }
+        inline std::vector<Scalar> const& GetInputScales() const { return m_inputScales; }
+
+        Metrics GetMetrics() const;
+        void ResetMetrics();
+
+    private:
+
+        // A staged batch with no rows marks the end of an epoch
+        struct Buffer
+        {
+            AlignedBuffer<Scalar>   m_inputs;
+            AlignedBuffer<int32_t>  m_expectedOutputs;
+            TrainingBatchType       m_batch;
+        };
+
+        void ProducerLoop();
+
+        // Free buffer the producer may fill, null once the pipeline shuts down
+        Buffer* WaitForFreeBuffer();
+        void PublishBuffer( double busySeconds );
+
+        // Gathers and converts the given entries into contiguous row-major matrices
+        void StageRows( TrainingSetType const& set, size_t const* entryIndices, size_t numRows, Scalar* inputs, int32_t* expectedOutputs ) const;
+
+    private:
+
+        TrainingDataType const&     m_data;
+        Settings                    m_settings;
+        int32_t                     m_numInputs = 0;
+        int32_t                     m_numOutputs = 0;
+
+        std::vector<Scalar>         m_inputOffsets;
+        std::vector<Scalar>         m_inputScales;
+
+        AlignedBuffer<Scalar>       m_testInputs;
+        AlignedBuffer<int32_t>      m_testExpectedOutputs;
+        TrainingBatchType           m_testBatch;
+
+        // Ring of buffers: the producer fills the one at m_writeIdx, the trainer reads the one at m_readIdx
+        std::vector<Buffer>         m_buffers;
+        size_t                      m_readIdx = 0;
+        size_t                      m_writeIdx = 0;
+        size_t                      m_numStaged = 0;            // Buffers filled and not yet released
+        bool                        m_shutdown = false;
+
+        mutable std::mutex          m_mutex;
+        std::condition_variable     m_batchReady;
+        std::condition_variable     m_bufferFree;
+        std::thread                 m_producer;
+
+        // Metrics, guarded by m_mutex
+        uint64_t                    m_numAcquires = 0;
+        uint64_t                    m_queueDepthSum = 0;
+        Metrics                     m_metrics;
+    };
+
+    // Double precision is the default
+    typedef TrainingPipelineT<double> TrainingPipeline;
+    typedef TrainingPipelineT<float> TrainingPipelineFloat;
+}
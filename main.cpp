@@ -1,11 +1,58 @@
 #include "NNTrainer.h"
 #include "TrainingFileReader.h"
+#include "StreamingDataSource.h"
+#include "TrainingPipeline.h"
+#include "Benchmarks.h"
+#include "HyperparameterSweep.h"
+#include "InferenceServer.h"
+#include "Profiler.h"
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 
-int main()
+// Command line mode: serve <model file> <socket path|-> [max batch size] [max delay in microseconds], "-" serves over stdin/stdout
+int RunInferenceServer(int argc, char** argv)
 {
+	if (argc < 4)
+	{
+		cerr << "Usage: " << argv[0] << " serve (model file) (socket path|-) [max batch size] [max delay in microseconds]" << endl;
+		return 1;
+	}
+
+	BPN::Network::Settings networkSettings{ 1, 1, 1 };
+	BPN::Network network(networkSettings);
+	if (!network.Load(argv[2]))
+	{
+		return 1;
+	}
+
+	BPN::InferenceServer::Settings serverSettings;
+	if (argc > 4)
+	{
+		serverSettings.m_maxBatchSize = std::max(atoi(argv[4]), 1);
+	}
+	if (argc > 5)
+	{
+		serverSettings.m_maxDelayMicroseconds = std::max(atoi(argv[5]), 0);
+	}
+
+	BPN::InferenceServer server(network, serverSettings);
+	string const path = argv[3];
+	return (path == "-" ? server.ServePipe() : server.ServeSocket(path)) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && string(argv[1]) == "serve")
+	{
+		return RunInferenceServer(argc, argv);
+	}
+
 	std::string trainingDataPath = "iris_original.data";
 
 	uint32_t const numInputs = 4;
@@ -13,7 +60,7 @@ int main()
 	uint32_t const numOutputs = 3;
 
 
-	BPN::TrainingFileReader dataReader(trainingDataPath, numInputs, numOutputs);
+	BPN::TrainingFileReader dataReader(trainingDataPath, numInputs, numOutputs, true);
 	if (!dataReader.ReadData())
 	{
 		return 1;
@@ -21,6 +68,7 @@ int main()
 
 	// Create neural network
 	BPN::Network::Settings networkSettings{ numInputs, numHidden, numOutputs };
+	networkSettings.m_layerWidths = { numInputs, numHidden, numOutputs };
 	BPN::Network nn(networkSettings);
 
 	// Create neural network trainer
@@ -38,8 +86,15 @@ int main()
 
 	while (!programEnd) {
 
-		cout << endl << "Filepath: " << trainingDataPath << ", desiredAccuracy:" << trainerSettings.m_desiredAccuracy << ", maxGenerations:" << trainerSettings.m_maxGenerations << ", momentum:"
-			<< trainerSettings.m_momentum << ", LearnRate:" << trainerSettings.m_learningRate << endl << " Enter a command for IrisNN: " << endl;
+		string layerWidths;
+		for (uint32_t width : networkSettings.m_layerWidths)
+		{
+			layerWidths += (layerWidths.empty() ? "" : "-") + to_string(width);
+		}
+
+		cout << endl << "Filepath: " << trainingDataPath << ", Layers:" << layerWidths << ", desiredAccuracy:" << trainerSettings.m_desiredAccuracy << ", maxGenerations:" << trainerSettings.m_maxGenerations << ", momentum:"
+			<< trainerSettings.m_momentum << ", LearnRate:" << trainerSettings.m_learningRate << ", BatchSize:" << trainerSettings.m_batchSize << ", Threads:" << trainerSettings.m_numThreads
+			<< ", Mode:" << (trainerSettings.m_parallelMode == BPN::NNTrainer::ParallelMode::Asynchronous ? "async" : "sync") << endl << " Enter a command for IrisNN: " << endl;
 		cin >> input;
 		cin.clear();
 		cout << endl;
@@ -65,7 +120,7 @@ int main()
 		else if (command == "check")
 		{
 			vector<double> test;
-			for (int i = 0; i < numInputs; i++)
+			for (uint32_t i = 0; i < numInputs; i++)
 			{
 				input.erase(0, input.find(' ') + 1);
 				std::string stringNumber = input.substr(0, input.find(' '));
@@ -127,13 +182,299 @@ int main()
 
 				}
 			}
+			else if (command == "batchsize")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				string stringNumber = input;
+				bool has_only_digits = (stringNumber.find_first_not_of("0123456789") == string::npos);
+
+				if (has_only_digits && !stringNumber.empty()) {
+					trainerSettings.m_batchSize = std::max(stoi(input.substr(0, input.find(' '))), 1);
 
+				}
+			}
+			else if (command == "layers")
+			{
+				// read second part of input: widths of the hidden layers, the input and output layers are given by the data
+				input.erase(0, input.find(' ') + 1);
+				std::istringstream widthStream(input);
+				std::vector<uint32_t> layerWidths{ numInputs };
+				int width;
+				while (widthStream >> width && width > 0)
+				{
+					layerWidths.push_back((uint32_t)width);
+				}
+				layerWidths.push_back(numOutputs);
+
+				if (widthStream.eof())
+				{
+					networkSettings.m_layerWidths = layerWidths;
+				}
+			}
+			else if (command == "activation")
+			{
+				// read second part of input: activation of the hidden layers and optionally of the output layer
+				input.erase(0, input.find(' ') + 1);
+				std::istringstream activationStream(input);
+				string hiddenName, outputName;
+				activationStream >> hiddenName >> outputName;
+
+				BPN::Activation hiddenActivation = networkSettings.m_hiddenActivation;
+				BPN::Activation outputActivation = networkSettings.m_outputActivation;
+				if (!BPN::ParseActivation(hiddenName.c_str(), hiddenActivation) || hiddenActivation == BPN::Activation::Softmax
+					|| (!outputName.empty() && !BPN::ParseActivation(outputName.c_str(), outputActivation)))
+				{
+					cout << "Activations: sigmoid, fastsigmoid, tanh, fasttanh, relu, leakyrelu, softmax (output layer only)" << endl;
+				}
+				else
+				{
+					networkSettings.m_hiddenActivation = hiddenActivation;
+					networkSettings.m_outputActivation = outputActivation;
+				}
+			}
+			else if (command == "threads")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				string stringNumber = input;
+				bool has_only_digits = (stringNumber.find_first_not_of("0123456789") == string::npos);
+
+				if (has_only_digits && !stringNumber.empty()) {
+					trainerSettings.m_numThreads = std::max(stoi(input.substr(0, input.find(' '))), 1);
+
+				}
+			}
+			else if (command == "mode")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				if (input == "sync")
+				{
+					trainerSettings.m_parallelMode = BPN::NNTrainer::ParallelMode::Synchronous;
+				}
+				else if (input == "async")
+				{
+					trainerSettings.m_parallelMode = BPN::NNTrainer::ParallelMode::Asynchronous;
+				}
+			}
+			else if (command == "stream")
+			{
+				// Same training, but chunk by chunk from disk with a hashed train/test split instead of the data loaded in memory
+				BPN::StreamingDataSource::Settings streamSettings;
+				streamSettings.m_chunkSize = std::max<size_t>(1024 / trainerSettings.m_batchSize, 1) * trainerSettings.m_batchSize;
+				BPN::StreamingDataSource dataSource(trainingDataPath, numInputs, numOutputs, streamSettings);
+
+				nn = BPN::Network(networkSettings);
+				trainer = BPN::NNTrainer(trainerSettings, &nn);
+				trainer.Train(dataSource);
+
+				if (dataSource.GetNumMalformedLines() > 0)
+				{
+					cout << trainingDataPath << ": " << dataSource.GetNumMalformedLines() << " malformed lines of the training split skipped" << endl;
+				}
+			}
+			else if (command == "prefetch")
+			{
+				// Same training, fed by a producer thread that shuffles and stages the next batches while the current one trains
+				BPN::TrainingPipeline::Settings pipelineSettings;
+				pipelineSettings.m_batchSize = std::max<size_t>(256 / trainerSettings.m_batchSize, 1) * trainerSettings.m_batchSize;
+				pipelineSettings.m_numInputs = numInputs;
+				BPN::TrainingPipeline pipeline(dataReader.GetTrainingData(), pipelineSettings);
+
+				nn = BPN::Network(networkSettings);
+				trainer = BPN::NNTrainer(trainerSettings, &nn);
+				trainer.Train(pipeline);
+
+				BPN::TrainingPipeline::Metrics const metrics = pipeline.GetMetrics();
+				cout << "Pipeline: " << metrics.m_numBatches << " batches, queue depth avg " << metrics.m_averageQueueDepth << " max " << metrics.m_maxQueueDepth
+					<< ", trainer stalled " << metrics.m_trainerStallSeconds * 1000 << " ms, producer stalled " << metrics.m_producerStallSeconds * 1000
+					<< " ms, producer busy " << metrics.m_producerBusySeconds * 1000 << " ms" << endl;
+			}
+			else if (command == "logfile")
+			{
+				// read second part of input, an empty path only prints to the console
+				input.erase(0, input.find(' ') + 1);
+				trainerSettings.m_logPath = (input == "none") ? "" : input;
+			}
+			else if (command == "logformat")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				if (input == "csv")
+				{
+					trainerSettings.m_logFormat = BPN::MetricsFormat::Csv;
+				}
+				else if (input == "binary")
+				{
+					trainerSettings.m_logFormat = BPN::MetricsFormat::Binary;
+				}
+			}
+			else if (command == "loginterval")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				string stringNumber = input;
+				bool has_only_digits = (stringNumber.find_first_not_of("0123456789") == string::npos);
+
+				if (has_only_digits && !stringNumber.empty()) {
+					trainerSettings.m_reportInterval = std::max(stoi(input.substr(0, input.find(' '))), 1);
+
+				}
+			}
+			else if (command == "patience")
+			{
+				// read second part of input, 0 disables early stopping
+				input.erase(0, input.find(' ') + 1);
+				string stringNumber = input;
+				bool has_only_digits = (stringNumber.find_first_not_of("0123456789") == string::npos);
+
+				if (has_only_digits && !stringNumber.empty()) {
+					trainerSettings.m_earlyStoppingPatience = stoi(input.substr(0, input.find(' ')));
+
+				}
+			}
+			else if (command == "checkpoint")
+			{
+				// read second part of input, none stops writing checkpoints
+				input.erase(0, input.find(' ') + 1);
+				trainerSettings.m_checkpointPath = (input == "none") ? "" : input;
+			}
+			else if (command == "checkpointinterval")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				string stringNumber = input;
+				bool has_only_digits = (stringNumber.find_first_not_of("0123456789") == string::npos);
+
+				if (has_only_digits && !stringNumber.empty()) {
+					trainerSettings.m_checkpointInterval = std::max(stoi(input.substr(0, input.find(' '))), 1);
+
+				}
+			}
+			else if (command == "resume")
+			{
+				// Continues training from the checkpoint at the checkpoint path, with the current settings
+				nn = BPN::Network (networkSettings);
+				trainer = BPN::NNTrainer(trainerSettings, &nn);
+				if (trainer.ResumeFromCheckpoint())
+				{
+					cout << "Resuming from generation " << trainer.GetCurrentGeneration() << " of " << trainerSettings.m_checkpointPath << endl;
+					trainer.Train(dataReader.GetTrainingData());
+				}
+			}
+			else if (command == "sweep")
+			{
+				// optional second part of input: number of random candidates, a grid search without it
+				input.erase(0, input.find(' ') + 1);
+				BPN::HyperparameterSweep::Settings sweepSettings;
+				if (!input.empty() && input.find_first_not_of("0123456789") == string::npos)
+				{
+					sweepSettings.m_numRandomCandidates = stoi(input);
+					sweepSettings.m_seed = std::random_device()();
+				}
+
+				auto const sweepStart = chrono::high_resolution_clock::now();
+				std::vector<BPN::HyperparameterSweep::Result> const results = BPN::HyperparameterSweep::Run(sweepSettings, numInputs, numOutputs, trainerSettings, dataReader.GetTrainingData());
+				BPN::HyperparameterSweep::PrintResults(results, chrono::duration<double>(chrono::high_resolution_clock::now() - sweepStart).count());
+			}
+			else if (command == "hogwild")
+			{
+				BPN::Benchmarks::RunAsynchronousConvergenceReport(BPN::Network(networkSettings), trainerSettings, dataReader.GetTrainingData(), trainerSettings.m_numThreads);
+			}
+			else if (command == "scaling")
+			{
+				// optional second part of input: highest thread count to measure
+				input.erase(0, input.find(' ') + 1);
+				uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+				if (!input.empty() && input.find_first_not_of("0123456789") == string::npos)
+				{
+					maxThreads = std::max(stoi(input), 1);
+				}
+
+				BPN::Benchmarks::RunThreadScalingReport(BPN::Network(networkSettings), trainerSettings, dataReader.GetTrainingData(), maxThreads);
+			}
+			else if (command == "precision")
+			{
+				BPN::Benchmarks::RunPrecisionReport(networkSettings, trainerSettings, dataReader.GetTrainingData());
+			}
+			else if (command == "activations")
+			{
+				BPN::Benchmarks::RunActivationReport(networkSettings, trainerSettings, dataReader.GetTrainingData());
+			}
+			else if (command == "kernels")
+			{
+				BPN::Benchmarks::RunKernelReport();
+			}
+			else if (command == "static")
+			{
+				BPN::Benchmarks::RunStaticNetworkReport(nn, dataReader.GetTrainingData().m_trainingSet);
+			}
+			else if (command == "quantize")
+			{
+				BPN::Benchmarks::RunQuantizationReport(nn, dataReader.GetTrainingData());
+			}
+
+			else if (command == "csv")
+			{
+				BPN::Benchmarks::RunCsvReaderReport(trainingDataPath, numInputs, numOutputs);
+			}
+			else if (command == "save")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				if (nn.Save(input))
+				{
+					cout << "Model saved to " << input << endl;
+				}
+			}
+			else if (command == "load")
+			{
+				// read second part of input
+				input.erase(0, input.find(' ') + 1);
+				auto const loadStart = chrono::high_resolution_clock::now();
+				if (nn.Load(input))
+				{
+					double const loadMilliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - loadStart).count();
+					cout << "Model loaded from " << input << " in " << loadMilliseconds << " ms" << endl;
+
+					// Later commands use the loaded topology, the trainer is rebuilt for it
+					networkSettings.m_layerWidths.clear();
+					for (int32_t layerIdx = 0; layerIdx < nn.GetNumLayers(); layerIdx++)
+					{
+						networkSettings.m_layerWidths.push_back(nn.GetLayerWidth(layerIdx));
+					}
+					networkSettings.m_hiddenActivation = nn.GetHiddenActivation();
+					networkSettings.m_outputActivation = nn.GetOutputActivation();
+					trainer = BPN::NNTrainer(trainerSettings, &nn);
+				}
+			}
+			else if (command == "serve")
+			{
+				// read second part of input: serves the current network until a client sends a shutdown request
+				input.erase(0, input.find(' ') + 1);
+				BPN::InferenceServer server(nn, BPN::InferenceServer::Settings());
+				server.ServeSocket(input);
+			}
+			else if (command == "profile")
+			{
+				// optional second part of input: "reset" clears the counters instead of printing them
+				input.erase(0, input.find(' ') + 1);
+				if (input == "reset")
+				{
+					BPN::Profiling::Reset();
+				}
+				else
+				{
+					BPN::Profiling::PrintSummary();
+				}
+			}
 			else if (command == "filepath")
 			{
 				// read second part of input
 				input.erase(0, input.find(' ') + 1);
 				trainingDataPath = input;
-				BPN::TrainingFileReader dataReader(trainingDataPath, numInputs, numOutputs);
+				dataReader = BPN::TrainingFileReader(trainingDataPath, numInputs, numOutputs, true);
 				if (!dataReader.ReadData())
 				{
 					return 1;
@@ -142,8 +483,11 @@ int main()
 			else
 			{
 				cout << "Invalid Command! The following commands are available:" << endl <<
-					"train, check (double) (double) (double) (double), accuracy (integer), generations (integer)," << endl <<
-					" learnrate (double), momentum (double), filepath (string) end" << endl;
+					"train, stream, prefetch, check (double) (double) (double) (double), accuracy (integer), generations (integer)," << endl <<
+					" learnrate (double), momentum (double), layers (integer...), activation (string) [string], batchsize (integer)," << endl <<
+					" threads (integer), mode (sync|async), logfile (string|none), logformat (csv|binary), loginterval (integer)," << endl <<
+					" patience (integer), checkpoint (string|none), checkpointinterval (integer), resume," << endl <<
+					" sweep [integer], scaling [integer], hogwild, precision, activations, kernels, static, quantize, csv, save (string), load (string), serve (string), profile [reset], filepath (string) end" << endl;
 			}
 		}
 		return 0;